@@ -0,0 +1,111 @@
+#!/usr/bin/env dnsjit
+-- Replay a PCAP with dnssim split over multiple worker processes or hosts.
+--
+-- Start the controller with the number of workers and the target, then the
+-- workers with the same PCAP and the controller's address. Each worker sends
+-- the queries of its share of the clients with the original timing, starting
+-- at the same time as the others, and the controller merges their statistics.
+--
+--   dnssim-coord.lua -w 4 -o merged.json 127.0.0.1 5300 <target> <port>
+--   dnssim-coord.lua -p file.pcap 127.0.0.1 5300   (four times)
+local log = require("dnsjit.core.log")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "v", "verbose", 0, "Enable and increase verbosity for each time given", "?+" },
+    { "w", "workers", 0, "Run as controller for this many workers", "?" },
+    { "o", "output", "merged.json", "Export the merged statistics to JSON file (controller)", "?" },
+    { "l", "lead", 2, "Seconds between starting and the common start of the workers (controller)", "?" },
+    { "p", "pcap", "", "PCAP to replay (worker)", "?" },
+    { "n", "name", "", "Name of the worker in the controller's log (worker)", "?" },
+    { "i", "interval", 1, "Statistics interval in seconds", "?" },
+})
+local host, port, target, target_port = unpack(getopt:parse())
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local v = getopt:val("v")
+if v > 0 then
+    log.enable("warning")
+end
+if v > 1 then
+    log.enable("notice")
+end
+if v > 2 then
+    log.enable("info")
+end
+if v > 3 then
+    log.enable("debug")
+end
+
+local coord = require("dnsjit.lib.coord").new()
+
+if getopt:val("workers") > 0 then
+    if host == nil or port == nil or target == nil or target_port == nil then
+        print("usage: "..arg[1].." -w <workers> [options] <listen host> <listen port> <target> <target port>")
+        return
+    end
+    if coord:listen(host, port) ~= 0 or coord:accept(getopt:val("workers")) ~= 0 then
+        log.fatal("unable to get the workers")
+    end
+    coord:start(getopt:val("lead"), target.." "..target_port.." "..getopt:val("interval"))
+    print("merged results of "..require("dnsjit.output.dnssim").collect(coord, getopt:val("output")).." workers")
+    return
+end
+
+local pcap = getopt:val("pcap")
+if host == nil or port == nil or pcap == "" then
+    print("usage: "..arg[1].." -p <pcap> [options] <controller host> <controller port>")
+    return
+end
+local name = getopt:val("name")
+if name == "" then
+    name = nil
+end
+if coord:connect(host, port, name) ~= 0 then
+    log.fatal("unable to connect to the controller")
+end
+local args = coord:wait()
+if args == nil then
+    log.fatal("controller didn't start the worker")
+end
+local target_host, target_port, interval = args:match("^(%S+) (%d+) (%S+)$")
+
+local input = require("dnsjit.input.fpcap").new()
+if input:open(pcap) ~= 0 then
+    log.fatal("unable to open "..pcap)
+end
+local timing = require("dnsjit.filter.timing").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.dnssim").new()
+output:target(target_host, tonumber(target_port))
+output:udp_only()
+output:client_key("src")
+
+-- The partition keeps the original source addresses as client keys.
+timing:keep()
+timing:receiver(layer)
+layer:receiver(coord)
+coord:receiver(output)
+
+local prod, pctx = input:produce()
+local trecv, tctx = timing:receive()
+coord:sleep()
+output:stats_collect(tonumber(interval))
+while true do
+    local obj = prod(pctx)
+    if obj == nil then
+        break
+    end
+    trecv(tctx, obj)
+    output:run_nowait()
+end
+
+-- Let the ongoing requests finish.
+output:stats_finish()
+while output:run_nowait() ~= 0 do end
+
+local passed, dropped = coord:stats()
+print(string.format("worker %d of %d: %d queries, %d of other workers", coord:index(), coord:count(), passed, dropped))
+if output:report(coord) ~= 0 then
+    log.fatal("unable to report to the controller")
+end
@@ -0,0 +1,189 @@
+#!/usr/bin/env dnsjit
+-- Compute latency percentiles from a request trace written by
+-- dnsjit.output.dnssim (DnsSim:trace()), with and without correction for
+-- coordinated omission.
+--
+-- Raw latency is measured from the time the query was written to the socket,
+-- the time it waited for a connection before that is shown as queue wait.
+-- Corrected latency is measured from the time the request should have been
+-- sent (intended time), so delays caused by the generator falling behind
+-- are accounted for. When the trace has no intended times (or in addition
+-- to them), --interval can be used to back-fill the samples that would have
+-- been sent during a long stall, as done by HdrHistogram.
+local ffi = require("ffi")
+local bit = require("bit")
+require("dnsjit.output.dnssim_h")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "i", "interval", 0, "Expected interval between requests of a client in microseconds (0 disables)", "?" },
+    { "t", "transport", -1, "Only include records with given transport number", "?" },
+    { "c", "csv", false, "Print percentiles as CSV", "?" },
+})
+local file = unpack(getopt:parse())
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+if file == nil then
+    print("usage: "..arg[1].." [options] <trace>")
+    return
+end
+local interval = getopt:val("interval")
+local transport = getopt:val("transport")
+
+-- Log-linear histogram in microseconds with 1/128 relative precision, so
+-- billions of samples fit into a few thousand buckets.
+local SUB = 128
+local NBUCKETS = SUB * 40
+
+local function bucket(us)
+    if us < SUB then
+        return us
+    end
+    local e = 0
+    while us >= SUB * 2 do
+        us = bit.rshift(us, 1)
+        e = e + 1
+    end
+    return us + e * SUB
+end
+
+local function bucket_value(idx)
+    if idx < SUB then
+        return idx
+    end
+    local e = math.floor(idx / SUB) - 1
+    return (idx - e * SUB) * math.pow(2, e)
+end
+
+local function new_hist()
+    return { buckets = ffi.new("uint64_t[?]", NBUCKETS), n = 0, timeouts = 0, max = 0 }
+end
+
+local function record(hist, us)
+    us = math.floor(us)
+    if us < 0 then
+        us = 0
+    end
+    local idx = bucket(us)
+    if idx >= NBUCKETS then
+        idx = NBUCKETS - 1
+    end
+    hist.buckets[idx] = hist.buckets[idx] + 1
+    hist.n = hist.n + 1
+    if us > hist.max then
+        hist.max = us
+    end
+end
+
+-- Back-fill samples which were omitted while waiting on a stalled request.
+local function record_corrected(hist, us)
+    record(hist, us)
+    if interval > 0 then
+        local missing = us - interval
+        while missing >= interval do
+            record(hist, missing)
+            missing = missing - interval
+        end
+    end
+end
+
+local function percentile(hist, p)
+    local total = hist.n + hist.timeouts
+    local rank = math.ceil(total * p / 100)
+    if rank > hist.n then
+        return nil
+    end
+    local seen = 0
+    for i = 0, NBUCKETS - 1 do
+        seen = seen + tonumber(hist.buckets[i])
+        if seen >= rank and seen > 0 then
+            return bucket_value(i)
+        end
+    end
+    return hist.max
+end
+
+local f = io.open(file, "rb")
+if f == nil then
+    print("unable to open "..file)
+    return
+end
+
+local hdr_size = ffi.sizeof("output_dnssim_trace_header_t")
+local hdr_data = f:read(hdr_size)
+if hdr_data == nil or #hdr_data ~= hdr_size then
+    print("trace header is truncated")
+    return
+end
+local hdr = ffi.new("output_dnssim_trace_header_t")
+ffi.copy(hdr, hdr_data, hdr_size)
+if ffi.string(hdr.magic, 8) ~= "DNSSIMTR" then
+    print("not a dnssim trace")
+    return
+end
+if hdr.version ~= ffi.C.OUTPUT_DNSSIM_TRACE_VERSION or hdr.record_size ~= ffi.sizeof("output_dnssim_trace_record_t") then
+    print("unsupported trace version "..hdr.version)
+    return
+end
+
+local raw = new_hist()
+local corrected = new_hist()
+local queue = new_hist()
+local rec_size = hdr.record_size
+local chunk_recs = 65536
+local records = ffi.new("output_dnssim_trace_record_t[?]", chunk_recs)
+local answered_flag = ffi.C.OUTPUT_DNSSIM_TRACE_ANSWERED
+local nrecs = 0
+
+while true do
+    local data = f:read(rec_size * chunk_recs)
+    if data == nil then break end
+    local n = math.floor(#data / rec_size)
+    ffi.copy(records, data, n * rec_size)
+    for i = 0, n - 1 do
+        local r = records[i]
+        if transport < 0 or r.transport == transport then
+            nrecs = nrecs + 1
+            if bit.band(r.flags, answered_flag) ~= 0 then
+                record(raw, tonumber(r.completed_ns - r.sent_ns) / 1000)
+                record(queue, tonumber(r.queue_wait_ns) / 1000)
+                local intended = r.intended_ns
+                if intended > r.sent_ns then
+                    intended = r.sent_ns
+                end
+                record_corrected(corrected, tonumber(r.completed_ns - intended) / 1000)
+            else
+                raw.timeouts = raw.timeouts + 1
+                corrected.timeouts = corrected.timeouts + 1
+            end
+        end
+    end
+end
+f:close()
+
+local pcts = { 50, 90, 95, 99, 99.9, 99.99, 99.999 }
+local function fmt(us)
+    if us == nil then
+        return "timeout"
+    end
+    return string.format("%.3f", us / 1000)
+end
+
+if getopt:val("csv") then
+    print("percentile,raw_ms,corrected_ms,queue_ms")
+    for _, p in ipairs(pcts) do
+        print(p..","..fmt(percentile(raw, p))..","..fmt(percentile(corrected, p))..","..fmt(percentile(queue, p)))
+    end
+    return
+end
+
+print(string.format("records: %d, answered: %d, timeouts: %d", nrecs, raw.n, raw.timeouts))
+if interval > 0 then
+    print(string.format("back-filled samples: %d", corrected.n - raw.n))
+end
+print(string.format("%-10s %14s %14s %14s", "percentile", "raw [ms]", "corrected [ms]", "queue [ms]"))
+for _, p in ipairs(pcts) do
+    print(string.format("%-10s %14s %14s %14s", p, fmt(percentile(raw, p)), fmt(percentile(corrected, p)),
+        fmt(percentile(queue, p))))
+end
+print(string.format("%-10s %14s %14s %14s", "max", fmt(raw.max), fmt(corrected.max), fmt(queue.max)))
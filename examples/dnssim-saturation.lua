@@ -0,0 +1,210 @@
+#!/usr/bin/env dnsjit
+-- Find the highest load a DNS server sustains within a latency SLO.
+--
+-- Queries are either replayed from a PCAP (looped when it ends, with the
+-- original timing sped up by the offered load) or generated synthetically
+-- at the base rate multiplied by the offered load. The load is adjusted by
+-- dnsjit.lib.saturation based on the periodic statistics of dnssim.
+local ffi = require("ffi")
+local bit = require("bit")
+local log = require("dnsjit.core.log")
+local object = require("dnsjit.core.objects")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "v", "verbose", 0, "Enable and increase verbosity for each time given", "?+" },
+    { "p", "pcap", "", "Replay queries from PCAP instead of generating them", "?" },
+    { "q", "qname", "example.com", "Query name of synthetic queries, %d is replaced by a counter", "?" },
+    { "r", "rate", 1000, "Base rate of synthetic queries (QPS at load 1)", "?" },
+    { "c", "clients", 10000, "Number of clients", "?" },
+    { "T", "tcp", false, "Use TCP instead of UDP", "?" },
+    { "l", "latency", 100, "SLO: maximum latency in ms at given percentile", "?" },
+    { "P", "percentile", 99, "SLO: latency percentile", "?" },
+    { "a", "answered", 0.99, "SLO: minimum ratio of answered queries", "?" },
+    { "s", "start", 1, "Initial load", "?" },
+    { "S", "step", 1, "Load step (linear increase)", "?" },
+    { "f", "factor", 0, "Load factor (geometric increase, overrides step)", "?" },
+    { "m", "max", 100, "Maximum load", "?" },
+    { "b", "bisect", 0.05, "Bisection precision (0 disables)", "?" },
+    { "i", "interval", 1, "Statistics interval in seconds", "?" },
+    { "w", "warmup", 1, "Intervals skipped after load change", "?" },
+    { "n", "measure", 3, "Intervals evaluated for each load", "?" },
+    { "o", "output", "", "Export the load-vs-latency curve to JSON file", "?" },
+})
+local host, port = unpack(getopt:parse())
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local v = getopt:val("v")
+if v > 0 then
+    log.enable("warning")
+end
+if v > 1 then
+    log.enable("notice")
+end
+if v > 2 then
+    log.enable("info")
+end
+if v > 3 then
+    log.enable("debug")
+end
+
+if host == nil or port == nil then
+    print("usage: "..arg[1].." [options] <host> <port>")
+    return
+end
+
+local clients = getopt:val("clients")
+local output = require("dnsjit.output.dnssim").new(clients + 1)
+output:target(host, port)
+if getopt:val("tcp") then
+    output:tcp()
+    output:free_after_use(true)
+else
+    output:udp_only()
+end
+output:stats_collect(getopt:val("interval"))
+
+local timing = require("dnsjit.filter.timing").new()
+local layer = require("dnsjit.filter.layer").new()
+timing:multiply(1)
+timing:receiver(layer)
+
+-- TCP queries are sent after the object is passed on, so they have to be copied.
+local last = output
+if getopt:val("tcp") then
+    local copy = require("dnsjit.filter.copy").new()
+    copy:obj_type(object.PAYLOAD)
+    copy:obj_type(object.IP)
+    copy:obj_type(object.IP6)
+    copy:receiver(last)
+    last = copy
+end
+
+-- Client IDs have to be written to the destination IP for dnssim.
+local pcap = getopt:val("pcap")
+if pcap ~= "" then
+    local ipsplit = require("dnsjit.filter.ipsplit").new()
+    ipsplit:overwrite_dst()
+    ipsplit:receiver(last)
+    last = ipsplit
+end
+layer:receiver(last)
+
+local sat = require("dnsjit.lib.saturation").new(output)
+sat:slo(getopt:val("latency"), getopt:val("percentile"), getopt:val("answered"))
+if getopt:val("factor") > 1 then
+    sat:ramp(getopt:val("start"), getopt:val("factor"), getopt:val("max"))
+else
+    sat:steps(getopt:val("start"), getopt:val("step"), getopt:val("max"))
+end
+if getopt:val("bisect") > 0 then
+    sat:bisect(getopt:val("bisect"))
+end
+sat:intervals(getopt:val("warmup"), getopt:val("measure"))
+sat:on_load(function(load)
+    timing:multiply(1 / load)
+end)
+
+-- Source of PCAP objects, either from file or synthetic.
+local next_pkt
+if pcap ~= "" then
+    local input = require("dnsjit.input.fpcap").new()
+    if input:open(pcap) ~= 0 then
+        log.fatal("unable to open "..pcap)
+    end
+    local prod, pctx = input:produce()
+    next_pkt = function()
+        local obj = prod(pctx)
+        if obj == nil then
+            input = require("dnsjit.input.fpcap").new()
+            input:open(pcap)
+            prod, pctx = input:produce()
+            obj = prod(pctx)
+        end
+        return obj
+    end
+else
+    -- Raw IPv6/UDP packets with DNS query, timestamps spaced by the base rate.
+    local DLT_RAW = 12
+    local buf = ffi.new("uint8_t[512]")
+    local pkt = ffi.new("core_object_pcap_t")
+    local gap_ns = math.floor(1000000000 / getopt:val("rate"))
+    local qname = getopt:val("qname")
+    local n = 0
+    local ts_ns = 0
+    pkt.obj_type = object.PCAP
+    pkt.linktype = DLT_RAW
+    pkt.snaplen = 512
+    pkt.bytes = buf
+
+    next_pkt = function()
+        n = n + 1
+        ts_ns = ts_ns + gap_ns
+        ffi.fill(buf, 48)
+
+        -- DNS header and question
+        local dns = buf + 48
+        dns[0] = bit.band(bit.rshift(n, 8), 0xff)
+        dns[1] = bit.band(n, 0xff)
+        dns[2] = 0x01 -- RD
+        dns[5] = 1 -- QDCOUNT
+        local pos = 12
+        for label in string.gmatch(string.gsub(qname, "%%d", tostring(n)), "[^.]+") do
+            dns[pos] = #label
+            ffi.copy(dns + pos + 1, label, #label)
+            pos = pos + 1 + #label
+        end
+        dns[pos] = 0
+        dns[pos + 2] = 1 -- QTYPE A
+        dns[pos + 4] = 1 -- QCLASS IN
+        local dnslen = pos + 5
+
+        -- IPv6 header, client ID in the first 4 bytes of destination (host order)
+        buf[0] = 0x60
+        buf[4] = bit.rshift(8 + dnslen, 8)
+        buf[5] = bit.band(8 + dnslen, 0xff)
+        buf[6] = 17
+        buf[7] = 64
+        buf[23] = 1
+        ffi.cast("uint32_t*", buf + 24)[0] = (n % clients) + 1
+
+        -- UDP header
+        buf[40] = 0xcf
+        buf[41] = 0x08
+        buf[43] = 53
+        buf[44] = bit.rshift(8 + dnslen, 8)
+        buf[45] = bit.band(8 + dnslen, 0xff)
+
+        pkt.caplen = 48 + dnslen
+        pkt.len = pkt.caplen
+        pkt.ts.sec = math.floor(ts_ns / 1000000000)
+        pkt.ts.nsec = ts_ns % 1000000000
+        return ffi.cast("core_object_t*", pkt)
+    end
+end
+
+local trecv, tctx = timing:receive()
+sat:start()
+while true do
+    trecv(tctx, next_pkt())
+    output:run_nowait()
+    if not sat:check() then
+        break
+    end
+end
+
+-- Let the ongoing requests finish.
+output:stats_finish()
+while output:run_nowait() ~= 0 do end
+
+print(string.format("%10s %12s %10s %12s %10s %6s", "load", "QPS", "answered",
+    "p"..getopt:val("percentile").." [ms]", "timeouts", "SLO"))
+for _, level in ipairs(sat:curve()) do
+    print(string.format("%10g %12.1f %10.4f %12d %10d %6s", level.load, level.qps,
+        level.answer_ratio, level.latency, level.timeouts, level.ok and "pass" or "fail"))
+end
+print(sat:verdict())
+
+if getopt:val("output") ~= "" then
+    sat:export(getopt:val("output"))
+end
@@ -0,0 +1,85 @@
+#!/usr/bin/env dnsjit
+-- Benchmark dnsjit.filter.suffixmatch: load a list of generated names and
+-- measure the time per query passed through the filter, half of the queries
+-- are for subdomains of listed names and half for names not listed.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local clock = require("dnsjit.lib.clock")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "n", "names", 1000000, "Number of names in the list", "?" },
+    { "q", "queries", 10000000, "Number of queries to pass through the filter", "?" },
+    { "r", "runs", 3, "Number of runs", "?" },
+})
+getopt:parse()
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local names, queries, runs = getopt:val("n"), getopt:val("q"), getopt:val("r")
+
+local function seconds(start_sec, start_nsec)
+    local end_sec, end_nsec = clock:monotonic()
+    return (end_sec - start_sec) + (end_nsec - start_nsec) / 1000000000
+end
+
+local list = {}
+for i = 1, names do
+    list[i] = string.format("host%d.zone%d.example", i, i % 1000)
+end
+local suffixmatch = require("dnsjit.filter.suffixmatch").new()
+local start_sec, start_nsec = clock:monotonic()
+suffixmatch:load({ list })
+print(string.format("loaded %d names in %.2f seconds", names, seconds(start_sec, start_nsec)))
+list = nil
+collectgarbage()
+
+local output = require("dnsjit.output.null").new()
+suffixmatch:receiver(output)
+suffixmatch:receiver(output, 1)
+local recv, rctx = suffixmatch:receive()
+
+-- Prepare some queries to cycle through, every other one matching.
+local pkt = ffi.new("core_object_pcap_t")
+pkt.obj_type = object.PCAP
+local objs, keep = {}, {}
+for i = 1, 1024 do
+    local n = math.random(names)
+    local name = string.format("www.host%d.zone%d.example", n, n % 1000)
+    if i % 2 == 0 then
+        name = string.format("www.other%d.zone%d.example", n, n % 1000)
+    end
+    local wire = "\0\1\1\0\0\1\0\0\0\0\0\0"
+    for label in name:gmatch("[^.]+") do
+        wire = wire..string.char(#label)..label
+    end
+    wire = wire.."\0\0\1\0\1"
+    local buf = ffi.new("uint8_t[?]", #wire)
+    ffi.copy(buf, wire, #wire)
+    local pl = ffi.new("core_object_payload_t")
+    pl.obj_type = object.PAYLOAD
+    pl.obj_prev = ffi.cast("core_object_t*", pkt)
+    pl.payload = buf
+    pl.len = #wire
+    keep[i] = { buf, pl }
+    objs[i] = pl:uncast()
+end
+
+local orecv, orctx = output:receive()
+for run = 1, runs do
+    start_sec, start_nsec = clock:monotonic()
+    for i = 1, queries do
+        orecv(orctx, objs[i % 1024 + 1])
+    end
+    local base = seconds(start_sec, start_nsec)
+
+    start_sec, start_nsec = clock:monotonic()
+    for i = 1, queries do
+        recv(rctx, objs[i % 1024 + 1])
+    end
+    local runtime = seconds(start_sec, start_nsec)
+
+    print(string.format("run %d: %.0f ns per query (%.0f ns without the filter)", run,
+        runtime * 1e9 / queries, base * 1e9 / queries))
+end
+local matched, unmatched = suffixmatch:stats()
+print(string.format("%d matched, %d not matched", matched, unmatched))
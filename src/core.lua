@@ -39,6 +39,7 @@ module(...,package.seeall)
 -- dnsjit.core.object (3),
 -- dnsjit.core.objects (3),
 -- dnsjit.core.producer (3),
+-- dnsjit.core.shmchannel (3),
 -- dnsjit.core.receiver (3),
 -- dnsjit.core.thread (3),
 -- dnsjit.core.timespec (3)
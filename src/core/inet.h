@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __dnsjit_core_inet_h
+#define __dnsjit_core_inet_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers for rewriting IP packets in place: Internet checksums (RFC 1071)
+ * and locating the transport header.
+ */
+
+/*
+ * Add data to a ones' complement sum of big-endian 16-bit words, odd is
+ * set if the data starts at an odd offset of the checksummed data.
+ * The sum doesn't overflow for less than 128KiB of data.
+ */
+static inline uint32_t core_inet_csum_add(uint32_t sum, const uint8_t* data, size_t len, size_t odd)
+{
+    size_t i = 0;
+
+    if ((odd & 1) && len) {
+        sum += data[0];
+        i = 1;
+    }
+    for (; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (i < len) {
+        sum += data[i] << 8;
+    }
+    return sum;
+}
+
+static inline uint16_t core_inet_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+/*
+ * Update the checksum at csum incrementally (RFC 1624) for len bytes
+ * replaced by new, so it works on truncated packets too. A zero UDP
+ * checksum is sent as all ones.
+ */
+static inline void core_inet_csum_replace(uint8_t* csum, int is_udp, const uint8_t* old, const uint8_t* new, size_t len, size_t odd)
+{
+    uint32_t sum = ~((csum[0] << 8) | csum[1]) & 0xffff;
+    uint16_t res;
+
+    sum += ~core_inet_csum_fold(core_inet_csum_add(0, old, len, odd)) & 0xffff;
+    sum = core_inet_csum_add(sum, new, len, odd);
+    res = ~core_inet_csum_fold(sum);
+    if (is_udp && !res) {
+        res = 0xffff;
+    }
+    csum[0] = res >> 8;
+    csum[1] = res & 0xff;
+}
+
+/* Compute and set the header checksum of an IPv4 header, returns it. */
+static inline uint16_t core_inet_ip4_csum(uint8_t* ip)
+{
+    uint16_t res;
+
+    ip[10] = 0;
+    ip[11] = 0;
+    res    = ~core_inet_csum_fold(core_inet_csum_add(0, ip, (ip[0] & 0xf) * 4, 0));
+    ip[10] = res >> 8;
+    ip[11] = res & 0xff;
+
+    return res;
+}
+
+/*
+ * Skip the extension headers of the IPv6 packet at ip6 with len bytes
+ * captured, returns the offset of the transport header and sets nxt to
+ * its protocol. The offset is beyond len if the headers are truncated, 0
+ * is returned for fragments other than the first one.
+ */
+static inline size_t core_inet_ip6_l4(const uint8_t* ip6, size_t len, uint8_t* nxt)
+{
+    size_t off = 40;
+
+    *nxt = ip6[6];
+    while (off + 8 <= len) {
+        if (*nxt == 0 || *nxt == 43 || *nxt == 60) {
+            *nxt = ip6[off];
+            off += (ip6[off + 1] + 1) * 8;
+        } else if (*nxt == 44) {
+            if (((ip6[off + 2] << 8) | ip6[off + 3]) & 0xfff8) {
+                return 0;
+            }
+            *nxt = ip6[off];
+            off += 8;
+        } else {
+            break;
+        }
+    }
+    return off;
+}
+
+/*
+ * Locate the checksum of the UDP, TCP or ICMPv6 header at l4 with left
+ * bytes captured, returns NULL if there is none to update (also for UDP
+ * over IPv4 sent without checksum).
+ */
+static inline uint8_t* core_inet_l4_csum(uint8_t* l4, size_t left, uint8_t proto, int is_v4, int* is_udp)
+{
+    *is_udp = 0;
+    switch (proto) {
+    case 17:
+        if (left < 8 || (is_v4 && !l4[6] && !l4[7])) {
+            return 0;
+        }
+        *is_udp = 1;
+        return l4 + 6;
+    case 6:
+        return left < 18 ? 0 : l4 + 16;
+    case 58:
+        return left < 4 || is_v4 ? 0 : l4 + 2;
+    }
+    return 0;
+}
+
+#endif
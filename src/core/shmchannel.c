@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "core/shmchannel.h"
+#include "core/assert.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_FUTEX_H)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define HAVE_SHMCHANNEL 1
+#endif
+
+#define SHM_MAGIC "DNSJSHM"
+#define SHM_VERSION 1
+#define SHM_SPIN 128
+/* Futex waits time out to check that the peer is still there. */
+#define SHM_WAIT_MS 100
+#define SHM_NIL UINT32_MAX
+
+/*
+ * Shared header, producer and consumer indexes are free running and in
+ * separate cache lines, futex waits are on the index the waiter needs the
+ * other side to move.
+ */
+struct _shm_hdr {
+    char     magic[8];
+    uint32_t version, slots, slot_size, hdr_size;
+    uint32_t closed, attached;
+
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t prod_waiting;
+
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t cons_waiting;
+} __attribute__((aligned(64)));
+
+/* Portable layout of the PCAP object at the start of a slot. */
+struct _shm_rec {
+    int64_t  sec;
+    uint32_t nsec, snaplen, linktype, caplen, len;
+    uint8_t  is_swapped, pad[3];
+};
+
+static core_log_t        _log      = LOG_T_INIT("core.shmchannel");
+static core_shmchannel_t _defaults = {
+    LOG_T_INIT_OBJ("core.shmchannel"),
+    -1, -1, 0, 0,
+    0, 0, 0,
+    CORE_OBJECT_PCAP_INIT(0), 0,
+    0, 0,
+    0, 0
+};
+
+core_log_t* core_shmchannel_log()
+{
+    return &_log;
+}
+
+#define _hdr ((struct _shm_hdr*)self->map)
+#define _slot(n) ((uint8_t*)self->map + _hdr->hdr_size + (size_t)((n) & (self->slots - 1)) * self->slot_size)
+
+void core_shmchannel_init(core_shmchannel_t* self)
+{
+    mlassert_self();
+
+    *self = _defaults;
+}
+
+void core_shmchannel_destroy(core_shmchannel_t* self)
+{
+    mlassert_self();
+
+    if (self->map) {
+        munmap(self->map, self->map_size);
+    }
+    if (self->fd > -1) {
+        close(self->fd);
+    }
+    if (self->ctl > -1) {
+        close(self->ctl);
+    }
+}
+
+#ifdef HAVE_SHMCHANNEL
+static inline void _wait(uint32_t* addr, uint32_t val)
+{
+    struct timespec ts = { 0, SHM_WAIT_MS * 1000000 };
+
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0);
+}
+
+static inline void _wake(uint32_t* addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, n, 0, 0, 0);
+}
+#endif
+
+static inline bool _is_pow2(size_t num)
+{
+    return num && !(num & (num - 1));
+}
+
+int core_shmchannel_create(core_shmchannel_t* self, size_t slots, size_t slot_size)
+{
+#ifdef HAVE_SHMCHANNEL
+    size_t hdr_size = (sizeof(struct _shm_hdr) + 4095) & ~(size_t)4095;
+    mlassert_self();
+
+    if (self->map) {
+        lfatal("already created or attached");
+    }
+    if (slots < 4 || !_is_pow2(slots) || slots > (1 << 30)) {
+        lfatal("invalid number of slots");
+    }
+    if (slot_size < 64 || slot_size % 64 || slot_size > (1 << 24)) {
+        lfatal("invalid slot size");
+    }
+
+    self->map_size = hdr_size + slots * slot_size;
+    if ((self->fd = memfd_create("dnsjit-shmchannel", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+        lcritical("memfd_create() failed: %s", core_log_errstr(errno));
+        return -1;
+    }
+    /* The peer must not be able to resize the memory under us (SIGBUS). */
+    if (ftruncate(self->fd, self->map_size)
+        || fcntl(self->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+        lcritical("sizing or sealing shared memory failed: %s", core_log_errstr(errno));
+        close(self->fd);
+        self->fd = -1;
+        return -1;
+    }
+    if ((self->map = mmap(0, self->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0)) == MAP_FAILED) {
+        lcritical("mmap() failed: %s", core_log_errstr(errno));
+        self->map = 0;
+        close(self->fd);
+        self->fd = -1;
+        return -1;
+    }
+
+    memcpy(_hdr->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    _hdr->version    = SHM_VERSION;
+    _hdr->slots      = slots;
+    _hdr->slot_size  = slot_size;
+    _hdr->hdr_size   = hdr_size;
+    self->slots      = slots;
+    self->slot_size  = slot_size;
+    self->is_creator = 1;
+
+    return 0;
+#else
+    mlassert_self();
+    lcritical("shared memory channels are not supported on this platform");
+    return -1;
+#endif
+}
+
+int core_shmchannel_attach(core_shmchannel_t* self, int fd)
+{
+#ifdef HAVE_SHMCHANNEL
+    struct stat      st;
+    struct _shm_hdr* hdr;
+    int              seals;
+    mlassert_self();
+
+    if (self->map) {
+        lfatal("already created or attached");
+    }
+
+    if ((seals = fcntl(fd, F_GET_SEALS)) < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        lcritical("shared memory is not sealed");
+        return -1;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct _shm_hdr)) {
+        lcritical("shared memory too small");
+        return -1;
+    }
+    if ((hdr = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        lcritical("mmap() failed: %s", core_log_errstr(errno));
+        return -1;
+    }
+    if (memcmp(hdr->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) || hdr->version != SHM_VERSION
+        || hdr->slots < 4 || !_is_pow2(hdr->slots) || hdr->slot_size < 64 || hdr->slot_size % 64
+        || hdr->hdr_size < sizeof(struct _shm_hdr)
+        || (uint64_t)hdr->hdr_size + (uint64_t)hdr->slots * hdr->slot_size != (uint64_t)st.st_size) {
+        lcritical("invalid shared memory header");
+        munmap(hdr, st.st_size);
+        return -1;
+    }
+    if (__atomic_exchange_n(&hdr->attached, 1, __ATOMIC_ACQ_REL)) {
+        lcritical("shared memory channel already attached");
+        munmap(hdr, st.st_size);
+        return -1;
+    }
+
+    self->fd        = fd;
+    self->map       = hdr;
+    self->map_size  = st.st_size;
+    self->slots     = hdr->slots;
+    self->slot_size = hdr->slot_size;
+
+    return 0;
+#else
+    mlassert_self();
+    lcritical("shared memory channels are not supported on this platform");
+    return -1;
+#endif
+}
+
+static int _unix(const char* path, struct sockaddr_un* addr)
+{
+    int fd;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+}
+
+int core_shmchannel_serve(core_shmchannel_t* self, const char* path)
+{
+    struct sockaddr_un addr;
+    struct ucred       cred;
+    socklen_t          len = sizeof(cred);
+    int                sock, peer;
+    ssize_t            ret;
+    char               buf[CMSG_SPACE(sizeof(int))];
+    uint8_t            byte = 0;
+    struct iovec       iov  = { &byte, 1 };
+    struct msghdr      msg  = { 0 };
+    struct cmsghdr*    cmsg;
+    mlassert_self();
+    lassert(path, "path is nil");
+
+    if (!self->is_creator) {
+        lfatal("only a created channel can be served");
+    }
+
+    if ((sock = _unix(path, &addr)) < 0) {
+        lcritical("socket(%s) failed: %s", path, core_log_errstr(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(sock, 1)) {
+        lcritical("bind/listen(%s) failed: %s", path, core_log_errstr(errno));
+        close(sock);
+        return -1;
+    }
+
+    for (;;) {
+        if ((peer = accept(sock, 0, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("accept(%s) failed: %s", path, core_log_errstr(errno));
+            close(sock);
+            unlink(path);
+            return -1;
+        }
+        /* Only hand the memory to processes of the same user. */
+        if (getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &cred, &len) || (cred.uid != getuid() && cred.uid != 0)) {
+            lwarning("rejected peer of another user");
+            close(peer);
+            continue;
+        }
+        break;
+    }
+    close(sock);
+    unlink(path);
+
+    memset(buf, 0, sizeof(buf));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = buf;
+    msg.msg_controllen = sizeof(buf);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &self->fd, sizeof(int));
+
+    if (sendmsg(peer, &msg, MSG_NOSIGNAL) != 1) {
+        lcritical("sendmsg() failed: %s", core_log_errstr(errno));
+        close(peer);
+        return -1;
+    }
+    /* Wait for the peer to have attached (or given up). */
+    while ((ret = read(peer, &byte, 1)) < 0 && errno == EINTR)
+        ;
+    if (ret != 1 || !self->map || !__atomic_load_n(&_hdr->attached, __ATOMIC_ACQUIRE)) {
+        lcritical("peer did not attach");
+        close(peer);
+        return -1;
+    }
+    self->ctl = peer;
+
+    return 0;
+}
+
+int core_shmchannel_connect(core_shmchannel_t* self, const char* path)
+{
+    struct sockaddr_un addr;
+    int                sock, fd = -1, ret;
+    char               buf[CMSG_SPACE(sizeof(int))];
+    uint8_t            byte;
+    struct iovec       iov = { &byte, 1 };
+    struct msghdr      msg = { 0 };
+    struct cmsghdr*    cmsg;
+    mlassert_self();
+    lassert(path, "path is nil");
+
+    if ((sock = _unix(path, &addr)) < 0) {
+        lcritical("socket(%s) failed: %s", path, core_log_errstr(errno));
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        lcritical("connect(%s) failed: %s", path, core_log_errstr(errno));
+        close(sock);
+        return -1;
+    }
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = buf;
+    msg.msg_controllen = sizeof(buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == 1) {
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+    if (fd < 0) {
+        lcritical("no shared memory received from %s", path);
+        close(sock);
+        return -1;
+    }
+
+    if ((ret = core_shmchannel_attach(self, fd))) {
+        close(fd);
+        close(sock);
+        return ret;
+    }
+    /* Tell the other side we attached, the socket is then kept open. */
+    byte = 1;
+    if (send(sock, &byte, 1, MSG_NOSIGNAL) != 1) {
+        lcritical("send() failed: %s", core_log_errstr(errno));
+        close(sock);
+        return -1;
+    }
+    self->ctl = sock;
+
+    return 0;
+}
+
+/*
+ * Ring
+ */
+
+#ifdef HAVE_SHMCHANNEL
+/*
+ * Check if the peer has gone away without closing the channel (the control
+ * socket is at EOF), the channel is then closed so nothing waits for it.
+ */
+static void _check_peer(core_shmchannel_t* self)
+{
+    struct pollfd pfd = { self->ctl, POLLIN, 0 };
+    uint8_t       byte;
+    ssize_t       n;
+
+    if (self->ctl < 0 || __atomic_load_n(&_hdr->closed, __ATOMIC_ACQUIRE) || poll(&pfd, 1, 0) < 1) {
+        return;
+    }
+    n = recv(self->ctl, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR))) {
+        return;
+    }
+
+    lcritical("peer went away");
+    self->lost = 1;
+    __atomic_store_n(&_hdr->closed, 1, __ATOMIC_RELEASE);
+}
+#endif
+
+static inline void _write(core_shmchannel_t* self, uint32_t head, const core_object_pcap_t* pkt)
+{
+    struct _shm_rec* rec = (struct _shm_rec*)_slot(head);
+
+    if (!pkt) {
+        rec->caplen = SHM_NIL;
+        return;
+    }
+    rec->sec        = pkt->ts.sec;
+    rec->nsec       = pkt->ts.nsec;
+    rec->snaplen    = pkt->snaplen;
+    rec->linktype   = pkt->linktype;
+    rec->caplen     = pkt->caplen;
+    rec->len        = pkt->len;
+    rec->is_swapped = pkt->is_swapped;
+    memcpy(rec + 1, pkt->bytes, pkt->caplen);
+}
+
+/* Find the PCAP object to send, returns -1 if it can't be. */
+static int _pcap(core_shmchannel_t* self, const core_object_t* obj, const core_object_pcap_t** pkt)
+{
+    *pkt = 0;
+    if (!obj) {
+        return 0;
+    }
+    for (; obj; obj = obj->obj_prev) {
+        if (obj->obj_type == CORE_OBJECT_PCAP) {
+            *pkt = (const core_object_pcap_t*)obj;
+            if ((*pkt)->caplen > self->slot_size - sizeof(struct _shm_rec)) {
+                self->dropped++;
+                return -1;
+            }
+            return 0;
+        }
+    }
+    self->dropped++;
+    return -1;
+}
+
+static inline void _published(core_shmchannel_t* self, uint32_t head)
+{
+    __atomic_store_n(&_hdr->head, head, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#ifdef HAVE_SHMCHANNEL
+    if (__atomic_load_n(&_hdr->cons_waiting, __ATOMIC_RELAXED)) {
+        _wake(&_hdr->head, 1);
+    }
+#endif
+}
+
+int core_shmchannel_try_put(core_shmchannel_t* self, const core_object_t* obj)
+{
+    const core_object_pcap_t* pkt;
+    uint32_t                  head;
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    if (_pcap(self, obj, &pkt)) {
+        return 0;
+    }
+    head = __atomic_load_n(&_hdr->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&_hdr->tail, __ATOMIC_ACQUIRE) >= self->slots) {
+        return -1;
+    }
+    _write(self, head, pkt);
+    _published(self, head + 1);
+
+    return 0;
+}
+
+void core_shmchannel_put(core_shmchannel_t* self, const core_object_t* obj)
+{
+    const core_object_pcap_t* pkt;
+    uint32_t                  head, tail;
+    size_t                    spin = 0;
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    if (_pcap(self, obj, &pkt)) {
+        return;
+    }
+    head = __atomic_load_n(&_hdr->head, __ATOMIC_RELAXED);
+    while (head - (tail = __atomic_load_n(&_hdr->tail, __ATOMIC_ACQUIRE)) >= self->slots) {
+        if (__atomic_load_n(&_hdr->closed, __ATOMIC_RELAXED)) {
+            self->dropped++;
+            return;
+        }
+        if (spin++ < SHM_SPIN) {
+            sched_yield();
+            continue;
+        }
+#ifdef HAVE_SHMCHANNEL
+        __atomic_store_n(&_hdr->prod_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&_hdr->tail, __ATOMIC_RELAXED) == tail && !__atomic_load_n(&_hdr->closed, __ATOMIC_RELAXED)) {
+            _wait(&_hdr->tail, tail);
+        }
+        __atomic_store_n(&_hdr->prod_waiting, 0, __ATOMIC_RELAXED);
+        _check_peer(self);
+#endif
+    }
+    _write(self, head, pkt);
+    _published(self, head + 1);
+}
+
+static inline void _release(core_shmchannel_t* self)
+{
+    uint32_t tail;
+
+    if (!self->holding) {
+        return;
+    }
+    self->holding = 0;
+    tail          = __atomic_load_n(&_hdr->tail, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(&_hdr->tail, tail, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#ifdef HAVE_SHMCHANNEL
+    if (__atomic_load_n(&_hdr->prod_waiting, __ATOMIC_RELAXED)) {
+        _wake(&_hdr->tail, 1);
+    }
+#endif
+}
+
+static inline core_object_t* _read(core_shmchannel_t* self, uint32_t tail)
+{
+    const struct _shm_rec* rec = (const struct _shm_rec*)_slot(tail);
+
+    self->holding = 1;
+    if (rec->caplen == SHM_NIL) {
+        return 0;
+    }
+    self->pkt.ts.sec     = rec->sec;
+    self->pkt.ts.nsec    = rec->nsec;
+    self->pkt.snaplen    = rec->snaplen;
+    self->pkt.linktype   = rec->linktype;
+    self->pkt.caplen     = rec->caplen;
+    self->pkt.len        = rec->len;
+    self->pkt.is_swapped = rec->is_swapped;
+    self->pkt.bytes      = (const unsigned char*)(rec + 1);
+
+    return (core_object_t*)&self->pkt;
+}
+
+core_object_t* core_shmchannel_try_get(core_shmchannel_t* self)
+{
+    uint32_t tail;
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    _release(self);
+    tail = __atomic_load_n(&_hdr->tail, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&_hdr->head, __ATOMIC_ACQUIRE) == tail) {
+        return 0;
+    }
+    return _read(self, tail);
+}
+
+/* Wait for an object, returns -1 if the channel was closed and is empty. */
+static int _wait_get(core_shmchannel_t* self, uint32_t* tail)
+{
+    uint32_t head;
+    size_t   spin = 0;
+
+    _release(self);
+    *tail = __atomic_load_n(&_hdr->tail, __ATOMIC_RELAXED);
+    while ((head = __atomic_load_n(&_hdr->head, __ATOMIC_ACQUIRE)) == *tail) {
+        if (__atomic_load_n(&_hdr->closed, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&_hdr->head, __ATOMIC_ACQUIRE) != *tail) {
+                continue;
+            }
+            if (!self->lost) {
+                linfo("channel closed");
+            }
+            return -1;
+        }
+        if (spin++ < SHM_SPIN) {
+            sched_yield();
+            continue;
+        }
+#ifdef HAVE_SHMCHANNEL
+        __atomic_store_n(&_hdr->cons_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&_hdr->head, __ATOMIC_RELAXED) == head && !__atomic_load_n(&_hdr->closed, __ATOMIC_RELAXED)) {
+            _wait(&_hdr->head, head);
+        }
+        __atomic_store_n(&_hdr->cons_waiting, 0, __ATOMIC_RELAXED);
+        _check_peer(self);
+#endif
+    }
+
+    return 0;
+}
+
+core_object_t* core_shmchannel_get(core_shmchannel_t* self)
+{
+    uint32_t tail;
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    if (_wait_get(self, &tail)) {
+        return 0;
+    }
+    return _read(self, tail);
+}
+
+int core_shmchannel_size(core_shmchannel_t* self)
+{
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    return __atomic_load_n(&_hdr->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&_hdr->tail, __ATOMIC_ACQUIRE);
+}
+
+bool core_shmchannel_full(core_shmchannel_t* self)
+{
+    mlassert_self();
+
+    return (uint32_t)core_shmchannel_size(self) >= self->slots;
+}
+
+bool core_shmchannel_closed(core_shmchannel_t* self)
+{
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    return __atomic_load_n(&_hdr->closed, __ATOMIC_ACQUIRE);
+}
+
+void core_shmchannel_close(core_shmchannel_t* self)
+{
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+
+    __atomic_store_n(&_hdr->closed, 1, __ATOMIC_RELEASE);
+#ifdef HAVE_SHMCHANNEL
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    _wake(&_hdr->head, INT_MAX);
+    _wake(&_hdr->tail, INT_MAX);
+#endif
+}
+
+core_receiver_t core_shmchannel_receiver()
+{
+    return (core_receiver_t)core_shmchannel_put;
+}
+
+int core_shmchannel_run(core_shmchannel_t* self)
+{
+    uint32_t tail;
+    mlassert_self();
+    lassert(self->map, "not created or attached");
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+
+    while (!_wait_get(self, &tail)) {
+        self->recv(self->ctx, _read(self, tail));
+    }
+
+    return self->lost ? -1 : 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.compat_h")
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.object.pcap_h")
+
+typedef struct core_shmchannel {
+    core_log_t _log;
+    int        fd;
+    /* Unix socket to the peer, closed by the kernel when it exits. */
+    int        ctl;
+    void*      map;
+    size_t     map_size;
+    uint32_t   slots, slot_size;
+    uint8_t    is_creator;
+
+    /* Object returned by get(), valid until the next get(). */
+    core_object_pcap_t pkt;
+    uint8_t            holding;
+
+    core_receiver_t recv;
+    void*           ctx;
+
+    uint64_t dropped;
+    uint8_t  lost;
+} core_shmchannel_t;
+
+core_log_t* core_shmchannel_log();
+
+void core_shmchannel_init(core_shmchannel_t* self);
+void core_shmchannel_destroy(core_shmchannel_t* self);
+int core_shmchannel_create(core_shmchannel_t* self, size_t slots, size_t slot_size);
+int core_shmchannel_attach(core_shmchannel_t* self, int fd);
+int core_shmchannel_serve(core_shmchannel_t* self, const char* path);
+int core_shmchannel_connect(core_shmchannel_t* self, const char* path);
+void core_shmchannel_put(core_shmchannel_t* self, const core_object_t* obj);
+int core_shmchannel_try_put(core_shmchannel_t* self, const core_object_t* obj);
+core_object_t* core_shmchannel_get(core_shmchannel_t* self);
+core_object_t* core_shmchannel_try_get(core_shmchannel_t* self);
+int core_shmchannel_size(core_shmchannel_t* self);
+bool core_shmchannel_full(core_shmchannel_t* self);
+bool core_shmchannel_closed(core_shmchannel_t* self);
+void core_shmchannel_close(core_shmchannel_t* self);
+
+core_receiver_t core_shmchannel_receiver();
+int core_shmchannel_run(core_shmchannel_t* self);
@@ -0,0 +1,194 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.core.shmchannel
+-- Send packets to another process
+--   -- process one
+--   local chan = require("dnsjit.core.shmchannel").new()
+--   chan:create()
+--   chan:serve("/run/dnsjit/replay.sock")
+--   input:receiver(chan)
+--   ...
+--   chan:close()
+--   -- process two
+--   local chan = require("dnsjit.core.shmchannel").new()
+--   chan:connect("/run/dnsjit/replay.sock")
+--   chan:receiver(layer)
+--   chan:run()
+--
+-- A shared memory channel works like
+-- .B dnsjit.core.channel
+-- but between processes, e.g. to keep the Lua heaps of decoding and
+-- sending apart or to run them on different CPU sockets.
+-- It is a single producer, single consumer ring of fixed size slots in
+-- shared memory (memfd), each slot holds the PCAP object of one put
+-- object chain and its bytes, other objects in the chain are not sent
+-- so the receiving process needs to layer the packets again (see
+-- .BR dnsjit.filter.layer ).
+-- Packets larger than the slot are dropped.
+-- .LP
+-- The process which creates the channel seals the memory so it can't be
+-- resized and hands it to one other process over a Unix socket, the
+-- other process checks the seals and the layout before using it.
+-- Either process can be the producer.
+-- Both sides spin shortly and then sleep on a futex when the ring is
+-- empty or full.
+-- .LP
+-- The Unix socket is kept open after the hand over, so when either process
+-- exits without closing the channel (e.g. it crashed) the other one sees
+-- the socket closed, logs it and takes the channel as closed:
+-- .B get()
+-- returns nil once the objects put before are consumed and
+-- .B run()
+-- returns -1.
+-- A channel attached with
+-- .B core_shmchannel_attach()
+-- from C has no socket and can not notice this.
+-- .LP
+-- The object returned by
+-- .B get()
+-- points into the ring and is only valid until the next
+-- .BR get() .
+-- .SS Attributes
+-- .TP
+-- uint64_t dropped
+-- Number of objects dropped, without PCAP object, too large or put after
+-- the channel was closed.
+-- .TP
+-- uint8_t lost
+-- Set if the other process went away without closing the channel.
+module(...,package.seeall)
+
+require("dnsjit.core.shmchannel_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "core_shmchannel_t"
+local core_shmchannel_t
+local ShmChannel = {}
+
+-- Create a new ShmChannel, it needs to be created or connected before use.
+function ShmChannel.new()
+    local self = core_shmchannel_t()
+    C.core_shmchannel_init(self)
+    ffi.gc(self, C.core_shmchannel_destroy)
+    return self
+end
+
+-- Return the Log object to control logging of this instance or module.
+function ShmChannel:log()
+    if self == nil then
+        return C.core_shmchannel_log()
+    end
+    return self._log
+end
+
+-- Create the shared memory with the given number of slots (power-of-two,
+-- default 4096) of the given size (multiple of 64, default 2048, 32 bytes
+-- are used for the packet header).
+-- Returns 0 on success.
+function ShmChannel:create(slots, slot_size)
+    return C.core_shmchannel_create(self, slots or 4096, slot_size or 2048)
+end
+
+-- Wait for another process to connect on the Unix socket
+-- .I path
+-- and hand it the shared memory.
+-- Returns 0 once the other process has attached.
+function ShmChannel:serve(path)
+    return C.core_shmchannel_serve(self, path)
+end
+
+-- Connect to a process serving the shared memory on the Unix socket
+-- .I path
+-- and attach to it.
+-- Returns 0 on success.
+function ShmChannel:connect(path)
+    return C.core_shmchannel_connect(self, path)
+end
+
+-- Put an object into the channel, if the channel is full then it will
+-- wait until space becomes available.
+-- Object may be nil.
+function ShmChannel:put(obj)
+    C.core_shmchannel_put(self, obj)
+end
+
+-- Try and put an object into the channel.
+-- Returns 0 on success.
+function ShmChannel:try_put(obj)
+    return C.core_shmchannel_try_put(self, obj)
+end
+
+-- Get an object from the channel, if the channel is empty it will wait until
+-- an object is available.
+-- Returns nil if the channel is closed or if a nil object was explicitly put
+-- into the channel.
+function ShmChannel:get()
+    return C.core_shmchannel_get(self)
+end
+
+-- Try and get an object from the channel.
+-- Returns nil if there was no objects to get.
+function ShmChannel:try_get()
+    return C.core_shmchannel_try_get(self)
+end
+
+-- Return number of enqueued objects.
+function ShmChannel:size()
+    return C.core_shmchannel_size(self)
+end
+
+-- Returns true when channel is full.
+function ShmChannel:full()
+    return C.core_shmchannel_full(self)
+end
+
+-- Returns true when the channel has been closed by either process.
+function ShmChannel:closed()
+    return C.core_shmchannel_closed(self)
+end
+
+-- Close the channel.
+function ShmChannel:close()
+    C.core_shmchannel_close(self)
+end
+
+-- Return the C functions and context for receiving objects.
+function ShmChannel:receive()
+    return C.core_shmchannel_receiver(), self
+end
+
+-- Set the receiver to pass objects to.
+-- NOTE; The channel keeps no reference of the receiver, it needs to live as
+-- long as the channel does.
+function ShmChannel:receiver(o)
+    self.recv, self.ctx = o:receive()
+end
+
+-- Retrieve all objects from the channel and send it to the receiver.
+-- Returns 0 once the channel is closed and empty, or -1 if the other
+-- process went away.
+function ShmChannel:run()
+    return C.core_shmchannel_run(self)
+end
+
+core_shmchannel_t = ffi.metatype(t_name, { __index = ShmChannel })
+
+-- dnsjit.core.channel (3)
+return ShmChannel
@@ -23,9 +23,13 @@
 -- messages.
 module(...,package.seeall)
 
+-- dnsjit.filter.amplify (3),
+-- dnsjit.filter.anonymize (3),
 -- dnsjit.filter.copy (3),
 -- dnsjit.filter.ipsplit (3),
 -- dnsjit.filter.layer (3),
+-- dnsjit.filter.schedule (3),
 -- dnsjit.filter.split (3),
+-- dnsjit.filter.suffixmatch (3),
 -- dnsjit.filter.timing (3)
 return
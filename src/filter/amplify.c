@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/amplify.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/object/ether.h"
+#include "core/object/null.h"
+#include "core/object/loop.h"
+#include "core/object/linuxsll.h"
+#include "core/object/ieee802.h"
+#include "core/object/gre.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/icmp.h"
+#include "core/object/icmp6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+#include "core/object/dns.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CHAIN 16
+#define N1e9 1000000000
+
+/* Synthetic clients are numbered within 240.0.0.0/4 and 100::/64 (RFC
+ * 6666), which don't appear in real captures. */
+#define SYNTH4_MAX (1 << 28)
+
+typedef union _pool_obj {
+    core_object_t          obj;
+    core_object_pcap_t     pcap;
+    core_object_ether_t    ether;
+    core_object_null_t     null;
+    core_object_loop_t     loop;
+    core_object_linuxsll_t linuxsll;
+    core_object_ieee802_t  ieee802;
+    core_object_gre_t      gre;
+    core_object_ip_t       ip;
+    core_object_ip6_t      ip6;
+    core_object_icmp_t     icmp;
+    core_object_icmp6_t    icmp6;
+    core_object_udp_t      udp;
+    core_object_tcp_t      tcp;
+    core_object_payload_t  payload;
+    core_object_dns_t      dns;
+} _pool_obj_t;
+
+typedef struct _entry {
+    int64_t        at;
+    uint64_t       seq;
+    core_object_t* obj;
+} _entry_t;
+
+typedef struct _filter_amplify {
+    filter_amplify_t pub;
+
+    /* Synthetic client index by original address and copy. */
+    trie_t*  trie;
+    uint64_t n4, n6;
+
+    _pool_obj_t pool[MAX_CHAIN];
+
+    /* Copied chains held back until they are in order, with jitter set. */
+    uint64_t  seq;
+    _entry_t* heap;
+    size_t    heap_size;
+} _filter_amplify_t;
+
+#define _self ((_filter_amplify_t*)self)
+
+static core_log_t       _log      = LOG_T_INIT("filter.amplify");
+static filter_amplify_t _defaults = {
+    LOG_T_INIT_OBJ("filter.amplify"),
+    0, 0,
+    1, AMPLIFY_REMAP_SRC,
+    0, 0,
+    0, 0, 0,
+    0, 0
+};
+
+core_log_t* filter_amplify_log()
+{
+    return &_log;
+}
+
+filter_amplify_t* filter_amplify_new()
+{
+    filter_amplify_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_filter_amplify_t)));
+    *self            = _defaults;
+    _self->trie      = trie_create(NULL);
+    _self->n4        = 0;
+    _self->n6        = 0;
+    _self->seq       = 0;
+    _self->heap      = 0;
+    _self->heap_size = 0;
+
+    return self;
+}
+
+static void _free_chain(core_object_t* obj)
+{
+    core_object_t* prev;
+
+    while (obj) {
+        prev = (core_object_t*)obj->obj_prev;
+        core_object_free(obj);
+        obj = prev;
+    }
+}
+
+void filter_amplify_free(filter_amplify_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    if (self->queued) {
+        lwarning("%zu objects still queued, discarding", self->queued);
+    }
+    for (i = 0; i < self->queued; i++) {
+        _free_chain(_self->heap[i].obj);
+    }
+    free(_self->heap);
+
+    trie_free(_self->trie);
+    free(self);
+}
+
+static size_t _obj_size(int32_t type)
+{
+    switch (type) {
+    case CORE_OBJECT_PCAP:
+        return sizeof(core_object_pcap_t);
+    case CORE_OBJECT_ETHER:
+        return sizeof(core_object_ether_t);
+    case CORE_OBJECT_NULL:
+        return sizeof(core_object_null_t);
+    case CORE_OBJECT_LOOP:
+        return sizeof(core_object_loop_t);
+    case CORE_OBJECT_LINUXSLL:
+        return sizeof(core_object_linuxsll_t);
+    case CORE_OBJECT_IEEE802:
+        return sizeof(core_object_ieee802_t);
+    case CORE_OBJECT_GRE:
+        return sizeof(core_object_gre_t);
+    case CORE_OBJECT_IP:
+        return sizeof(core_object_ip_t);
+    case CORE_OBJECT_IP6:
+        return sizeof(core_object_ip6_t);
+    case CORE_OBJECT_ICMP:
+        return sizeof(core_object_icmp_t);
+    case CORE_OBJECT_ICMP6:
+        return sizeof(core_object_icmp6_t);
+    case CORE_OBJECT_UDP:
+        return sizeof(core_object_udp_t);
+    case CORE_OBJECT_TCP:
+        return sizeof(core_object_tcp_t);
+    case CORE_OBJECT_PAYLOAD:
+        return sizeof(core_object_payload_t);
+    case CORE_OBJECT_DNS:
+        return sizeof(core_object_dns_t);
+    }
+    return 0;
+}
+
+static inline uint64_t _mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Get the synthetic client for the address and copy, clients are numbered
+ * in the order they are first seen so the mapping is deterministic for
+ * the same input.
+ */
+static uint64_t _client(filter_amplify_t* self, const uint8_t* addr, size_t len, size_t copy)
+{
+    char        key[1 + 16 + sizeof(copy)];
+    trie_val_t* val;
+
+    key[0] = len;
+    memcpy(key + 1, addr, len);
+    memcpy(key + 1 + len, &copy, sizeof(copy));
+    lassert(val = trie_get_ins(_self->trie, key, 1 + len + sizeof(copy)), "trie failure");
+
+    if (!*val) {
+        if (len == 4) {
+            if (_self->n4 == SYNTH4_MAX) {
+                lfatal("out of synthetic IPv4 clients");
+            }
+            *val = (void*)(uintptr_t)++_self->n4;
+        } else {
+            *val = (void*)(uintptr_t)++_self->n6;
+        }
+        self->clients++;
+    }
+
+    return (uint64_t)(uintptr_t)*val - 1;
+}
+
+/*
+ * Min-heap ordered by timestamp, ties are broken by arrival so copies
+ * with the same offset keep the order of the input.
+ */
+static inline int _before(const _entry_t* a, const _entry_t* b)
+{
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static void _push(filter_amplify_t* self, int64_t at, core_object_t* obj)
+{
+    _entry_t e = { at, _self->seq++, obj };
+    size_t   i;
+
+    if (self->queued == _self->heap_size) {
+        size_t    size = _self->heap_size ? _self->heap_size * 2 : 1024;
+        _entry_t* heap;
+
+        lfatal_oom(heap = realloc(_self->heap, size * sizeof(_entry_t)));
+        _self->heap      = heap;
+        _self->heap_size = size;
+    }
+
+    for (i = self->queued++; i; i = (i - 1) / 2) {
+        if (!_before(&e, &_self->heap[(i - 1) / 2])) {
+            break;
+        }
+        _self->heap[i] = _self->heap[(i - 1) / 2];
+    }
+    _self->heap[i] = e;
+
+    if (self->queued > self->queued_max) {
+        self->queued_max = self->queued;
+    }
+}
+
+static _entry_t _pop(filter_amplify_t* self)
+{
+    _entry_t top = _self->heap[0], last = _self->heap[--self->queued];
+    size_t   i   = 0, c;
+
+    while ((c = i * 2 + 1) < self->queued) {
+        if (c + 1 < self->queued && _before(&_self->heap[c + 1], &_self->heap[c])) {
+            c++;
+        }
+        if (!_before(&_self->heap[c], &last)) {
+            break;
+        }
+        _self->heap[i] = _self->heap[c];
+        i              = c;
+    }
+    _self->heap[i] = last;
+
+    return top;
+}
+
+/* Pass on all held objects with a timestamp at or before the given time. */
+static void _release(filter_amplify_t* self, int64_t until)
+{
+    _entry_t e;
+
+    while (self->queued && _self->heap[0].at <= until) {
+        e = _pop(self);
+        self->recv(self->ctx, e.obj);
+        _free_chain(e.obj);
+    }
+}
+
+/* Copy the chain and hold it at the timestamp of its PCAP object. */
+static void _hold(filter_amplify_t* self, const core_object_t* obj)
+{
+    const core_object_t*      src;
+    const core_object_pcap_t* pkt = 0;
+    core_object_t *           out = 0, *cur = 0, *copy;
+
+    for (src = obj; src; src = src->obj_prev) {
+        lfatal_oom(copy = core_object_copy(src));
+        if (cur) {
+            cur->obj_prev = copy;
+        } else {
+            out = copy;
+        }
+        cur = copy;
+        if (!pkt && copy->obj_type == CORE_OBJECT_PCAP) {
+            pkt = (const core_object_pcap_t*)copy;
+        }
+    }
+
+    _push(self, pkt->ts.sec * (int64_t)N1e9 + pkt->ts.nsec, out);
+}
+
+void filter_amplify_flush(filter_amplify_t* self)
+{
+    mlassert_self();
+
+    if (self->queued) {
+        if (!self->recv) {
+            lfatal("no receiver set");
+        }
+        _release(self, INT64_MAX);
+    }
+}
+
+static void _receive(filter_amplify_t* self, const core_object_t* obj)
+{
+    const core_object_t* chain[MAX_CHAIN];
+    const core_object_t* o;
+    size_t               n = 0, i, copy, ip_at = MAX_CHAIN, pcap_at = MAX_CHAIN;
+    uint8_t*             addr;
+    uint64_t             client, off;
+    int64_t              now = 0;
+    int                  hold;
+    mlassert_self();
+
+    self->packets++;
+
+    for (o = obj; o; o = o->obj_prev) {
+        if (n == MAX_CHAIN || !_obj_size(o->obj_type)) {
+            ip_at   = MAX_CHAIN;
+            pcap_at = MAX_CHAIN;
+            break;
+        }
+        if (ip_at == MAX_CHAIN && (o->obj_type == CORE_OBJECT_IP || o->obj_type == CORE_OBJECT_IP6)) {
+            ip_at = n;
+        } else if (o->obj_type == CORE_OBJECT_PCAP) {
+            pcap_at = n;
+        }
+        chain[n++] = o;
+    }
+
+    /*
+     * With jitter the original and its copies are held and passed on in
+     * timestamp order. The offsets are never negative and input arrives in
+     * capture order, so nothing received later can come before the
+     * timestamp of this packet.
+     */
+    hold = self->jitter_ns && pcap_at != MAX_CHAIN;
+    if (hold) {
+        const core_object_pcap_t* pcap = (const core_object_pcap_t*)chain[pcap_at];
+
+        now = pcap->ts.sec * (int64_t)N1e9 + pcap->ts.nsec;
+        _hold(self, obj);
+    } else {
+        self->recv(self->ctx, obj);
+    }
+
+    if (ip_at == MAX_CHAIN) {
+        self->passed++;
+        if (hold) {
+            _release(self, now);
+        }
+        return;
+    }
+
+    /* Copies share everything but the object structures. */
+    for (copy = 1; copy < self->copies; copy++) {
+        for (i = 0; i < n; i++) {
+            memcpy(&_self->pool[i], chain[i], _obj_size(chain[i]->obj_type));
+            if (i) {
+                _self->pool[i - 1].obj.obj_prev = &_self->pool[i].obj;
+            }
+        }
+
+        if (chain[ip_at]->obj_type == CORE_OBJECT_IP) {
+            core_object_ip_t* ip = &_self->pool[ip_at].ip;
+            uint32_t          a;
+
+            addr   = self->remap == AMPLIFY_REMAP_DST ? ip->dst : ip->src;
+            client = _client(self, addr, 4, copy);
+            a      = 0xf0000000 | (uint32_t)client;
+            addr[0] = a >> 24;
+            addr[1] = (a >> 16) & 0xff;
+            addr[2] = (a >> 8) & 0xff;
+            addr[3] = a & 0xff;
+        } else {
+            core_object_ip6_t* ip6 = &_self->pool[ip_at].ip6;
+
+            addr   = self->remap == AMPLIFY_REMAP_DST ? ip6->dst : ip6->src;
+            client = _client(self, addr, 16, copy);
+            memset(addr, 0, 16);
+            addr[0] = 0x01;
+            for (i = 0; i < 8; i++) {
+                addr[15 - i] = (client >> (i * 8)) & 0xff;
+            }
+        }
+
+        /* Constant offset per client and copy keeps the client's timing. */
+        if (hold) {
+            core_object_pcap_t* pcap = &_self->pool[pcap_at].pcap;
+
+            off = _mix(self->seed ^ _mix(client) ^ chain[ip_at]->obj_type) % (self->jitter_ns + 1);
+            pcap->ts.sec += off / N1e9;
+            pcap->ts.nsec += off % N1e9;
+            if (pcap->ts.nsec >= N1e9) {
+                pcap->ts.sec += 1;
+                pcap->ts.nsec -= N1e9;
+            }
+
+            _hold(self, &_self->pool[0].obj);
+        } else {
+            self->recv(self->ctx, &_self->pool[0].obj);
+        }
+    }
+
+    if (hold) {
+        _release(self, now);
+    }
+}
+
+core_receiver_t filter_amplify_receiver(filter_amplify_t* self)
+{
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+    if (self->copies < 1) {
+        lfatal("copies must be at least 1");
+    }
+
+    return (core_receiver_t)_receive;
+}
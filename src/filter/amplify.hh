@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct filter_amplify {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Number of copies of each packet, including the original. */
+    size_t copies;
+    enum {
+        AMPLIFY_REMAP_SRC = 0,
+        AMPLIFY_REMAP_DST = 1
+    } remap;
+    /* Maximum time offset of a client's copy and its seed. */
+    uint64_t jitter_ns;
+    uint64_t seed;
+
+    uint64_t clients;
+    uint64_t packets;
+    uint64_t passed;
+    size_t   queued, queued_max;
+} filter_amplify_t;
+
+core_log_t* filter_amplify_log();
+
+filter_amplify_t* filter_amplify_new();
+void filter_amplify_free(filter_amplify_t* self);
+void filter_amplify_flush(filter_amplify_t* self);
+
+core_receiver_t filter_amplify_receiver(filter_amplify_t* self);
@@ -0,0 +1,137 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.amplify
+-- Multiply traffic by replaying each packet as several synthetic clients
+--   local amplify = require("dnsjit.filter.amplify").new()
+--   amplify:copies(10)
+--   amplify:jitter(5000000)
+--   amplify:receiver(...)
+--   input:receiver(amplify)
+--   ...
+--   amplify:flush()
+--
+-- The filter passes each object chain to the receiver unchanged and then
+-- as given number of additional copies, each copy seen as a different
+-- client.
+-- Every copy of a client gets its own synthetic address which stays the
+-- same for all packets of that client, so per-client state (e.g. in
+-- dnsjit.filter.ipsplit or dnsjit.output.dnssim) is kept.
+-- Synthetic IPv4 clients are numbered within 240.0.0.0/4 and IPv6 clients
+-- within the discard prefix 100::/64, in the order they are first seen.
+-- .LP
+-- Only the object structures of a copy are duplicated, packet bytes and
+-- payload are shared with the original and are not rewritten, use
+-- the rewrite mode of dnsjit.output.pcap to write out the synthetic
+-- addresses.
+-- Copies are only valid during the call to the receiver, use
+-- dnsjit.filter.copy to keep them.
+-- Object chains without IPv4/IPv6 packet are passed once.
+-- .LP
+-- With jitter set, the timestamp of each copy is moved by a constant
+-- random offset of its synthetic client, which keeps the timing of that
+-- client but spreads the burst of copies.
+-- The original and its copies are then copied and held until no object
+-- received later can have an earlier timestamp, so objects are passed on
+-- in timestamp order and
+-- .B dnsjit.filter.timing
+-- can be used after this filter.
+-- The received objects must be in capture order, and
+-- .B flush()
+-- must be called after the input ends to pass on the remaining objects.
+module(...,package.seeall)
+
+require("dnsjit.filter.amplify_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Amplify = {}
+
+-- Create a new Amplify filter.
+function Amplify.new()
+    local self = {
+        _receiver = nil,
+        obj = C.filter_amplify_new(),
+    }
+    ffi.gc(self.obj, C.filter_amplify_free)
+    return setmetatable(self, { __index = Amplify })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Amplify:log()
+    if self == nil then
+        return C.filter_amplify_log()
+    end
+    return self.obj._log
+end
+
+-- Set the number of times each packet is passed on, including the
+-- original (default 1).
+function Amplify:copies(copies)
+    if copies < 1 then
+        error("copies must be at least 1")
+    end
+    self.obj.copies = copies
+end
+
+-- Write the synthetic client address to the source IP (default).
+function Amplify:remap_src()
+    self.obj.remap = "AMPLIFY_REMAP_SRC"
+end
+
+-- Write the synthetic client address to the destination IP, for traffic
+-- where the clients are the destination (e.g. responses).
+function Amplify:remap_dst()
+    self.obj.remap = "AMPLIFY_REMAP_DST"
+end
+
+-- Set the maximum time offset in nanoseconds of the copies and optionally
+-- the seed for the offsets (default 0), the offsets are the same for the
+-- same input and seed.
+function Amplify:jitter(ns, seed)
+    self.obj.jitter_ns = ns
+    if seed then
+        self.obj.seed = seed
+    end
+end
+
+-- Pass on all held objects, call after the input ended.
+function Amplify:flush()
+    C.filter_amplify_flush(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function Amplify:receive()
+    return C.filter_amplify_receiver(self.obj), self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Amplify:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the number of packets received, synthetic clients created,
+-- packets passed once because they had no IP layer and the current and
+-- the highest number of held objects.
+function Amplify:stats()
+    return tonumber(self.obj.packets), tonumber(self.obj.clients), tonumber(self.obj.passed),
+        tonumber(self.obj.queued), tonumber(self.obj.queued_max)
+end
+
+return Amplify
@@ -0,0 +1,850 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/anonymize.h"
+#include "core/assert.h"
+#include "core/inet.h"
+#include "core/object/pcap.h"
+#include "core/object/ether.h"
+#include "core/object/null.h"
+#include "core/object/loop.h"
+#include "core/object/linuxsll.h"
+#include "core/object/ieee802.h"
+#include "core/object/gre.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/icmp.h"
+#include "core/object/icmp6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+#include "core/object/dns.h"
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ANONYMIZE_AESNI 1
+#include <wmmintrin.h>
+#endif
+
+#define KEY_SIZE 32
+#define MAX_CHAIN 16
+#define DEFAULT_CACHE_SIZE (1 << 14)
+
+/*
+ * Prefix cache levels, the anonymized prefix of these lengths (in bits) is
+ * cached so only the remaining bits have to be computed for addresses
+ * sharing the prefix.
+ */
+static const uint8_t _levels4[] = { 16, 24, 32 };
+static const uint8_t _levels6[] = { 32, 48, 64, 128 };
+#define LEVELS4 (sizeof(_levels4) / sizeof(_levels4[0]))
+#define LEVELS6 (sizeof(_levels6) / sizeof(_levels6[0]))
+
+typedef struct _cache_entry {
+    uint8_t prefix[16];
+    uint8_t result[16];
+    uint8_t used;
+} _cache_entry_t;
+
+typedef union _pool_obj {
+    core_object_t          obj;
+    core_object_pcap_t     pcap;
+    core_object_ether_t    ether;
+    core_object_null_t     null;
+    core_object_loop_t     loop;
+    core_object_linuxsll_t linuxsll;
+    core_object_ieee802_t  ieee802;
+    core_object_gre_t      gre;
+    core_object_ip_t       ip;
+    core_object_ip6_t      ip6;
+    core_object_icmp_t     icmp;
+    core_object_icmp6_t    icmp6;
+    core_object_udp_t      udp;
+    core_object_tcp_t      tcp;
+    core_object_payload_t  payload;
+    core_object_dns_t      dns;
+} _pool_obj_t;
+
+typedef struct _filter_anonymize {
+    filter_anonymize_t pub;
+
+    gnutls_cipher_hd_t cipher;
+    uint8_t            round_keys[11 * 16];
+    uint8_t            pad[16];
+
+    size_t          cache_size;
+    _cache_entry_t* cache[LEVELS4 + LEVELS6];
+
+    /* Pooled copies of the object chain and its data. */
+    _pool_obj_t pool[MAX_CHAIN];
+    uint8_t*    pkt;
+    size_t      pkt_size;
+    uint8_t*    buf;
+    size_t      buf_size;
+} _filter_anonymize_t;
+
+#define _self ((_filter_anonymize_t*)self)
+
+static core_log_t         _log      = LOG_T_INIT("filter.anonymize");
+static filter_anonymize_t _defaults = {
+    LOG_T_INIT_OBJ("filter.anonymize"),
+    0, 0,
+    1, 1,
+    ANONYMIZE_ECS_ANONYMIZE,
+    0,
+    0, 0,
+    0, 0, 0, 0, 0
+};
+
+static uint8_t _zero_iv[16];
+
+core_log_t* filter_anonymize_log()
+{
+    return &_log;
+}
+
+filter_anonymize_t* filter_anonymize_new()
+{
+    filter_anonymize_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_filter_anonymize_t)));
+    memset(self, 0, sizeof(_filter_anonymize_t));
+    *self = _defaults;
+
+#ifdef ANONYMIZE_AESNI
+    __builtin_cpu_init();
+    self->has_aesni = __builtin_cpu_supports("aes") ? 1 : 0;
+#endif
+    filter_anonymize_cache_size(self, DEFAULT_CACHE_SIZE);
+
+    return self;
+}
+
+void filter_anonymize_free(filter_anonymize_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    if (_self->cipher) {
+        gnutls_cipher_deinit(_self->cipher);
+    }
+    gnutls_memset(_self->round_keys, 0, sizeof(_self->round_keys));
+    gnutls_memset(_self->pad, 0, sizeof(_self->pad));
+    for (i = 0; i < LEVELS4 + LEVELS6; i++) {
+        free(_self->cache[i]);
+    }
+    free(_self->pkt);
+    free(_self->buf);
+    free(self);
+}
+
+/*
+ * AES-128 single block encryption, using AES-NI when available and
+ * GnuTLS otherwise (CBC with zero IV reset for each block, which is
+ * equal to encrypting the block alone).
+ */
+
+#ifdef ANONYMIZE_AESNI
+__attribute__((target("aes,sse2"))) static inline __m128i _aesni_assist(__m128i key, __m128i gen)
+{
+    gen = _mm_shuffle_epi32(gen, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, gen);
+}
+
+#define _aesni_round_key(rk, i, rcon) rk[i] = _aesni_assist(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+__attribute__((target("aes,sse2"))) static void _aesni_expand(const uint8_t* key, uint8_t* round_keys)
+{
+    __m128i rk[11];
+    int     i;
+
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    _aesni_round_key(rk, 1, 0x01);
+    _aesni_round_key(rk, 2, 0x02);
+    _aesni_round_key(rk, 3, 0x04);
+    _aesni_round_key(rk, 4, 0x08);
+    _aesni_round_key(rk, 5, 0x10);
+    _aesni_round_key(rk, 6, 0x20);
+    _aesni_round_key(rk, 7, 0x40);
+    _aesni_round_key(rk, 8, 0x80);
+    _aesni_round_key(rk, 9, 0x1b);
+    _aesni_round_key(rk, 10, 0x36);
+
+    for (i = 0; i < 11; i++) {
+        _mm_storeu_si128((__m128i*)(round_keys + i * 16), rk[i]);
+    }
+}
+
+__attribute__((target("aes,sse2"))) static void _aesni_encrypt(const uint8_t* round_keys, const uint8_t* in, uint8_t* out)
+{
+    __m128i b;
+    int     i;
+
+    b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)round_keys));
+    for (i = 1; i < 10; i++) {
+        b = _mm_aesenc_si128(b, _mm_loadu_si128((const __m128i*)(round_keys + i * 16)));
+    }
+    b = _mm_aesenclast_si128(b, _mm_loadu_si128((const __m128i*)(round_keys + 160)));
+    _mm_storeu_si128((__m128i*)out, b);
+}
+#endif
+
+static inline void _encrypt(filter_anonymize_t* self, const uint8_t* in, uint8_t* out)
+{
+#ifdef ANONYMIZE_AESNI
+    if (self->has_aesni) {
+        _aesni_encrypt(_self->round_keys, in, out);
+        return;
+    }
+#endif
+    gnutls_cipher_set_iv(_self->cipher, _zero_iv, sizeof(_zero_iv));
+    gnutls_cipher_encrypt2(_self->cipher, in, 16, out, 16);
+}
+
+static void _cache_clear(filter_anonymize_t* self)
+{
+    size_t i;
+
+    for (i = 0; i < LEVELS4 + LEVELS6; i++) {
+        if (_self->cache[i]) {
+            memset(_self->cache[i], 0, sizeof(_cache_entry_t) * _self->cache_size);
+        }
+    }
+}
+
+int filter_anonymize_key(filter_anonymize_t* self, const uint8_t* key, size_t len)
+{
+    gnutls_datum_t k, iv;
+    int            err;
+    mlassert_self();
+    lassert(key, "key is nil");
+
+    if (len != KEY_SIZE) {
+        lcritical("key must be %d bytes long", KEY_SIZE);
+        return -1;
+    }
+
+    if (_self->cipher) {
+        gnutls_cipher_deinit(_self->cipher);
+        _self->cipher = 0;
+    }
+    self->has_key = 0;
+
+    k.data  = (unsigned char*)key;
+    k.size  = 16;
+    iv.data = _zero_iv;
+    iv.size = sizeof(_zero_iv);
+    if ((err = gnutls_cipher_init(&_self->cipher, GNUTLS_CIPHER_AES_128_CBC, &k, &iv)) < 0) {
+        lcritical("unable to initialize cipher: %s", gnutls_strerror(err));
+        _self->cipher = 0;
+        return -1;
+    }
+#ifdef ANONYMIZE_AESNI
+    if (self->has_aesni) {
+        _aesni_expand(key, _self->round_keys);
+    }
+#endif
+
+    /* The second half of the key is encrypted to form the padding. */
+    _encrypt(self, key + 16, _self->pad);
+    _cache_clear(self);
+    self->has_key = 1;
+
+    return 0;
+}
+
+int filter_anonymize_random_key(filter_anonymize_t* self)
+{
+    uint8_t key[KEY_SIZE];
+    int     err;
+    mlassert_self();
+
+    if ((err = gnutls_rnd(GNUTLS_RND_KEY, key, sizeof(key))) < 0) {
+        lcritical("unable to generate key: %s", gnutls_strerror(err));
+        return -1;
+    }
+    err = filter_anonymize_key(self, key, sizeof(key));
+    gnutls_memset(key, 0, sizeof(key));
+
+    return err;
+}
+
+void filter_anonymize_cache_size(filter_anonymize_t* self, size_t entries)
+{
+    size_t size = 1, i;
+    mlassert_self();
+
+    for (i = 0; i < LEVELS4 + LEVELS6; i++) {
+        free(_self->cache[i]);
+        _self->cache[i] = 0;
+    }
+    if (!entries) {
+        _self->cache_size = 0;
+        return;
+    }
+
+    while (size < entries) {
+        size <<= 1;
+    }
+    _self->cache_size = size;
+    for (i = 0; i < LEVELS4 + LEVELS6; i++) {
+        lfatal_oom(_self->cache[i] = calloc(size, sizeof(_cache_entry_t)));
+    }
+}
+
+static inline _cache_entry_t* _cache_entry(filter_anonymize_t* self, size_t level, const uint8_t* prefix, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t   i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ prefix[i]) * 16777619u;
+    }
+    hash ^= hash >> 15;
+
+    return &_self->cache[level][hash & (_self->cache_size - 1)];
+}
+
+/*
+ * Crypto-PAn: bit N of the anonymized address is bit N of the address
+ * XOR the first bit of AES(pad with the first N bits replaced by the
+ * first N bits of the address), so addresses sharing a prefix of N bits
+ * map to addresses sharing a prefix of N bits.
+ */
+static void _anonymize(filter_anonymize_t* self, const uint8_t* addr, size_t bits, uint8_t* out)
+{
+    const uint8_t* levels  = bits == 32 ? _levels4 : _levels6;
+    size_t         nlevels = bits == 32 ? LEVELS4 : LEVELS6;
+    size_t         first   = bits == 32 ? 0 : LEVELS4;
+    size_t         pos = 0, next = 0, i, byte;
+    uint8_t        block[16], enc[16], res[16], mask;
+    _cache_entry_t* e;
+
+    memset(res, 0, sizeof(res));
+    if (_self->cache_size) {
+        for (i = nlevels; i-- > 0;) {
+            e = _cache_entry(self, first + i, addr, levels[i] / 8);
+            if (e->used && !memcmp(e->prefix, addr, levels[i] / 8)) {
+                memcpy(res, e->result, levels[i] / 8);
+                pos  = levels[i];
+                next = i + 1;
+                self->cache_hits++;
+                break;
+            }
+        }
+    }
+
+    memcpy(block, _self->pad, sizeof(block));
+    memcpy(block, addr, pos / 8);
+    for (; pos < bits; pos++) {
+        byte = pos / 8;
+        mask = 0x80 >> (pos % 8);
+
+        _encrypt(self, block, enc);
+        if (((enc[0] & 0x80) != 0) != ((addr[byte] & mask) != 0)) {
+            res[byte] |= mask;
+        }
+        block[byte] = (block[byte] & ~mask) | (addr[byte] & mask);
+
+        if (_self->cache_size && next < nlevels && pos + 1 == levels[next]) {
+            e = _cache_entry(self, first + next, addr, levels[next] / 8);
+            memcpy(e->prefix, addr, levels[next] / 8);
+            memcpy(e->result, res, levels[next] / 8);
+            e->used = 1;
+            next++;
+        }
+    }
+
+    memcpy(out, res, bits / 8);
+    self->addresses++;
+}
+
+int filter_anonymize_address(filter_anonymize_t* self, const uint8_t* addr, size_t len, uint8_t* out)
+{
+    mlassert_self();
+    lassert(addr, "addr is nil");
+    lassert(out, "out is nil");
+
+    if (!self->has_key) {
+        lcritical("no key set");
+        return -1;
+    }
+    if (len != 4 && len != 16) {
+        lcritical("invalid address length %zu", len);
+        return -1;
+    }
+    _anonymize(self, addr, len * 8, out);
+
+    return 0;
+}
+
+static int _is_ip(const uint8_t* bytes, size_t caplen, size_t off, size_t alen, const uint8_t* src, const uint8_t* dst)
+{
+    if (alen == 4) {
+        return off + 20 <= caplen && (bytes[off] >> 4) == 4
+               && !memcmp(bytes + off + 12, src, 4) && !memcmp(bytes + off + 16, dst, 4);
+    }
+    return off + 40 <= caplen && (bytes[off] >> 4) == 6
+           && !memcmp(bytes + off + 8, src, 16) && !memcmp(bytes + off + 24, dst, 16);
+}
+
+/*
+ * Locate the IP header in the packet, the expected offset is tried first
+ * and then the packet is searched backwards so the innermost header of
+ * tunneled packets is found.
+ */
+static ssize_t _find_ip(const uint8_t* bytes, size_t caplen, ssize_t guess, size_t alen, const uint8_t* src, const uint8_t* dst)
+{
+    size_t off;
+
+    if (guess >= 0 && _is_ip(bytes, caplen, guess, alen, src, dst)) {
+        return guess;
+    }
+    for (off = caplen; off-- > 0;) {
+        if (_is_ip(bytes, caplen, off, alen, src, dst)) {
+            return off;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Find EDNS Client Subnet option in the OPT record, returns offset of the
+ * address in the message or -1.
+ */
+
+static size_t _skip_name(const uint8_t* p, size_t len, size_t off)
+{
+    while (off < len) {
+        if ((p[off] & 0xc0) == 0xc0) {
+            return off + 2;
+        }
+        if (p[off] & 0xc0) {
+            return 0;
+        }
+        if (!p[off]) {
+            return off + 1;
+        }
+        off += p[off] + 1;
+    }
+    return 0;
+}
+
+static ssize_t _find_ecs(const uint8_t* p, size_t len, uint16_t* family, uint8_t* prefix, size_t* addrlen)
+{
+    size_t   off = 12, i, rr, rdlen, o, end, olen;
+    uint16_t qd, an, ns, ar, type, code;
+
+    if (len < 12) {
+        return -1;
+    }
+    qd = (p[4] << 8) | p[5];
+    an = (p[6] << 8) | p[7];
+    ns = (p[8] << 8) | p[9];
+    ar = (p[10] << 8) | p[11];
+    if (!ar) {
+        return -1;
+    }
+
+    for (i = 0; i < qd; i++) {
+        if (!(off = _skip_name(p, len, off))) {
+            return -1;
+        }
+        off += 4;
+    }
+    rr = (size_t)an + ns + ar;
+    for (i = 0; i < rr; i++) {
+        if (!(off = _skip_name(p, len, off)) || off + 10 > len) {
+            return -1;
+        }
+        type  = (p[off] << 8) | p[off + 1];
+        rdlen = (p[off + 8] << 8) | p[off + 9];
+        off += 10;
+        if (off + rdlen > len) {
+            return -1;
+        }
+
+        if (type == 41 && i >= (size_t)an + ns) {
+            for (o = off, end = off + rdlen; o + 4 <= end; o += olen) {
+                code = (p[o] << 8) | p[o + 1];
+                olen = (p[o + 2] << 8) | p[o + 3];
+                o += 4;
+                if (o + olen > end) {
+                    return -1;
+                }
+                if (code == 8 && olen >= 4) {
+                    *family  = (p[o] << 8) | p[o + 1];
+                    *prefix  = p[o + 2];
+                    *addrlen = olen - 4;
+                    return o + 4;
+                }
+            }
+        }
+        off += rdlen;
+    }
+    return -1;
+}
+
+/*
+ * Copy the object chain into the pool, including the packet bytes and
+ * the payload when it's not part of the packet.
+ */
+
+static size_t _obj_size(int32_t type)
+{
+    switch (type) {
+    case CORE_OBJECT_PCAP:
+        return sizeof(core_object_pcap_t);
+    case CORE_OBJECT_ETHER:
+        return sizeof(core_object_ether_t);
+    case CORE_OBJECT_NULL:
+        return sizeof(core_object_null_t);
+    case CORE_OBJECT_LOOP:
+        return sizeof(core_object_loop_t);
+    case CORE_OBJECT_LINUXSLL:
+        return sizeof(core_object_linuxsll_t);
+    case CORE_OBJECT_IEEE802:
+        return sizeof(core_object_ieee802_t);
+    case CORE_OBJECT_GRE:
+        return sizeof(core_object_gre_t);
+    case CORE_OBJECT_IP:
+        return sizeof(core_object_ip_t);
+    case CORE_OBJECT_IP6:
+        return sizeof(core_object_ip6_t);
+    case CORE_OBJECT_ICMP:
+        return sizeof(core_object_icmp_t);
+    case CORE_OBJECT_ICMP6:
+        return sizeof(core_object_icmp6_t);
+    case CORE_OBJECT_UDP:
+        return sizeof(core_object_udp_t);
+    case CORE_OBJECT_TCP:
+        return sizeof(core_object_tcp_t);
+    case CORE_OBJECT_PAYLOAD:
+        return sizeof(core_object_payload_t);
+    case CORE_OBJECT_DNS:
+        return sizeof(core_object_dns_t);
+    }
+    return 0;
+}
+
+static inline const uint8_t* _rebase(const uint8_t* p, const uint8_t* from, size_t len, uint8_t* to)
+{
+    if (p && from && p >= from && p <= from + len) {
+        return to + (p - from);
+    }
+    return p;
+}
+
+static core_object_t* _copy(filter_anonymize_t* self, const core_object_t* obj)
+{
+    const core_object_t*         chain[MAX_CHAIN];
+    const core_object_pcap_t*    pcap    = 0;
+    const core_object_payload_t* payload = 0;
+    const uint8_t*               ext     = 0;
+    size_t                       n = 0, i, size;
+
+    for (; obj; obj = obj->obj_prev) {
+        if (n == MAX_CHAIN || !_obj_size(obj->obj_type)) {
+            return 0;
+        }
+        chain[n++] = obj;
+        if (obj->obj_type == CORE_OBJECT_PCAP) {
+            pcap = (const core_object_pcap_t*)obj;
+        } else if (obj->obj_type == CORE_OBJECT_PAYLOAD && !payload) {
+            payload = (const core_object_payload_t*)obj;
+        }
+    }
+
+    if (pcap) {
+        if (_self->pkt_size < pcap->caplen) {
+            free(_self->pkt);
+            lfatal_oom(_self->pkt = malloc(pcap->caplen));
+            _self->pkt_size = pcap->caplen;
+        }
+        memcpy(_self->pkt, pcap->bytes, pcap->caplen);
+    }
+    if (payload && payload->payload
+        && (!pcap || payload->payload < pcap->bytes || payload->payload + payload->len > pcap->bytes + pcap->caplen)) {
+        if (_self->buf_size < payload->len) {
+            free(_self->buf);
+            lfatal_oom(_self->buf = malloc(payload->len));
+            _self->buf_size = payload->len;
+        }
+        memcpy(_self->buf, payload->payload, payload->len);
+        ext = payload->payload;
+    }
+
+    for (i = 0; i < n; i++) {
+        size = _obj_size(chain[i]->obj_type);
+        memcpy(&_self->pool[i], chain[i], size);
+        if (i) {
+            _self->pool[i - 1].obj.obj_prev = &_self->pool[i].obj;
+        }
+
+        switch (chain[i]->obj_type) {
+        case CORE_OBJECT_PCAP:
+            _self->pool[i].pcap.bytes = _self->pkt;
+            break;
+        case CORE_OBJECT_PAYLOAD:
+            if (ext) {
+                _self->pool[i].payload.payload = _rebase(_self->pool[i].payload.payload, ext, payload->len, _self->buf);
+            } else if (pcap) {
+                _self->pool[i].payload.payload = _rebase(_self->pool[i].payload.payload, pcap->bytes, pcap->caplen, _self->pkt);
+            }
+            break;
+        case CORE_OBJECT_DNS:
+            if (ext) {
+                _self->pool[i].dns.payload = _rebase(_self->pool[i].dns.payload, ext, payload->len, _self->buf);
+                _self->pool[i].dns.at      = _rebase(_self->pool[i].dns.at, ext, payload->len, _self->buf);
+            } else if (pcap) {
+                _self->pool[i].dns.payload = _rebase(_self->pool[i].dns.payload, pcap->bytes, pcap->caplen, _self->pkt);
+                _self->pool[i].dns.at      = _rebase(_self->pool[i].dns.at, pcap->bytes, pcap->caplen, _self->pkt);
+            }
+            break;
+        }
+    }
+
+    return &_self->pool[0].obj;
+}
+
+static void _ecs(filter_anonymize_t* self, uint8_t* msg, size_t len, uint8_t* bytes, size_t caplen, ssize_t t_off, uint8_t* csum, int is_udp)
+{
+    uint16_t family;
+    uint8_t  prefix, old[16], full[16], out[16];
+    size_t   alen, flen, i;
+    ssize_t  off;
+    uint8_t* a;
+
+    if ((off = _find_ecs(msg, len, &family, &prefix, &alen)) < 0 || !alen) {
+        return;
+    }
+    flen = family == 1 ? 4 : family == 2 ? 16 : 0;
+    if (alen > flen) {
+        return;
+    }
+    a = msg + off;
+    memcpy(old, a, alen);
+
+    if (self->ecs == ANONYMIZE_ECS_ZERO) {
+        memset(a, 0, alen);
+    } else {
+        memset(full, 0, sizeof(full));
+        memcpy(full, a, alen);
+        _anonymize(self, full, flen * 8, out);
+        /* Keep only the source prefix. */
+        for (i = 0; i < alen; i++) {
+            if (prefix >= (i + 1) * 8) {
+                continue;
+            }
+            out[i] &= prefix > i * 8 ? (uint8_t)(0xff << (8 - (prefix - i * 8))) : 0;
+        }
+        memcpy(a, out, alen);
+    }
+    self->ecs_rewritten++;
+
+    if (csum && t_off >= 0 && a >= bytes && a + alen <= bytes + caplen) {
+        core_inet_csum_replace(csum, is_udp, old, a, alen, (size_t)(a - bytes - t_off));
+    }
+}
+
+static void _receive(filter_anonymize_t* self, const core_object_t* obj)
+{
+    core_object_t*         o;
+    core_object_pcap_t*    pcap    = 0;
+    core_object_ip_t*      ip      = 0;
+    core_object_ip6_t*     ip6     = 0;
+    core_object_udp_t*     udp     = 0;
+    core_object_tcp_t*     tcp     = 0;
+    core_object_icmp6_t*   icmp6   = 0;
+    core_object_payload_t* payload = 0;
+    uint8_t *              src, *dst, *bytes = 0, *csum = 0;
+    uint8_t                old[32], new[32], nxt;
+    size_t                 alen, caplen = 0, p_off, l4;
+    ssize_t                ip_off = -1, t_off = -1, guess = -1;
+    int                    is_udp = 0;
+    mlassert_self();
+
+    self->packets++;
+
+    if (!self->inplace) {
+        for (o = (core_object_t*)obj; o; o = (core_object_t*)o->obj_prev) {
+            if (o->obj_type == CORE_OBJECT_IP || o->obj_type == CORE_OBJECT_IP6) {
+                break;
+            }
+        }
+        if (o) {
+            if (!(o = _copy(self, obj))) {
+                self->skipped++;
+                lwarning("packet discarded (unable to copy object chain)");
+                return;
+            }
+            obj = o;
+        }
+    }
+
+    /* Find the innermost IP header and the layers above it. */
+    for (o = (core_object_t*)obj; o; o = (core_object_t*)o->obj_prev) {
+        switch (o->obj_type) {
+        case CORE_OBJECT_PCAP:
+            pcap = (core_object_pcap_t*)o;
+            break;
+        case CORE_OBJECT_IP:
+            if (!ip && !ip6)
+                ip = (core_object_ip_t*)o;
+            break;
+        case CORE_OBJECT_IP6:
+            if (!ip && !ip6)
+                ip6 = (core_object_ip6_t*)o;
+            break;
+        case CORE_OBJECT_UDP:
+            if (!ip && !ip6)
+                udp = (core_object_udp_t*)o;
+            break;
+        case CORE_OBJECT_TCP:
+            if (!ip && !ip6)
+                tcp = (core_object_tcp_t*)o;
+            break;
+        case CORE_OBJECT_ICMP6:
+            if (!ip && !ip6)
+                icmp6 = (core_object_icmp6_t*)o;
+            break;
+        case CORE_OBJECT_PAYLOAD:
+            if (!ip && !ip6 && !payload)
+                payload = (core_object_payload_t*)o;
+            break;
+        }
+    }
+    if (!ip && !ip6) {
+        self->skipped++;
+        self->recv(self->ctx, obj);
+        return;
+    }
+
+    if (ip) {
+        src  = ip->src;
+        dst  = ip->dst;
+        alen = 4;
+    } else {
+        src  = ip6->src;
+        dst  = ip6->dst;
+        alen = 16;
+    }
+    memcpy(old, src, alen);
+    memcpy(old + alen, dst, alen);
+    memcpy(new, old, alen * 2);
+    if (self->src) {
+        _anonymize(self, old, alen * 8, new);
+    }
+    if (self->dst) {
+        _anonymize(self, old + alen, alen * 8, new + alen);
+    }
+    memcpy(src, new, alen);
+    memcpy(dst, new + alen, alen);
+
+    if (pcap && pcap->bytes) {
+        bytes  = (uint8_t*)pcap->bytes;
+        caplen = pcap->caplen;
+
+        if (payload && payload->payload >= bytes && payload->payload <= bytes + caplen) {
+            p_off = payload->payload - bytes;
+            if (udp && p_off >= 8) {
+                t_off = p_off - 8;
+            } else if (tcp && p_off >= (size_t)tcp->off * 4) {
+                t_off = p_off - tcp->off * 4;
+            }
+        }
+        if (t_off >= 0) {
+            guess = ip ? t_off - ip->hl * 4 : t_off - 40;
+        }
+
+        if ((ip_off = _find_ip(bytes, caplen, guess, alen, old, old + alen)) < 0) {
+            ldebug("IP header not found in packet, only objects rewritten");
+        } else if (ip) {
+            memcpy(bytes + ip_off + 12, new, 8);
+            if (ip_off + ip->hl * 4 <= caplen) {
+                ip->sum = core_inet_ip4_csum(bytes + ip_off);
+            }
+            if (t_off < 0 && (udp || tcp) && !(ip->off & 0x1fff)) {
+                t_off = ip_off + ip->hl * 4;
+            }
+        } else {
+            memcpy(bytes + ip_off + 8, new, 32);
+            if (t_off < 0 && (udp || tcp || icmp6)) {
+                l4 = core_inet_ip6_l4(bytes + ip_off, caplen - ip_off, &nxt);
+                if (l4 && ((udp && nxt == 17) || (tcp && nxt == 6) || (icmp6 && nxt == 58))) {
+                    t_off = ip_off + l4;
+                }
+            }
+        }
+
+        /* Fix the transport checksum which covers the pseudo header. */
+        if (ip_off >= 0 && t_off > ip_off && (size_t)t_off <= caplen && (udp || tcp || icmp6)) {
+            csum = core_inet_l4_csum(bytes + t_off, caplen - t_off, udp ? 17 : tcp ? 6 : 58, ip != 0, &is_udp);
+            if (csum) {
+                core_inet_csum_replace(csum, is_udp, old, new, alen * 2, 0);
+            }
+        }
+    }
+
+    if (self->ecs != ANONYMIZE_ECS_KEEP && payload && payload->payload && (udp || tcp)) {
+        uint8_t* msg = (uint8_t*)payload->payload;
+        size_t   len = payload->len;
+
+        /* Skip the DNS length prefix of TCP messages. */
+        if (tcp && len >= 2 && (size_t)((msg[0] << 8) | msg[1]) == len - 2) {
+            msg += 2;
+            len -= 2;
+        }
+        _ecs(self, msg, len, bytes, caplen, t_off, csum, is_udp);
+    }
+
+    if (csum) {
+        if (udp) {
+            udp->sum = (csum[0] << 8) | csum[1];
+        } else if (tcp) {
+            tcp->sum = (csum[0] << 8) | csum[1];
+        } else {
+            icmp6->cksum = (csum[0] << 8) | csum[1];
+        }
+    }
+
+    self->recv(self->ctx, obj);
+}
+
+core_receiver_t filter_anonymize_receiver(filter_anonymize_t* self)
+{
+    if (!self->recv) {
+        lfatal("no receiver(s) set");
+    }
+    if (!self->has_key) {
+        lfatal("no key set, use key() or random_key()");
+    }
+
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct filter_anonymize {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Anonymize source and/or destination addresses. */
+    uint8_t src, dst;
+
+    enum {
+        ANONYMIZE_ECS_KEEP      = 0,
+        ANONYMIZE_ECS_ANONYMIZE = 1,
+        ANONYMIZE_ECS_ZERO      = 2
+    } ecs;
+
+    /* Rewrite the received objects and packet instead of pooled copies. */
+    uint8_t inplace;
+
+    uint8_t has_key;
+    uint8_t has_aesni;
+
+    uint64_t packets;
+    uint64_t addresses;
+    uint64_t cache_hits;
+    uint64_t ecs_rewritten;
+    uint64_t skipped;
+} filter_anonymize_t;
+
+core_log_t* filter_anonymize_log();
+
+filter_anonymize_t* filter_anonymize_new();
+void filter_anonymize_free(filter_anonymize_t* self);
+int filter_anonymize_key(filter_anonymize_t* self, const uint8_t* key, size_t len);
+int filter_anonymize_random_key(filter_anonymize_t* self);
+void filter_anonymize_cache_size(filter_anonymize_t* self, size_t entries);
+int filter_anonymize_address(filter_anonymize_t* self, const uint8_t* addr, size_t len, uint8_t* out);
+
+core_receiver_t filter_anonymize_receiver(filter_anonymize_t* self);
@@ -0,0 +1,175 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.anonymize
+-- Prefix-preserving anonymization of IP addresses
+--   local anon = require("dnsjit.filter.anonymize").new()
+--   anon:key("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f")
+--   anon:receiver(output)
+--   layer:receiver(anon)
+--
+-- Anonymize the source and destination addresses of IPv4/IPv6 packets with
+-- Crypto-PAn, addresses sharing a prefix of N bits are mapped to addresses
+-- sharing a prefix of N bits, so subnet structure of the traffic is kept
+-- while the original addresses can't be recovered without the key.
+-- The mapping is stable for a given key, the same key must be used to
+-- anonymize traffic which is analysed together.
+-- The algorithm is compatible with the original Crypto-PAn implementation
+-- for IPv4 and extended to 128 bits for IPv6.
+-- .P
+-- AES is done using AES-NI when the CPU supports it and GnuTLS otherwise,
+-- and anonymized prefixes are cached (/16, /24 and /32 for IPv4, /32, /48,
+-- /64 and /128 for IPv6) so only the remaining bits are computed for
+-- addresses from an already seen network.
+-- .P
+-- Both the IP objects and the packet bytes (the PCAP object) are rewritten
+-- and the IPv4 header and UDP/TCP/ICMPv6 checksums are updated
+-- incrementally, so the objects can be written out with
+-- dnsjit.output.pcap.
+-- Only the innermost IP header is anonymized, packets without an IP object
+-- are passed on unchanged.
+-- The EDNS Client Subnet address in DNS messages is also anonymized by
+-- default (truncated to the source prefix length), see
+-- .IR ecs() .
+-- .P
+-- By default the object chain and the packet are copied to buffers owned by
+-- the filter before rewriting, which are reused for the next packet, so the
+-- receiver must copy the objects if it needs to keep them.
+-- With
+-- .I inplace()
+-- the received objects and packet are rewritten directly, which avoids the
+-- copies but requires writable input buffers (i.e. not
+-- dnsjit.input.mmpcap).
+module(...,package.seeall)
+
+require("dnsjit.filter.anonymize_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Anonymize = {}
+
+-- Create a new Anonymize filter.
+function Anonymize.new()
+    local self = {
+        obj = C.filter_anonymize_new(),
+    }
+    ffi.gc(self.obj, C.filter_anonymize_free)
+    return setmetatable(self, { __index = Anonymize })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Anonymize:log()
+    if self == nil then
+        return C.filter_anonymize_log()
+    end
+    return self.obj._log
+end
+
+-- Return the C functions and context for receiving objects.
+function Anonymize:receive()
+    local recv = C.filter_anonymize_receiver(self.obj)
+    return recv, self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Anonymize:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+end
+
+-- Set the 32 byte key, either as raw bytes or as 64 hexadecimal characters.
+-- Returns 0 on success.
+function Anonymize:key(key)
+    if #key == 64 and key:match("^%x+$") then
+        key = key:gsub("%x%x", function(hex)
+            return string.char(tonumber(hex, 16))
+        end)
+    end
+    return C.filter_anonymize_key(self.obj, key, #key)
+end
+
+-- Generate a random key, the mapping is then only stable for the lifetime
+-- of this filter.
+-- Returns 0 on success.
+function Anonymize:random_key()
+    return C.filter_anonymize_random_key(self.obj)
+end
+
+-- Set the number of entries of each prefix cache level (rounded up to a
+-- power of two, default 16384), 0 disables the cache.
+function Anonymize:cache_size(entries)
+    C.filter_anonymize_cache_size(self.obj, entries)
+end
+
+-- Set if the source and destination addresses should be anonymized
+-- (default both).
+function Anonymize:addresses(src, dst)
+    self.obj.src = src and 1 or 0
+    self.obj.dst = dst and 1 or 0
+end
+
+-- Set how the EDNS Client Subnet address is handled:
+-- .I anonymize
+-- (default),
+-- .I zero
+-- or
+-- .IR keep .
+function Anonymize:ecs(mode)
+    if mode == "anonymize" then
+        self.obj.ecs = "ANONYMIZE_ECS_ANONYMIZE"
+    elseif mode == "zero" then
+        self.obj.ecs = "ANONYMIZE_ECS_ZERO"
+    elseif mode == "keep" then
+        self.obj.ecs = "ANONYMIZE_ECS_KEEP"
+    else
+        error("invalid ECS mode: "..tostring(mode))
+    end
+end
+
+-- Set if the received objects and packet should be rewritten in place
+-- instead of copies (default false).
+function Anonymize:inplace(bool)
+    if bool == nil or bool == true then
+        self.obj.inplace = 1
+    else
+        self.obj.inplace = 0
+    end
+end
+
+-- Anonymize an address given as 4 or 16 raw bytes and return the result
+-- as raw bytes, or nil on error.
+function Anonymize:address(addr)
+    local out = ffi.new("uint8_t[16]")
+    if C.filter_anonymize_address(self.obj, addr, #addr, out) ~= 0 then
+        return nil
+    end
+    return ffi.string(out, #addr)
+end
+
+-- Return the number of packets received, addresses anonymized, prefix cache
+-- hits, ECS addresses rewritten and packets passed on without changes
+-- (no IP object) or discarded.
+function Anonymize:stats()
+    return tonumber(self.obj.packets), tonumber(self.obj.addresses),
+        tonumber(self.obj.cache_hits), tonumber(self.obj.ecs_rewritten),
+        tonumber(self.obj.skipped)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.output.pcap (3),
+-- dnsjit.filter.copy (3)
+return Anonymize
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/schedule.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define N1e9 1000000000
+
+typedef struct _client {
+    int64_t first, start;
+    double  factor;
+    uint8_t seen;
+} _client_t;
+
+typedef struct _entry {
+    int64_t        at;
+    uint64_t       seq;
+    core_object_t* obj;
+} _entry_t;
+
+typedef struct _filter_schedule {
+    filter_schedule_t pub;
+
+    trie_t* trie;
+    /* Smallest per-client factor set by filter_schedule_client(). */
+    double factor_min;
+
+    /* Capture time of the first packet, scheduled times are relative to it. */
+    int64_t  t0;
+    uint8_t  have_t0;
+    uint64_t seq;
+
+    _entry_t* heap;
+    size_t    heap_size;
+} _filter_schedule_t;
+
+#define _self ((_filter_schedule_t*)self)
+
+static core_log_t        _log      = LOG_T_INIT("filter.schedule");
+static filter_schedule_t _defaults = {
+    LOG_T_INIT_OBJ("filter.schedule"),
+    0, 0,
+    1.0,
+    1.0, 1.0, 0,
+    1000000,
+    0, 0, 0, 0,
+    0, 0
+};
+
+core_log_t* filter_schedule_log()
+{
+    return &_log;
+}
+
+filter_schedule_t* filter_schedule_new()
+{
+    filter_schedule_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_filter_schedule_t)));
+    *self             = _defaults;
+    _self->trie       = trie_create(NULL);
+    _self->factor_min = 0;
+    _self->t0         = 0;
+    _self->have_t0    = 0;
+    _self->seq        = 0;
+    _self->heap       = 0;
+    _self->heap_size  = 0;
+
+    return self;
+}
+
+static int _free_trie_value(trie_val_t* val, void* ctx)
+{
+    free(*val);
+    return 0;
+}
+
+static void _free_chain(core_object_t* obj)
+{
+    core_object_t* prev;
+
+    while (obj) {
+        prev = (core_object_t*)obj->obj_prev;
+        core_object_free(obj);
+        obj = prev;
+    }
+}
+
+void filter_schedule_free(filter_schedule_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    if (self->queued) {
+        lwarning("%zu objects still queued, discarding", self->queued);
+    }
+    for (i = 0; i < self->queued; i++) {
+        _free_chain(_self->heap[i].obj);
+    }
+    free(_self->heap);
+
+    trie_apply(_self->trie, _free_trie_value, NULL);
+    trie_free(_self->trie);
+    free(self);
+}
+
+static _client_t* _get_client(filter_schedule_t* self, const uint8_t* addr, size_t len)
+{
+    char        key[1 + 16];
+    trie_val_t* val;
+
+    key[0] = len;
+    memcpy(key + 1, addr, len);
+    lassert(val = trie_get_ins(_self->trie, key, 1 + len), "trie failure");
+    if (!*val) {
+        _client_t* c;
+
+        lfatal_oom(c = calloc(1, sizeof(_client_t)));
+        *val = c;
+    }
+
+    return *val;
+}
+
+int filter_schedule_client(filter_schedule_t* self, const char* ip, double factor)
+{
+    uint8_t    addr[16];
+    size_t     len = 4;
+    _client_t* c;
+    mlassert_self();
+    lassert(ip, "ip is nil");
+
+    if (factor <= 0) {
+        return -1;
+    }
+    if (inet_pton(AF_INET, ip, addr) != 1) {
+        if (inet_pton(AF_INET6, ip, addr) != 1) {
+            return -1;
+        }
+        len = 16;
+    }
+
+    c = _get_client(self, addr, len);
+    if (c->seen) {
+        lwarning("client already scheduled, factor applies to its next packets");
+    }
+    c->factor = factor;
+    if (!_self->factor_min || factor < _self->factor_min) {
+        _self->factor_min = factor;
+    }
+
+    return 0;
+}
+
+static inline uint64_t _mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Per-client factor from the stretch range, stable for the address and seed. */
+static double _stretch(filter_schedule_t* self, const uint8_t* addr, size_t len)
+{
+    uint64_t h = self->seed;
+    size_t   i;
+
+    if (self->stretch_max <= self->stretch_min) {
+        return self->stretch_min;
+    }
+    for (i = 0; i < len; i++) {
+        h = _mix(h ^ addr[i]);
+    }
+
+    return self->stretch_min + (self->stretch_max - self->stretch_min) * ((h >> 11) / 9007199254740992.0);
+}
+
+/*
+ * Min-heap ordered by scheduled time, ties are broken by arrival so objects
+ * of a client (which are scheduled monotonically) keep their order.
+ */
+static inline int _before(const _entry_t* a, const _entry_t* b)
+{
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static void _push(filter_schedule_t* self, int64_t at, core_object_t* obj)
+{
+    _entry_t e = { at, _self->seq++, obj };
+    size_t   i;
+
+    if (self->queued == _self->heap_size) {
+        size_t    size = _self->heap_size ? _self->heap_size * 2 : 1024;
+        _entry_t* heap;
+
+        lfatal_oom(heap = realloc(_self->heap, size * sizeof(_entry_t)));
+        _self->heap      = heap;
+        _self->heap_size = size;
+    }
+
+    for (i = self->queued++; i; i = (i - 1) / 2) {
+        if (!_before(&e, &_self->heap[(i - 1) / 2])) {
+            break;
+        }
+        _self->heap[i] = _self->heap[(i - 1) / 2];
+    }
+    _self->heap[i] = e;
+
+    if (self->queued > self->queued_max) {
+        self->queued_max = self->queued;
+    }
+}
+
+static _entry_t _pop(filter_schedule_t* self)
+{
+    _entry_t top = _self->heap[0], last = _self->heap[--self->queued];
+    size_t   i   = 0, c;
+
+    while ((c = i * 2 + 1) < self->queued) {
+        if (c + 1 < self->queued && _before(&_self->heap[c + 1], &_self->heap[c])) {
+            c++;
+        }
+        if (!_before(&_self->heap[c], &last)) {
+            break;
+        }
+        _self->heap[i] = _self->heap[c];
+        i              = c;
+    }
+    _self->heap[i] = last;
+
+    return top;
+}
+
+/* Pass on all objects scheduled at or before the given time. */
+static void _release(filter_schedule_t* self, int64_t until)
+{
+    _entry_t e;
+
+    while (self->queued && _self->heap[0].at <= until) {
+        e = _pop(self);
+        self->recv(self->ctx, e.obj);
+        _free_chain(e.obj);
+    }
+}
+
+void filter_schedule_flush(filter_schedule_t* self)
+{
+    mlassert_self();
+
+    if (self->queued) {
+        if (!self->recv) {
+            lfatal("no receiver set");
+        }
+        _release(self, INT64_MAX);
+    }
+}
+
+static void _receive(filter_schedule_t* self, const core_object_t* obj)
+{
+    const core_object_t* src;
+    const uint8_t*       addr = 0;
+    size_t               len  = 0;
+    core_object_pcap_t*  pkt  = 0;
+    core_object_t *      out = 0, *cur = 0, *copy;
+    int64_t              t, at, watermark;
+    double               low;
+    mlassert_self();
+
+    for (src = obj; src; src = src->obj_prev) {
+        if (!addr && src->obj_type == CORE_OBJECT_IP) {
+            addr = ((const core_object_ip_t*)src)->src;
+            len  = 4;
+        } else if (!addr && src->obj_type == CORE_OBJECT_IP6) {
+            addr = ((const core_object_ip6_t*)src)->src;
+            len  = 16;
+        }
+
+        copy = core_object_copy(src);
+        if (!copy) {
+            lwarning("unknown object type %d, discarding", src->obj_type);
+            _free_chain(out);
+            return;
+        }
+        if (cur) {
+            cur->obj_prev = copy;
+        } else {
+            out = copy;
+        }
+        cur = copy;
+        if (!pkt && copy->obj_type == CORE_OBJECT_PCAP) {
+            pkt = (core_object_pcap_t*)copy;
+        }
+    }
+    if (!pkt) {
+        lwarning("no pcap object in chain, discarding");
+        _free_chain(out);
+        return;
+    }
+    self->packets++;
+
+    t = pkt->ts.sec * (int64_t)N1e9 + pkt->ts.nsec;
+    if (!_self->have_t0) {
+        _self->t0      = t;
+        _self->have_t0 = 1;
+    }
+    t -= _self->t0;
+
+    if (addr) {
+        _client_t* c = _get_client(self, addr, len);
+
+        if (!c->seen) {
+            c->first = t;
+            c->start = (int64_t)(t * self->mul);
+            if (!c->factor) {
+                c->factor = _stretch(self, addr, len);
+            }
+            c->seen = 1;
+            self->clients++;
+        }
+        at = c->start + (int64_t)((t - c->first) * self->mul * c->factor);
+    } else {
+        self->unmapped++;
+        at = (int64_t)(t * self->mul);
+    }
+
+    at += _self->t0;
+    pkt->ts.sec  = at / N1e9;
+    pkt->ts.nsec = at % N1e9;
+
+    /*
+     * Input arrives in capture order so nothing received later can be
+     * scheduled before t * mul * (smallest factor), anything up to that
+     * is final (less the rounding of the client's start and offset).
+     */
+    low = self->stretch_min;
+    if (_self->factor_min && _self->factor_min < low) {
+        low = _self->factor_min;
+    }
+    if (low > 1) {
+        low = 1;
+    }
+    watermark = _self->t0 + (int64_t)(t * self->mul * low) - 2;
+    _release(self, watermark);
+
+    if (self->limit && self->queued >= self->limit) {
+        if (!self->dropped) {
+            lwarning("queue limit of %zu objects reached, dropping", self->limit);
+        }
+        self->dropped++;
+        _free_chain(out);
+        return;
+    }
+    _push(self, at, out);
+    _release(self, watermark);
+}
+
+core_receiver_t filter_schedule_receiver(filter_schedule_t* self)
+{
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+    if (self->mul <= 0 || self->stretch_min <= 0 || self->stretch_max < self->stretch_min) {
+        lfatal("invalid time factors");
+    }
+
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct filter_schedule {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Global time factor, client start times are multiplied by it. */
+    double mul;
+    /* Range of the per-client time factor and its seed. */
+    double   stretch_min, stretch_max;
+    uint64_t seed;
+    /* Maximum number of queued objects, 0 for no limit. */
+    size_t limit;
+
+    uint64_t packets, clients, unmapped, dropped;
+    size_t   queued, queued_max;
+} filter_schedule_t;
+
+core_log_t* filter_schedule_log();
+
+filter_schedule_t* filter_schedule_new();
+void filter_schedule_free(filter_schedule_t* self);
+int filter_schedule_client(filter_schedule_t* self, const char* ip, double factor);
+void filter_schedule_flush(filter_schedule_t* self);
+
+core_receiver_t filter_schedule_receiver(filter_schedule_t* self);
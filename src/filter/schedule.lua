@@ -0,0 +1,137 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.schedule
+-- Reorder objects on a global timeline keeping the timing of each client
+--   local schedule = require("dnsjit.filter.schedule").new()
+--   schedule:multiply(0.1)
+--   schedule:stretch(0.5, 2)
+--   schedule:receiver(timing)
+--   ...
+--   schedule:flush()
+--
+-- Filter which keeps the relative timing between the packets of each
+-- client (the source IP address) from the capture, while the time of each
+-- client can be stretched or compressed independently of the others.
+-- A client starts at the time it was first seen multiplied by the global
+-- factor (see
+-- .BR multiply() )
+-- and the gaps between its packets are then multiplied by both the global
+-- factor and its own factor, so e.g. replaying ten times faster keeps the
+-- bursts of a client as they were captured if its factor is 10.
+-- .LP
+-- The timestamp of the PCAP object in the chain is set to the scheduled
+-- time and objects are passed on in the scheduled order.
+-- Objects are copied and held in a heap until no object received later can
+-- be scheduled before them, which depends on the smallest factor in use,
+-- and
+-- .B flush()
+-- must be called after the input ends to pass on the remaining objects.
+-- The received objects must be in capture order.
+-- The number of queued objects is limited (see
+-- .BR limit() ),
+-- objects received while the queue is full are dropped and counted.
+-- .LP
+-- Use
+-- .B dnsjit.filter.timing
+-- in keep mode after this filter to pace the packets, and
+-- .B dnsjit.filter.ipsplit
+-- after that to split them across threads, which keeps every client on
+-- one thread.
+-- Objects without IP are scheduled with the global factor only.
+module(...,package.seeall)
+
+require("dnsjit.filter.schedule_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Schedule = {}
+
+-- Create a new Schedule filter.
+function Schedule.new()
+    local self = {
+        _receiver = nil,
+        obj = C.filter_schedule_new(),
+    }
+    ffi.gc(self.obj, C.filter_schedule_free)
+    return setmetatable(self, { __index = Schedule })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Schedule:log()
+    if self == nil then
+        return C.filter_schedule_log()
+    end
+    return self.obj._log
+end
+
+-- Set the global time factor (default 1.0), less than 1 replays faster.
+function Schedule:multiply(factor)
+    self.obj.mul = factor
+end
+
+-- Set the range of the per-client time factor (default 1.0 to 1.0), each
+-- client gets a factor uniformly distributed in the range which is stable
+-- for the address and given seed (default 0).
+function Schedule:stretch(min, max, seed)
+    self.obj.stretch_min = min
+    self.obj.stretch_max = max or min
+    if seed then
+        self.obj.seed = seed
+    end
+end
+
+-- Set the time factor of a specific client given as IPv4 or IPv6 address
+-- string, overrides the stretch range.
+function Schedule:client(ip, factor)
+    if C.filter_schedule_client(self.obj, ip, factor) ~= 0 then
+        error("invalid address or factor")
+    end
+end
+
+-- Set the maximum number of queued objects (default 1000000), 0 for no
+-- limit.
+function Schedule:limit(objects)
+    self.obj.limit = objects
+end
+
+-- Pass on all queued objects, call after the input ended.
+function Schedule:flush()
+    C.filter_schedule_flush(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function Schedule:receive()
+    return C.filter_schedule_receiver(self.obj), self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Schedule:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the number of packets received, clients seen, packets without IP,
+-- the current and the highest number of queued objects and the number of
+-- packets dropped because the queue was full.
+function Schedule:stats()
+    return tonumber(self.obj.packets), tonumber(self.obj.clients), tonumber(self.obj.unmapped),
+        tonumber(self.obj.queued), tonumber(self.obj.queued_max), tonumber(self.obj.dropped)
+end
+
+return Schedule
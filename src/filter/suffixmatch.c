@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/suffixmatch.h"
+#include "core/assert.h"
+#include "core/object/payload.h"
+#include "core/object/dns.h"
+#include "contrib/trie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define MAX_LABELS 128
+#define MAX_NAME 255
+
+/*
+ * Names are stored in the trie by their reversed, lowercased labels each
+ * prefixed with its length, so every suffix of a name is a prefix of its
+ * key (www.example.com -> \3com\7example\3www).
+ * The suffixes of a listed name are stored too with tag 0, a lookup walks
+ * the labels of the query name from the top and stops at the first suffix
+ * missing in the trie, so names outside of the list are rejected after one
+ * or two lookups.
+ */
+typedef struct _filter_suffixmatch_list _filter_suffixmatch_list_t;
+struct _filter_suffixmatch_list {
+    filter_suffixmatch_list_t pub;
+
+    trie_t*                     trie;
+    uint32_t                    root_tag;
+    _filter_suffixmatch_list_t* next;
+};
+
+typedef struct _filter_suffixmatch {
+    filter_suffixmatch_t pub;
+
+    /*
+     * The active list is only used by the receiver. A reload publishes the
+     * new list as pending, the receiver takes it before the next object and
+     * pushes the replaced list to retired, where the next reload frees it.
+     */
+    _filter_suffixmatch_list_t* active;
+    _filter_suffixmatch_list_t* pending;
+    _filter_suffixmatch_list_t* retired;
+} _filter_suffixmatch_t;
+
+#define _self ((_filter_suffixmatch_t*)self)
+#define _list ((_filter_suffixmatch_list_t*)list)
+
+static core_log_t           _log      = LOG_T_INIT("filter.suffixmatch");
+static filter_suffixmatch_t _defaults = {
+    LOG_T_INIT_OBJ("filter.suffixmatch"),
+    0, 0,
+    0, 0,
+    0, 0, 0, 0, 0
+};
+
+core_log_t* filter_suffixmatch_log()
+{
+    return &_log;
+}
+
+static inline uint8_t _lower(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+/*
+ * Key of a name in presentation format, a leading "*." is ignored since
+ * names match their subdomains anyway. Escapes are not supported.
+ * Returns the number of labels or -1 if the name is invalid.
+ */
+static int _text_key(const char* name, uint8_t* key, uint8_t* ends)
+{
+    const char* label[MAX_LABELS];
+    size_t      len[MAX_LABELS];
+    size_t      n = 0, i, k = 0, total = 1;
+    int         labels;
+
+    if (name[0] == '*' && name[1] == '.') {
+        name += 2;
+    }
+    if (!strcmp(name, ".")) {
+        return 0;
+    }
+    while (*name) {
+        const char* dot = strchr(name, '.');
+        size_t      l   = dot ? (size_t)(dot - name) : strlen(name);
+
+        if (!l || l > 63 || n == MAX_LABELS - 1 || (total += 1 + l) > MAX_NAME) {
+            return -1;
+        }
+        label[n] = name;
+        len[n++] = l;
+        name += dot ? l + 1 : l;
+    }
+    if (!n) {
+        return -1;
+    }
+
+    labels = n;
+    while (n--) {
+        key[k++] = len[n];
+        for (i = 0; i < len[n]; i++) {
+            key[k++] = _lower(label[n][i]);
+        }
+        *ends++ = k;
+    }
+    return labels;
+}
+
+/*
+ * Key of a name in wire format at the given offset of the message,
+ * following compression pointers.
+ * Returns the number of labels or -1 if the name is malformed.
+ */
+static int _wire_key(const uint8_t* msg, size_t len, size_t off, uint8_t* key, uint8_t* ends)
+{
+    size_t label[MAX_LABELS];
+    size_t n = 0, hops = 0, k = 0, total = 1;
+    int    labels;
+
+    for (;;) {
+        if (off >= len) {
+            return -1;
+        }
+        if ((msg[off] & 0xc0) == 0xc0) {
+            if (off + 1 >= len || ++hops > MAX_LABELS) {
+                return -1;
+            }
+            off = ((msg[off] & 0x3f) << 8) | msg[off + 1];
+        } else if (msg[off] & 0xc0) {
+            return -1;
+        } else if (!msg[off]) {
+            break;
+        } else {
+            if (n == MAX_LABELS - 1 || off + 1 + msg[off] > len || (total += 1 + msg[off]) > MAX_NAME) {
+                return -1;
+            }
+            label[n++] = off;
+            off += 1 + msg[off];
+        }
+    }
+
+    labels = n;
+    while (n--) {
+        const uint8_t* p = msg + label[n];
+        uint8_t        l = *p++;
+
+        key[k++] = l;
+        while (l--) {
+            key[k++] = _lower(*p++);
+        }
+        *ends++ = k;
+    }
+    return labels;
+}
+
+/* Tag of the longest listed suffix of the key or 0, with its number of labels. */
+static inline uint32_t _lookup(_filter_suffixmatch_list_t* list, const uint8_t* key, const uint8_t* ends, int labels, uint32_t* matched)
+{
+    uint32_t    tag = list->root_tag;
+    trie_val_t* val;
+    int         i;
+
+    *matched = 0;
+    for (i = 0; i < labels; i++) {
+        if (!(val = trie_get_try(list->trie, (const char*)key, ends[i]))) {
+            break;
+        }
+        if (*val) {
+            tag      = (uint32_t)(uintptr_t)*val;
+            *matched = i + 1;
+        }
+    }
+    return tag;
+}
+
+filter_suffixmatch_list_t* filter_suffixmatch_list_new()
+{
+    filter_suffixmatch_list_t* list;
+
+    mlfatal_oom(list = calloc(1, sizeof(_filter_suffixmatch_list_t)));
+    mlfatal_oom(_list->trie = trie_create(NULL));
+
+    return list;
+}
+
+void filter_suffixmatch_list_free(filter_suffixmatch_list_t* list)
+{
+    if (list) {
+        trie_free(_list->trie);
+        free(list);
+    }
+}
+
+int filter_suffixmatch_list_add(filter_suffixmatch_list_t* list, const char* name, uint32_t tag)
+{
+    uint8_t     key[MAX_NAME], ends[MAX_LABELS];
+    trie_val_t* val = 0;
+    int         labels, i;
+    mlassert(list, "list is nil");
+    mlassert(name, "name is nil");
+    mlassert(tag, "tag must be positive");
+
+    if ((labels = _text_key(name, key, ends)) < 0) {
+        list->invalid++;
+        mldebug("invalid name %s", name);
+        return -1;
+    }
+    if (!labels) {
+        if (_list->root_tag) {
+            list->duplicates++;
+        } else {
+            _list->root_tag = tag;
+            list->names++;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < labels; i++) {
+        mlfatal_oom(val = trie_get_ins(_list->trie, (const char*)key, ends[i]));
+    }
+    if (*val) {
+        list->duplicates++;
+    } else {
+        *val = (void*)(uintptr_t)tag;
+        list->names++;
+    }
+    return 0;
+}
+
+int filter_suffixmatch_list_load(filter_suffixmatch_list_t* list, const char* file, uint32_t tag)
+{
+    FILE*   fp;
+    char*   line = 0;
+    size_t  size = 0;
+    char *  tok, *name, *save;
+    ssize_t len;
+    mlassert(list, "list is nil");
+    mlassert(file, "file is nil");
+
+    if (!(fp = fopen(file, "r"))) {
+        mlcritical("fopen(%s) error %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    /*
+     * One name per line, or the last word of the line so hosts files can
+     * be used, comments starting with # are ignored.
+     */
+    while ((len = getline(&line, &size, fp)) > -1) {
+        if ((tok = strchr(line, '#'))) {
+            *tok = 0;
+        }
+        name = 0;
+        for (tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(0, " \t\r\n", &save)) {
+            name = tok;
+        }
+        if (name) {
+            filter_suffixmatch_list_add(list, name, tag);
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    mldebug("loaded %s: %zu names, %zu duplicates, %zu invalid", file, list->names, list->duplicates, list->invalid);
+    return 0;
+}
+
+filter_suffixmatch_t* filter_suffixmatch_new()
+{
+    filter_suffixmatch_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_filter_suffixmatch_t)));
+    *self          = _defaults;
+    _self->active  = 0;
+    _self->pending = 0;
+    _self->retired = 0;
+
+    return self;
+}
+
+static void _free_retired(filter_suffixmatch_t* self)
+{
+    _filter_suffixmatch_list_t *list, *next;
+
+    for (list = __atomic_exchange_n(&_self->retired, 0, __ATOMIC_ACQUIRE); list; list = next) {
+        next = list->next;
+        filter_suffixmatch_list_free((filter_suffixmatch_list_t*)list);
+    }
+}
+
+void filter_suffixmatch_free(filter_suffixmatch_t* self)
+{
+    mlassert_self();
+
+    _free_retired(self);
+    filter_suffixmatch_list_free((filter_suffixmatch_list_t*)_self->pending);
+    filter_suffixmatch_list_free((filter_suffixmatch_list_t*)_self->active);
+    free(self->recv);
+    free(self);
+}
+
+void filter_suffixmatch_add(filter_suffixmatch_t* self, uint32_t tag, core_receiver_t recv, void* ctx)
+{
+    mlassert_self();
+    lassert(recv, "recv is nil");
+
+    if (tag >= self->recvs) {
+        lfatal_oom(self->recv = realloc(self->recv, (tag + 1) * sizeof(filter_suffixmatch_recv_t)));
+        memset(&self->recv[self->recvs], 0, (tag + 1 - self->recvs) * sizeof(filter_suffixmatch_recv_t));
+        self->recvs = tag + 1;
+    }
+    self->recv[tag].recv = recv;
+    self->recv[tag].ctx  = ctx;
+}
+
+void filter_suffixmatch_swap(filter_suffixmatch_t* self, filter_suffixmatch_list_t* list)
+{
+    _filter_suffixmatch_list_t* old;
+    mlassert_self();
+    lassert(list, "list is nil");
+
+    /* Lists in retired are no longer used by the receiver. */
+    _free_retired(self);
+
+    /* A pending list not yet taken by the receiver is replaced. */
+    old = __atomic_exchange_n(&_self->pending, _list, __ATOMIC_ACQ_REL);
+    filter_suffixmatch_list_free((filter_suffixmatch_list_t*)old);
+    self->reloads++;
+}
+
+static void _take(filter_suffixmatch_t* self)
+{
+    _filter_suffixmatch_list_t* old = _self->active;
+
+    if (!(_self->active = __atomic_exchange_n(&_self->pending, 0, __ATOMIC_ACQUIRE))) {
+        _self->active = old;
+        return;
+    }
+    if (old) {
+        old->next = __atomic_load_n(&_self->retired, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_self->retired, &old->next, old, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+uint32_t filter_suffixmatch_match(filter_suffixmatch_t* self, const char* name, uint32_t* labels)
+{
+    uint8_t  key[MAX_NAME], ends[MAX_LABELS];
+    uint32_t matched;
+    int      n;
+    mlassert_self();
+    lassert(name, "name is nil");
+
+    if (__atomic_load_n(&_self->pending, __ATOMIC_RELAXED)) {
+        _take(self);
+    }
+    if (!labels) {
+        labels = &matched;
+    }
+    *labels = 0;
+    if (!_self->active || (n = _text_key(name, key, ends)) < 0) {
+        return 0;
+    }
+    return _lookup(_self->active, key, ends, n, labels);
+}
+
+static void _receive(filter_suffixmatch_t* self, const core_object_t* obj)
+{
+    const core_object_t*         o;
+    const core_object_payload_t* payload = 0;
+    int                          tcp     = 0;
+    core_object_dns_t            dns;
+    const uint8_t*               msg;
+    uint8_t                      key[MAX_NAME], ends[MAX_LABELS];
+    int                          labels;
+    uint32_t                     tag = 0;
+    mlassert_self();
+
+    if (__atomic_load_n(&_self->pending, __ATOMIC_RELAXED)) {
+        _take(self);
+    }
+
+    for (o = obj; o; o = o->obj_prev) {
+        if (o->obj_type == CORE_OBJECT_PAYLOAD) {
+            if (!payload) {
+                payload = (const core_object_payload_t*)o;
+            }
+        } else if (o->obj_type == CORE_OBJECT_TCP) {
+            tcp = 1;
+        }
+    }
+
+    self->last_labels = 0;
+    labels            = -1;
+    if (payload && payload->len) {
+        dns                 = (core_object_dns_t)CORE_OBJECT_DNS_INIT(payload);
+        dns.includes_dnslen = tcp;
+        if (!core_object_dns_parse_header(&dns) && dns.qdcount) {
+            /* Compression pointers are relative to the message, after the TCP length. */
+            msg    = dns.payload + (tcp ? 2 : 0);
+            labels = _wire_key(msg, dns.len - (msg - dns.payload), dns.at - msg, key, ends);
+        }
+    }
+    if (labels < 0) {
+        self->invalid++;
+    } else if (_self->active && (tag = _lookup(_self->active, key, ends, labels, &self->last_labels))) {
+        self->matched++;
+    } else {
+        self->unmatched++;
+    }
+    self->last_tag = tag;
+
+    if (tag < self->recvs && self->recv[tag].recv) {
+        self->recv[tag].recv(self->recv[tag].ctx, obj);
+    } else {
+        self->dropped++;
+    }
+}
+
+core_receiver_t filter_suffixmatch_receiver(filter_suffixmatch_t* self)
+{
+    mlassert_self();
+
+    if (!self->recvs) {
+        lfatal("no receiver(s) set");
+    }
+
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct filter_suffixmatch_list {
+    /* Number of names added, names already present and unparsable names. */
+    size_t names;
+    size_t duplicates;
+    size_t invalid;
+} filter_suffixmatch_list_t;
+
+typedef struct filter_suffixmatch_recv {
+    core_receiver_t recv;
+    void*           ctx;
+} filter_suffixmatch_recv_t;
+
+typedef struct filter_suffixmatch {
+    core_log_t _log;
+
+    /* Receivers by tag, tag 0 receives objects not matching any name. */
+    filter_suffixmatch_recv_t* recv;
+    size_t                     recvs;
+
+    /* Tag and number of labels of the suffix matched by the last object. */
+    uint32_t last_tag;
+    uint32_t last_labels;
+
+    uint64_t matched;
+    uint64_t unmatched;
+    uint64_t invalid;
+    uint64_t dropped;
+    uint64_t reloads;
+} filter_suffixmatch_t;
+
+core_log_t* filter_suffixmatch_log();
+
+filter_suffixmatch_list_t* filter_suffixmatch_list_new();
+void filter_suffixmatch_list_free(filter_suffixmatch_list_t* list);
+int filter_suffixmatch_list_add(filter_suffixmatch_list_t* list, const char* name, uint32_t tag);
+int filter_suffixmatch_list_load(filter_suffixmatch_list_t* list, const char* file, uint32_t tag);
+
+filter_suffixmatch_t* filter_suffixmatch_new();
+void filter_suffixmatch_free(filter_suffixmatch_t* self);
+void filter_suffixmatch_add(filter_suffixmatch_t* self, uint32_t tag, core_receiver_t recv, void* ctx);
+void filter_suffixmatch_swap(filter_suffixmatch_t* self, filter_suffixmatch_list_t* list);
+uint32_t filter_suffixmatch_match(filter_suffixmatch_t* self, const char* name, uint32_t* labels);
+
+core_receiver_t filter_suffixmatch_receiver(filter_suffixmatch_t* self);
@@ -0,0 +1,150 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.suffixmatch
+-- Pass objects to receivers based on the query name matching lists of domains
+--   local suffixmatch = require("dnsjit.filter.suffixmatch").new()
+--   suffixmatch:load({ "blocklist.txt", "customers.txt" })
+--   suffixmatch:receiver(unmatched)
+--   suffixmatch:receiver(blocked, 1)
+--   suffixmatch:receiver(customers, 2)
+--   input:receiver(suffixmatch)
+--
+-- The filter matches the query name of DNS messages against lists of
+-- domain names, a name matches itself and all of its subdomains.
+-- Each list has a tag (the list's index starting from 1) and when several
+-- listed names match, the longest one wins.
+-- The object is passed to the receiver of the matched tag, or to the receiver
+-- of tag 0 if no name matched or if the DNS message could not be parsed.
+-- Objects with a tag without receiver are dropped.
+-- .LP
+-- The lists are compiled into a trie keyed by reversed labels and matched in
+-- C, names are compared case-insensitively.
+-- Lists can be reloaded while objects are being processed, the receiver
+-- switches to the new lists between objects.
+-- .LP
+-- List files contain one domain name per line, or the last word of the
+-- line so hosts files can be used; comments start with
+-- .IR # .
+-- A leading
+-- .I *.
+-- is ignored and
+-- .I .
+-- matches all names.
+module(...,package.seeall)
+
+require("dnsjit.filter.suffixmatch_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local SuffixMatch = {}
+
+-- Create a new SuffixMatch filter.
+function SuffixMatch.new()
+    local self = {
+        _receivers = {},
+        obj = C.filter_suffixmatch_new(),
+    }
+    ffi.gc(self.obj, C.filter_suffixmatch_free)
+    return setmetatable(self, { __index = SuffixMatch })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function SuffixMatch:log()
+    if self == nil then
+        return C.filter_suffixmatch_log()
+    end
+    return self.obj._log
+end
+
+-- Compile the given lists and atomically replace the lists in use.
+-- Each list is either a file name or a table of domain names, its tag is
+-- its index in
+-- .IR lists .
+-- Returns the number of names loaded, or nil and the failed file if a file
+-- could not be read in which case the lists in use are kept.
+-- The receiver switches to the new lists before the next object, lists
+-- replaced by a previous load are freed here.
+function SuffixMatch:load(lists)
+    local list = C.filter_suffixmatch_list_new()
+    ffi.gc(list, C.filter_suffixmatch_list_free)
+    for tag, names in ipairs(lists) do
+        if type(names) == "table" then
+            for _, name in ipairs(names) do
+                C.filter_suffixmatch_list_add(list, name, tag)
+            end
+        elseif C.filter_suffixmatch_list_load(list, names, tag) ~= 0 then
+            return nil, names
+        end
+    end
+    if list.invalid > 0 then
+        self.obj._log:warning(tonumber(list.invalid).." invalid names ignored")
+    end
+    local names = tonumber(list.names)
+    C.filter_suffixmatch_swap(self.obj, ffi.gc(list, nil))
+    return names
+end
+
+-- Return the tag and number of labels of the longest listed suffix of the
+-- given name, or nil if no name matches.
+-- Must not be used concurrently with the receiver.
+function SuffixMatch:match(name)
+    local labels = ffi.new("uint32_t[1]")
+    local tag = C.filter_suffixmatch_match(self.obj, name, labels)
+    if tag == 0 then
+        return
+    end
+    return tag, labels[0]
+end
+
+-- Return the tag and number of labels of the suffix matched by the last
+-- object received, tag 0 if none matched.
+-- Can be used by a receiver further down the chain to tag the object.
+function SuffixMatch:last()
+    return self.obj.last_tag, self.obj.last_labels
+end
+
+-- Return the C functions and context for receiving objects.
+function SuffixMatch:receive()
+    return C.filter_suffixmatch_receiver(self.obj), self.obj
+end
+
+-- Set the receiver to pass objects matching the list with the given tag to,
+-- the tag defaults to 0 for objects not matching any list.
+function SuffixMatch:receiver(o, tag)
+    if tag == nil then
+        tag = 0
+    end
+    local recv, ctx = o:receive()
+    C.filter_suffixmatch_add(self.obj, tag, recv, ctx)
+    self._receivers[tag] = o
+end
+
+-- Return the number of objects matched, not matched, which could not be
+-- parsed as DNS queries and dropped for lack of a receiver.
+function SuffixMatch:stats()
+    return tonumber(self.obj.matched), tonumber(self.obj.unmatched),
+        tonumber(self.obj.invalid), tonumber(self.obj.dropped)
+end
+
+-- Return the number of times the lists have been (re)loaded.
+function SuffixMatch:reloads()
+    return tonumber(self.obj.reloads)
+end
+
+return SuffixMatch
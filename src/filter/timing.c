@@ -47,6 +47,7 @@ static filter_timing_t _defaults = {
     LOG_T_INIT_OBJ("filter.timing"),
     0, 0,
     TIMING_MODE_KEEP, 0, 0, 0, 0, 0.0, 0,
+    0, 0,
     0, 0
 };
 
@@ -57,6 +58,26 @@ core_log_t* filter_timing_log()
     return &_log;
 }
 
+/* Let the receiver send out what it has batched before sleeping. */
+static inline void _flush(filter_timing_t* self)
+{
+    if (self->flush) {
+        self->flush(self->flush_ctx);
+    }
+}
+
+#if HAVE_CLOCK_NANOSLEEP
+static inline void _flush_until(filter_timing_t* self, const struct timespec* to)
+{
+    struct timespec now;
+
+    if (self->flush && !clock_gettime(CLOCK_MONOTONIC, &now)
+        && (to->tv_sec > now.tv_sec || (to->tv_sec == now.tv_sec && to->tv_nsec > now.tv_nsec))) {
+        self->flush(self->flush_ctx);
+    }
+}
+#endif
+
 static void _keep(filter_timing_t* self, const core_object_pcap_t* pkt)
 {
 #if HAVE_CLOCK_NANOSLEEP
@@ -74,6 +95,7 @@ static void _keep(filter_timing_t* self, const core_object_pcap_t* pkt)
         to.tv_nsec += N1e9;
     }
 
+    _flush_until(self, &to);
     while (ret) {
         ldebug("keep mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
         ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
@@ -97,6 +119,7 @@ static void _keep(filter_timing_t* self, const core_object_pcap_t* pkt)
     }
 
     if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
+        _flush(self);
         while (ret) {
             ldebug("keep mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -150,6 +173,7 @@ static void _increase(filter_timing_t* self, const core_object_pcap_t* pkt)
             to.tv_nsec += N1e9;
         }
 
+        _flush_until(self, &to);
         while (ret) {
             ldebug("increase mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
             ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
@@ -158,6 +182,7 @@ static void _increase(filter_timing_t* self, const core_object_pcap_t* pkt)
             }
         }
 #elif HAVE_NANOSLEEP
+        _flush(self);
         while (ret) {
             ldebug("increase mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -217,6 +242,7 @@ static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
             to.tv_nsec += N1e9;
         }
 
+        _flush_until(self, &to);
         while (ret) {
             ldebug("reduce mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
             ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
@@ -225,6 +251,7 @@ static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
             }
         }
 #elif HAVE_NANOSLEEP
+        _flush(self);
         while (ret) {
             ldebug("reduce mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -284,6 +311,7 @@ static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
             to.tv_nsec += N1e9;
         }
 
+        _flush_until(self, &to);
         while (ret) {
             ldebug("multiply mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
             ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
@@ -292,6 +320,7 @@ static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
             }
         }
 #elif HAVE_NANOSLEEP
+        _flush(self);
         while (ret) {
             ldebug("multiply mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -336,6 +365,7 @@ static void _fixed(filter_timing_t* self, const core_object_pcap_t* pkt)
             to.tv_nsec += N1e9;
         }
 
+        _flush_until(self, &to);
         while (ret) {
             ldebug("fixed mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
             ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
@@ -344,6 +374,7 @@ static void _fixed(filter_timing_t* self, const core_object_pcap_t* pkt)
             }
         }
 #elif HAVE_NANOSLEEP
+        _flush(self);
         while (ret) {
             ldebug("fixed mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -408,6 +439,7 @@ static void _realtime(filter_timing_t* self, const core_object_pcap_t* pkt)
             _timespec_diff(&_self->diff, &simulated, &simulated);
 
             ldebug("sleeping for %ld.%09lds", simulated.tv_sec, simulated.tv_nsec);
+            _flush(self);
             while (ret) {
                 ret = clock_nanosleep(CLOCK_MONOTONIC, 0, &simulated, 0);
                 if (ret && ret != EINTR) {
@@ -507,16 +539,27 @@ void filter_timing_free(filter_timing_t* self)
     free(self);
 }
 
+/* Find the PCAP object in the chain, inputs such as input.dnstap produce
+ * already layered objects. */
+static const core_object_pcap_t* _pcap(const core_object_t* obj)
+{
+    while (obj && obj->obj_type != CORE_OBJECT_PCAP) {
+        obj = obj->obj_prev;
+    }
+    return (const core_object_pcap_t*)obj;
+}
+
 static void _receive(filter_timing_t* self, const core_object_t* obj)
 {
+    const core_object_pcap_t* pkt;
     mlassert_self();
     lassert(obj, "obj is nil");
 
-    if (obj->obj_type != CORE_OBJECT_PCAP) {
-        lfatal("obj is not CORE_OBJECT_PCAP");
+    if (!(pkt = _pcap(obj))) {
+        lfatal("obj has no CORE_OBJECT_PCAP");
     }
 
-    _self->timing_callback(self, (core_object_pcap_t*)obj);
+    _self->timing_callback(self, (core_object_pcap_t*)pkt);
     self->recv(self->ctx, obj);
 }
 
@@ -533,15 +576,16 @@ core_receiver_t filter_timing_receiver(filter_timing_t* self)
 
 static const core_object_t* _produce(filter_timing_t* self)
 {
-    const core_object_t* obj;
+    const core_object_t*      obj;
+    const core_object_pcap_t* pkt;
     mlassert_self();
 
     obj = self->prod(self->prod_ctx);
-    if (!obj || obj->obj_type != CORE_OBJECT_PCAP) {
+    if (!obj || !(pkt = _pcap(obj))) {
         return 0;
     }
 
-    _self->timing_callback(self, (core_object_pcap_t*)obj);
+    _self->timing_callback(self, (core_object_pcap_t*)pkt);
     return obj;
 }
 
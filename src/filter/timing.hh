@@ -41,6 +41,10 @@ typedef struct filter_timing {
 
     core_producer_t prod;
     void*           prod_ctx;
+
+    /* Called before sleeping, see flush(). */
+    void (*flush)(void* ctx);
+    void* flush_ctx;
 } filter_timing_t;
 
 core_log_t* filter_timing_log();
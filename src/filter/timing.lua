@@ -24,6 +24,8 @@
 --
 -- Filter to manipulate processing so it simulates the actual timing when
 -- packets arrived or to delay processing.
+-- The timestamp is taken from the PCAP object in the chain of the received
+-- object, so layered objects (e.g. from dnsjit.input.dnstap) are accepted too.
 module(...,package.seeall)
 
 require("dnsjit.filter.timing_h")
@@ -109,6 +111,13 @@ function Timing:receiver(o)
     self._receiver = o
 end
 
+-- Set an output which batches packets (e.g. dnsjit.output.afpacket) to be
+-- flushed before sleeping, so batched packets are sent on time.
+function Timing:flush(o)
+    self.obj.flush, self.obj.flush_ctx = o:flusher()
+    self._flush = o
+end
+
 -- Return the C functions and context for producing objects.
 function Timing:produce()
     return C.filter_timing_producer(self.obj), self.obj
@@ -22,8 +22,10 @@
 -- Input modules used to read DNS messages in various ways.
 module(...,package.seeall)
 
+-- dnsjit.input.dnstap (3),
 -- dnsjit.input.fpcap (3),
 -- dnsjit.input.mmpcap (3),
+-- dnsjit.input.pcaplist (3),
 -- dnsjit.input.pcap (3),
 -- dnsjit.input.zero (3)
 return
@@ -0,0 +1,825 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input/dnstap.h"
+#include "core/assert.h"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+/*
+ * Frame Streams
+ */
+
+#define FSTRM_CONTROL_ACCEPT 0x01
+#define FSTRM_CONTROL_START 0x02
+#define FSTRM_CONTROL_STOP 0x03
+#define FSTRM_CONTROL_READY 0x04
+#define FSTRM_CONTROL_FINISH 0x05
+#define FSTRM_FIELD_CONTENT_TYPE 0x01
+#define FSTRM_MAX_CONTROL 512
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+#define RBUF_INITIAL_SIZE (256 * 1024)
+#define RBUF_MAX_FRAME (16 * 1024 * 1024)
+
+static core_log_t     _log      = LOG_T_INIT("input.dnstap");
+static input_dnstap_t _defaults = {
+    LOG_T_INIT_OBJ("input.dnstap"),
+    0, 0,
+    1, 1, 0,
+    0, 0,
+    CORE_OBJECT_PCAP_INIT(0),
+    CORE_OBJECT_IP_INIT(0),
+    CORE_OBJECT_IP6_INIT(0),
+    CORE_OBJECT_UDP_INIT(0),
+    CORE_OBJECT_TCP_INIT(0),
+    CORE_OBJECT_PAYLOAD_INIT(0),
+    -1, 0, 0, MAP_FAILED,
+    -1, -1, 0, 0, 0, 0,
+    0, 0, 0
+};
+
+core_log_t* input_dnstap_log()
+{
+    return &_log;
+}
+
+void input_dnstap_init(input_dnstap_t* self)
+{
+    mlassert_self();
+
+    *self = _defaults;
+
+    self->prod_ip.obj_prev  = (core_object_t*)&self->prod_pcap;
+    self->prod_ip6.obj_prev = (core_object_t*)&self->prod_pcap;
+}
+
+void input_dnstap_destroy(input_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (self->buf != MAP_FAILED) {
+        munmap(self->buf, self->len);
+    }
+    if (self->fd > -1) {
+        close(self->fd);
+    }
+    if (self->conn_fd > -1) {
+        close(self->conn_fd);
+    }
+    if (self->sock_fd > -1) {
+        close(self->sock_fd);
+    }
+    free(self->rbuf);
+}
+
+static inline uint32_t _be32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/*
+ * Check the content type of a START or READY control frame, a frame
+ * without content type is accepted.
+ */
+static int _check_content_type(input_dnstap_t* self, const uint8_t* ctrl, size_t len)
+{
+    size_t at = 4, flen;
+    int    found = 0;
+
+    while (len - at >= 8) {
+        flen = _be32(ctrl + at + 4);
+        if (len - at - 8 < flen) {
+            lwarning("invalid control frame field length");
+            return -1;
+        }
+        if (_be32(ctrl + at) == FSTRM_FIELD_CONTENT_TYPE) {
+            if (flen == sizeof(DNSTAP_CONTENT_TYPE) - 1 && !memcmp(ctrl + at + 8, DNSTAP_CONTENT_TYPE, flen)) {
+                return 0;
+            }
+            found = 1;
+        }
+        at += 8 + flen;
+    }
+
+    if (found) {
+        lcritical("unsupported content type, expected " DNSTAP_CONTENT_TYPE);
+        return -1;
+    }
+    return 0;
+}
+
+int input_dnstap_open(input_dnstap_t* self, const char* file)
+{
+    struct stat sb;
+    size_t      clen;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (self->fd != -1 || self->sock_fd != -1) {
+        lfatal("already opened");
+    }
+
+    if ((self->fd = open(file, O_RDONLY)) < 0) {
+        lcritical("open(%s) error %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    if (fstat(self->fd, &sb)) {
+        lcritical("stat(%s) error %s", file, core_log_errstr(errno));
+        return -1;
+    }
+    self->len = sb.st_size;
+
+    if (self->len < 12) {
+        lcritical("could not read Frame Streams START frame");
+        return -2;
+    }
+
+    if ((self->buf = mmap(0, self->len, PROT_READ, MAP_PRIVATE, self->fd, 0)) == MAP_FAILED) {
+        lcritical("mmap(%s) error %s", file, core_log_errstr(errno));
+        return -1;
+    }
+    madvise(self->buf, self->len, MADV_SEQUENTIAL);
+
+    clen = _be32(self->buf + 4);
+    if (_be32(self->buf) != 0 || clen < 4 || clen > self->len - 8 || _be32(self->buf + 8) != FSTRM_CONTROL_START) {
+        lcritical("invalid Frame Streams START frame");
+        return -2;
+    }
+    if (_check_content_type(self, self->buf + 8, clen)) {
+        return -2;
+    }
+    self->at = 8 + clen;
+
+    return 0;
+}
+
+int input_dnstap_listen(input_dnstap_t* self, const char* path)
+{
+    struct sockaddr_un addr;
+    mlassert_self();
+    lassert(path, "path is nil");
+
+    if (self->fd != -1 || self->sock_fd != -1) {
+        lfatal("already opened");
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        lcritical("socket path too long");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((self->sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(self->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        lcritical("bind(%s) error %s", path, core_log_errstr(errno));
+        return -1;
+    }
+    if (listen(self->sock_fd, 1)) {
+        lcritical("listen(%s) error %s", path, core_log_errstr(errno));
+        return -1;
+    }
+
+    self->rbuf_size = RBUF_INITIAL_SIZE;
+    lfatal_oom(self->rbuf = malloc(self->rbuf_size));
+
+    return 0;
+}
+
+/*
+ * Make sure at least `need` bytes are buffered from the connected writer.
+ * Returns 1 on success, 0 on end of stream and -1 on error.
+ */
+static int _sock_fill(input_dnstap_t* self, size_t need)
+{
+    ssize_t n;
+
+    if (self->rbuf_len - self->rbuf_at >= need) {
+        return 1;
+    }
+
+    if (self->rbuf_at > 0) {
+        memmove(self->rbuf, self->rbuf + self->rbuf_at, self->rbuf_len - self->rbuf_at);
+        self->rbuf_len -= self->rbuf_at;
+        self->rbuf_at = 0;
+    }
+    if (need > self->rbuf_size) {
+        while (need > self->rbuf_size) {
+            self->rbuf_size *= 2;
+        }
+        lfatal_oom(self->rbuf = realloc(self->rbuf, self->rbuf_size));
+    }
+
+    while (self->rbuf_len < need) {
+        n = read(self->conn_fd, self->rbuf + self->rbuf_len, self->rbuf_size - self->rbuf_len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lwarning("read() error %s", core_log_errstr(errno));
+            return -1;
+        }
+        if (!n) {
+            return 0;
+        }
+        self->rbuf_len += n;
+    }
+
+    return 1;
+}
+
+static int _sock_send_control(input_dnstap_t* self, uint32_t type, int with_content_type)
+{
+    uint8_t  frame[12 + 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1];
+    uint32_t v[5] = { 0, htonl(4), htonl(type), htonl(FSTRM_FIELD_CONTENT_TYPE), htonl(sizeof(DNSTAP_CONTENT_TYPE) - 1) };
+    size_t   len = 12, at = 0;
+    ssize_t  n;
+
+    if (with_content_type) {
+        v[1] = htonl(4 + 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        memcpy(frame, v, 20);
+        memcpy(frame + 20, DNSTAP_CONTENT_TYPE, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        len = sizeof(frame);
+    } else {
+        memcpy(frame, v, 12);
+    }
+
+    while (at < len) {
+        n = write(self->conn_fd, frame + at, len - at);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lwarning("write() error %s", core_log_errstr(errno));
+            return -1;
+        }
+        at += n;
+    }
+    return 0;
+}
+
+static void _sock_close_conn(input_dnstap_t* self)
+{
+    close(self->conn_fd);
+    self->conn_fd  = -1;
+    self->rbuf_len = 0;
+    self->rbuf_at  = 0;
+}
+
+/*
+ * Wait for the next writer and do the bidirectional handshake, writers
+ * that start with START directly (unidirectional) are accepted too.
+ */
+static int _sock_accept(input_dnstap_t* self)
+{
+    uint32_t clen, type;
+
+    for (;;) {
+        if ((self->conn_fd = accept(self->sock_fd, 0, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("accept() error %s", core_log_errstr(errno));
+            return -1;
+        }
+        ldebug("writer connected");
+
+        for (;;) {
+            if (_sock_fill(self, 8) != 1) {
+                break;
+            }
+            clen = _be32(self->rbuf + self->rbuf_at + 4);
+            if (_be32(self->rbuf + self->rbuf_at) != 0 || clen < 4 || clen > FSTRM_MAX_CONTROL || _sock_fill(self, 8 + clen) != 1) {
+                lwarning("invalid Frame Streams handshake");
+                break;
+            }
+            type = _be32(self->rbuf + self->rbuf_at + 8);
+            if ((type == FSTRM_CONTROL_READY || type == FSTRM_CONTROL_START)
+                && _check_content_type(self, self->rbuf + self->rbuf_at + 8, clen)) {
+                break;
+            }
+            self->rbuf_at += 8 + clen;
+
+            if (type == FSTRM_CONTROL_READY) {
+                if (_sock_send_control(self, FSTRM_CONTROL_ACCEPT, 1)) {
+                    break;
+                }
+            } else if (type == FSTRM_CONTROL_START) {
+                return 0;
+            } else {
+                lwarning("unexpected control frame %u in handshake", type);
+                break;
+            }
+        }
+
+        _sock_close_conn(self);
+    }
+}
+
+/*
+ * Get the next data frame, either from the mapped file or the socket.
+ * Returns 1 and sets frame/len, 0 at the end of the stream or -1 on error.
+ */
+static int _next_frame(input_dnstap_t* self, const uint8_t** frame, size_t* len)
+{
+    uint32_t flen, clen;
+    int      ret;
+
+    if (self->sock_fd == -1) {
+        for (;;) {
+            if (self->len - self->at < 4) {
+                if (self->at < self->len) {
+                    lwarning("could not read next frame, aborting");
+                    return -1;
+                }
+                return 0;
+            }
+            flen = _be32(self->buf + self->at);
+            self->at += 4;
+
+            if (!flen) {
+                if (self->len - self->at < 4 || (clen = _be32(self->buf + self->at)) > self->len - self->at - 4 || clen < 4) {
+                    lwarning("invalid control frame, aborting");
+                    return -1;
+                }
+                if (_be32(self->buf + self->at + 4) == FSTRM_CONTROL_STOP) {
+                    self->at = self->len;
+                    return 0;
+                }
+                self->at += 4 + clen;
+                continue;
+            }
+
+            if (self->len - self->at < flen) {
+                lwarning("could not read all of frame, aborting");
+                return -1;
+            }
+            *frame = self->buf + self->at;
+            *len   = flen;
+            self->at += flen;
+            return 1;
+        }
+    }
+
+    for (;;) {
+        if (self->conn_fd == -1 && _sock_accept(self)) {
+            return -1;
+        }
+
+        if ((ret = _sock_fill(self, 4)) != 1) {
+            if (ret == 0) {
+                ldebug("writer disconnected");
+            }
+            _sock_close_conn(self);
+            continue;
+        }
+        flen = _be32(self->rbuf + self->rbuf_at);
+
+        if (!flen) {
+            if (_sock_fill(self, 8) != 1
+                || (clen = _be32(self->rbuf + self->rbuf_at + 4)) < 4 || clen > FSTRM_MAX_CONTROL
+                || _sock_fill(self, 8 + clen) != 1) {
+                lwarning("invalid control frame, closing connection");
+                _sock_close_conn(self);
+                continue;
+            }
+            if (_be32(self->rbuf + self->rbuf_at + 8) == FSTRM_CONTROL_STOP) {
+                self->rbuf_at += 8 + clen;
+                _sock_send_control(self, FSTRM_CONTROL_FINISH, 0);
+                _sock_close_conn(self);
+                continue;
+            }
+            self->rbuf_at += 8 + clen;
+            continue;
+        }
+
+        if (flen > RBUF_MAX_FRAME) {
+            lwarning("frame too large (%u), closing connection", flen);
+            _sock_close_conn(self);
+            continue;
+        }
+        if (_sock_fill(self, 4 + flen) != 1) {
+            lwarning("could not read all of frame, closing connection");
+            _sock_close_conn(self);
+            continue;
+        }
+        *frame = self->rbuf + self->rbuf_at + 4;
+        *len   = flen;
+        self->rbuf_at += 4 + flen;
+        return 1;
+    }
+}
+
+/*
+ * Protocol Buffers
+ */
+
+typedef struct _message {
+    uint32_t       type;
+    uint32_t       socket_family;
+    uint32_t       socket_protocol;
+    const uint8_t* query_address;
+    size_t         query_address_len;
+    const uint8_t* response_address;
+    size_t         response_address_len;
+    uint32_t       query_port;
+    uint32_t       response_port;
+    uint64_t       query_time_sec;
+    uint32_t       query_time_nsec;
+    const uint8_t* query_message;
+    size_t         query_message_len;
+    uint64_t       response_time_sec;
+    uint32_t       response_time_nsec;
+    const uint8_t* response_message;
+    size_t         response_message_len;
+} _message_t;
+
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_BYTES 2
+#define PB_FIXED32 5
+
+static inline uint32_t _le32(const uint8_t* p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline int _pb_varint(const uint8_t** p, const uint8_t* end, uint64_t* v)
+{
+    uint64_t r     = 0;
+    int      shift = 0;
+
+    while (*p < end && shift < 64) {
+        uint8_t b = *(*p)++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/*
+ * Read the next field, for length-delimited fields `data`/`len` point to
+ * the content and for the others `v` holds the value.
+ */
+static inline int _pb_field(const uint8_t** p, const uint8_t* end, uint32_t* field, const uint8_t** data, uint64_t* v)
+{
+    uint64_t key;
+
+    if (_pb_varint(p, end, &key)) {
+        return -1;
+    }
+    *field = key >> 3;
+
+    switch (key & 7) {
+    case PB_VARINT:
+        return _pb_varint(p, end, v);
+    case PB_FIXED64:
+        if (end - *p < 8) {
+            return -1;
+        }
+        *v = (uint64_t)_le32(*p + 4) << 32 | _le32(*p);
+        *p += 8;
+        return 0;
+    case PB_BYTES:
+        if (_pb_varint(p, end, v) || (uint64_t)(end - *p) < *v) {
+            return -1;
+        }
+        *data = *p;
+        *p += *v;
+        return 1;
+    case PB_FIXED32:
+        if (end - *p < 4) {
+            return -1;
+        }
+        *v = _le32(*p);
+        *p += 4;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static int _decode_message(const uint8_t* p, const uint8_t* end, _message_t* m)
+{
+    uint32_t       field;
+    const uint8_t* data = 0;
+    uint64_t       v    = 0;
+    int            ret;
+
+    while (p < end) {
+        if ((ret = _pb_field(&p, end, &field, &data, &v)) < 0) {
+            return -1;
+        }
+        if (ret) {
+            switch (field) {
+            case 4:
+                m->query_address     = data;
+                m->query_address_len = v;
+                break;
+            case 5:
+                m->response_address     = data;
+                m->response_address_len = v;
+                break;
+            case 10:
+                m->query_message     = data;
+                m->query_message_len = v;
+                break;
+            case 14:
+                m->response_message     = data;
+                m->response_message_len = v;
+                break;
+            }
+            continue;
+        }
+        switch (field) {
+        case 1:
+            m->type = v;
+            break;
+        case 2:
+            m->socket_family = v;
+            break;
+        case 3:
+            m->socket_protocol = v;
+            break;
+        case 6:
+            m->query_port = v;
+            break;
+        case 7:
+            m->response_port = v;
+            break;
+        case 8:
+            m->query_time_sec = v;
+            break;
+        case 9:
+            m->query_time_nsec = v;
+            break;
+        case 12:
+            m->response_time_sec = v;
+            break;
+        case 13:
+            m->response_time_nsec = v;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Decode the Dnstap envelope of a frame and find its Message (field 14).
+ * Returns 1 if a message was decoded, 0 if there's none and -1 on error.
+ */
+static int _decode_dnstap(const uint8_t* p, size_t len, _message_t* m)
+{
+    const uint8_t* end = p + len;
+    uint32_t       field;
+    const uint8_t* data = 0;
+    uint64_t       v    = 0;
+    int            ret;
+
+    while (p < end) {
+        if ((ret = _pb_field(&p, end, &field, &data, &v)) < 0) {
+            return -1;
+        }
+        if (ret && field == 14) {
+            memset(m, 0, sizeof(*m));
+            if (_decode_message(data, data + v, m)) {
+                return -1;
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Fill the produced objects from a decoded message and return the payload
+ * object at the end of the chain, or NULL if the message should be skipped.
+ * The payload points directly to the mapped file or the read buffer.
+ */
+static const core_object_t* _build(input_dnstap_t* self, const uint8_t* frame, size_t frame_len, const _message_t* m)
+{
+    const uint8_t *src, *dst, *msg;
+    size_t         src_len, dst_len, msg_len;
+    uint16_t       sport, dport;
+    int            is_response = m->type && !(m->type & 1);
+    int            is_tcp;
+    core_object_t* ip;
+
+    if (is_response) {
+        if (!self->use_responses || !m->response_message) {
+            return 0;
+        }
+        msg     = m->response_message;
+        msg_len = m->response_message_len;
+        src     = m->response_address;
+        src_len = m->response_address_len;
+        sport   = m->response_port;
+        dst     = m->query_address;
+        dst_len = m->query_address_len;
+        dport   = m->query_port;
+        if (m->response_time_sec) {
+            self->prod_pcap.ts.sec  = m->response_time_sec;
+            self->prod_pcap.ts.nsec = m->response_time_nsec;
+        } else {
+            self->prod_pcap.ts.sec  = m->query_time_sec;
+            self->prod_pcap.ts.nsec = m->query_time_nsec;
+        }
+    } else {
+        if (!self->use_queries || !m->query_message) {
+            return 0;
+        }
+        msg     = m->query_message;
+        msg_len = m->query_message_len;
+        src     = m->query_address;
+        src_len = m->query_address_len;
+        sport   = m->query_port;
+        dst     = m->response_address;
+        dst_len = m->response_address_len;
+        dport   = m->response_port;
+        self->prod_pcap.ts.sec  = m->query_time_sec;
+        self->prod_pcap.ts.nsec = m->query_time_nsec;
+    }
+
+    self->message_type    = m->type;
+    self->socket_protocol = m->socket_protocol;
+
+    self->prod_pcap.bytes  = frame;
+    self->prod_pcap.caplen = frame_len;
+    self->prod_pcap.len    = frame_len;
+
+    /* DoQ runs over UDP, unknown protocols are taken as UDP as well. */
+    switch (m->socket_protocol) {
+    case INPUT_DNSTAP_TCP:
+    case INPUT_DNSTAP_DOT:
+    case INPUT_DNSTAP_DOH:
+    case INPUT_DNSTAP_DNSCRYPT_TCP:
+        is_tcp = 1;
+        break;
+    default:
+        is_tcp = 0;
+    }
+
+    if (m->socket_family == 2 || (!m->socket_family && (src_len == 16 || dst_len == 16))) {
+        memset(self->prod_ip6.src, 0, 16);
+        memset(self->prod_ip6.dst, 0, 16);
+        if (src_len == 16) {
+            memcpy(self->prod_ip6.src, src, 16);
+        }
+        if (dst_len == 16) {
+            memcpy(self->prod_ip6.dst, dst, 16);
+        }
+        self->prod_ip6.nxt  = is_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+        self->prod_ip6.plen = msg_len + (is_tcp ? 20 : 8);
+        ip                  = (core_object_t*)&self->prod_ip6;
+    } else {
+        memset(self->prod_ip.src, 0, 4);
+        memset(self->prod_ip.dst, 0, 4);
+        if (src_len == 4) {
+            memcpy(self->prod_ip.src, src, 4);
+        }
+        if (dst_len == 4) {
+            memcpy(self->prod_ip.dst, dst, 4);
+        }
+        self->prod_ip.v   = 4;
+        self->prod_ip.hl  = 5;
+        self->prod_ip.p   = is_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+        self->prod_ip.len = msg_len + 20 + (is_tcp ? 20 : 8);
+        ip                = (core_object_t*)&self->prod_ip;
+    }
+
+    if (is_tcp) {
+        self->prod_tcp.obj_prev     = ip;
+        self->prod_tcp.sport        = sport;
+        self->prod_tcp.dport        = dport;
+        self->prod_payload.obj_prev = (core_object_t*)&self->prod_tcp;
+    } else {
+        self->prod_udp.obj_prev     = ip;
+        self->prod_udp.sport        = sport;
+        self->prod_udp.dport        = dport;
+        self->prod_udp.ulen         = msg_len + 8;
+        self->prod_payload.obj_prev = (core_object_t*)&self->prod_udp;
+    }
+
+    self->prod_payload.payload = msg;
+    self->prod_payload.len     = msg_len;
+
+    return (core_object_t*)&self->prod_payload;
+}
+
+static const core_object_t* _next(input_dnstap_t* self)
+{
+    const uint8_t*       frame;
+    size_t               len;
+    _message_t           m;
+    const core_object_t* obj;
+    int                  ret;
+
+    for (;;) {
+        if ((ret = _next_frame(self, &frame, &len)) != 1) {
+            if (ret < 0) {
+                self->is_broken = 1;
+            }
+            return 0;
+        }
+        self->frames++;
+
+        if ((ret = _decode_dnstap(frame, len, &m)) != 1) {
+            if (ret < 0) {
+                ldebug("malformed dnstap frame");
+            }
+            self->skipped++;
+            continue;
+        }
+        if (!(obj = _build(self, frame, len, &m))) {
+            self->skipped++;
+            continue;
+        }
+
+        self->messages++;
+        return obj;
+    }
+}
+
+int input_dnstap_run(input_dnstap_t* self)
+{
+    const core_object_t* obj;
+    mlassert_self();
+
+    if (self->buf == MAP_FAILED && self->sock_fd == -1) {
+        lfatal("no file opened or socket listening");
+    }
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+
+    while ((obj = _next(self))) {
+        self->recv(self->ctx, obj);
+    }
+
+    return self->is_broken ? -1 : 0;
+}
+
+static const core_object_t* _produce(input_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (self->is_broken) {
+        lwarning("dnstap is broken, will not read next message");
+        return 0;
+    }
+
+    return _next(self);
+}
+
+core_producer_t input_dnstap_producer(input_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (self->buf == MAP_FAILED && self->sock_fd == -1) {
+        lfatal("no file opened or socket listening");
+    }
+
+    return (core_producer_t)_produce;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.producer_h")
+//lua:require("dnsjit.core.object.pcap_h")
+//lua:require("dnsjit.core.object.ip_h")
+//lua:require("dnsjit.core.object.ip6_h")
+//lua:require("dnsjit.core.object.udp_h")
+//lua:require("dnsjit.core.object.tcp_h")
+//lua:require("dnsjit.core.object.payload_h")
+
+/* dnstap Message.Type */
+typedef enum input_dnstap_message_type {
+    INPUT_DNSTAP_AUTH_QUERY         = 1,
+    INPUT_DNSTAP_AUTH_RESPONSE      = 2,
+    INPUT_DNSTAP_RESOLVER_QUERY     = 3,
+    INPUT_DNSTAP_RESOLVER_RESPONSE  = 4,
+    INPUT_DNSTAP_CLIENT_QUERY       = 5,
+    INPUT_DNSTAP_CLIENT_RESPONSE    = 6,
+    INPUT_DNSTAP_FORWARDER_QUERY    = 7,
+    INPUT_DNSTAP_FORWARDER_RESPONSE = 8,
+    INPUT_DNSTAP_STUB_QUERY         = 9,
+    INPUT_DNSTAP_STUB_RESPONSE      = 10,
+    INPUT_DNSTAP_TOOL_QUERY         = 11,
+    INPUT_DNSTAP_TOOL_RESPONSE      = 12,
+    INPUT_DNSTAP_UPDATE_QUERY       = 13,
+    INPUT_DNSTAP_UPDATE_RESPONSE    = 14
+} input_dnstap_message_type_t;
+
+/* dnstap SocketProtocol */
+typedef enum input_dnstap_socket_protocol {
+    INPUT_DNSTAP_UDP          = 1,
+    INPUT_DNSTAP_TCP          = 2,
+    INPUT_DNSTAP_DOT          = 3,
+    INPUT_DNSTAP_DOH          = 4,
+    INPUT_DNSTAP_DNSCRYPT_UDP = 5,
+    INPUT_DNSTAP_DNSCRYPT_TCP = 6,
+    INPUT_DNSTAP_DOQ          = 7
+} input_dnstap_socket_protocol_t;
+
+typedef struct input_dnstap {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    uint8_t use_queries;
+    uint8_t use_responses;
+    uint8_t is_broken;
+
+    /* Type and protocol of the last message passed on. */
+    int32_t message_type;
+    int32_t socket_protocol;
+
+    core_object_pcap_t    prod_pcap;
+    core_object_ip_t      prod_ip;
+    core_object_ip6_t     prod_ip6;
+    core_object_udp_t     prod_udp;
+    core_object_tcp_t     prod_tcp;
+    core_object_payload_t prod_payload;
+
+    int      fd;
+    size_t   len, at;
+    uint8_t* buf;
+
+    /* Unix socket server and the currently connected writer. */
+    int      sock_fd, conn_fd;
+    size_t   rbuf_size, rbuf_len, rbuf_at;
+    uint8_t* rbuf;
+
+    size_t frames, messages, skipped;
+} input_dnstap_t;
+
+core_log_t* input_dnstap_log();
+
+void input_dnstap_init(input_dnstap_t* self);
+void input_dnstap_destroy(input_dnstap_t* self);
+int input_dnstap_open(input_dnstap_t* self, const char* file);
+int input_dnstap_listen(input_dnstap_t* self, const char* path);
+int input_dnstap_run(input_dnstap_t* self);
+
+core_producer_t input_dnstap_producer(input_dnstap_t* self);
@@ -0,0 +1,163 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.input.dnstap
+-- Read dnstap from Frame Streams files or a Unix socket
+--   local input = require("dnsjit.input.dnstap").new()
+--   input:open("file.dnstap")
+--   input:receiver(filter_or_output)
+--   input:run()
+-- .
+--   local input = require("dnsjit.input.dnstap").new()
+--   input:listen("/run/dnstap.sock")
+--   input:receiver(filter_or_output)
+--   input:run()
+--
+-- Read dnstap messages from a Frame Streams file, by mapping the whole file
+-- to memory using
+-- .BR mmap() ,
+-- or from a Unix socket server accepting live feeds of writers such as
+-- resolvers (bidirectional handshake or unidirectional).
+-- The protobuf messages are parsed by a small built-in decoder without
+-- copying, the produced payload points directly to the mapped file or the
+-- read buffer and is valid only until the next message is read.
+-- .P
+-- Each message is passed on as a chain of objects as if it was parsed by
+-- .IR dnsjit.filter.layer :
+-- a payload with the DNS message, preceded by UDP (also for DoQ) or TCP
+-- (for the stream based protocols, e.g. DoT or DoH) with the ports, IP or
+-- IPv6 with the addresses and PCAP with the message timestamp.
+-- Addresses and ports are in the direction of the message: queries are sent
+-- from the query address to the response address and responses the other
+-- way around.
+-- Objects can be passed to
+-- .I dnsjit.filter.timing
+-- since it looks up the PCAP object in the chain.
+-- .P
+-- Query messages (odd dnstap message types) carry the query and response
+-- messages (even types) carry the response, messages without the
+-- corresponding DNS message are skipped.
+-- .SS Attributes
+-- .TP
+-- message_type
+-- The dnstap message type of the last message passed on, see
+-- .IR INPUT_DNSTAP_*_QUERY / INPUT_DNSTAP_*_RESPONSE .
+-- .TP
+-- socket_protocol
+-- The dnstap socket protocol of the last message passed on (UDP 1, TCP 2,
+-- DOT 3, DOH 4, DNSCrypt UDP 5, DNSCrypt TCP 6, DOQ 7).
+module(...,package.seeall)
+
+require("dnsjit.input.dnstap_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "input_dnstap_t"
+local input_dnstap_t = ffi.typeof(t_name)
+local Dnstap = {}
+
+-- Create a new Dnstap input.
+function Dnstap.new()
+    local self = {
+        _receiver = nil,
+        obj = input_dnstap_t(),
+    }
+    C.input_dnstap_init(self.obj)
+    ffi.gc(self.obj, C.input_dnstap_destroy)
+    return setmetatable(self, { __index = Dnstap })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Dnstap:log()
+    if self == nil then
+        return C.input_dnstap_log()
+    end
+    return self.obj._log
+end
+
+-- Set the receiver to pass objects to.
+function Dnstap:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the C functions and context for producing objects.
+function Dnstap:produce()
+    return C.input_dnstap_producer(self.obj), self.obj
+end
+
+-- Open a Frame Streams file for processing and read the START frame.
+-- Returns 0 on success.
+function Dnstap:open(file)
+    return C.input_dnstap_open(self.obj, file)
+end
+
+-- Listen on a Unix socket for Frame Streams writers, an existing socket
+-- file is removed.
+-- Writers are served one at a time, after a writer stops or disconnects the
+-- next one is accepted.
+-- Returns 0 on success.
+function Dnstap:listen(path)
+    return C.input_dnstap_listen(self.obj, path)
+end
+
+-- Set if query messages are passed on (default true).
+function Dnstap:queries(bool)
+    if bool == false then
+        self.obj.use_queries = 0
+    else
+        self.obj.use_queries = 1
+    end
+end
+
+-- Set if response messages are passed on (default true).
+function Dnstap:responses(bool)
+    if bool == false then
+        self.obj.use_responses = 0
+    else
+        self.obj.use_responses = 1
+    end
+end
+
+-- Start processing messages and send each message read to the receiver.
+-- Returns 0 if all messages was read successfully, when listening on a
+-- socket this only returns on error.
+function Dnstap:run()
+    return C.input_dnstap_run(self.obj)
+end
+
+-- Return the number of frames seen.
+function Dnstap:frames()
+    return tonumber(self.obj.frames)
+end
+
+-- Return the number of messages passed on.
+function Dnstap:messages()
+    return tonumber(self.obj.messages)
+end
+
+-- Return the number of frames skipped, either malformed, without a message
+-- or filtered out.
+function Dnstap:skipped()
+    return tonumber(self.obj.skipped)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.filter.timing (3),
+-- dnsjit.input.mmpcap (3)
+return Dnstap
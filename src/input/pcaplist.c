@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input/pcaplist.h"
+#include "input/mmpcap.h"
+#include "core/assert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define N1e9 1000000000ULL
+
+typedef struct _file {
+    char*    name;
+    uint64_t first_ns;
+} _file_t;
+
+typedef struct _ready {
+    input_mmpcap_t* pcap;
+    size_t          file;
+} _ready_t;
+
+typedef struct _input_pcaplist {
+    input_pcaplist_t pub;
+
+    _file_t* list;
+    size_t   size;
+
+    pthread_t       thr_id;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  space;
+    uint8_t         started, stop, done;
+
+    /* Files mapped by the prefetch thread, in order. */
+    _ready_t* ready;
+    size_t    head, count;
+    size_t    next;
+
+    /* The file being read and the previous one, which the prefetch thread
+     * unmaps so the reader doesn't stall on it. */
+    input_mmpcap_t* cur;
+    core_producer_t prod;
+    input_mmpcap_t* retired;
+} _input_pcaplist_t;
+
+#define _self ((_input_pcaplist_t*)self)
+
+static core_log_t       _log      = LOG_T_INIT("input.pcaplist");
+static input_pcaplist_t _defaults = {
+    LOG_T_INIT_OBJ("input.pcaplist"),
+    0, 0,
+    1, 1,
+    0,
+    0, 0, 0,
+    0, 0
+};
+
+core_log_t* input_pcaplist_log()
+{
+    return &_log;
+}
+
+input_pcaplist_t* input_pcaplist_new()
+{
+    input_pcaplist_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_input_pcaplist_t)));
+    *self          = _defaults;
+    _self->list    = 0;
+    _self->size    = 0;
+    _self->started = 0;
+    _self->stop    = 0;
+    _self->done    = 0;
+    _self->ready   = 0;
+    _self->head    = 0;
+    _self->count   = 0;
+    _self->next    = 0;
+    _self->cur     = 0;
+    _self->prod    = 0;
+    _self->retired = 0;
+    pthread_mutex_init(&_self->lock, 0);
+    pthread_cond_init(&_self->cond, 0);
+    pthread_cond_init(&_self->space, 0);
+
+    return self;
+}
+
+static void _close(input_mmpcap_t* pcap)
+{
+    if (pcap) {
+        input_mmpcap_destroy(pcap);
+        free(pcap);
+    }
+}
+
+void input_pcaplist_free(input_pcaplist_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    if (_self->started) {
+        pthread_mutex_lock(&_self->lock);
+        _self->stop = 1;
+        pthread_cond_signal(&_self->space);
+        pthread_mutex_unlock(&_self->lock);
+        pthread_join(_self->thr_id, 0);
+    }
+    for (; _self->count; _self->count--) {
+        _close(_self->ready[_self->head].pcap);
+        _self->head = (_self->head + 1) % self->prefetch;
+    }
+    free(_self->ready);
+    _close(_self->cur);
+    _close(_self->retired);
+
+    for (i = 0; i < self->files; i++) {
+        free(_self->list[i].name);
+    }
+    free(_self->list);
+    pthread_cond_destroy(&_self->space);
+    pthread_cond_destroy(&_self->cond);
+    pthread_mutex_destroy(&_self->lock);
+    free(self);
+}
+
+int input_pcaplist_add(input_pcaplist_t* self, const char* file)
+{
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (_self->started) {
+        lfatal("files can't be added after reading started");
+    }
+
+    if (self->files == _self->size) {
+        _self->size = _self->size ? _self->size * 2 : 64;
+        lfatal_oom(_self->list = realloc(_self->list, sizeof(_file_t) * _self->size));
+    }
+    lfatal_oom(_self->list[self->files].name = strdup(file));
+    _self->list[self->files].first_ns = 0;
+    self->files++;
+
+    return 0;
+}
+
+int input_pcaplist_glob(input_pcaplist_t* self, const char* pattern)
+{
+    struct stat sb;
+    glob_t      g;
+    char*       dir = 0;
+    size_t      i;
+    int         err;
+    mlassert_self();
+    lassert(pattern, "pattern is nil");
+
+    /* A directory means all files in it. */
+    if (!stat(pattern, &sb) && S_ISDIR(sb.st_mode)) {
+        lfatal_oom(dir = malloc(strlen(pattern) + 3));
+        strcpy(dir, pattern);
+        strcat(dir, "/*");
+        pattern = dir;
+    }
+
+    err = glob(pattern, 0, 0, &g);
+    free(dir);
+    if (err == GLOB_NOMATCH) {
+        globfree(&g);
+        lwarning("no files matched");
+        return 0;
+    }
+    if (err) {
+        globfree(&g);
+        lcritical("glob() error %d", err);
+        return -1;
+    }
+
+    for (i = 0; i < g.gl_pathc; i++) {
+        if (stat(g.gl_pathv[i], &sb) || !S_ISREG(sb.st_mode)) {
+            continue;
+        }
+        input_pcaplist_add(self, g.gl_pathv[i]);
+    }
+    globfree(&g);
+
+    return 0;
+}
+
+static int _cmp_name(const void* a, const void* b)
+{
+    return strcmp(((const _file_t*)a)->name, ((const _file_t*)b)->name);
+}
+
+static int _cmp_time(const void* a, const void* b)
+{
+    const _file_t* fa = (const _file_t*)a;
+    const _file_t* fb = (const _file_t*)b;
+
+    if (fa->first_ns != fb->first_ns) {
+        return fa->first_ns < fb->first_ns ? -1 : 1;
+    }
+    return strcmp(fa->name, fb->name);
+}
+
+int input_pcaplist_sort_name(input_pcaplist_t* self)
+{
+    mlassert_self();
+
+    if (_self->started) {
+        lfatal("files can't be sorted after reading started");
+    }
+
+    if (self->files) {
+        qsort(_self->list, self->files, sizeof(_file_t), _cmp_name);
+    }
+    return 0;
+}
+
+/*
+ * Get the timestamp of the first packet, only the headers are read so
+ * sorting thousands of files stays cheap.
+ */
+static int _first_ns(input_pcaplist_t* self, _file_t* file)
+{
+    uint32_t hdr[10];
+    uint32_t sec, frac;
+    int      fd, nanosec = 0, swapped = 0;
+    ssize_t  n;
+
+    if ((fd = open(file->name, O_RDONLY)) < 0) {
+        lwarning("open(%s) error %s", file->name, core_log_errstr(errno));
+        return -1;
+    }
+    n = pread(fd, hdr, sizeof(hdr), 0);
+    close(fd);
+    if (n != sizeof(hdr)) {
+        lwarning("%s: could not read first packet header", file->name);
+        return -1;
+    }
+
+    switch (hdr[0]) {
+    case 0x4d3cb2a1:
+        nanosec = 1;
+        /* fallthrough */
+    case 0xd4c3b2a1:
+        swapped = 1;
+        break;
+    case 0xa1b23c4d:
+        nanosec = 1;
+        /* fallthrough */
+    case 0xa1b2c3d4:
+        break;
+    default:
+        lwarning("%s: invalid PCAP header", file->name);
+        return -1;
+    }
+
+    sec  = swapped ? __builtin_bswap32(hdr[6]) : hdr[6];
+    frac = swapped ? __builtin_bswap32(hdr[7]) : hdr[7];
+
+    file->first_ns = sec * N1e9 + (nanosec ? frac : frac * 1000ULL);
+    return 0;
+}
+
+int input_pcaplist_sort_time(input_pcaplist_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    if (_self->started) {
+        lfatal("files can't be sorted after reading started");
+    }
+
+    /* Files without a packet sort first and are skipped when read. */
+    for (i = 0; i < self->files; i++) {
+        if (_first_ns(self, &_self->list[i])) {
+            _self->list[i].first_ns = 0;
+        }
+    }
+    if (self->files) {
+        qsort(_self->list, self->files, sizeof(_file_t), _cmp_time);
+    }
+    return 0;
+}
+
+const char* input_pcaplist_name(input_pcaplist_t* self, size_t file)
+{
+    mlassert_self();
+
+    if (file >= self->files) {
+        return 0;
+    }
+    return _self->list[file].name;
+}
+
+/*
+ * Map the file and fault in its pages, which makes the kernel read it
+ * into the page cache and set up the page tables before it's needed.
+ */
+static input_mmpcap_t* _open(input_pcaplist_t* self, size_t file)
+{
+    input_mmpcap_t*  pcap;
+    volatile uint8_t sum = 0;
+    size_t           i, page = sysconf(_SC_PAGESIZE);
+
+    lfatal_oom(pcap = malloc(sizeof(input_mmpcap_t)));
+    input_mmpcap_init(pcap);
+    if (input_mmpcap_open(pcap, _self->list[file].name)) {
+        lwarning("skipping %s", _self->list[file].name);
+        _close(pcap);
+        return 0;
+    }
+
+    madvise(pcap->buf, pcap->len, MADV_SEQUENTIAL);
+    if (self->prefault) {
+        madvise(pcap->buf, pcap->len, MADV_WILLNEED);
+        for (i = 0; i < pcap->len; i += page) {
+            sum += pcap->buf[i];
+        }
+    }
+    (void)sum;
+
+    return pcap;
+}
+
+static void* _prefetch(void* arg)
+{
+    input_pcaplist_t* self = (input_pcaplist_t*)arg;
+    input_mmpcap_t*   pcap;
+    input_mmpcap_t*   retired;
+    size_t            file;
+
+    pthread_mutex_lock(&_self->lock);
+    while (!_self->stop) {
+        if (_self->retired) {
+            retired        = _self->retired;
+            _self->retired = 0;
+            pthread_mutex_unlock(&_self->lock);
+            _close(retired);
+            pthread_mutex_lock(&_self->lock);
+            continue;
+        }
+        if (_self->next == self->files || _self->count == self->prefetch) {
+            pthread_cond_wait(&_self->space, &_self->lock);
+            continue;
+        }
+
+        file = _self->next++;
+        pthread_mutex_unlock(&_self->lock);
+        ldebug("prefetching %s", _self->list[file].name);
+        pcap = _open(self, file);
+        pthread_mutex_lock(&_self->lock);
+
+        if (!pcap) {
+            self->failed++;
+        } else {
+            _self->ready[(_self->head + _self->count) % self->prefetch].pcap = pcap;
+            _self->ready[(_self->head + _self->count) % self->prefetch].file = file;
+            _self->count++;
+        }
+        if (_self->next == self->files) {
+            _self->done = 1;
+        }
+        pthread_cond_signal(&_self->cond);
+    }
+    pthread_mutex_unlock(&_self->lock);
+
+    return 0;
+}
+
+static void _start(input_pcaplist_t* self)
+{
+    int err;
+
+    if (_self->started) {
+        return;
+    }
+    if (!self->files) {
+        lfatal("no files");
+    }
+    if (!self->prefetch) {
+        lfatal("prefetch must be at least 1");
+    }
+
+    lfatal_oom(_self->ready = malloc(sizeof(_ready_t) * self->prefetch));
+    if ((err = pthread_create(&_self->thr_id, 0, _prefetch, (void*)self))) {
+        lfatal("pthread_create() error %s", core_log_errstr(err));
+    }
+    _self->started = 1;
+}
+
+/*
+ * Switch to the next prefetched file, returns 0 when there are no more.
+ */
+static int _next(input_pcaplist_t* self)
+{
+    struct timespec t1, t2;
+    int             waited = 0;
+
+    pthread_mutex_lock(&_self->lock);
+    if (_self->cur) {
+        if (_self->retired) {
+            /* The thread is still busy, unmap the older one here. */
+            pthread_mutex_unlock(&_self->lock);
+            _close(_self->cur);
+            pthread_mutex_lock(&_self->lock);
+        } else {
+            _self->retired = _self->cur;
+        }
+        _self->cur = 0;
+    }
+
+    while (!_self->count && !_self->done) {
+        if (!waited) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            waited = 1;
+        }
+        pthread_cond_signal(&_self->space);
+        pthread_cond_wait(&_self->cond, &_self->lock);
+    }
+    if (waited) {
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        self->waits++;
+        self->wait_ns += (t2.tv_sec - t1.tv_sec) * N1e9 + t2.tv_nsec - t1.tv_nsec;
+    }
+
+    if (_self->count) {
+        _self->cur  = _self->ready[_self->head].pcap;
+        self->file  = _self->ready[_self->head].file;
+        _self->head = (_self->head + 1) % self->prefetch;
+        _self->count--;
+        _self->prod = input_mmpcap_producer(_self->cur);
+    }
+    pthread_cond_signal(&_self->space);
+    pthread_mutex_unlock(&_self->lock);
+
+    if (_self->cur) {
+        ldebug("reading %s", _self->list[self->file].name);
+        return 1;
+    }
+    return 0;
+}
+
+int input_pcaplist_run(input_pcaplist_t* self)
+{
+    mlassert_self();
+
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+    _start(self);
+
+    while (_next(self)) {
+        _self->cur->recv = self->recv;
+        _self->cur->ctx  = self->ctx;
+        input_mmpcap_run(_self->cur);
+        self->pkts += _self->cur->pkts;
+    }
+
+    return 0;
+}
+
+static const core_object_t* _produce(input_pcaplist_t* self)
+{
+    const core_object_t* obj;
+    mlassert_self();
+
+    for (;;) {
+        if (_self->cur && (obj = _self->prod(_self->cur))) {
+            self->pkts++;
+            return obj;
+        }
+        if (!_next(self)) {
+            return 0;
+        }
+    }
+}
+
+core_producer_t input_pcaplist_producer(input_pcaplist_t* self)
+{
+    mlassert_self();
+
+    _start(self);
+
+    return (core_producer_t)_produce;
+}
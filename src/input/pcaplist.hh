@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.producer_h")
+//lua:require("dnsjit.core.object.pcap_h")
+
+typedef struct input_pcaplist {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Number of files mapped ahead of the one being read and if the
+     * prefetch thread faults in all of their pages. */
+    size_t  prefetch;
+    uint8_t prefault;
+
+    size_t files;
+
+    /* Index of the file being read, number of files that couldn't be
+     * opened and number of packets read. */
+    size_t file;
+    size_t failed;
+    size_t pkts;
+
+    /* Number of times and total nanoseconds reading had to wait for the
+     * next file to be prefetched. */
+    size_t   waits;
+    uint64_t wait_ns;
+} input_pcaplist_t;
+
+core_log_t* input_pcaplist_log();
+
+input_pcaplist_t* input_pcaplist_new();
+void input_pcaplist_free(input_pcaplist_t* self);
+int input_pcaplist_add(input_pcaplist_t* self, const char* file);
+int input_pcaplist_glob(input_pcaplist_t* self, const char* pattern);
+int input_pcaplist_sort_name(input_pcaplist_t* self);
+int input_pcaplist_sort_time(input_pcaplist_t* self);
+const char* input_pcaplist_name(input_pcaplist_t* self, size_t file);
+int input_pcaplist_run(input_pcaplist_t* self);
+
+core_producer_t input_pcaplist_producer(input_pcaplist_t* self);
@@ -0,0 +1,154 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.input.pcaplist
+-- Read input from many PCAP files as one stream
+--   local input = require("dnsjit.input.pcaplist").new()
+--   input:glob("/var/capture/*.pcap")
+--   input:sort("time")
+--   input:receiver(filter_or_output)
+--   input:run()
+--
+-- Read a list of PCAP files, e.g. captures rotated into many files, one after
+-- the other as one continuous stream of packets.
+-- The files are read like
+-- .I dnsjit.input.mmpcap
+-- does but a background thread opens and maps the next files, and faults in
+-- their pages, while the current file is being read, so there is no stall at
+-- file boundaries.
+-- The previous file is also unmapped by the thread.
+-- Files that can't be opened or aren't PCAPs are skipped, and reading a
+-- broken file continues with the next one.
+module(...,package.seeall)
+
+require("dnsjit.input.pcaplist_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Pcaplist = {}
+
+-- Create a new Pcaplist input.
+function Pcaplist.new()
+    local self = {
+        _receiver = nil,
+        obj = C.input_pcaplist_new(),
+    }
+    ffi.gc(self.obj, C.input_pcaplist_free)
+    return setmetatable(self, { __index = Pcaplist })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Pcaplist:log()
+    if self == nil then
+        return C.input_pcaplist_log()
+    end
+    return self.obj._log
+end
+
+-- Add a file, or a table of files, to the end of the list.
+-- Returns 0 on success.
+function Pcaplist:add(file)
+    if type(file) == "table" then
+        for _, f in ipairs(file) do
+            C.input_pcaplist_add(self.obj, f)
+        end
+        return 0
+    end
+    return C.input_pcaplist_add(self.obj, file)
+end
+
+-- Add the files matching the glob pattern, in name order, or all files of a
+-- directory.
+-- Returns 0 on success.
+function Pcaplist:glob(pattern)
+    return C.input_pcaplist_glob(self.obj, pattern)
+end
+
+-- Sort the files by
+-- .I name
+-- (default) or by the timestamp of their first packet
+-- .RI ( time ),
+-- which only reads the start of each file.
+-- Returns 0 on success.
+function Pcaplist:sort(by)
+    if by == "time" then
+        return C.input_pcaplist_sort_time(self.obj)
+    end
+    return C.input_pcaplist_sort_name(self.obj)
+end
+
+-- Set the number of files to map ahead of the one being read (default 1)
+-- and, optionally, if their pages should be faulted in (default true).
+-- Without prefaulting the kernel is only advised to read the file ahead.
+function Pcaplist:prefetch(files, prefault)
+    self.obj.prefetch = files
+    if prefault ~= nil then
+        self.obj.prefault = prefault and 1 or 0
+    end
+end
+
+-- Return the number of files.
+function Pcaplist:files()
+    return tonumber(self.obj.files)
+end
+
+-- Return the name of the file at the given index (starting with 1) or, if
+-- not given, of the file being read.
+function Pcaplist:name(file)
+    if file == nil then
+        file = tonumber(self.obj.file) + 1
+    end
+    local name = C.input_pcaplist_name(self.obj, file - 1)
+    if name == nil then
+        return
+    end
+    return ffi.string(name)
+end
+
+-- Set the receiver to pass objects to.
+function Pcaplist:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the C functions and context for producing objects.
+function Pcaplist:produce()
+    return C.input_pcaplist_producer(self.obj), self.obj
+end
+
+-- Start processing packets of all files and send each packet read to the
+-- receiver.
+-- Returns 0 when all files have been read.
+function Pcaplist:run()
+    return C.input_pcaplist_run(self.obj)
+end
+
+-- Return the number of packets seen.
+function Pcaplist:packets()
+    return tonumber(self.obj.pkts)
+end
+
+-- Return the number of files skipped because they couldn't be opened, and
+-- the number of times and total seconds reading waited for the next file to
+-- be prefetched.
+function Pcaplist:stats()
+    return tonumber(self.obj.failed), tonumber(self.obj.waits), tonumber(self.obj.wait_ns) / 1e9
+end
+
+-- dnsjit.input.mmpcap (3)
+return Pcaplist
@@ -21,6 +21,8 @@
 module(...,package.seeall)
 
 -- dnsjit.lib.clock (3),
+-- dnsjit.lib.coord (3),
 -- dnsjit.lib.getopt (3),
--- dnsjit.lib.parseconf (3)
+-- dnsjit.lib.parseconf (3),
+-- dnsjit.lib.saturation (3)
 return
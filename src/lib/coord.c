@@ -0,0 +1,746 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "lib/coord.h"
+#include "core/assert.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define N1e9 1000000000ULL
+#define BUF_MIN 4096
+#define PROBE_TIMEOUT_MS 5000
+
+/*
+ * Control protocol, one command per line:
+ *
+ *   worker:     HELLO <name>
+ *   worker:     TIME <t1>            (repeated, clock offset probes)
+ *   controller: TIME <t1> <now>
+ *   worker:     READY
+ *   controller: START <index> <count> <epoch> [args]
+ *
+ * Anything the workers send afterwards is returned line by line by
+ * lib_coord_recv(). All times are nanoseconds of the realtime clock.
+ */
+
+typedef struct _peer {
+    int    fd;
+    int    ready;
+    char*  buf;
+    size_t len, size, pos;
+} _peer_t;
+
+typedef struct _lib_coord {
+    lib_coord_t pub;
+
+    /* Listening socket of the controller or the connection of a worker. */
+    int fd;
+
+    _peer_t* peers;
+    size_t   npeers;
+    size_t   next;
+
+    _peer_t conn;
+    char*   args;
+} _lib_coord_t;
+
+#define _self ((_lib_coord_t*)self)
+
+static core_log_t  _log      = LOG_T_INIT("lib.coord");
+static lib_coord_t _defaults = {
+    LOG_T_INIT_OBJ("lib.coord"),
+    0, 0,
+    0, 1, COORD_CLIENT_SRC,
+    0, 0, 0,
+    0,
+    0, 0
+};
+
+core_log_t* lib_coord_log()
+{
+    return &_log;
+}
+
+lib_coord_t* lib_coord_new()
+{
+    lib_coord_t* self;
+
+    mlfatal_oom(self = malloc(sizeof(_lib_coord_t)));
+    *self         = _defaults;
+    _self->fd     = -1;
+    _self->peers  = 0;
+    _self->npeers = 0;
+    _self->next   = 0;
+    memset(&_self->conn, 0, sizeof(_self->conn));
+    _self->conn.fd = -1;
+    _self->args    = 0;
+
+    return self;
+}
+
+static void _peer_close(_peer_t* peer)
+{
+    if (peer->fd > -1) {
+        close(peer->fd);
+        peer->fd = -1;
+    }
+}
+
+void lib_coord_free(lib_coord_t* self)
+{
+    size_t i;
+    mlassert_self();
+
+    for (i = 0; i < _self->npeers; i++) {
+        _peer_close(&_self->peers[i]);
+        free(_self->peers[i].buf);
+    }
+    free(_self->peers);
+    _peer_close(&_self->conn);
+    free(_self->conn.buf);
+    if (_self->fd > -1) {
+        close(_self->fd);
+    }
+    free(_self->args);
+    free(self);
+}
+
+static uint64_t _now_ns()
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts)) {
+        mlfatal("clock_gettime() error %s", core_log_errstr(errno));
+    }
+    return ts.tv_sec * N1e9 + ts.tv_nsec;
+}
+
+static int _timeout(uint64_t deadline_ms)
+{
+    uint64_t now_ms = _now_ns() / 1000000;
+
+    if (!deadline_ms) {
+        return -1;
+    }
+    return now_ms < deadline_ms ? (int)(deadline_ms - now_ms) : 0;
+}
+
+/*
+ * Return the next complete line buffered for the peer, the line is valid
+ * until the next read from the peer.
+ */
+static char* _line(_peer_t* peer)
+{
+    char* nl;
+    char* line;
+
+    if (peer->pos == peer->len || !(nl = memchr(peer->buf + peer->pos, '\n', peer->len - peer->pos))) {
+        return 0;
+    }
+    *nl  = 0;
+    line = peer->buf + peer->pos;
+    if (nl > line && nl[-1] == '\r') {
+        nl[-1] = 0;
+    }
+    peer->pos = nl + 1 - peer->buf;
+    return line;
+}
+
+/*
+ * Read what is available from the peer, returns 0 on EOF and -1 on error.
+ */
+static ssize_t _fill(lib_coord_t* self, _peer_t* peer)
+{
+    ssize_t n;
+
+    if (peer->pos) {
+        memmove(peer->buf, peer->buf + peer->pos, peer->len - peer->pos);
+        peer->len -= peer->pos;
+        peer->pos = 0;
+    }
+    if (peer->size - peer->len < BUF_MIN) {
+        peer->size = peer->size ? peer->size * 2 : BUF_MIN * 4;
+        lfatal_oom(peer->buf = realloc(peer->buf, peer->size));
+    }
+
+    while ((n = read(peer->fd, peer->buf + peer->len, peer->size - peer->len)) < 0 && errno == EINTR)
+        ;
+    if (n < 0) {
+        lwarning("read() error %s", core_log_errstr(errno));
+    } else {
+        peer->len += n;
+    }
+    return n;
+}
+
+static int _write(lib_coord_t* self, int fd, const char* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lwarning("send() error %s", core_log_errstr(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int _writef(lib_coord_t* self, int fd, const char* fmt, ...)
+{
+    char    buf[256];
+    va_list ap;
+    int     n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0 || n >= (int)sizeof(buf)) {
+        lcritical("control message too long");
+        return -1;
+    }
+    return _write(self, fd, buf, n);
+}
+
+/*
+ * Controller
+ */
+
+int lib_coord_listen(lib_coord_t* self, const char* host, const char* port)
+{
+    struct addrinfo  hints = { 0 };
+    struct addrinfo* addr;
+    int              err, on = 1;
+    mlassert_self();
+    lassert(port, "port is nil");
+
+    if (_self->fd > -1 || _self->conn.fd > -1) {
+        lfatal("already listening or connected");
+    }
+
+    hints.ai_flags    = AI_PASSIVE;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(host, port, &hints, &addr))) {
+        lcritical("getaddrinfo(%s, %s) error %s", host ? host : "*", port, gai_strerror(err));
+        return -1;
+    }
+
+    if ((_self->fd = socket(addr->ai_family, SOCK_STREAM, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        freeaddrinfo(addr);
+        return -1;
+    }
+    setsockopt(_self->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(_self->fd, addr->ai_addr, addr->ai_addrlen) || listen(_self->fd, 64)) {
+        lcritical("bind/listen(%s, %s) error %s", host ? host : "*", port, core_log_errstr(errno));
+        freeaddrinfo(addr);
+        close(_self->fd);
+        _self->fd = -1;
+        return -1;
+    }
+    freeaddrinfo(addr);
+
+    return 0;
+}
+
+static void _serve(lib_coord_t* self, _peer_t* peer, char* line)
+{
+    if (!strncmp(line, "TIME ", 5)) {
+        if (_writef(self, peer->fd, "TIME %s %" PRIu64 "\n", line + 5, _now_ns())) {
+            _peer_close(peer);
+        }
+    } else if (!strncmp(line, "HELLO", 5)) {
+        linfo("worker %s joined", line[5] ? line + 6 : "(unnamed)");
+    } else if (!strcmp(line, "READY")) {
+        peer->ready = 1;
+        self->workers++;
+    } else {
+        lwarning("unexpected message from worker: %.32s", line);
+    }
+}
+
+int lib_coord_accept(lib_coord_t* self, size_t workers, uint64_t timeout_ms)
+{
+    struct pollfd* pfds = 0;
+    uint64_t       deadline = timeout_ms ? _now_ns() / 1000000 + timeout_ms : 0;
+    size_t         i, n;
+    char*          line;
+    int            fd, ret;
+    mlassert_self();
+
+    if (_self->fd < 0) {
+        lfatal("not listening");
+    }
+    if (!workers) {
+        lfatal("number of workers must be at least 1");
+    }
+
+    while (self->workers < workers) {
+        lfatal_oom(pfds = realloc(pfds, sizeof(struct pollfd) * (_self->npeers + 1)));
+        pfds[0].fd     = _self->fd;
+        pfds[0].events = POLLIN;
+        for (i = 0; i < _self->npeers; i++) {
+            pfds[i + 1].fd     = _self->peers[i].fd;
+            pfds[i + 1].events = POLLIN;
+        }
+
+        if ((ret = poll(pfds, _self->npeers + 1, _timeout(deadline))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("poll() error %s", core_log_errstr(errno));
+            break;
+        }
+        if (!ret) {
+            lcritical("timed out with %zu of %zu workers ready", self->workers, workers);
+            break;
+        }
+
+        n = _self->npeers;
+        for (i = 0; i < n; i++) {
+            _peer_t* peer = &_self->peers[i];
+
+            if (!pfds[i + 1].revents || peer->fd < 0) {
+                continue;
+            }
+            if (_fill(self, peer) < 1) {
+                if (peer->ready) {
+                    lwarning("ready worker disconnected");
+                    self->workers--;
+                    peer->ready = 0;
+                }
+                _peer_close(peer);
+                continue;
+            }
+            while (peer->fd > -1 && (line = _line(peer))) {
+                _serve(self, peer, line);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            if ((fd = accept(_self->fd, 0, 0)) < 0) {
+                if (errno != EINTR && errno != ECONNABORTED) {
+                    lwarning("accept() error %s", core_log_errstr(errno));
+                }
+                continue;
+            }
+            lfatal_oom(_self->peers = realloc(_self->peers, sizeof(_peer_t) * (_self->npeers + 1)));
+            memset(&_self->peers[_self->npeers], 0, sizeof(_peer_t));
+            _self->peers[_self->npeers++].fd = fd;
+        }
+    }
+    free(pfds);
+
+    /* Only the ready workers take part, any others are turned away. */
+    for (i = 0, n = 0; i < _self->npeers; i++) {
+        if (_self->peers[i].ready && n < workers) {
+            _self->peers[n++] = _self->peers[i];
+            continue;
+        }
+        _peer_close(&_self->peers[i]);
+        free(_self->peers[i].buf);
+    }
+    _self->npeers = n;
+    self->workers = n;
+    close(_self->fd);
+    _self->fd = -1;
+
+    return n == workers ? 0 : -1;
+}
+
+int lib_coord_start(lib_coord_t* self, uint64_t lead_ms, const char* args)
+{
+    size_t i;
+    mlassert_self();
+
+    if (!_self->npeers) {
+        lfatal("no workers");
+    }
+    if (args && strchr(args, '\n')) {
+        lfatal("args can't contain newlines");
+    }
+
+    self->index    = 0;
+    self->count    = _self->npeers;
+    self->epoch_ns = _now_ns() + lead_ms * 1000000;
+
+    for (i = 0; i < _self->npeers; i++) {
+        _peer_t* peer = &_self->peers[i];
+
+        if (_writef(self, peer->fd, "START %zu %zu %" PRIu64, i, _self->npeers, self->epoch_ns)
+            || (args && *args && (_write(self, peer->fd, " ", 1) || _write(self, peer->fd, args, strlen(args))))
+            || _write(self, peer->fd, "\n", 1)) {
+            lcritical("unable to start worker %zu", i);
+            return -1;
+        }
+    }
+    linfo("starting %zu workers at %" PRIu64 ".%09" PRIu64, _self->npeers, self->epoch_ns / N1e9, self->epoch_ns % N1e9);
+
+    return 0;
+}
+
+const char* lib_coord_recv(lib_coord_t* self, size_t* worker, uint64_t timeout_ms)
+{
+    struct pollfd* pfds;
+    uint64_t       deadline = timeout_ms ? _now_ns() / 1000000 + timeout_ms : 0;
+    size_t         i, n, open;
+    char*          line;
+    int            ret;
+    mlassert_self();
+    lassert(worker, "worker is nil");
+
+    lfatal_oom(pfds = malloc(sizeof(struct pollfd) * (_self->npeers + 1)));
+    for (;;) {
+        /* Round-robin over buffered lines so no worker is starved. */
+        for (i = 0, open = 0; i < _self->npeers; i++) {
+            n = (_self->next + i) % _self->npeers;
+            if ((line = _line(&_self->peers[n]))) {
+                _self->next = n + 1;
+                *worker     = n;
+                free(pfds);
+                return line;
+            }
+            if (_self->peers[n].fd > -1) {
+                pfds[open].fd     = _self->peers[n].fd;
+                pfds[open].events = POLLIN;
+                open++;
+            }
+        }
+        if (!open) {
+            break;
+        }
+
+        if ((ret = poll(pfds, open, _timeout(deadline))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("poll() error %s", core_log_errstr(errno));
+            break;
+        }
+        if (!ret) {
+            lwarning("timed out waiting for %zu workers", open);
+            break;
+        }
+
+        for (i = 0; i < _self->npeers; i++) {
+            _peer_t* peer = &_self->peers[i];
+
+            if (peer->fd < 0) {
+                continue;
+            }
+            for (n = 0; n < open; n++) {
+                if (pfds[n].fd == peer->fd && pfds[n].revents) {
+                    if (_fill(self, peer) < 1) {
+                        ldebug("worker %zu finished", i);
+                        _peer_close(peer);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    free(pfds);
+
+    *worker = 0;
+    return 0;
+}
+
+/*
+ * Worker
+ */
+
+static char* _read_line(lib_coord_t* self, uint64_t timeout_ms)
+{
+    struct pollfd pfd      = { _self->conn.fd, POLLIN, 0 };
+    uint64_t      deadline = timeout_ms ? _now_ns() / 1000000 + timeout_ms : 0;
+    char*         line;
+    int           ret;
+
+    while (!(line = _line(&_self->conn))) {
+        if ((ret = poll(&pfd, 1, _timeout(deadline))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("poll() error %s", core_log_errstr(errno));
+            return 0;
+        }
+        if (!ret) {
+            lcritical("timed out waiting for the controller");
+            return 0;
+        }
+        if (_fill(self, &_self->conn) < 1) {
+            lcritical("controller closed the connection");
+            return 0;
+        }
+    }
+    return line;
+}
+
+int lib_coord_connect(lib_coord_t* self, const char* host, const char* port, const char* name, size_t probes)
+{
+    struct addrinfo  hints = { 0 };
+    struct addrinfo *addr, *a;
+    uint64_t         t1, t2, tc;
+    char*            line;
+    int              err, fd = -1;
+    mlassert_self();
+    lassert(host, "host is nil");
+    lassert(port, "port is nil");
+
+    if (_self->fd > -1 || _self->conn.fd > -1) {
+        lfatal("already listening or connected");
+    }
+    if (name && strchr(name, '\n')) {
+        lfatal("name can't contain newlines");
+    }
+
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(host, port, &hints, &addr))) {
+        lcritical("getaddrinfo(%s, %s) error %s", host, port, gai_strerror(err));
+        return -1;
+    }
+    for (a = addr; a; a = a->ai_next) {
+        if ((fd = socket(a->ai_family, SOCK_STREAM, 0)) < 0) {
+            continue;
+        }
+        if (!connect(fd, a->ai_addr, a->ai_addrlen)) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addr);
+    if (fd < 0) {
+        lcritical("connect(%s, %s) error %s", host, port, core_log_errstr(errno));
+        return -1;
+    }
+    _self->conn.fd = fd;
+
+    if (_writef(self, fd, "HELLO %s\n", name ? name : "")) {
+        lib_coord_close(self);
+        return -1;
+    }
+
+    /* Cristian's algorithm, the probe with the shortest round trip bounds
+     * the error of the offset to half of it. */
+    self->rtt_ns    = UINT64_MAX;
+    self->offset_ns = 0;
+    if (!probes) {
+        probes = 1;
+    }
+    while (probes--) {
+        t1 = _now_ns();
+        if (_writef(self, fd, "TIME %" PRIu64 "\n", t1) || !(line = _read_line(self, PROBE_TIMEOUT_MS))) {
+            lib_coord_close(self);
+            return -1;
+        }
+        t2 = _now_ns();
+        if (sscanf(line, "TIME %*s %" SCNu64, &tc) != 1) {
+            lcritical("invalid time probe response");
+            lib_coord_close(self);
+            return -1;
+        }
+        if (t2 - t1 < self->rtt_ns) {
+            self->rtt_ns    = t2 - t1;
+            self->offset_ns = (int64_t)(tc - (t1 + (t2 - t1) / 2));
+        }
+    }
+    ldebug("clock offset %" PRId64 " ns, rtt %" PRIu64 " ns", self->offset_ns, self->rtt_ns);
+
+    if (_write(self, fd, "READY\n", 6)) {
+        lib_coord_close(self);
+        return -1;
+    }
+
+    return 0;
+}
+
+const char* lib_coord_wait(lib_coord_t* self, uint64_t timeout_ms)
+{
+    uint64_t index, count, epoch;
+    char*    line;
+    int      n = 0;
+    mlassert_self();
+
+    if (_self->conn.fd < 0) {
+        lfatal("not connected");
+    }
+
+    if (!(line = _read_line(self, timeout_ms))) {
+        return 0;
+    }
+    if (sscanf(line, "START %" SCNu64 " %" SCNu64 " %" SCNu64 "%n", &index, &count, &epoch, &n) != 3 || !count || count > UINT32_MAX || index >= count) {
+        lcritical("invalid start message: %.32s", line);
+        return 0;
+    }
+    self->index    = index;
+    self->count    = count;
+    self->epoch_ns = epoch;
+
+    free(_self->args);
+    lfatal_oom(_self->args = strdup(line[n] ? line + n + 1 : ""));
+
+    return _self->args;
+}
+
+int lib_coord_sleep(lib_coord_t* self)
+{
+    uint64_t        at, now;
+    struct timespec to;
+    int             ret = EINTR;
+    mlassert_self();
+
+    if (!self->epoch_ns) {
+        lfatal("no start epoch");
+    }
+
+    at  = self->epoch_ns - self->offset_ns;
+    now = _now_ns();
+    if (now >= at) {
+        lwarning("start epoch passed %" PRIu64 " ns ago", now - at);
+        return 0;
+    }
+
+#if HAVE_CLOCK_NANOSLEEP
+    to.tv_sec  = at / N1e9;
+    to.tv_nsec = at % N1e9;
+    while (ret) {
+        ret = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &to, 0);
+        if (ret && ret != EINTR) {
+            lcritical("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
+            return -1;
+        }
+    }
+#else
+    while ((now = _now_ns()) < at) {
+        to.tv_sec  = (at - now) / N1e9;
+        to.tv_nsec = (at - now) % N1e9;
+        if (nanosleep(&to, 0) && errno != EINTR) {
+            lcritical("nanosleep(%ld.%09ld) error %s", to.tv_sec, to.tv_nsec, core_log_errstr(errno));
+            return -1;
+        }
+    }
+    (void)ret;
+#endif
+
+    return 0;
+}
+
+int lib_coord_send(lib_coord_t* self, const char* line)
+{
+    mlassert_self();
+    lassert(line, "line is nil");
+
+    if (_self->conn.fd < 0) {
+        lfatal("not connected");
+    }
+    if (strchr(line, '\n')) {
+        lfatal("line can't contain newlines");
+    }
+
+    if (_write(self, _self->conn.fd, line, strlen(line)) || _write(self, _self->conn.fd, "\n", 1)) {
+        return -1;
+    }
+    return 0;
+}
+
+void lib_coord_close(lib_coord_t* self)
+{
+    mlassert_self();
+
+    _peer_close(&_self->conn);
+}
+
+/*
+ * Partition
+ */
+
+static void _receive(lib_coord_t* self, const core_object_t* obj)
+{
+    const core_object_t* o;
+    const uint8_t*       addr = 0;
+    size_t               len = 0, i;
+    uint64_t             h = 0xcbf29ce484222325ULL;
+    mlassert_self();
+
+    for (o = obj; o; o = o->obj_prev) {
+        if (o->obj_type == CORE_OBJECT_IP) {
+            const core_object_ip_t* ip = (const core_object_ip_t*)o;
+            addr                       = self->client == COORD_CLIENT_DST ? ip->dst : ip->src;
+            len                        = 4;
+            break;
+        }
+        if (o->obj_type == CORE_OBJECT_IP6) {
+            const core_object_ip6_t* ip6 = (const core_object_ip6_t*)o;
+            addr                         = self->client == COORD_CLIENT_DST ? ip6->dst : ip6->src;
+            len                          = 16;
+            break;
+        }
+    }
+
+    /* Objects without a client all go to the first partition. */
+    if (addr) {
+        for (i = 0; i < len; i++) {
+            h = (h ^ addr[i]) * 0x100000001b3ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+
+    if ((addr ? h % self->count : 0) != self->index) {
+        self->dropped++;
+        return;
+    }
+    self->passed++;
+    self->recv(self->ctx, obj);
+}
+
+core_receiver_t lib_coord_receiver(lib_coord_t* self)
+{
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+    if (!self->count || self->index >= self->count) {
+        lfatal("invalid partition %u of %u", self->index, self->count);
+    }
+
+    return (core_receiver_t)_receive;
+}
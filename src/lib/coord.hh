@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct lib_coord {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Partition of the clients passed on by the receiver, objects are
+     * passed if the hash of the client address modulo count is index. */
+    uint32_t index;
+    uint32_t count;
+    enum {
+        COORD_CLIENT_SRC = 0,
+        COORD_CLIENT_DST = 1
+    } client;
+
+    /* Common start epoch in nanoseconds of the controller's realtime
+     * clock, the controller's clock minus the local clock and the
+     * round-trip time of the probe the offset was estimated from. */
+    uint64_t epoch_ns;
+    int64_t  offset_ns;
+    uint64_t rtt_ns;
+
+    /* Number of workers connected to the controller. */
+    size_t workers;
+
+    uint64_t passed;
+    uint64_t dropped;
+} lib_coord_t;
+
+core_log_t* lib_coord_log();
+
+lib_coord_t* lib_coord_new();
+void lib_coord_free(lib_coord_t* self);
+
+int lib_coord_listen(lib_coord_t* self, const char* host, const char* port);
+int lib_coord_accept(lib_coord_t* self, size_t workers, uint64_t timeout_ms);
+int lib_coord_start(lib_coord_t* self, uint64_t lead_ms, const char* args);
+const char* lib_coord_recv(lib_coord_t* self, size_t* worker, uint64_t timeout_ms);
+
+int lib_coord_connect(lib_coord_t* self, const char* host, const char* port, const char* name, size_t probes);
+const char* lib_coord_wait(lib_coord_t* self, uint64_t timeout_ms);
+int lib_coord_sleep(lib_coord_t* self);
+int lib_coord_send(lib_coord_t* self, const char* line);
+void lib_coord_close(lib_coord_t* self);
+
+core_receiver_t lib_coord_receiver(lib_coord_t* self);
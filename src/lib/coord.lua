@@ -0,0 +1,218 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.lib.coord
+-- Coordinate a replay over multiple processes or hosts
+--   local coord = require("dnsjit.lib.coord").new()
+--   -- controller
+--   coord:listen("127.0.0.1", 5300)
+--   coord:accept(4)
+--   coord:start(2)
+--   require("dnsjit.output.dnssim").collect(coord, "merged.json")
+--   -- worker
+--   coord:connect("127.0.0.1", 5300)
+--   coord:wait()
+--   coord:receiver(output)
+--   input:receiver(coord)
+--   coord:sleep()
+--   output:stats_collect(1)
+--   ...
+--   output:report(coord)
+--
+-- Split a replay over worker processes, which may run on other hosts, and
+-- merge their results.
+-- The controller waits for the given number of workers to connect over a
+-- simple line-based TCP control protocol, then hands each worker its
+-- partition of the clients and a common start epoch.
+-- Every worker reads the whole input and passes on only the objects of its
+-- clients, by a hash of the client address, so all queries of a client are
+-- sent by the same worker and the partitions are the same for the same number
+-- of workers.
+-- The offset of the worker's clock to the controller's clock is estimated
+-- while connecting (from the probe with the shortest round trip), so the
+-- workers start at the same time even if their clocks differ.
+-- Finally the workers report their results as lines over the same
+-- connection, see
+-- .I report()
+-- and
+-- .I collect()
+-- of
+-- .I dnsjit.output.dnssim
+-- which merge the dnssim statistics of the workers.
+module(...,package.seeall)
+
+require("dnsjit.lib.coord_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Coord = {}
+
+-- Create a new Coord.
+function Coord.new()
+    local self = {
+        _receiver = nil,
+        obj = C.lib_coord_new(),
+    }
+    ffi.gc(self.obj, C.lib_coord_free)
+    return setmetatable(self, { __index = Coord })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Coord:log()
+    if self == nil then
+        return C.lib_coord_log()
+    end
+    return self.obj._log
+end
+
+-- Listen for workers on the given host and port (controller),
+-- host may be nil to listen on all addresses.
+-- Returns 0 on success.
+function Coord:listen(host, port)
+    return C.lib_coord_listen(self.obj, host, tostring(port))
+end
+
+-- Wait for the given number of workers to connect and finish their clock
+-- probes, up to
+-- .I timeout
+-- seconds (default 0, wait forever).
+-- Returns 0 on success.
+function Coord:accept(workers, timeout)
+    return C.lib_coord_accept(self.obj, workers, math.floor((timeout or 0) * 1000))
+end
+
+-- Start the workers,
+-- .I lead
+-- seconds (default 1) from now. The optional
+-- .I args
+-- (a string) are passed on to every worker and returned by its
+-- .IR wait() .
+-- Returns 0 on success.
+function Coord:start(lead, args)
+    if lead == nil then
+        lead = 1
+    end
+    return C.lib_coord_start(self.obj, math.floor(lead * 1000), args)
+end
+
+-- Return the index of the next worker that sent a line and the line, or nil
+-- when all workers have disconnected or nothing arrived within
+-- .I timeout
+-- seconds (default 0, wait forever).
+function Coord:recv(timeout)
+    local worker = ffi.new("size_t[1]")
+    local line = C.lib_coord_recv(self.obj, worker, math.floor((timeout or 0) * 1000))
+    if line == nil then
+        return
+    end
+    return tonumber(worker[0]), ffi.string(line)
+end
+
+-- Connect to the controller at the given host and port (worker), optionally
+-- giving the worker a
+-- .I name
+-- for the controller's log.
+-- The clock offset is estimated from
+-- .I probes
+-- (default 8) round trips.
+-- Returns 0 on success.
+function Coord:connect(host, port, name, probes)
+    return C.lib_coord_connect(self.obj, host, tostring(port), name, probes or 8)
+end
+
+-- Wait up to
+-- .I timeout
+-- seconds (default 0, wait forever) for the controller to start the workers,
+-- sets the partition and start epoch of this worker.
+-- Returns the args given to the controller's
+-- .I start()
+-- or nil on failure.
+function Coord:wait(timeout)
+    local args = C.lib_coord_wait(self.obj, math.floor((timeout or 0) * 1000))
+    if args == nil then
+        return
+    end
+    return ffi.string(args)
+end
+
+-- Sleep until the common start epoch.
+-- Returns 0 on success.
+function Coord:sleep()
+    return C.lib_coord_sleep(self.obj)
+end
+
+-- Send a line to the controller, it's returned by the controller's
+-- .IR recv() .
+-- Returns 0 on success.
+function Coord:send(line)
+    return C.lib_coord_send(self.obj, line)
+end
+
+-- Close the connection to the controller.
+function Coord:close()
+    C.lib_coord_close(self.obj)
+end
+
+-- Return the index of this worker's partition.
+function Coord:index()
+    return self.obj.index
+end
+
+-- Return the number of partitions (workers).
+function Coord:count()
+    return self.obj.count
+end
+
+-- Return the estimated offset in seconds of the controller's clock to the
+-- local clock and the round-trip time it was estimated from.
+function Coord:offset()
+    return tonumber(self.obj.offset_ns) / 1e9, tonumber(self.obj.rtt_ns) / 1e9
+end
+
+-- Set the partition to pass on without a controller, e.g. for local worker
+-- processes started with their index and the number of workers.
+function Coord:partition(index, count)
+    self.obj.index = index
+    self.obj.count = count
+end
+
+-- Identify clients by the destination address instead of the source address
+-- (e.g. after dnsjit.filter.ipsplit has written client IDs to it).
+function Coord:client_dst()
+    self.obj.client = "COORD_CLIENT_DST"
+end
+
+-- Return the number of objects passed on and dropped as belonging to other
+-- partitions.
+function Coord:stats()
+    return tonumber(self.obj.passed), tonumber(self.obj.dropped)
+end
+
+-- Return the C functions and context for receiving objects.
+function Coord:receive()
+    return C.lib_coord_receiver(self.obj), self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Coord:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- dnsjit.output.dnssim (3)
+return Coord
@@ -0,0 +1,408 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.lib.saturation
+-- Search for the highest load a DNS server sustains within a latency SLO
+--   local sat = require("dnsjit.lib.saturation").new(output)
+--   sat:slo(50, 99, 0.99)
+--   sat:steps(1, 1, 20)
+--   sat:bisect(0.05)
+--   sat:on_load(function(load)
+--       timing:multiply(1 / load)
+--   end)
+--   sat:start()
+-- .
+--   -- in the main loop, next to output:run_nowait()
+--   if not sat:check() then break end
+-- .
+--   print(sat:verdict())
+--   sat:export("saturation.json")
+--
+-- Controller which adjusts the offered load of a dnsjit.output.dnssim
+-- instance on the fly and converges on the knee point: the highest load
+-- at which the server still meets the SLO.
+-- The load is an abstract number passed to the
+-- .I on_load
+-- callback, e.g. a multiplier of the original speed of a replayed PCAP
+-- (see dnsjit.filter.timing) or the rate of a synthetic generator.
+-- .P
+-- Each load level is evaluated using the periodic statistics of dnssim
+-- (see
+-- .IR stats_collect() ),
+-- so statistics collection must be started before the controller.
+-- After changing the load, a number of warm-up intervals is skipped and
+-- the following intervals are evaluated together.
+-- Since requests are accounted to the interval in which they were sent, an
+-- interval is evaluated only after the request timeout has passed since its
+-- end.
+-- .P
+-- The load is first increased in steps (linearly or geometrically) until
+-- the SLO is violated or the maximum load is reached.
+-- If bisection is enabled, the interval between the last passing and the
+-- first failing load is then bisected until it's narrower than the given
+-- precision.
+-- .P
+-- See the dnssim-saturation.lua example for a complete script using PCAP
+-- replay or a synthetic generator.
+module(...,package.seeall)
+
+local log = require("dnsjit.core.log")
+local clock = require("dnsjit.lib.clock")
+
+local module_log = log.new("lib.saturation")
+local Saturation = {}
+
+-- Create a new Saturation controller for given dnsjit.output.dnssim
+-- instance.
+function Saturation.new(dnssim)
+    local self = setmetatable({
+        dnssim = dnssim,
+        slo_latency_ms = 100,
+        slo_percentile = 99,
+        slo_answer_ratio = 0.99,
+        start_load = 1,
+        step = 1,
+        factor = nil,
+        max_load = 100,
+        precision = nil,
+        warmup = 1,
+        measure = 3,
+        levels = {},
+        _on_load = nil,
+        _phase = nil,
+        _last = nil,
+        _log = log.new("lib.saturation", module_log),
+    }, { __index = Saturation })
+
+    self._log:debug("new()")
+
+    return self
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Saturation:log()
+    if self == nil then
+        return module_log
+    end
+    return self._log
+end
+
+-- Set the SLO: the given
+-- .I percentile
+-- (default 99) of latency must not exceed
+-- .I latency_ms
+-- milliseconds (default 100) and at least
+-- .I answer_ratio
+-- (default 0.99) of requests must be answered.
+function Saturation:slo(latency_ms, percentile, answer_ratio)
+    self.slo_latency_ms = latency_ms or 100
+    self.slo_percentile = percentile or 99
+    self.slo_answer_ratio = answer_ratio or 0.99
+end
+
+-- Increase the load linearly: start at
+-- .I start
+-- and add
+-- .I step
+-- after each passing level, up to
+-- .IR max .
+function Saturation:steps(start, step, max)
+    self.start_load = start
+    self.step = step
+    self.factor = nil
+    self.max_load = max
+end
+
+-- Increase the load geometrically: start at
+-- .I start
+-- and multiply it by
+-- .I factor
+-- after each passing level, up to
+-- .IR max .
+function Saturation:ramp(start, factor, max)
+    if factor <= 1 then
+        self._log:fatal("ramp factor must be greater than 1")
+    end
+    self.start_load = start
+    self.step = nil
+    self.factor = factor
+    self.max_load = max
+end
+
+-- Refine the result by bisection until the difference between passing and
+-- failing load is lower than
+-- .I precision
+-- (relative to the failing load, default 0.05).
+function Saturation:bisect(precision)
+    self.precision = precision or 0.05
+end
+
+-- Set the number of statistics intervals skipped after changing the load
+-- (default 1) and the number of intervals the load level is evaluated from
+-- (default 3).
+function Saturation:intervals(warmup, measure)
+    self.warmup = warmup or 1
+    self.measure = measure or 3
+    if self.measure < 1 then
+        self._log:fatal("at least one interval must be measured")
+    end
+end
+
+-- Set the function which applies the given load, it's called with the load
+-- as the only argument.
+function Saturation:on_load(func)
+    self._on_load = func
+end
+
+local function _now_ms()
+    local sec, nsec = clock.realtime()
+    return sec * 1000 + math.floor(nsec / 1000000)
+end
+
+function Saturation:_set_load(load)
+    self.load = load
+    self._since_ms = _now_ms()
+    self._skip = self.warmup
+    self._acc = nil
+    self._log:notice("offered load set to "..load)
+    self._on_load(load)
+end
+
+-- Start the search by applying the initial load.
+function Saturation:start()
+    if self._on_load == nil then
+        self._log:fatal("on_load() callback must be set")
+    end
+    if self.dnssim.obj.stats_interval_ms == 0 then
+        self._log:fatal("dnssim statistics collection must be started")
+    end
+    self._phase = "steps"
+    self._low = nil
+    self._high = nil
+    self:_set_load(self.start_load)
+end
+
+local function _percentile(hist, total, timeout_ms, pct)
+    local rank = math.ceil(total * pct / 100)
+    local seen = 0
+    for i = 0, timeout_ms do
+        seen = seen + hist[i]
+        if seen >= rank and seen > 0 then
+            return i
+        end
+    end
+    return timeout_ms
+end
+
+function Saturation:_accumulate(stats)
+    local timeout_ms = tonumber(self.dnssim.obj.timeout_ms)
+    local acc = self._acc
+    if acc == nil then
+        acc = { since_ms = tonumber(stats.since_ms), requests = 0, answers = 0, intervals = 0, hist = {} }
+        for i = 0, timeout_ms do
+            acc.hist[i] = 0
+        end
+        self._acc = acc
+    end
+    acc.until_ms = tonumber(stats.until_ms)
+    acc.requests = acc.requests + tonumber(stats.requests)
+    acc.answers = acc.answers + tonumber(stats.answers)
+    acc.intervals = acc.intervals + 1
+    for i = 0, timeout_ms do
+        acc.hist[i] = acc.hist[i] + tonumber(stats.latency[i])
+    end
+end
+
+function Saturation:_finish_level()
+    local acc = self._acc
+    local timeout_ms = tonumber(self.dnssim.obj.timeout_ms)
+    local total = 0
+    for i = 0, timeout_ms do
+        total = total + acc.hist[i]
+    end
+
+    local level = {
+        load = self.load,
+        qps = acc.requests * 1000 / math.max(acc.until_ms - acc.since_ms, 1),
+        requests = acc.requests,
+        answers = acc.answers,
+        answer_ratio = acc.requests > 0 and acc.answers / acc.requests or 0,
+        latency = _percentile(acc.hist, total, timeout_ms, self.slo_percentile),
+        timeouts = acc.hist[timeout_ms],
+    }
+    level.ok = acc.requests > 0
+        and level.answer_ratio >= self.slo_answer_ratio
+        and level.latency <= self.slo_latency_ms
+    table.insert(self.levels, level)
+
+    self._log:notice(string.format("load %g: %.1f QPS, answered %.4f, p%g %d ms, timeouts %d: %s",
+        level.load, level.qps, level.answer_ratio, self.slo_percentile, level.latency,
+        level.timeouts, level.ok and "pass" or "fail"))
+
+    if level.ok then
+        self._low = level
+    else
+        self._high = level
+    end
+end
+
+-- Pick the next load level, returns nil when the search is finished.
+function Saturation:_next_load()
+    if self._phase == "steps" then
+        if self._high == nil then
+            local load
+            if self.factor then
+                load = self.load * self.factor
+            else
+                load = self.load + self.step
+            end
+            if load > self.max_load then
+                return nil
+            end
+            return load
+        end
+        if self.precision == nil or self._low == nil then
+            return nil
+        end
+        self._phase = "bisect"
+    end
+
+    if self._high.load - self._low.load <= self.precision * self._high.load then
+        return nil
+    end
+    return (self._low.load + self._high.load) / 2
+end
+
+-- Evaluate statistics intervals which are complete and adjust the load.
+-- Should be called regularly from the main loop.
+-- Returns false once the search is finished.
+function Saturation:check()
+    if self._phase == nil then
+        return false
+    end
+
+    local obj = self.dnssim.obj
+    local now_ms = _now_ms()
+    local stats
+    if self._last == nil then
+        stats = obj.stats_first
+    else
+        stats = self._last.next
+    end
+
+    while stats ~= nil and stats.next ~= nil and tonumber(stats.until_ms) + tonumber(obj.timeout_ms) <= now_ms do
+        self._last = stats
+        if tonumber(stats.since_ms) >= self._since_ms then
+            if self._skip > 0 then
+                self._skip = self._skip - 1
+            else
+                self:_accumulate(stats)
+                if self._acc.intervals >= self.measure then
+                    self:_finish_level()
+                    local load = self:_next_load()
+                    if load == nil then
+                        self._phase = nil
+                        self._log:notice(self:verdict())
+                        return false
+                    end
+                    self:_set_load(load)
+                end
+            end
+        end
+        stats = stats.next
+    end
+
+    return true
+end
+
+-- Return the list of evaluated load levels (the load-vs-latency curve).
+-- Each level is a table with
+-- .IR load ,
+-- .I qps
+-- (achieved),
+-- .IR requests ,
+-- .IR answers ,
+-- .IR answer_ratio ,
+-- .I latency
+-- (the SLO percentile in ms),
+-- .I timeouts
+-- and
+-- .I ok
+-- (whether the SLO was met).
+function Saturation:curve()
+    return self.levels
+end
+
+-- Return the final verdict as a string, followed by the highest passing
+-- level (or nil if the SLO wasn't met at any load).
+function Saturation:verdict()
+    local slo = string.format("p%g <= %g ms, answered >= %g", self.slo_percentile,
+        self.slo_latency_ms, self.slo_answer_ratio)
+    if self._low == nil then
+        return "SLO ("..slo..") not met at any tested load", nil
+    end
+    if self._high == nil then
+        return string.format("SLO (%s) met up to the maximum tested load %g (%.1f QPS)",
+            slo, self._low.load, self._low.qps), self._low
+    end
+    return string.format("maximum load within SLO (%s) is %g (%.1f QPS), fails at %g",
+        slo, self._low.load, self._low.qps, self._high.load), self._low
+end
+
+-- Export the curve and the verdict to a JSON file.
+function Saturation:export(filename)
+    local file = io.open(filename, "w")
+    if file == nil then
+        self._log:critical("export failed: no filename")
+        return
+    end
+
+    local verdict, best = self:verdict()
+    file:write(
+        "{ ",
+            '"slo_latency_ms":', self.slo_latency_ms, ',',
+            '"slo_percentile":', self.slo_percentile, ',',
+            '"slo_answer_ratio":', self.slo_answer_ratio, ',',
+            '"verdict":"', verdict, '",',
+            '"max_load":', best and best.load or "null", ',',
+            '"max_qps":', best and best.qps or "null", ',',
+            '"levels":[')
+    for i, level in ipairs(self.levels) do
+        if i > 1 then
+            file:write(',')
+        end
+        file:write(
+            "{ ",
+                '"load":', level.load, ',',
+                '"qps":', level.qps, ',',
+                '"requests":', level.requests, ',',
+                '"answers":', level.answers, ',',
+                '"answer_ratio":', level.answer_ratio, ',',
+                '"latency_ms":', level.latency, ',',
+                '"timeouts":', level.timeouts, ',',
+                '"ok":', tostring(level.ok),
+            "}")
+    end
+    file:write(']}')
+    file:close()
+    self._log:notice("results exported to "..filename)
+end
+
+-- dnsjit.output.dnssim (3),
+-- dnsjit.filter.timing (3)
+return Saturation
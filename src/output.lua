@@ -23,7 +23,11 @@
 -- replay them against other targets.
 module(...,package.seeall)
 
+-- dnsjit.output.afpacket (3),
+-- dnsjit.output.aggregate (3),
+-- dnsjit.output.cachesim (3),
 -- dnsjit.output.dnscli (3),
+-- dnsjit.output.dnstap (3),
 -- dnsjit.output.null (3),
 -- dnsjit.output.pcap (3),
 -- dnsjit.output.respdiff (3),
@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/afpacket.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/inet.h"
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <poll.h>
+#endif
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define DLT_EN10MB 1
+#define DLT_RAW 12
+#define LINKTYPE_RAW 101
+
+#define ETH_HLEN_ 14
+
+static core_log_t         _log      = LOG_T_INIT("output.afpacket");
+static output_afpacket_t _defaults = {
+    LOG_T_INIT_OBJ("output.afpacket"),
+    -1, 0, 0,
+    0, 0, 0, 0,
+    0,
+    64, 0, 0,
+    0, 0,
+    { 0 }, { 0 },
+    0, 0, 0, 0,
+    { 0 }, { 0 },
+    { 0 }, { 0 },
+    0, 0, 0, 0, 0, 0
+};
+
+core_log_t* output_afpacket_log()
+{
+    return &_log;
+}
+
+void output_afpacket_init(output_afpacket_t* self)
+{
+    mlassert_self();
+
+    *self = _defaults;
+}
+
+void output_afpacket_destroy(output_afpacket_t* self)
+{
+    mlassert_self();
+
+    output_afpacket_close(self);
+}
+
+int output_afpacket_open(output_afpacket_t* self, const char* ifname, size_t frame_size, size_t frames)
+{
+#ifdef HAVE_LINUX_IF_PACKET_H
+    struct tpacket_req req;
+    struct sockaddr_ll sll;
+    int                ver = TPACKET_V2, one = 1;
+    long               page;
+    size_t             block_size;
+    mlassert_self();
+    lassert(ifname, "ifname is nil");
+    if (self->fd > -1) {
+        lfatal("already opened");
+    }
+
+    /* Frames have to be aligned and blocks a multiple of the page size. */
+    frame_size = TPACKET_ALIGN(frame_size);
+    if (frame_size < TPACKET2_HDRLEN + ETH_HLEN_) {
+        lcritical("frame size %zu too small", frame_size);
+        return -1;
+    }
+    if ((page = sysconf(_SC_PAGESIZE)) < 1) {
+        page = 4096;
+    }
+    block_size = ((frame_size + page - 1) / page) * page;
+    while (block_size < (size_t)page * 16 && block_size * 2 / frame_size <= frames) {
+        block_size *= 2;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_frame_size = frame_size;
+    req.tp_block_size = block_size;
+    req.tp_block_nr   = (frames + block_size / frame_size - 1) / (block_size / frame_size);
+    req.tp_frame_nr   = req.tp_block_nr * (block_size / frame_size);
+
+    /* Protocol 0 in bind() too, otherwise it registers a receive hook. */
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = 0;
+    if (!(sll.sll_ifindex = if_nametoindex(ifname))) {
+        lcritical("unknown interface %s", ifname);
+        return -1;
+    }
+
+    /* Protocol 0 so nothing is received on this socket. */
+    if ((self->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    if (setsockopt(self->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) {
+        lcritical("setsockopt(PACKET_VERSION) error %s", core_log_errstr(errno));
+        goto fail;
+    }
+#ifdef PACKET_QDISC_BYPASS
+    if (self->qdisc_bypass && setsockopt(self->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one))) {
+        lwarning("setsockopt(PACKET_QDISC_BYPASS) error %s", core_log_errstr(errno));
+    }
+#endif
+    if (setsockopt(self->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+        lcritical("setsockopt(PACKET_TX_RING) error %s", core_log_errstr(errno));
+        goto fail;
+    }
+
+    self->ring_size = (size_t)req.tp_block_size * req.tp_block_nr;
+    if ((self->ring = mmap(0, self->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0)) == MAP_FAILED) {
+        lcritical("mmap() error %s", core_log_errstr(errno));
+        self->ring = 0;
+        goto fail;
+    }
+    if (bind(self->fd, (struct sockaddr*)&sll, sizeof(sll))) {
+        lcritical("bind(%s) error %s", ifname, core_log_errstr(errno));
+        goto fail;
+    }
+
+    self->block_size       = req.tp_block_size;
+    self->frame_size       = req.tp_frame_size;
+    self->frames_per_block = req.tp_block_size / req.tp_frame_size;
+    self->frame_nr         = req.tp_frame_nr;
+    self->frame            = 0;
+    self->queued           = 0;
+    ldebug("opened %s, %u frames of %u bytes", ifname, self->frame_nr, self->frame_size);
+
+    return 0;
+
+fail:
+    if (self->ring) {
+        munmap(self->ring, self->ring_size);
+        self->ring = 0;
+    }
+    close(self->fd);
+    self->fd = -1;
+    return -1;
+#else
+    mlassert_self();
+    lcritical("AF_PACKET is not supported on this system");
+    return -1;
+#endif
+}
+
+static int _parse_mac(const char* str, uint8_t* mac)
+{
+    unsigned int b[6];
+    int          i;
+
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return -1;
+    }
+    for (i = 0; i < 6; i++) {
+        if (b[i] > 0xff) {
+            return -1;
+        }
+        mac[i] = b[i];
+    }
+    return 0;
+}
+
+int output_afpacket_mac(output_afpacket_t* self, const char* src, const char* dst)
+{
+    mlassert_self();
+
+    if (src) {
+        if (_parse_mac(src, self->mac_src)) {
+            lcritical("invalid MAC address %s", src);
+            return -1;
+        }
+        self->rewrite_mac_src = 1;
+    }
+    if (dst) {
+        if (_parse_mac(dst, self->mac_dst)) {
+            lcritical("invalid MAC address %s", dst);
+            return -1;
+        }
+        self->rewrite_mac_dst = 1;
+    }
+    return 0;
+}
+
+static int _parse_ip(output_afpacket_t* self, const char* str, int is_dst)
+{
+    if (inet_pton(AF_INET, str, is_dst ? self->ip4_dst : self->ip4_src) == 1) {
+        if (is_dst) {
+            self->rewrite_ip4_dst = 1;
+        } else {
+            self->rewrite_ip4_src = 1;
+        }
+        return 0;
+    }
+    if (inet_pton(AF_INET6, str, is_dst ? self->ip6_dst : self->ip6_src) == 1) {
+        if (is_dst) {
+            self->rewrite_ip6_dst = 1;
+        } else {
+            self->rewrite_ip6_src = 1;
+        }
+        return 0;
+    }
+    lcritical("invalid IP address %s", str);
+    return -1;
+}
+
+int output_afpacket_ip(output_afpacket_t* self, const char* src, const char* dst)
+{
+    mlassert_self();
+
+    if (src && _parse_ip(self, src, 0)) {
+        return -1;
+    }
+    if (dst && _parse_ip(self, dst, 1)) {
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+static inline struct tpacket2_hdr* _frame(output_afpacket_t* self, uint32_t n)
+{
+    return (struct tpacket2_hdr*)(self->ring + (size_t)(n / self->frames_per_block) * self->block_size
+                                  + (size_t)(n % self->frames_per_block) * self->frame_size);
+}
+
+static int _kick(output_afpacket_t* self)
+{
+    self->queued = 0;
+    self->kicks++;
+    if (sendto(self->fd, 0, 0, MSG_DONTWAIT, 0, 0) < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case ENOBUFS:
+        case EINTR:
+            break;
+        default:
+            self->errors++;
+            lwarning("sendto() error %s", core_log_errstr(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+int output_afpacket_flush(output_afpacket_t* self)
+{
+    mlassert_self();
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+    if (self->fd > -1 && self->queued) {
+        return _kick(self);
+    }
+#endif
+    return 0;
+}
+
+static void _flush(output_afpacket_t* self)
+{
+    output_afpacket_flush(self);
+}
+
+void output_afpacket_close(output_afpacket_t* self)
+{
+#ifdef HAVE_LINUX_IF_PACKET_H
+    struct pollfd pfd;
+    uint32_t      n;
+    int           tries;
+    mlassert_self();
+
+    if (self->fd < 0) {
+        return;
+    }
+
+    /* Wait for the kernel to send out what's left in the ring. */
+    output_afpacket_flush(self);
+    for (tries = 0; tries < 100; tries++) {
+        for (n = 0; n < self->frame_nr; n++) {
+            if (_frame(self, n)->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+                break;
+            }
+        }
+        if (n == self->frame_nr) {
+            break;
+        }
+        pfd.fd     = self->fd;
+        pfd.events = POLLOUT;
+        poll(&pfd, 1, 10);
+        _kick(self);
+    }
+
+    munmap(self->ring, self->ring_size);
+    self->ring = 0;
+    close(self->fd);
+    self->fd = -1;
+#else
+    mlassert_self();
+#endif
+}
+
+static void _rewrite_ip(output_afpacket_t* self, uint8_t* ip, size_t len)
+{
+    uint8_t  old[32], *csum, nxt;
+    size_t   hl, off;
+    int      is_udp;
+
+    if (len >= 20 && (ip[0] >> 4) == 4 && (self->rewrite_ip4_src || self->rewrite_ip4_dst)) {
+        hl = (ip[0] & 0xf) * 4;
+        if (hl < 20 || hl > len) {
+            return;
+        }
+        memcpy(old, ip + 12, 8);
+        if (self->rewrite_ip4_src) {
+            memcpy(ip + 12, self->ip4_src, 4);
+        }
+        if (self->rewrite_ip4_dst) {
+            memcpy(ip + 16, self->ip4_dst, 4);
+        }
+        core_inet_csum_replace(ip + 10, 0, old, ip + 12, 8, 0);
+        /* Only the first fragment carries the transport header. */
+        if (!(((ip[6] << 8) | ip[7]) & 0x1fff)
+            && (csum = core_inet_l4_csum(ip + hl, len - hl, ip[9], 1, &is_udp))) {
+            core_inet_csum_replace(csum, is_udp, old, ip + 12, 8, 0);
+        }
+    } else if (len >= 40 && (ip[0] >> 4) == 6 && (self->rewrite_ip6_src || self->rewrite_ip6_dst)) {
+        memcpy(old, ip + 8, 32);
+        if (self->rewrite_ip6_src) {
+            memcpy(ip + 8, self->ip6_src, 16);
+        }
+        if (self->rewrite_ip6_dst) {
+            memcpy(ip + 24, self->ip6_dst, 16);
+        }
+
+        off = core_inet_ip6_l4(ip, len, &nxt);
+        if (off && off <= len && (csum = core_inet_l4_csum(ip + off, len - off, nxt, 0, &is_udp))) {
+            core_inet_csum_replace(csum, is_udp, old, ip + 8, 32, 0);
+        }
+    }
+}
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+/* Get the next free frame, kicks the kernel and waits while the ring is full. */
+static struct tpacket2_hdr* _next_frame(output_afpacket_t* self)
+{
+    struct tpacket2_hdr* hdr = _frame(self, self->frame);
+    struct pollfd        pfd;
+
+    while (hdr->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        self->ring_full++;
+        if (_kick(self)) {
+            return 0;
+        }
+        pfd.fd     = self->fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+            self->errors++;
+            lwarning("poll() error %s", core_log_errstr(errno));
+            return 0;
+        }
+    }
+    if (hdr->tp_status & TP_STATUS_WRONG_FORMAT) {
+        self->errors++;
+        ldebug("frame rejected by kernel (wrong format)");
+    }
+    return hdr;
+}
+#endif
+
+static void _receive(output_afpacket_t* self, const core_object_t* obj)
+{
+#ifdef HAVE_LINUX_IF_PACKET_H
+    const core_object_pcap_t* pkt;
+    struct tpacket2_hdr*      hdr;
+    uint8_t*                  data;
+    size_t                    len, eth = 0, room;
+    uint16_t                  type;
+    mlassert_self();
+
+    while (obj && obj->obj_type != CORE_OBJECT_PCAP) {
+        obj = obj->obj_prev;
+    }
+    if (!obj) {
+        self->dropped++;
+        ldebug("packet dropped (no PCAP object)");
+        return;
+    }
+    pkt = (const core_object_pcap_t*)obj;
+
+    switch (pkt->linktype) {
+    case DLT_EN10MB:
+        if (pkt->caplen < ETH_HLEN_) {
+            self->dropped++;
+            return;
+        }
+        break;
+    case DLT_RAW:
+    case LINKTYPE_RAW:
+        /* Raw IP gets an Ethernet header built from the set MACs. */
+        eth = ETH_HLEN_;
+        break;
+    default:
+        self->dropped++;
+        ldebug("packet dropped (unsupported linktype %u)", pkt->linktype);
+        return;
+    }
+
+    len  = pkt->caplen + eth;
+    room = self->frame_size - (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll));
+    if (len > room) {
+        self->dropped++;
+        ldebug("packet dropped (%zu bytes does not fit frame)", len);
+        return;
+    }
+
+    if (!(hdr = _next_frame(self))) {
+        self->dropped++;
+        return;
+    }
+    data = (uint8_t*)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+    if (eth) {
+        if (!pkt->caplen) {
+            self->dropped++;
+            return;
+        }
+        memcpy(data, self->mac_dst, 6);
+        memcpy(data + 6, self->mac_src, 6);
+        type     = (pkt->bytes[0] >> 4) == 6 ? ETH_P_IPV6 : ETH_P_IP;
+        data[12] = type >> 8;
+        data[13] = type & 0xff;
+    }
+    memcpy(data + eth, pkt->bytes, pkt->caplen);
+
+    if (self->rewrite_mac_dst) {
+        memcpy(data, self->mac_dst, 6);
+    }
+    if (self->rewrite_mac_src) {
+        memcpy(data + 6, self->mac_src, 6);
+    }
+    if (self->rewrite_ip4_src || self->rewrite_ip4_dst || self->rewrite_ip6_src || self->rewrite_ip6_dst) {
+        /* Skip VLAN tags. */
+        eth  = 12;
+        type = (data[eth] << 8) | data[eth + 1];
+        while ((type == 0x8100 || type == 0x88a8) && eth + 6 <= len) {
+            eth += 4;
+            type = (data[eth] << 8) | data[eth + 1];
+        }
+        eth += 2;
+        if (type == ETH_P_IP || type == ETH_P_IPV6) {
+            _rewrite_ip(self, data + eth, len - eth);
+        }
+    }
+
+    hdr->tp_len    = len;
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+    if (++self->frame == self->frame_nr) {
+        self->frame = 0;
+    }
+    self->packets++;
+    self->bytes += len;
+
+    if (++self->queued >= self->batch) {
+        _kick(self);
+    }
+#endif
+}
+
+core_receiver_t output_afpacket_receiver(output_afpacket_t* self)
+{
+    if (self->fd < 0) {
+        lfatal("not opened");
+    }
+
+    return (core_receiver_t)_receive;
+}
+
+output_afpacket_flush_t output_afpacket_flusher(output_afpacket_t* self)
+{
+    return (output_afpacket_flush_t)_flush;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef void (*output_afpacket_flush_t)(void* ctx);
+
+typedef struct output_afpacket {
+    core_log_t _log;
+
+    int      fd;
+    uint8_t* ring;
+    size_t   ring_size;
+    uint32_t block_size, frame_size, frames_per_block, frame_nr;
+    uint32_t frame;
+    /* Frames to queue before kicking the kernel to send them. */
+    uint32_t batch, queued;
+    uint8_t  qdisc_bypass;
+
+    /* Optional rewriting of MAC and IP addresses, also used to build the
+     * Ethernet header for raw IP packets. */
+    uint8_t rewrite_mac_src, rewrite_mac_dst;
+    uint8_t mac_src[6], mac_dst[6];
+    uint8_t rewrite_ip4_src, rewrite_ip4_dst, rewrite_ip6_src, rewrite_ip6_dst;
+    uint8_t ip4_src[4], ip4_dst[4];
+    uint8_t ip6_src[16], ip6_dst[16];
+
+    uint64_t packets, bytes, kicks, ring_full, dropped, errors;
+} output_afpacket_t;
+
+core_log_t* output_afpacket_log();
+void output_afpacket_init(output_afpacket_t* self);
+void output_afpacket_destroy(output_afpacket_t* self);
+int output_afpacket_open(output_afpacket_t* self, const char* ifname, size_t frame_size, size_t frames);
+int output_afpacket_mac(output_afpacket_t* self, const char* src, const char* dst);
+int output_afpacket_ip(output_afpacket_t* self, const char* src, const char* dst);
+int output_afpacket_flush(output_afpacket_t* self);
+void output_afpacket_close(output_afpacket_t* self);
+
+core_receiver_t output_afpacket_receiver(output_afpacket_t* self);
+output_afpacket_flush_t output_afpacket_flusher(output_afpacket_t* self);
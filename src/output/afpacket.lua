@@ -0,0 +1,156 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.afpacket
+-- Send raw packets to a network interface using an AF_PACKET TX ring
+--   local output = require("dnsjit.output.afpacket").new()
+--   output:mac(nil, "02:00:00:00:00:02")
+--   output:open("eth0")
+--   local timing = require("dnsjit.filter.timing").new()
+--   timing:receiver(output)
+--   timing:flush(output)
+--   ...
+--   output:close()
+--
+-- Output module which puts
+-- .I dnsjit.core.object.pcap
+-- objects back on the wire as they were captured (addresses, ports, IP IDs,
+-- fragments), unlike the socket based outputs.
+-- Packets are copied into a memory mapped
+-- .B PACKET_TX_RING
+-- (TPACKET_V2) and the kernel is kicked to send them once a batch of
+-- frames is queued, so one system call sends many packets.
+-- Requires Linux and CAP_NET_RAW.
+-- .P
+-- Packets with Ethernet linktype are sent as is, raw IP packets get an
+-- Ethernet header built from the MAC addresses set by
+-- .IR mac() .
+-- The MAC and IP addresses can be rewritten, the IPv4 header and
+-- UDP/TCP/ICMPv6 checksums are then updated incrementally.
+-- Only the captured part of the packet is sent.
+-- .P
+-- For pacing use dnsjit.filter.timing and set this output with
+-- .I flush()
+-- of the filter so queued packets are sent before it sleeps, otherwise
+-- they wait for the batch to fill up.
+-- The output can be tested over a veth pair, e.g.
+-- .BR "ip link add veth0 type veth peer name veth1" .
+module(...,package.seeall)
+
+require("dnsjit.output.afpacket_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "output_afpacket_t"
+local output_afpacket_t = ffi.typeof(t_name)
+local AfPacket = {}
+
+-- Create a new AfPacket output.
+function AfPacket.new()
+    local self = {
+        obj = output_afpacket_t(),
+    }
+    C.output_afpacket_init(self.obj)
+    ffi.gc(self.obj, C.output_afpacket_destroy)
+    return setmetatable(self, { __index = AfPacket })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function AfPacket:log()
+    if self == nil then
+        return C.output_afpacket_log()
+    end
+    return self.obj._log
+end
+
+-- Set the number of packets queued before the kernel is kicked to send
+-- them (default 64).
+function AfPacket:batch(frames)
+    self.obj.batch = frames
+end
+
+-- Bypass the queuing discipline of the interface (default false), must be
+-- set before
+-- .IR open() .
+function AfPacket:qdisc_bypass(bool)
+    if bool == nil or bool == true then
+        self.obj.qdisc_bypass = 1
+    else
+        self.obj.qdisc_bypass = 0
+    end
+end
+
+-- Set the source and/or destination MAC address (e.g. "02:00:00:00:00:01")
+-- written to sent packets, nil leaves the address unchanged.
+-- Returns 0 on success.
+function AfPacket:mac(src, dst)
+    return C.output_afpacket_mac(self.obj, src, dst)
+end
+
+-- Set the source and/or destination IP address written to sent packets of
+-- the same family, nil leaves the address unchanged.
+-- Can be called once for IPv4 and once for IPv6.
+-- Returns 0 on success.
+function AfPacket:ip(src, dst)
+    return C.output_afpacket_ip(self.obj, src, dst)
+end
+
+-- Open the TX ring on interface
+-- .I ifname
+-- with
+-- .I frames
+-- (default 4096) frames of
+-- .I frame_size
+-- bytes (default 2048, must fit the largest packet plus ring header).
+-- Returns 0 on success.
+function AfPacket:open(ifname, frame_size, frames)
+    return C.output_afpacket_open(self.obj, ifname, frame_size or 2048, frames or 4096)
+end
+
+-- Kick the kernel to send the queued packets.
+-- Returns 0 on success.
+function AfPacket:flush()
+    return C.output_afpacket_flush(self.obj)
+end
+
+-- Send what's left in the ring and close it.
+function AfPacket:close()
+    C.output_afpacket_close(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function AfPacket:receive()
+    return C.output_afpacket_receiver(self.obj), self.obj
+end
+
+-- Return the C function and context for flushing queued packets.
+function AfPacket:flusher()
+    return C.output_afpacket_flusher(self.obj), self.obj
+end
+
+-- Return the number of packets and bytes sent, kernel kicks, times the
+-- ring was full, packets dropped (unsupported linktype or too large) and
+-- errors.
+function AfPacket:stats()
+    return tonumber(self.obj.packets), tonumber(self.obj.bytes), tonumber(self.obj.kicks),
+        tonumber(self.obj.ring_full), tonumber(self.obj.dropped), tonumber(self.obj.errors)
+end
+
+-- dnsjit.filter.timing (3),
+-- dnsjit.output.pcap (3)
+return AfPacket
@@ -0,0 +1,588 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/aggregate.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COUNTERS (1 << 24)
+#define MAX_SIZE 4096
+#define NO_SEC INT64_MIN
+
+static core_log_t         _log      = LOG_T_INIT("output.aggregate");
+static output_aggregate_t _defaults = {
+    LOG_T_INIT_OBJ("output.aggregate"),
+    (1 << AGGREGATE_DIM_RCODE), (1 << AGGREGATE_METRIC_PACKETS),
+    { 1, 10, 60, 0 }, 3,
+    64,
+    2, 10,
+    0, 0, 0,
+    { 0 }, 0, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER, 0,
+    0, 0,
+    { 0 }, NO_SEC, NO_SEC,
+    0, 0, 0, 0
+};
+
+static const char* _dim_names[AGGREGATE_DIMS] = {
+    "qr", "opcode", "rcode", "qtype", "transport", "family", "size"
+};
+static const char* _metric_names[AGGREGATE_METRICS] = {
+    "packets", "bytes"
+};
+static const char* _transport_names[3] = {
+    "udp", "tcp", "other"
+};
+
+core_log_t* output_aggregate_log()
+{
+    return &_log;
+}
+
+void output_aggregate_init(output_aggregate_t* self)
+{
+    mlassert_self();
+
+    *self = _defaults;
+    if (pthread_mutex_init(&self->lock, 0)) {
+        lfatal("pthread_mutex_init() failed");
+    }
+}
+
+static void _free_buckets(output_aggregate_bucket_t* b)
+{
+    output_aggregate_bucket_t* next;
+
+    for (; b; b = next) {
+        next = b->next;
+        free(b->counters);
+        free(b);
+    }
+}
+
+void output_aggregate_destroy(output_aggregate_t* self)
+{
+    output_aggregate_shard_t* shard;
+    size_t                    i;
+    mlassert_self();
+
+    while ((shard = self->shards)) {
+        self->shards = shard->next;
+        _free_buckets(shard->ring);
+        _free_buckets(shard->free_buckets);
+        free(shard);
+    }
+    _free_buckets(self->pending);
+    _free_buckets(self->free_buckets);
+    for (i = 0; i < 4; i++) {
+        _free_buckets(self->rollup[i]);
+    }
+    if (self->fp) {
+        fclose(self->fp);
+    }
+    pthread_mutex_destroy(&self->lock);
+}
+
+const char* output_aggregate_dim_name(output_aggregate_dim_t dim)
+{
+    return dim < AGGREGATE_DIMS ? _dim_names[dim] : 0;
+}
+
+uint32_t output_aggregate_cell(output_aggregate_t* self, size_t cell, output_aggregate_dim_t dim)
+{
+    int      d;
+    uint32_t v = 0;
+    mlassert_self();
+
+    for (d = AGGREGATE_DIMS - 1; d >= 0; d--) {
+        if (!(self->dims & (1 << d))) {
+            continue;
+        }
+        v = cell % self->radix[d];
+        cell /= self->radix[d];
+        if (d == dim) {
+            break;
+        }
+    }
+    if (d < 0) {
+        return 0;
+    }
+
+    switch (dim) {
+    case AGGREGATE_DIM_FAMILY:
+        return v ? 6 : 4;
+    case AGGREGATE_DIM_SIZE:
+        return v * self->size_step;
+    default:
+        break;
+    }
+    return v;
+}
+
+/* Set up the layout of the counters, once the first shard is created. */
+static void _start(output_aggregate_t* self)
+{
+    size_t i, d;
+
+    if (self->started) {
+        return;
+    }
+
+    if (!self->resolutions || self->resolutions > 4) {
+        lfatal("invalid number of resolutions");
+    }
+    for (i = 0; i < self->resolutions; i++) {
+        if (!self->resolution[i] || (i && self->resolution[i] <= self->resolution[i - 1])) {
+            lfatal("resolutions must be positive and ascending");
+        }
+    }
+    if (!self->size_step || self->size_step > MAX_SIZE) {
+        lfatal("invalid size step");
+    }
+
+    self->radix[AGGREGATE_DIM_QR]        = 2;
+    self->radix[AGGREGATE_DIM_OPCODE]    = 16;
+    self->radix[AGGREGATE_DIM_RCODE]     = 16;
+    self->radix[AGGREGATE_DIM_QTYPE]     = 256;
+    self->radix[AGGREGATE_DIM_TRANSPORT] = 3;
+    self->radix[AGGREGATE_DIM_FAMILY]    = 2;
+    self->radix[AGGREGATE_DIM_SIZE]      = MAX_SIZE / self->size_step + 1;
+
+    self->cells = 1;
+    for (d = 0; d < AGGREGATE_DIMS; d++) {
+        if (self->dims & (1 << d)) {
+            self->cells *= self->radix[d];
+        }
+    }
+    /* Packets are always counted, rows without packets are skipped. */
+    self->metrics |= 1 << AGGREGATE_METRIC_PACKETS;
+    self->nmetrics = 0;
+    for (d = 0; d < AGGREGATE_METRICS; d++) {
+        if (self->metrics & (1 << d)) {
+            self->nmetrics++;
+        }
+    }
+    if (self->cells * self->nmetrics > MAX_COUNTERS) {
+        lfatal("too many cells (%zu), use fewer dimensions", self->cells);
+    }
+
+    self->started = 1;
+}
+
+int output_aggregate_open(output_aggregate_t* self, const char* file)
+{
+    FILE*  fp;
+    size_t d;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (self->fp) {
+        lfatal("already opened");
+    }
+    self->metrics |= 1 << AGGREGATE_METRIC_PACKETS;
+    if (!(fp = fopen(file, "w"))) {
+        lcritical("fopen(%s) failed: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    fputs("resolution,time", fp);
+    for (d = 0; d < AGGREGATE_DIMS; d++) {
+        if (self->dims & (1 << d)) {
+            fprintf(fp, ",%s", _dim_names[d]);
+        }
+    }
+    for (d = 0; d < AGGREGATE_METRICS; d++) {
+        if (self->metrics & (1 << d)) {
+            fprintf(fp, ",%s", _metric_names[d]);
+        }
+    }
+    fputc('\n', fp);
+    self->fp = fp;
+
+    return 0;
+}
+
+output_aggregate_shard_t* output_aggregate_shard(output_aggregate_t* self)
+{
+    output_aggregate_shard_t* shard;
+    mlassert_self();
+
+    lfatal_oom(shard = calloc(1, sizeof(output_aggregate_shard_t)));
+    shard->agg = self;
+    shard->sec = NO_SEC;
+
+    pthread_mutex_lock(&self->lock);
+    _start(self);
+    shard->next  = self->shards;
+    self->shards = shard;
+    pthread_mutex_unlock(&self->lock);
+
+    return shard;
+}
+
+/*
+ * Buckets
+ */
+
+static output_aggregate_bucket_t* _bucket(output_aggregate_t* self, output_aggregate_bucket_t** free_buckets, int64_t sec)
+{
+    output_aggregate_bucket_t* b;
+
+    if ((b = *free_buckets)) {
+        *free_buckets = b->next;
+        memset(b->counters, 0, b->cells * self->nmetrics * sizeof(uint64_t));
+    } else {
+        lfatal_oom(b = malloc(sizeof(output_aggregate_bucket_t)));
+        lfatal_oom(b->counters = calloc(self->cells * self->nmetrics, sizeof(uint64_t)));
+        b->cells = self->cells;
+    }
+    b->next       = 0;
+    b->resolution = 1;
+    b->sec        = sec;
+
+    return b;
+}
+
+static inline void _add(output_aggregate_t* self, output_aggregate_bucket_t* to, const output_aggregate_bucket_t* from)
+{
+    size_t i, n = self->cells * self->nmetrics;
+
+    for (i = 0; i < n; i++) {
+        to->counters[i] += from->counters[i];
+    }
+}
+
+static void _write(output_aggregate_t* self, const output_aggregate_bucket_t* b)
+{
+    const uint64_t* c = b->counters;
+    size_t          cell, d, m;
+
+    for (cell = 0; cell < b->cells; cell++, c += self->nmetrics) {
+        if (!c[0]) {
+            continue;
+        }
+        fprintf(self->fp, "%u,%ld", b->resolution, (long)b->sec);
+        for (d = 0; d < AGGREGATE_DIMS; d++) {
+            if (!(self->dims & (1 << d))) {
+                continue;
+            }
+            if (d == AGGREGATE_DIM_TRANSPORT) {
+                fprintf(self->fp, ",%s", _transport_names[output_aggregate_cell(self, cell, d)]);
+            } else {
+                fprintf(self->fp, ",%u", output_aggregate_cell(self, cell, d));
+            }
+        }
+        for (m = 0; m < self->nmetrics; m++) {
+            fprintf(self->fp, ",%lu", (unsigned long)c[m]);
+        }
+        fputc('\n', self->fp);
+    }
+}
+
+static void _emit(output_aggregate_t* self, const output_aggregate_bucket_t* b)
+{
+    self->buckets++;
+    if (self->fp) {
+        _write(self, b);
+    }
+    if (self->flush) {
+        self->flush(self->flush_ctx, b);
+    }
+}
+
+/* A second is final, pass it on and add it to the rollups. */
+static void _finalize(output_aggregate_t* self, output_aggregate_bucket_t* b)
+{
+    output_aggregate_bucket_t* roll;
+    size_t                     i;
+    int64_t                    start;
+    uint32_t                   r;
+
+    for (i = 0; i < self->resolutions; i++) {
+        if ((r = self->resolution[i]) == 1) {
+            _emit(self, b);
+            continue;
+        }
+
+        start = b->sec - (((b->sec % r) + r) % r);
+        roll  = self->rollup[i];
+        if (roll && roll->sec != start) {
+            _emit(self, roll);
+            roll->next         = self->free_buckets;
+            self->free_buckets = roll;
+            roll               = 0;
+        }
+        if (!roll) {
+            roll             = _bucket(self, &self->free_buckets, start);
+            roll->resolution = r;
+            self->rollup[i]  = roll;
+        }
+        _add(self, roll, b);
+    }
+
+    self->done         = b->sec;
+    b->next            = self->free_buckets;
+    self->free_buckets = b;
+}
+
+/*
+ * Move a shard's buckets older than the given second to the pending ones,
+ * must be called with the lock held.
+ */
+static void _handoff(output_aggregate_t* self, output_aggregate_shard_t* shard, int64_t before)
+{
+    output_aggregate_bucket_t **b = &shard->ring, *move, **p;
+    size_t                      n;
+
+    self->packets += shard->packets;
+    self->late += shard->late;
+    self->discarded += shard->discarded;
+    shard->packets = shard->late = shard->discarded = 0;
+
+    /* Ring is newest first. */
+    while (*b && (*b)->sec >= before) {
+        b = &(*b)->next;
+    }
+    while ((move = *b)) {
+        *b = move->next;
+
+        if (move->sec <= self->done) {
+            self->late += move->counters[0];
+            move->next          = shard->free_buckets;
+            shard->free_buckets = move;
+            continue;
+        }
+        for (p = &self->pending; *p && (*p)->sec < move->sec; p = &(*p)->next)
+            ;
+        if (*p && (*p)->sec == move->sec) {
+            _add(self, *p, move);
+            move->next          = shard->free_buckets;
+            shard->free_buckets = move;
+        } else {
+            move->next = *p;
+            *p         = move;
+        }
+    }
+
+    /* Finalized buckets are freed here, give some back to the shard. */
+    if (!shard->free_buckets) {
+        for (n = 0; n <= self->window && (move = self->free_buckets); n++) {
+            self->free_buckets  = move->next;
+            move->next          = shard->free_buckets;
+            shard->free_buckets = move;
+        }
+    }
+}
+
+/*
+ * Finalize the pending seconds no open shard can add to anymore. A shard
+ * that is idle or behind holds back the others by at most the lateness,
+ * what it hands off later for finished seconds is counted as late.
+ */
+static void _advance(output_aggregate_t* self)
+{
+    output_aggregate_shard_t*  shard;
+    output_aggregate_bucket_t* b;
+    int64_t                    watermark = INT64_MAX, sec;
+
+    for (shard = self->shards; shard; shard = shard->next) {
+        if (shard->closed || shard->sec == NO_SEC) {
+            continue;
+        }
+        sec = shard->sec;
+        if (self->lateness && sec < self->newest - self->lateness) {
+            sec = self->newest - self->lateness;
+        }
+        if (sec - self->window < watermark) {
+            watermark = sec - self->window;
+        }
+    }
+    while ((b = self->pending) && b->sec < watermark) {
+        self->pending = b->next;
+        _finalize(self, b);
+    }
+}
+
+void output_aggregate_shard_close(output_aggregate_shard_t* shard)
+{
+    output_aggregate_t* self;
+    glassert(shard, "shard is nil");
+    self = shard->agg;
+
+    pthread_mutex_lock(&self->lock);
+    _handoff(self, shard, INT64_MAX);
+    shard->closed = 1;
+    _advance(self);
+    pthread_mutex_unlock(&self->lock);
+}
+
+void output_aggregate_finish(output_aggregate_t* self)
+{
+    output_aggregate_shard_t* shard;
+    size_t                    i;
+    mlassert_self();
+
+    pthread_mutex_lock(&self->lock);
+    for (shard = self->shards; shard; shard = shard->next) {
+        _handoff(self, shard, INT64_MAX);
+        shard->closed = 1;
+    }
+    _advance(self);
+    for (i = 0; i < self->resolutions; i++) {
+        if (self->rollup[i]) {
+            _emit(self, self->rollup[i]);
+            self->rollup[i]->next = self->free_buckets;
+            self->free_buckets    = self->rollup[i];
+            self->rollup[i]       = 0;
+        }
+    }
+    if (self->fp) {
+        fflush(self->fp);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * Receiver
+ */
+
+static void _receive(output_aggregate_shard_t* shard, const core_object_t* obj)
+{
+    output_aggregate_t*          self    = shard->agg;
+    const core_object_pcap_t*    pkt     = 0;
+    const core_object_payload_t* payload = 0;
+    output_aggregate_bucket_t*   b;
+    uint32_t                     val[AGGREGATE_DIMS] = { 0 };
+    const uint8_t*               p;
+    size_t                       len, off, cell, d, m;
+    int64_t                      sec;
+
+    val[AGGREGATE_DIM_TRANSPORT] = 2;
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_PCAP:
+            pkt = (const core_object_pcap_t*)obj;
+            break;
+        case CORE_OBJECT_PAYLOAD:
+            if (!payload) {
+                payload = (const core_object_payload_t*)obj;
+            }
+            break;
+        case CORE_OBJECT_UDP:
+            val[AGGREGATE_DIM_TRANSPORT] = 0;
+            break;
+        case CORE_OBJECT_TCP:
+            val[AGGREGATE_DIM_TRANSPORT] = 1;
+            break;
+        case CORE_OBJECT_IP6:
+            val[AGGREGATE_DIM_FAMILY] = 1;
+            break;
+        }
+    }
+
+    /* DNS length prefix is part of the payload with TCP. */
+    off = val[AGGREGATE_DIM_TRANSPORT] == 1 ? 2 : 0;
+    if (!pkt || !payload || payload->len < off + 12) {
+        shard->discarded++;
+        return;
+    }
+    p   = payload->payload + off;
+    len = payload->len - off;
+
+    val[AGGREGATE_DIM_QR]     = p[2] >> 7;
+    val[AGGREGATE_DIM_OPCODE] = (p[2] >> 3) & 0xf;
+    val[AGGREGATE_DIM_RCODE]  = p[3] & 0xf;
+    val[AGGREGATE_DIM_SIZE]   = len < MAX_SIZE ? len / self->size_step : self->radix[AGGREGATE_DIM_SIZE] - 1;
+    if ((self->dims & (1 << AGGREGATE_DIM_QTYPE)) && (p[4] || p[5])) {
+        for (off = 12; off < len;) {
+            if (!p[off]) {
+                off++;
+                break;
+            }
+            if ((p[off] & 0xc0) == 0xc0) {
+                off += 2;
+                break;
+            }
+            off += p[off] + 1;
+        }
+        if (off + 2 > len) {
+            shard->discarded++;
+            return;
+        }
+        val[AGGREGATE_DIM_QTYPE] = p[off] ? 0 : p[off + 1];
+    }
+
+    sec = pkt->ts.sec;
+    if (sec > shard->sec) {
+        /* Once per second, pass on what's out of the window. */
+        pthread_mutex_lock(&self->lock);
+        shard->sec = sec;
+        if (sec > self->newest) {
+            self->newest = sec;
+        }
+        _handoff(self, shard, sec - self->window);
+        _advance(self);
+        pthread_mutex_unlock(&self->lock);
+    } else if (sec < shard->sec - self->window) {
+        shard->late++;
+        return;
+    }
+
+    for (b = shard->ring; b && b->sec > sec; b = b->next)
+        ;
+    if (!b || b->sec != sec) {
+        output_aggregate_bucket_t** at;
+
+        for (at = &shard->ring; *at && (*at)->sec > sec; at = &(*at)->next)
+            ;
+        b        = _bucket(self, &shard->free_buckets, sec);
+        b->next  = *at;
+        *at      = b;
+    }
+
+    cell = 0;
+    for (d = 0; d < AGGREGATE_DIMS; d++) {
+        if (self->dims & (1 << d)) {
+            cell = cell * self->radix[d] + val[d];
+        }
+    }
+    m = cell * self->nmetrics;
+    b->counters[m++]++;
+    if (self->metrics & (1 << AGGREGATE_METRIC_BYTES)) {
+        b->counters[m++] += len;
+    }
+    shard->packets++;
+}
+
+core_receiver_t output_aggregate_receiver()
+{
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.compat_h")
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef enum output_aggregate_dim {
+    AGGREGATE_DIM_QR        = 0,
+    AGGREGATE_DIM_OPCODE    = 1,
+    AGGREGATE_DIM_RCODE     = 2,
+    AGGREGATE_DIM_QTYPE     = 3,
+    AGGREGATE_DIM_TRANSPORT = 4,
+    AGGREGATE_DIM_FAMILY    = 5,
+    AGGREGATE_DIM_SIZE      = 6,
+    AGGREGATE_DIMS          = 7
+} output_aggregate_dim_t;
+
+typedef enum output_aggregate_metric {
+    AGGREGATE_METRIC_PACKETS = 0,
+    AGGREGATE_METRIC_BYTES   = 1,
+    AGGREGATE_METRICS        = 2
+} output_aggregate_metric_t;
+
+/* Counters of one time bucket, cells * metrics values. */
+typedef struct output_aggregate_bucket output_aggregate_bucket_t;
+struct output_aggregate_bucket {
+    output_aggregate_bucket_t* next;
+    uint32_t                   resolution;
+    int64_t                    sec;
+    size_t                     cells;
+    uint64_t*                  counters;
+};
+
+typedef struct output_aggregate_shard output_aggregate_shard_t;
+struct output_aggregate_shard {
+    output_aggregate_shard_t* next;
+    struct output_aggregate*  agg;
+    uint8_t                   closed;
+    /* Highest second seen, buckets in the window below it are kept. */
+    int64_t                    sec;
+    output_aggregate_bucket_t *ring, *free_buckets;
+
+    uint64_t packets, late, discarded;
+};
+
+typedef void (*output_aggregate_flush_t)(void* ctx, const output_aggregate_bucket_t* bucket);
+
+typedef struct output_aggregate {
+    core_log_t _log;
+
+    /* Bitmasks of the dimensions and metrics used. */
+    uint32_t dims, metrics;
+    uint32_t resolution[4];
+    size_t   resolutions;
+    /* Width in bytes of the size dimension buckets. */
+    uint32_t size_step;
+    /* Seconds a shard waits for late packets. */
+    uint32_t window;
+    /* Seconds a shard can fall behind the newest second before it no
+     * longer holds back the others, 0 to wait for it. */
+    uint32_t lateness;
+
+    output_aggregate_flush_t flush;
+    void*                    flush_ctx;
+    void*                    fp;
+
+    uint32_t radix[AGGREGATE_DIMS];
+    size_t   cells, nmetrics;
+    uint8_t  started;
+
+    pthread_mutex_t           lock;
+    output_aggregate_shard_t* shards;
+    /* Seconds handed off by shards, ordered, and the rollups. */
+    output_aggregate_bucket_t *pending, *free_buckets;
+    output_aggregate_bucket_t* rollup[4];
+    int64_t                    done, newest;
+
+    uint64_t packets, late, discarded, buckets;
+} output_aggregate_t;
+
+core_log_t* output_aggregate_log();
+void output_aggregate_init(output_aggregate_t* self);
+void output_aggregate_destroy(output_aggregate_t* self);
+int output_aggregate_open(output_aggregate_t* self, const char* file);
+output_aggregate_shard_t* output_aggregate_shard(output_aggregate_t* self);
+void output_aggregate_shard_close(output_aggregate_shard_t* shard);
+void output_aggregate_finish(output_aggregate_t* self);
+uint32_t output_aggregate_cell(output_aggregate_t* self, size_t cell, output_aggregate_dim_t dim);
+const char* output_aggregate_dim_name(output_aggregate_dim_t dim);
+
+core_receiver_t output_aggregate_receiver();
@@ -0,0 +1,293 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.aggregate
+-- Count DNS traffic in time buckets by dimensions
+--   local agg = require("dnsjit.output.aggregate").new()
+--   agg:dims("qr", "rcode", "qtype", "transport")
+--   agg:metrics("packets", "bytes")
+--   agg:open("traffic.csv")
+--   layer:receiver(agg)
+--   ...
+--   agg:finish()
+--
+-- Output module which counts packets, and optionally DNS message bytes,
+-- per second for each combination of the selected dimensions, and rolls
+-- the seconds up into coarser resolutions (default 1, 10 and 60 seconds).
+-- Finished buckets are written as CSV to a file and/or passed to a
+-- callback.
+-- Objects must be layered (see
+-- .BR dnsjit.filter.layer )
+-- and have a PCAP object for the timestamp.
+-- .LP
+-- The dimensions are
+-- .I qr
+-- (0 or 1),
+-- .IR opcode ,
+-- .I rcode
+-- (from the DNS header),
+-- .I qtype
+-- (0 for types above 255),
+-- .I transport
+-- (udp, tcp or other),
+-- .I family
+-- (4 or 6) and
+-- .I size
+-- (DNS message length rounded down to the size step, 4096 and above are
+-- counted together).
+-- Counters are kept for every combination so the number of cells is the
+-- product of the number of values of each dimension, e.g. qtype and rcode
+-- are 4096 cells.
+-- .LP
+-- To count in several threads, each thread gets its own shard which has
+-- no locking on the packet path.
+-- A shard keeps the last seconds (see
+-- .BR window() )
+-- to allow for slightly unordered packets, older seconds are merged into
+-- the shared buckets which are finished once all open shards have moved
+-- past them.
+-- A shard which is idle or falls behind the others holds them back by at
+-- most the lateness (see
+-- .BR lateness() ),
+-- after that its older seconds are finished without it.
+-- Packets older than the window or than finished buckets are counted as
+-- late and discarded.
+--   -- main
+--   agg:open("traffic.csv")
+--   thr:push(agg)
+--   ...
+--   thr:stop()
+--   agg:finish()
+--   -- thread
+--   local agg = thr:pop()
+--   local shard = agg:shard()
+--   layer:receiver(shard)
+--   ...
+--   shard:close()
+module(...,package.seeall)
+
+require("dnsjit.output.aggregate_h")
+local bit = require("bit")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "output_aggregate_t"
+local output_aggregate_t = ffi.typeof(t_name)
+local Aggregate = {}
+local Shard = {}
+
+local dims = {
+    qr = "AGGREGATE_DIM_QR",
+    opcode = "AGGREGATE_DIM_OPCODE",
+    rcode = "AGGREGATE_DIM_RCODE",
+    qtype = "AGGREGATE_DIM_QTYPE",
+    transport = "AGGREGATE_DIM_TRANSPORT",
+    family = "AGGREGATE_DIM_FAMILY",
+    size = "AGGREGATE_DIM_SIZE",
+}
+local metrics = {
+    packets = "AGGREGATE_METRIC_PACKETS",
+    bytes = "AGGREGATE_METRIC_BYTES",
+}
+local transports = { [0] = "udp", "tcp", "other" }
+
+-- Create a new Aggregate output.
+function Aggregate.new()
+    local self = {
+        _shard = nil,
+        _flush = nil,
+        obj = output_aggregate_t(),
+    }
+    C.output_aggregate_init(self.obj)
+    ffi.gc(self.obj, C.output_aggregate_destroy)
+    return setmetatable(self, { __index = Aggregate })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Aggregate:log()
+    if self == nil then
+        return C.output_aggregate_log()
+    end
+    return self.obj._log
+end
+
+-- Set the dimensions to count by, see above for the names
+-- (default rcode).
+function Aggregate:dims(...)
+    local mask = 0
+    for _, name in pairs({...}) do
+        if not dims[name] then
+            error("unknown dimension "..name)
+        end
+        mask = bit.bor(mask, bit.lshift(1, C[dims[name]]))
+    end
+    self.obj.dims = mask
+end
+
+-- Set the metrics to count,
+-- .I packets
+-- and/or
+-- .I bytes
+-- (default packets, which is always counted).
+function Aggregate:metrics(...)
+    local mask = 0
+    for _, name in pairs({...}) do
+        if not metrics[name] then
+            error("unknown metric "..name)
+        end
+        mask = bit.bor(mask, bit.lshift(1, C[metrics[name]]))
+    end
+    self.obj.metrics = mask
+end
+
+-- Set up to 4 resolutions in seconds in ascending order
+-- (default 1, 10, 60).
+function Aggregate:resolutions(...)
+    local res = {...}
+    if #res < 1 or #res > 4 then
+        error("need 1 to 4 resolutions")
+    end
+    for i, r in ipairs(res) do
+        self.obj.resolution[i - 1] = r
+    end
+    self.obj.resolutions = #res
+end
+
+-- Set the width in bytes of the size dimension buckets (default 64).
+function Aggregate:size_step(step)
+    self.obj.size_step = step
+end
+
+-- Set the number of seconds a shard waits for late packets (default 2).
+function Aggregate:window(secs)
+    self.obj.window = secs
+end
+
+-- Set the number of seconds a shard can fall behind the newest second seen
+-- by any shard before the others are finished without it (default 10), 0
+-- to wait for every open shard.
+function Aggregate:lateness(secs)
+    self.obj.lateness = secs
+end
+
+-- Write finished buckets as CSV to the file, returns 0 on success.
+-- Call after setting dimensions and metrics.
+function Aggregate:open(file)
+    return C.output_aggregate_open(self.obj, file)
+end
+
+-- Set a function to be called with each finished bucket, it gets the
+-- resolution, the start of the bucket (seconds since epoch) and a table
+-- with one table per combination of dimensions which has the values of
+-- the dimensions and the metrics by name.
+-- The function is called from the thread which finished the bucket, so
+-- it can only be used if all shards are in the same thread, use
+-- .B open()
+-- otherwise.
+function Aggregate:callback(func)
+    local obj = self.obj
+    self._flush = ffi.cast("output_aggregate_flush_t", function(_, bucket)
+        local used_dims, used_metrics = {}, {}
+        for name, dim in pairs(dims) do
+            if bit.band(obj.dims, bit.lshift(1, C[dim])) ~= 0 then
+                used_dims[name] = C[dim]
+            end
+        end
+        table.insert(used_metrics, "packets")
+        if bit.band(obj.metrics, bit.lshift(1, C[metrics.bytes])) ~= 0 then
+            table.insert(used_metrics, "bytes")
+        end
+
+        local rows = {}
+        local c = bucket.counters
+        local n = #used_metrics
+        for cell = 0, tonumber(bucket.cells) - 1 do
+            if c[cell * n] > 0 then
+                local row = {}
+                for name, dim in pairs(used_dims) do
+                    row[name] = C.output_aggregate_cell(obj, cell, dim)
+                end
+                if row.transport then
+                    row.transport = transports[row.transport]
+                end
+                for i, name in ipairs(used_metrics) do
+                    row[name] = tonumber(c[cell * n + i - 1])
+                end
+                table.insert(rows, row)
+            end
+        end
+        func(bucket.resolution, tonumber(bucket.sec), rows)
+    end)
+    self.obj.flush = self._flush
+end
+
+-- Return the C functions and context for receiving objects, uses a shard
+-- of this thread.
+function Aggregate:receive()
+    if not self._shard then
+        self._shard = C.output_aggregate_shard(self.obj)
+    end
+    return C.output_aggregate_receiver(), self._shard
+end
+
+-- Return a new Shard to count in, used in threads.
+function Aggregate:shard()
+    return Shard.new(self.obj)
+end
+
+-- Return information to use when sharing this object between threads.
+function Aggregate:share()
+    return ffi.cast("void*", self.obj), t_name.."*", "dnsjit.output.aggregate"
+end
+
+-- Close all shards and pass on all remaining buckets, call once all
+-- threads have stopped.
+function Aggregate:finish()
+    C.output_aggregate_finish(self.obj)
+end
+
+-- Return the number of packets counted, late packets and discarded
+-- objects (not DNS), and the number of buckets finished.
+function Aggregate:stats()
+    return tonumber(self.obj.packets), tonumber(self.obj.late), tonumber(self.obj.discarded),
+        tonumber(self.obj.buckets)
+end
+
+-- Create a new Shard of the given shared Aggregate object.
+function Shard.new(agg)
+    local self = {
+        obj = C.output_aggregate_shard(agg),
+    }
+    return setmetatable(self, { __index = Shard })
+end
+
+-- Return the C functions and context for receiving objects.
+function Shard:receive()
+    return C.output_aggregate_receiver(), self.obj
+end
+
+-- Pass on everything counted in this shard, nothing can be received
+-- after this.
+function Shard:close()
+    C.output_aggregate_shard_close(self.obj)
+end
+
+-- Shared objects popped in a thread only have the shard() function.
+ffi.metatype(output_aggregate_t, { __index = { shard = Shard.new } })
+
+return Aggregate
@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/cachesim.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+#include "core/object/dns.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define N1e9 1000000000
+#define MAX_LABELS 128
+#define NO_EXPIRE UINT64_MAX
+
+/*
+ * Stack distances are counted in log2 buckets with 8 sub-buckets each,
+ * exact below 16.
+ */
+#define BUCKETS (16 + 60 * 8)
+
+typedef struct _key {
+    uint64_t h, pos, expire;
+    uint32_t interval;
+} _key_t;
+
+typedef struct _output_cachesim {
+    output_cachesim_t pub;
+
+    /* Open addressing table of sampled keys by hash. */
+    _key_t* table;
+    size_t  table_size;
+
+    /*
+     * Fenwick tree over the positions of the last accesses, the stack
+     * distance of a key is the number of keys accessed after its position.
+     * Positions are renumbered when the tree is full.
+     */
+    uint32_t* tree;
+    uint64_t* slot;
+    size_t    cap, next, marks;
+
+    uint64_t hist[BUCKETS];
+
+    uint64_t* wss;
+    size_t    wss_size;
+
+    int64_t t0;
+    uint8_t have_t0;
+} _output_cachesim_t;
+
+#define _self ((_output_cachesim_t*)self)
+
+static core_log_t        _log      = LOG_T_INIT("output.cachesim");
+static output_cachesim_t _defaults = {
+    LOG_T_INIT_OBJ("output.cachesim"),
+    1.0, 0, 60,
+    0, 0, 0, 0, 0,
+    0,
+    0, 0
+};
+
+core_log_t* output_cachesim_log()
+{
+    return &_log;
+}
+
+output_cachesim_t* output_cachesim_new()
+{
+    output_cachesim_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(_output_cachesim_t)));
+    *self = _defaults;
+
+    _self->table_size = 1 << 16;
+    mlfatal_oom(_self->table = calloc(_self->table_size, sizeof(_key_t)));
+    _self->cap  = 1 << 16;
+    _self->next = 1;
+    mlfatal_oom(_self->tree = calloc(_self->cap + 1, sizeof(uint32_t)));
+    mlfatal_oom(_self->slot = calloc(_self->cap + 1, sizeof(uint64_t)));
+
+    return self;
+}
+
+void output_cachesim_free(output_cachesim_t* self)
+{
+    mlassert_self();
+
+    free(_self->table);
+    free(_self->tree);
+    free(_self->slot);
+    free(_self->wss);
+    free(self);
+}
+
+static inline uint64_t _mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+/*
+ * Key table
+ */
+
+static _key_t* _lookup(output_cachesim_t* self, uint64_t h, int insert)
+{
+    size_t  mask = _self->table_size - 1, i;
+    _key_t* k;
+
+    for (i = h & mask;; i = (i + 1) & mask) {
+        k = &_self->table[i];
+        if (k->h == h) {
+            return k;
+        }
+        if (!k->h) {
+            break;
+        }
+    }
+    if (!insert) {
+        return 0;
+    }
+
+    if ((self->keys + 1) * 2 > _self->table_size) {
+        _key_t* old  = _self->table;
+        size_t  size = _self->table_size, j;
+
+        lfatal_oom(_self->table = calloc(size * 2, sizeof(_key_t)));
+        _self->table_size = size * 2;
+        mask              = _self->table_size - 1;
+        for (j = 0; j < size; j++) {
+            if (!old[j].h) {
+                continue;
+            }
+            for (i = old[j].h & mask; _self->table[i].h; i = (i + 1) & mask)
+                ;
+            _self->table[i] = old[j];
+        }
+        free(old);
+
+        for (i = h & mask; _self->table[i].h; i = (i + 1) & mask)
+            ;
+        k = &_self->table[i];
+    }
+
+    k->h        = h;
+    k->pos      = 0;
+    k->expire   = NO_EXPIRE;
+    k->interval = 0;
+    self->keys++;
+
+    return k;
+}
+
+/*
+ * Stack distance
+ */
+
+static inline void _tree_add(output_cachesim_t* self, size_t i, int32_t v)
+{
+    for (; i <= _self->cap; i += i & -i) {
+        _self->tree[i] += v;
+    }
+}
+
+static inline uint64_t _tree_sum(output_cachesim_t* self, size_t i)
+{
+    uint64_t s = 0;
+
+    for (; i; i -= i & -i) {
+        s += _self->tree[i];
+    }
+    return s;
+}
+
+static void _compact(output_cachesim_t* self)
+{
+    size_t    cap = _self->cap, i, n = 0;
+    uint64_t* slot;
+
+    if (_self->marks * 2 > cap) {
+        cap *= 2;
+    }
+    lfatal_oom(slot = calloc(cap + 1, sizeof(uint64_t)));
+    for (i = 1; i < _self->next; i++) {
+        if (_self->slot[i]) {
+            slot[++n]                            = _self->slot[i];
+            _lookup(self, _self->slot[i], 0)->pos = n;
+        }
+    }
+    free(_self->slot);
+    _self->slot = slot;
+
+    if (cap != _self->cap) {
+        free(_self->tree);
+        lfatal_oom(_self->tree = malloc((cap + 1) * sizeof(uint32_t)));
+        _self->cap = cap;
+    }
+    memset(_self->tree, 0, (cap + 1) * sizeof(uint32_t));
+    for (i = 1; i <= cap; i++) {
+        size_t j = i + (i & -i);
+
+        if (i <= n) {
+            _self->tree[i] += 1;
+        }
+        if (j <= cap) {
+            _self->tree[j] += _self->tree[i];
+        }
+    }
+    _self->next = n + 1;
+}
+
+static inline void _place(output_cachesim_t* self, _key_t* k)
+{
+    if (k->pos) {
+        _tree_add(self, k->pos, -1);
+        _self->slot[k->pos] = 0;
+        _self->marks--;
+    }
+    if (_self->next > _self->cap) {
+        _compact(self);
+    }
+    _tree_add(self, _self->next, 1);
+    _self->slot[_self->next] = k->h;
+    k->pos                   = _self->next++;
+    _self->marks++;
+}
+
+static inline size_t _bucket(uint64_t d)
+{
+    int e;
+
+    if (d < 16) {
+        return d;
+    }
+    e = 63 - __builtin_clzll(d);
+    return 16 + (e - 4) * 8 + ((d >> (e - 3)) & 7);
+}
+
+static inline uint64_t _bucket_low(size_t b)
+{
+    if (b < 16) {
+        return b;
+    }
+    b -= 16;
+    return (uint64_t)(8 + b % 8) << (b / 8 + 1);
+}
+
+/*
+ * DNS
+ */
+
+static inline uint64_t _fnv(uint64_t h, uint8_t c)
+{
+    return (h ^ c) * 0x100000001b3ULL;
+}
+
+static inline uint64_t _fnv_label(uint64_t h, const uint8_t* p, uint8_t len)
+{
+    uint8_t i;
+
+    h = _fnv(h, len);
+    for (i = 0; i < len; i++) {
+        h = _fnv(h, p[i] >= 'A' && p[i] <= 'Z' ? p[i] + 32 : p[i]);
+    }
+    return h;
+}
+
+/* Hash the rest of a compressed name, returns -1 if malformed. */
+static int _fnv_ptr(uint64_t* h, const uint8_t* payload, size_t len, size_t off)
+{
+    size_t hops;
+
+    for (hops = 0; hops < MAX_LABELS; hops++) {
+        if (off >= len) {
+            return -1;
+        }
+        if ((payload[off] & 0xc0) == 0xc0) {
+            if (off + 1 >= len) {
+                return -1;
+            }
+            off = ((payload[off] & 0x3f) << 8) | payload[off + 1];
+        } else if (payload[off] & 0xc0) {
+            return -1;
+        } else if (!payload[off]) {
+            return 0;
+        } else {
+            if (off + 1 + payload[off] > len) {
+                return -1;
+            }
+            *h = _fnv_label(*h, payload + off + 1, payload[off]);
+            off += 1 + payload[off];
+        }
+    }
+    return -1;
+}
+
+/* Canonical (lowercase qname, qtype) key of the question. */
+static int _qkey(core_object_dns_t* dns, core_object_dns_label_t* label, uint64_t* key)
+{
+    core_object_dns_q_t q;
+    uint64_t            h = 0xcbf29ce484222325ULL;
+    size_t              i;
+
+    if (!dns->qdcount || core_object_dns_parse_q(dns, &q, label, MAX_LABELS)) {
+        return -1;
+    }
+    for (i = 0; i < q.labels; i++) {
+        if (label[i].have_dn) {
+            h = _fnv_label(h, dns->payload + label[i].offset + 1, label[i].length);
+        } else if (label[i].have_offset) {
+            if (_fnv_ptr(&h, dns->payload, dns->len, label[i].offset)) {
+                return -1;
+            }
+        } else if (!label[i].is_end) {
+            return -1;
+        }
+    }
+    h = _fnv(_fnv(h, q.type >> 8), q.type & 0xff);
+
+    *key = _mix(h) | 1;
+    return 0;
+}
+
+/*
+ * TTL of a response, the lowest TTL in the answer section or for negative
+ * responses the lower of the TTL and MINIMUM of the SOA in the authority
+ * section (RFC 2308), returns -1 if not cacheable.
+ */
+static int64_t _ttl(core_object_dns_t* dns, core_object_dns_label_t* label)
+{
+    core_object_dns_rr_t rr;
+    const uint8_t*       p;
+    uint32_t             minimum;
+    int64_t              ttl = -1, rr_ttl;
+    size_t               i, n = dns->ancount;
+
+    if (dns->qdcount != 1 || (dns->rcode != 0 && dns->rcode != 3)) {
+        return -1;
+    }
+    if (!n) {
+        n = dns->nscount;
+    } else if (dns->rcode) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (core_object_dns_parse_rr(dns, &rr, label, MAX_LABELS)) {
+            return -1;
+        }
+        rr_ttl = rr.ttl;
+        if (!dns->ancount) {
+            /* MINIMUM is the last field, after two names of at least one byte. */
+            if (rr.type != CORE_OBJECT_DNS_TYPE_SOA || !rr.have_rdata || rr.rdlength < 22) {
+                continue;
+            }
+            p       = dns->payload + rr.rdata_offset + rr.rdlength - 4;
+            minimum = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+            if (minimum < rr_ttl) {
+                rr_ttl = minimum;
+            }
+        }
+        if (ttl < 0 || rr_ttl < ttl) {
+            ttl = rr_ttl;
+        }
+    }
+
+    return ttl;
+}
+
+static void _access(output_cachesim_t* self, _key_t* k, uint64_t now, int is_new)
+{
+    uint32_t interval = now / (self->interval * (uint64_t)N1e9) + 1;
+
+    if (is_new || now >= k->expire) {
+        if (!is_new) {
+            self->expired++;
+        }
+        self->cold++;
+        k->expire = self->ttl_default ? now + self->ttl_default * (uint64_t)N1e9 : NO_EXPIRE;
+    } else {
+        uint64_t d = _self->marks - _tree_sum(self, k->pos);
+
+        _self->hist[_bucket(d / self->rate)]++;
+    }
+    _place(self, k);
+
+    if (k->interval != interval) {
+        if (interval > _self->wss_size) {
+            size_t    size = interval * 2;
+            uint64_t* wss;
+
+            lfatal_oom(wss = realloc(_self->wss, size * sizeof(uint64_t)));
+            memset(wss + _self->wss_size, 0, (size - _self->wss_size) * sizeof(uint64_t));
+            _self->wss      = wss;
+            _self->wss_size = size;
+        }
+        _self->wss[interval - 1]++;
+        k->interval = interval;
+    }
+}
+
+static void _receive(output_cachesim_t* self, const core_object_t* obj)
+{
+    const core_object_pcap_t*    pkt     = 0;
+    const core_object_payload_t* payload = 0;
+    int                          tcp     = 0;
+    core_object_dns_label_t      label[MAX_LABELS];
+    core_object_dns_t            dns;
+    uint64_t                     key, now;
+    int64_t                      t, ttl;
+    _key_t*                      k;
+    mlassert_self();
+
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_PCAP:
+            pkt = (const core_object_pcap_t*)obj;
+            break;
+        case CORE_OBJECT_PAYLOAD:
+            if (!payload) {
+                payload = (const core_object_payload_t*)obj;
+            }
+            break;
+        case CORE_OBJECT_TCP:
+            tcp = 1;
+            break;
+        }
+    }
+    if (!pkt || !payload || !payload->len) {
+        self->discarded++;
+        return;
+    }
+
+    dns                 = (core_object_dns_t)CORE_OBJECT_DNS_INIT(payload);
+    dns.includes_dnslen = tcp;
+    if (core_object_dns_parse_header(&dns) || _qkey(&dns, label, &key)) {
+        self->discarded++;
+        return;
+    }
+
+    t = pkt->ts.sec * (int64_t)N1e9 + pkt->ts.nsec;
+    if (!_self->have_t0) {
+        _self->t0       = t;
+        _self->have_t0  = 1;
+        self->first_sec = pkt->ts.sec;
+    }
+    now = t > _self->t0 ? t - _self->t0 : 0;
+
+    if (dns.qr) {
+        self->responses++;
+        if ((key >> 40) < self->rate * (1 << 24) && (k = _lookup(self, key, 0)) && (ttl = _ttl(&dns, label)) > -1) {
+            k->expire = now + ttl * N1e9;
+        }
+        return;
+    }
+
+    self->queries++;
+    if ((key >> 40) >= self->rate * (1 << 24)) {
+        return;
+    }
+    self->sampled++;
+    k = _lookup(self, key, 1);
+    _access(self, k, now, !k->pos);
+}
+
+core_receiver_t output_cachesim_receiver(output_cachesim_t* self)
+{
+    if (self->rate <= 0 || self->rate > 1) {
+        lfatal("rate must be in (0, 1]");
+    }
+    if (!self->interval) {
+        lfatal("interval must be positive");
+    }
+
+    return (core_receiver_t)_receive;
+}
+
+size_t output_cachesim_curve(output_cachesim_t* self, uint64_t* sizes, double* ratios, size_t n)
+{
+    double total, hits;
+    size_t b, last = 0, i = 0;
+    mlassert_self();
+
+    /* SHARDS-adj, the difference to the expected number of sampled
+     * accesses is accounted as hits of the smallest distance. */
+    total = self->queries * self->rate;
+    hits  = total - self->sampled;
+    if (total <= 0) {
+        return 0;
+    }
+    for (b = 0; b < BUCKETS; b++) {
+        if (_self->hist[b]) {
+            last = b;
+        }
+    }
+
+    for (b = 0; b <= last && i < n; b++) {
+        hits += _self->hist[b];
+        sizes[i]  = b + 1 < BUCKETS ? _bucket_low(b + 1) : UINT64_MAX;
+        ratios[i] = hits > 0 ? hits / total : 0;
+        i++;
+    }
+
+    return i;
+}
+
+size_t output_cachesim_wss(output_cachesim_t* self, uint64_t* keys, size_t n)
+{
+    size_t i, used = 0;
+    mlassert_self();
+
+    for (i = 0; i < _self->wss_size; i++) {
+        if (_self->wss[i]) {
+            used = i + 1;
+        }
+    }
+    if (!keys) {
+        return used;
+    }
+    for (i = 0; i < used && i < n; i++) {
+        keys[i] = _self->wss[i] / self->rate + 0.5;
+    }
+
+    return i;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct output_cachesim {
+    core_log_t _log;
+
+    /* Fraction of (qname, qtype) keys sampled (SHARDS), 1.0 is exact. */
+    double rate;
+    /* TTL in seconds of keys not seen in a response, 0 never expires. */
+    uint32_t ttl_default;
+    /* Working set size interval in seconds. */
+    uint32_t interval;
+
+    uint64_t queries, responses, sampled, expired, discarded;
+    /* Sampled queries missing at every cache size, first seen or expired. */
+    uint64_t cold;
+    size_t   keys;
+    int64_t  first_sec;
+} output_cachesim_t;
+
+core_log_t* output_cachesim_log();
+
+output_cachesim_t* output_cachesim_new();
+void output_cachesim_free(output_cachesim_t* self);
+size_t output_cachesim_curve(output_cachesim_t* self, uint64_t* sizes, double* ratios, size_t n);
+/* Without keys, returns the number of intervals. */
+size_t output_cachesim_wss(output_cachesim_t* self, uint64_t* keys, size_t n);
+
+core_receiver_t output_cachesim_receiver(output_cachesim_t* self);
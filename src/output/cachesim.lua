@@ -0,0 +1,138 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.cachesim
+-- Simulate a resolver cache over the query stream
+--   local cachesim = require("dnsjit.output.cachesim").new()
+--   cachesim:rate(0.01)
+--   layer:receiver(cachesim)
+--   ...
+--   for _, p in ipairs(cachesim:curve()) do
+--       print(p.size, p.hit_ratio)
+--   end
+--
+-- Output module which computes the hit ratio of an LRU cache against the
+-- cache size in one pass over the DNS queries, using Mattson stack
+-- distances of the canonical (lowercase QNAME, QTYPE) keys.
+-- Objects must be layered (see
+-- .BR dnsjit.filter.layer )
+-- and have a PCAP object for the timestamp.
+-- .LP
+-- Cache entries expire by their TTL which is taken from the responses in
+-- the stream (the lowest TTL of the answer, or for negative responses
+-- the lower of the TTL and MINIMUM of the SOA in the authority section),
+-- queries for expired entries are misses at every cache size.
+-- Entries never seen in a response use the default TTL, see
+-- .BR ttl() .
+-- Expiry is counted from the last response, which matches a cache large
+-- enough to hold the entry since then.
+-- .LP
+-- For large captures, keys can be sampled by their hash (SHARDS) so only
+-- a fraction of them is tracked and distances are scaled by the rate.
+-- Memory use is up to about 100 bytes per tracked key.
+-- The working set size, the number of distinct keys queried in each
+-- interval, is tracked as well.
+module(...,package.seeall)
+
+require("dnsjit.output.cachesim_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local CacheSim = {}
+
+-- Create a new CacheSim output.
+function CacheSim.new()
+    local self = {
+        obj = C.output_cachesim_new(),
+    }
+    ffi.gc(self.obj, C.output_cachesim_free)
+    return setmetatable(self, { __index = CacheSim })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function CacheSim:log()
+    if self == nil then
+        return C.output_cachesim_log()
+    end
+    return self.obj._log
+end
+
+-- Set the fraction of keys to sample, between 0 and 1 (default 1, exact).
+function CacheSim:rate(rate)
+    self.obj.rate = rate
+end
+
+-- Set the TTL in seconds of entries not seen in a response (default 0,
+-- never expire).
+function CacheSim:ttl(ttl)
+    self.obj.ttl_default = ttl
+end
+
+-- Set the working set size interval in seconds (default 60).
+function CacheSim:interval(interval)
+    self.obj.interval = interval
+end
+
+-- Return the C functions and context for receiving objects.
+function CacheSim:receive()
+    return C.output_cachesim_receiver(self.obj), self.obj
+end
+
+-- Return the hit ratio curve as a table of tables with
+-- .I size
+-- (number of cache entries) and
+-- .IR hit_ratio ,
+-- sizes are spaced logarithmically with 8 steps per power of two.
+function CacheSim:curve()
+    local sizes = ffi.new("uint64_t[?]", 512)
+    local ratios = ffi.new("double[?]", 512)
+    local n = tonumber(C.output_cachesim_curve(self.obj, sizes, ratios, 512))
+    local curve = {}
+    for i = 0, n - 1 do
+        table.insert(curve, { size = tonumber(sizes[i]), hit_ratio = ratios[i] })
+    end
+    return curve
+end
+
+-- Return the working set size as a table of tables with
+-- .I time
+-- (start of the interval, seconds since epoch) and
+-- .I keys
+-- (distinct keys queried in the interval).
+function CacheSim:wss()
+    local n = tonumber(C.output_cachesim_wss(self.obj, nil, 0))
+    local keys = ffi.new("uint64_t[?]", n + 1)
+    n = tonumber(C.output_cachesim_wss(self.obj, keys, n))
+    local first = tonumber(self.obj.first_sec)
+    local wss = {}
+    for i = 0, n - 1 do
+        table.insert(wss, { time = first + i * self.obj.interval, keys = tonumber(keys[i]) })
+    end
+    return wss
+end
+
+-- Return the number of queries, responses, sampled queries, queries of
+-- expired entries, objects discarded (not DNS), tracked keys and sampled
+-- queries that miss at every cache size (first seen or expired).
+function CacheSim:stats()
+    return tonumber(self.obj.queries), tonumber(self.obj.responses), tonumber(self.obj.sampled),
+        tonumber(self.obj.expired), tonumber(self.obj.discarded), tonumber(self.obj.keys),
+        tonumber(self.obj.cold)
+end
+
+return CacheSim
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include "output/dnscli.h"
+#include "output/ktls.h"
 #include "core/assert.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
@@ -73,7 +74,8 @@ static output_dnscli_t _defaults = {
     { 0 }, 0,
     { 0 }, CORE_OBJECT_PAYLOAD_INIT(0), 0, 0, 0, 0, 0,
     { 0, 0 },
-    0, 0
+    0, 0,
+    0, 0, 0
 };
 
 core_log_t* output_dnscli_log()
@@ -126,7 +128,11 @@ void output_dnscli_destroy(output_dnscli_t* self)
             break;
         case OUTPUT_DNSCLI_MODE_TLS:
             if (self->session) {
-                gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
+                if (self->ktls_tx) {
+                    output_ktls_bye(self->fd);
+                } else {
+                    gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
+                }
                 gnutls_deinit(self->session);
             }
             shutdown(self->fd, SHUT_RDWR);
@@ -238,6 +244,24 @@ int output_dnscli_connect(output_dnscli_t* self, const char* host, const char* p
             lcritical("gnutls_handshake() failed: %s (%d)\n", gnutls_strerror(err), err);
             return -3;
         }
+
+        /* With kernel TLS the socket is used like in TCP mode, including
+         * the timeout GnuTLS would have applied. */
+        if (self->ktls) {
+            int dirs = output_ktls_enable(self->session, self->fd, 1);
+
+            self->ktls_tx = (dirs & OUTPUT_KTLS_TX) ? 1 : 0;
+            self->ktls_rx = (dirs & OUTPUT_KTLS_RX) ? 1 : 0;
+            if (dirs) {
+                linfo("kernel TLS enabled for%s%s", self->ktls_tx ? " tx" : "", self->ktls_rx ? " rx" : "");
+            } else {
+                linfo("kernel TLS not available (%s), using GnuTLS", core_log_errstr(errno));
+            }
+        }
+        if (self->ktls_rx && (self->timeout.sec > 0 || self->timeout.nsec > 0)) {
+            self->poll.fd      = self->fd;
+            self->poll_timeout = ms;
+        }
         break;
     }
     default:
@@ -436,6 +460,10 @@ inline ssize_t _send_tls(output_dnscli_t* self, const uint8_t* payload, size_t l
 {
     ssize_t n;
 
+    if (self->ktls_tx) {
+        return _send_tcp(self, payload, len, sent);
+    }
+
     n = gnutls_record_send(self->session, payload + sent, len - sent);
     if (n > -1) {
         return n;
@@ -726,7 +754,11 @@ static const core_object_t* _produce_tcp(output_dnscli_t* self)
                 return 0;
             }
         }
-        n = recvfrom(self->fd, self->recvbuf + self->recv, sizeof(self->recvbuf) - self->recv, 0, 0, 0);
+        if (self->ktls_rx) {
+            n = output_ktls_recv(self->fd, self->recvbuf + self->recv, sizeof(self->recvbuf) - self->recv);
+        } else {
+            n = recvfrom(self->fd, self->recvbuf + self->recv, sizeof(self->recvbuf) - self->recv, 0, 0, 0);
+        }
         if (n > 0) {
             self->recv += n;
 
@@ -878,6 +910,9 @@ core_producer_t output_dnscli_producer(output_dnscli_t* self)
     case OUTPUT_DNSCLI_MODE_TCP:
         return (core_producer_t)_produce_tcp;
     case OUTPUT_DNSCLI_MODE_TLS:
+        if (self->ktls_rx) {
+            return (core_producer_t)_produce_tcp;
+        }
         return (core_producer_t)_produce_tls;
     default:
         break;
@@ -59,6 +59,11 @@ typedef struct output_dnscli {
 
     gnutls_session_t                 session;
     gnutls_certificate_credentials_t cred;
+
+    /* Hand the records to kernel TLS after the handshake, if possible,
+     * and the directions the kernel took over. */
+    uint8_t ktls;
+    uint8_t ktls_tx, ktls_rx;
 } output_dnscli_t;
 
 core_log_t* output_dnscli_log();
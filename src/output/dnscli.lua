@@ -104,6 +104,24 @@ function Dnscli:timeout(seconds, nanoseconds)
     self.obj.timeout.nsec = nanoseconds
 end
 
+-- Enable (true) or disable (false) kernel TLS, must be used before
+-- .IR connect() .
+-- After the handshake the negotiated keys are handed to the kernel, which
+-- then encrypts and decrypts the records so sending and receiving are plain
+-- socket calls.
+-- Requires the tls kernel module and TLS 1.2 or 1.3 with AES-GCM or
+-- ChaCha20-Poly1305, otherwise GnuTLS is used as before.
+function Dnscli:ktls(enable)
+    self.obj.ktls = enable and 1 or 0
+end
+
+-- Return if the kernel took over sending and receiving (as a list of
+-- booleans), see
+-- .IR ktls() .
+function Dnscli:ktls_active()
+    return self.obj.ktls_tx == 1, self.obj.ktls_rx == 1
+end
+
 -- Connect to the
 -- .I host
 -- and
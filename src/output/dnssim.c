@@ -22,6 +22,9 @@
 #include "output/dnssim/common.c"
 #include "output/dnssim/udp.c"
 #include "output/dnssim/tcp.c"
+#include "output/dnssim/quic.c"
+#include "output/dnssim/trace.c"
+#include "output/dnssim/clients.c"
 
 
 core_log_t* output_dnssim_log()
@@ -29,6 +32,55 @@ core_log_t* output_dnssim_log()
     return &_log;
 }
 
+/* Configuration is read by the event loop thread without locking. */
+static void _check_config(output_dnssim_t* self)
+{
+    if (_self->is_threaded) {
+        lfatal("configuration can't be changed while the event loop thread is running");
+    }
+}
+
+static output_dnssim_stats_t* _new_stats(output_dnssim_t* self)
+{
+    output_dnssim_stats_t* stats;
+
+    lfatal_oom(stats = calloc(1, sizeof(output_dnssim_stats_t)));
+    lfatal_oom(stats->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    lfatal_oom(stats->conn_queue_wait = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    lfatal_oom(stats->client_queue_wait = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    lfatal_oom(stats->fallback_latency_udp = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    lfatal_oom(stats->fallback_latency_tcp = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+
+    return stats;
+}
+
+static void _free_stats(output_dnssim_stats_t* stats)
+{
+    free(stats->latency);
+    free(stats->conn_queue_wait);
+    free(stats->client_queue_wait);
+    free(stats->fallback_latency_udp);
+    free(stats->fallback_latency_tcp);
+    free(stats);
+}
+
+static void _clear_targets(output_dnssim_t* self)
+{
+    for (size_t i = 0; i < _self->n_targets; ++i) {
+        _free_stats(_self->targets[i]->stats);
+#if HAVE_NGTCP2
+        _free_client_quic(&_self->targets[i]->shared_client);
+#endif
+        free(_self->targets[i]);
+    }
+    free(_self->targets);
+    _self->targets = NULL;
+    _self->n_targets = 0;
+    free(_self->ring_points);
+    _self->ring_points = NULL;
+    _self->n_ring_points = 0;
+}
+
 output_dnssim_t* output_dnssim_new(size_t max_clients)
 {
     output_dnssim_t* self;
@@ -37,16 +89,14 @@ output_dnssim_t* output_dnssim_new(size_t max_clients)
     mlfatal_oom(self = calloc(1, sizeof(_output_dnssim_t)));
     self->handshake_timeout_ms = 5000;
     self->idle_timeout_ms = 10000;
+    self->max_client_conns = 1;
     output_dnssim_timeout_ms(self, 2000);
 
-    _self->source = NULL;
+    self->linger_s = -1;
     _self->transport = OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY;
 
     self->max_clients = max_clients;
-    lfatal_oom(_self->client_arr = calloc(
-        max_clients, sizeof(_output_dnssim_client_t)));
-    for (int i=0; i < max_clients; ++i)
-        _self->client_arr[i].dnssim = self;
+    self->client_idle_timeout_ms = 60000;
 
     ret = uv_loop_init(&_self->loop);
     if (ret < 0) {
@@ -54,6 +104,8 @@ output_dnssim_t* output_dnssim_new(size_t max_clients)
     }
     ldebug("initialized uv_loop");
 
+    _init_clients(self);
+
     return self;
 }
 
@@ -61,29 +113,35 @@ void output_dnssim_free(output_dnssim_t* self)
 {
     mlassert_self();
     int ret;
-    _output_dnssim_source_t* source;
-    _output_dnssim_source_t* first = _self->source;
     output_dnssim_stats_t* stats_prev;
 
-    free(self->stats_sum->latency);
-    free(self->stats_sum);
+    _trace_close(self);
+
+    /* Close the remaining handles and let the loop run their close callbacks
+     * before freeing the targets, stats and clients they may refer to. */
+    if (self->stats_interval_ms != 0 && !_self->is_stats_finished)
+        uv_close((uv_handle_t*)&_self->stats_timer, NULL);
+    _close_clients(self);
+    uv_run(&_self->loop, UV_RUN_NOWAIT);
+
+    _free_stats(self->stats_sum);
     do {
         stats_prev = self->stats_current->prev;
-        free(self->stats_current->latency);
-        free(self->stats_current);
+        _free_stats(self->stats_current);
         self->stats_current = stats_prev;
     } while (self->stats_current != NULL);
 
-    if (_self->source != NULL) {
-        // free cilcular linked list
-        do {
-            source = _self->source->next;
-            free(_self->source);
-            _self->source = source;
-        } while (_self->source != first);
-    }
+    free(_self->sources4.sources);
+    free(_self->sources6.sources);
+
+    _clear_targets(self);
+
+    _free_clients(self);
 
-    free(_self->client_arr);
+#if HAVE_NGTCP2
+    if (_self->quic_creds != NULL)
+        gnutls_certificate_free_credentials(_self->quic_creds);
+#endif
 
     ret = uv_loop_close(&_self->loop);
     if (ret < 0) {
@@ -95,34 +153,19 @@ void output_dnssim_free(output_dnssim_t* self)
     free(self);
 }
 
-static uint32_t _extract_client(const core_object_t* obj) {
-    uint32_t client;
-    uint8_t* ip;
-
-    switch (obj->obj_type) {
-    case CORE_OBJECT_IP:
-        ip = ((core_object_ip_t*)obj)->dst;
-        break;
-    case CORE_OBJECT_IP6:
-        ip = ((core_object_ip6_t*)obj)->dst;
-        break;
-    default:
-        return -1;
-    }
-
-    memcpy(&client, ip, sizeof(client));
-    return client;
-}
-
-static void _receive(output_dnssim_t* self, const core_object_t* obj)
+static void _process(output_dnssim_t* self, const core_object_t* obj)
 {
     mlassert_self();
     core_object_t* current = (core_object_t*)obj;
     core_object_payload_t* payload;
-    uint32_t client;
+    _output_dnssim_client_t* client;
+    uint64_t intended_ns = 0;
 
     self->processed++;
 
+    if (_self->trace != NULL)
+        intended_ns = _trace_intended_ns(_self->trace, obj);
+
     /* get payload from packet */
     for (;;) {
         if (current->obj_type == CORE_OBJECT_PAYLOAD) {
@@ -140,7 +183,7 @@ static void _receive(output_dnssim_t* self, const core_object_t* obj)
     /* extract client information from IP/IP6 layer */
     for (;;) {
         if (current->obj_type == CORE_OBJECT_IP || current->obj_type == CORE_OBJECT_IP6) {
-            client = _extract_client(current);
+            client = _lookup_client(self, current);
             break;
         }
         if (current->obj_prev == NULL) {
@@ -164,14 +207,33 @@ static void _receive(output_dnssim_t* self, const core_object_t* obj)
         }
     }
 
-    if (client >= self->max_clients) {
+    if (client == NULL) {
         self->discarded++;
         lwarning("packet discarded (client exceeded max_clients)");
+        if (self->free_after_use)
+            core_object_payload_free(payload);
+        return;
+    }
+
+    ldebug("client(c): %d", client->id);
+    _submit_request(self, client, payload, intended_ns);
+}
+
+static void _receive(output_dnssim_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    if (!_self->is_threaded) {
+        _process(self, obj);
         return;
     }
 
-    ldebug("client(c): %d", client);
-    _create_request(self, &_self->client_arr[client], payload);
+    /* Hand the object over to the event loop thread. */
+    while (!ck_ring_enqueue_spsc(&_self->ring, _self->ring_buf, (void*)obj)) {
+        uv_async_send(&_self->async);
+        sched_yield();
+    }
+    uv_async_send(&_self->async);
 }
 
 core_receiver_t output_dnssim_receiver()
@@ -181,15 +243,30 @@ core_receiver_t output_dnssim_receiver()
 
 void output_dnssim_set_transport(output_dnssim_t* self, output_dnssim_transport_t tr) {
     mlassert_self();
+    _check_config(self);
 
     switch(tr) {
     case OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY:
         lnotice("transport set to UDP (no TCP fallback)");
         break;
+    case OUTPUT_DNSSIM_TRANSPORT_UDP:
+        lnotice("transport set to UDP (with TCP fallback)");
+        break;
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
         lnotice("transport set to TCP");
         break;
-    case OUTPUT_DNSSIM_TRANSPORT_UDP:
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
+#if HAVE_NGTCP2
+        if (_self->quic_creds == NULL) {
+            int ret = gnutls_certificate_allocate_credentials(&_self->quic_creds);
+            if (ret != GNUTLS_E_SUCCESS)
+                lfatal("failed to allocate TLS credentials: %s", gnutls_strerror(ret));
+        }
+        lnotice("transport set to QUIC (DNS-over-QUIC)");
+#else
+        lfatal("DNS-over-QUIC support not compiled in");
+#endif
+        break;
     case OUTPUT_DNSSIM_TRANSPORT_TLS:
     default:
         lfatal("unknown or unsupported transport");
@@ -200,80 +277,505 @@ void output_dnssim_set_transport(output_dnssim_t* self, output_dnssim_transport_
 }
 
 int output_dnssim_target(output_dnssim_t* self, const char* ip, uint16_t port) {
+    mlassert_self();
+    _check_config(self);
+
+    if (_self->targets_in_use) {
+        lfatal("targets can't be changed once clients or connections use them");
+    }
+    _clear_targets(self);
+
+    return output_dnssim_add_target(self, ip, port, 1);
+}
+
+int output_dnssim_add_target(output_dnssim_t* self, const char* ip, uint16_t port, uint32_t weight) {
     int ret;
     mlassert_self();
     lassert(ip, "ip is nil");
     lassert(port, "port is nil");
+    _check_config(self);
 
-    ret = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&_self->target);
+    if (_self->targets_in_use) {
+        lfatal("targets can't be changed once clients or connections use them");
+    }
+    if (weight == 0 || weight > _OUTPUT_DNSSIM_MAX_WEIGHT) {
+        lcritical("target weight must be between 1 and %d", _OUTPUT_DNSSIM_MAX_WEIGHT);
+        return -1;
+    }
+
+    _output_dnssim_target_t* target;
+    lfatal_oom(target = calloc(1, sizeof(_output_dnssim_target_t)));
+
+    ret = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&target->addr);
     if (ret != 0) {
-        lcritical("failed to parse IPv6 from \"%s\"", ip);
+        ret = uv_ip4_addr(ip, port, (struct sockaddr_in*)&target->addr);
+        if (ret != 0) {
+            lcritical("failed to parse IP/IP6 from \"%s\"", ip);
+            free(target);
+            return -1;
+        }
+    }
+
+    target->weight = weight;
+    target->idx = _self->n_targets;
+    target->stats = _new_stats(self);
+    target->shared_client.dnssim = self;
+    target->shared_client.target = target;
+
+    lfatal_oom(_self->targets = realloc(_self->targets,
+        (_self->n_targets + 1) * sizeof(_output_dnssim_target_t*)));
+    _self->targets[_self->n_targets++] = target;
+
+    /* Ring is rebuilt on first use. */
+    free(_self->ring_points);
+    _self->ring_points = NULL;
+    _self->n_ring_points = 0;
+
+    lnotice("added target %s port %d (weight %u)", ip, port, weight);
+    return 0;
+}
+
+output_dnssim_stats_t* output_dnssim_target_stats(output_dnssim_t* self, size_t idx)
+{
+    mlassert_self();
+    lassert(idx < _self->n_targets, "target index out of range");
+
+    return _self->targets[idx]->stats;
+}
+
+int output_dnssim_client_key(output_dnssim_t* self, output_dnssim_client_key_t key)
+{
+    mlassert_self();
+    _check_config(self);
+
+    if (self->processed > 0) {
+        lfatal("client key can't be changed after queries were sent");
+    }
+    if (_self->client_table == NULL) {
+        lcritical("client key requires sparse client table (max_clients 0)");
         return -1;
-        // TODO IPv4 support
-        //ret = uv_ip4_addr(ip, port, (struct sockaddr_in*)&_self->target);
-        //if (ret != 0) {
-        //    lcritical("failed to parse IP/IP6 from \"%s\"", ip);
-        //    return -1;
-        //}
     }
 
-    lnotice("set target to %s port %d", ip, port);
+    _self->client_table->key = key;
     return 0;
 }
 
-int output_dnssim_bind(output_dnssim_t* self, const char* ip) {
-    int ret;
+int output_dnssim_bind(output_dnssim_t* self, const char* ip)
+{
     mlassert_self();
+    _check_config(self);
     lassert(ip, "ip is nil");
 
-    _output_dnssim_source_t* source;
-    lfatal_oom(source = malloc(sizeof(_output_dnssim_source_t)));
-
-    ret = uv_ip6_addr(ip, 0, (struct sockaddr_in6*)&source->addr);
-    if (ret != 0) {
-        lfatal("failed to parse IPv6 from \"%s\"", ip);
+    char addr[INET6_ADDRSTRLEN];
+    const char* slash = strchr(ip, '/');
+    size_t addr_len = slash ? (size_t)(slash - ip) : strlen(ip);
+    if (addr_len >= sizeof(addr)) {
+        lcritical("invalid source address \"%s\"", ip);
+        return -1;
+    }
+    memcpy(addr, ip, addr_len);
+    addr[addr_len] = 0;
+
+    _output_dnssim_source_t source;
+    _output_dnssim_source_pool_t* pool;
+    unsigned int max_prefix;
+    memset(&source, 0, sizeof(source));
+    if (uv_ip6_addr(addr, 0, (struct sockaddr_in6*)&source.addr) == 0) {
+        pool = &_self->sources6;
+        max_prefix = 128;
+    } else if (uv_ip4_addr(addr, 0, (struct sockaddr_in*)&source.addr) == 0) {
+        pool = &_self->sources4;
+        max_prefix = 32;
+    } else {
+        lcritical("failed to parse IPv4 or IPv6 from \"%s\"", ip);
         return -1;
-        // TODO IPv4 support
     }
 
-    if (_self->source == NULL) {
-        source->next = source;
-        _self->source = source;
+    unsigned int prefix_len = max_prefix;
+    if (slash) {
+        char* end;
+        unsigned long len = strtoul(slash + 1, &end, 10);
+        if (*(slash + 1) == 0 || *end != 0 || len > max_prefix) {
+            lcritical("invalid prefix length in \"%s\"", ip);
+            return -1;
+        }
+        prefix_len = len;
+    }
+    source.prefix_len = prefix_len;
+
+    /* Clear the host bits and skip the network (and IPv4 broadcast) address. */
+    unsigned int host_bits = max_prefix - prefix_len;
+    uint8_t* bytes = max_prefix == 128
+        ? ((struct sockaddr_in6*)&source.addr)->sin6_addr.s6_addr
+        : (uint8_t*)&((struct sockaddr_in*)&source.addr)->sin_addr.s_addr;
+    for (unsigned int i = prefix_len; i < max_prefix; ++i)
+        bytes[i / 8] &= ~(0x80 >> (i % 8));
+    if (host_bits == 0) {
+        source.n_addrs = 1;
+    } else if (host_bits >= 32) {
+        source.n_addrs = _OUTPUT_DNSSIM_MAX_SOURCE_ADDRS;
+        source.offset = 1;
     } else {
-        source->next = _self->source->next;
-        _self->source->next = source;
+        source.n_addrs = ((uint64_t)1 << host_bits) - 1;
+        source.offset = 1;
+        if (max_prefix == 32 && host_bits > 1)
+            source.n_addrs--;
     }
 
-    lnotice("bind to source address %s", ip);
+    lfatal_oom(pool->sources = realloc(pool->sources, (pool->n_sources + 1) * sizeof(_output_dnssim_source_t)));
+    pool->sources[pool->n_sources++] = source;
+    pool->n_addrs += source.n_addrs;
+    if (host_bits > 0)
+        pool->has_prefix = true;
+
+    lnotice("bind to source %s (%lu addresses)", ip, source.n_addrs);
+    return 0;
+}
+
+int output_dnssim_source_ports(output_dnssim_t* self, uint16_t port_min, uint16_t port_max)
+{
+    mlassert_self();
+    _check_config(self);
+
+    if (port_min > port_max || (port_min == 0 && port_max != 0)) {
+        lcritical("invalid source port range %u-%u", port_min, port_max);
+        return -1;
+    }
+    _self->port_min = port_min;
+    _self->port_max = port_max;
+    _self->port_next = 0;
+
+    if (port_min == 0)
+        lnotice("source ports are chosen by the system");
+    else
+        lnotice("source ports %u-%u", port_min, port_max);
     return 0;
 }
 
 int output_dnssim_run_nowait(output_dnssim_t* self)
 {
     mlassert_self();
+    lassert(!_self->is_threaded, "run_nowait() can't be used with event loop thread");
 
     return uv_run(&_self->loop, UV_RUN_NOWAIT);
 }
 
+static void _finish_stats(output_dnssim_t* self)
+{
+    uint64_t now_ms = _now_ms();
+
+    if (_self->is_stats_finished)
+        return;
+    _self->is_stats_finished = true;
+
+    self->stats_sum->until_ms = now_ms;
+    self->stats_current->until_ms = now_ms;
+
+    if (self->stats_interval_ms != 0) {
+        uv_timer_stop(&_self->stats_timer);
+        uv_close((uv_handle_t*)&_self->stats_timer, NULL);
+    }
+}
+
+static void _copy_stats(output_dnssim_t* self, output_dnssim_stats_t* dst)
+{
+    *dst = *self->stats_sum;
+    dst->prev = NULL;
+    dst->next = NULL;
+    dst->latency = NULL;
+    dst->conn_queue_wait = NULL;
+    dst->client_queue_wait = NULL;
+    dst->fallback_latency_udp = NULL;
+    dst->fallback_latency_tcp = NULL;
+    dst->ongoing = self->ongoing;
+    dst->conn_active = self->stats_current->conn_active;
+}
+
+/* Finish the stats and close the remaining handles of the loop thread,
+ * including the idle and preconnected connections, so the loop ends without
+ * waiting for their idle timers. */
+static void _finish_thread(output_dnssim_t* self)
+{
+    _finish_stats(self);
+
+    /* Serve a snapshot requested in the meantime, later ones are refused. */
+    pthread_mutex_lock(&_self->stats_lock);
+    _self->is_stats_closed = true;
+    if (_self->stats_dst != NULL) {
+        _copy_stats(self, _self->stats_dst);
+        _self->stats_dst = NULL;
+        pthread_cond_signal(&_self->stats_cond);
+    }
+    pthread_mutex_unlock(&_self->stats_lock);
+
+    uv_close((uv_handle_t*)&_self->stats_async, NULL);
+    uv_close((uv_handle_t*)&_self->drain_check, NULL);
+    _close_idle_conns(self);
+}
+
+static void _on_drain_check(uv_check_t* handle)
+{
+    output_dnssim_t* self = (output_dnssim_t*)handle->data;
+
+    if (_self->outstanding == 0) {
+        uv_check_stop(handle);
+        _finish_thread(self);
+    }
+}
+
+static void _on_async(uv_async_t* handle)
+{
+    output_dnssim_t* self = (output_dnssim_t*)handle->data;
+    void* obj;
+
+    if (uv_is_closing((uv_handle_t*)handle))
+        return;
+
+    /* Objects are enqueued before the input end is signalled, so once it's
+     * seen the ring is drained for good. */
+    int is_closing = ck_pr_load_int(&_self->is_closing);
+    ck_pr_fence_load();
+
+    while (ck_ring_dequeue_spsc(&_self->ring, _self->ring_buf, &obj))
+        _process(self, (core_object_t*)obj);
+
+    if (!is_closing)
+        return;
+
+    /* Let the loop finish once ongoing requests are done. */
+    uv_close((uv_handle_t*)handle, NULL);
+    if (_self->outstanding == 0)
+        _finish_thread(self);
+    else
+        uv_check_start(&_self->drain_check, _on_drain_check);
+}
+
+static void _on_stats_async(uv_async_t* handle)
+{
+    output_dnssim_t* self = (output_dnssim_t*)handle->data;
+
+    pthread_mutex_lock(&_self->stats_lock);
+    if (_self->stats_dst != NULL) {
+        _copy_stats(self, _self->stats_dst);
+        _self->stats_dst = NULL;
+        pthread_cond_signal(&_self->stats_cond);
+    }
+    pthread_mutex_unlock(&_self->stats_lock);
+}
+
+static void* _loop_thread(void* arg)
+{
+    output_dnssim_t* self = (output_dnssim_t*)arg;
+
+    ldebug("event loop thread started");
+    uv_run(&_self->loop, UV_RUN_DEFAULT);
+    ldebug("event loop thread finished");
+
+    return NULL;
+}
+
+int output_dnssim_thread_start(output_dnssim_t* self, size_t capacity)
+{
+    mlassert_self();
+    int err;
+
+    if (_self->is_threaded) {
+        lfatal("event loop thread already started");
+    }
+    if (capacity < 4 || (capacity & (capacity - 1)) != 0) {
+        lfatal("invalid capacity, must be power of two and at least 4");
+    }
+    if (!self->free_after_use) {
+        lfatal("event loop thread requires free_after_use, objects must be copied");
+    }
+
+    lfatal_oom(_self->ring_buf = malloc(sizeof(ck_ring_buffer_t) * capacity));
+    ck_ring_init(&_self->ring, capacity);
+
+    _self->async.data = (void*)self;
+    uv_async_init(&_self->loop, &_self->async, _on_async);
+    _self->stats_async.data = (void*)self;
+    uv_async_init(&_self->loop, &_self->stats_async, _on_stats_async);
+    _self->drain_check.data = (void*)self;
+    uv_check_init(&_self->loop, &_self->drain_check);
+    pthread_mutex_init(&_self->stats_lock, NULL);
+    pthread_cond_init(&_self->stats_cond, NULL);
+
+    _self->is_threaded = true;
+    if ((err = pthread_create(&_self->thread, NULL, _loop_thread, (void*)self))) {
+        lcritical("pthread_create() error: %s", core_log_errstr(err));
+        _self->is_threaded = false;
+        return -1;
+    }
+
+    lnotice("started event loop thread");
+    return 0;
+}
+
+int output_dnssim_thread_stop(output_dnssim_t* self)
+{
+    mlassert_self();
+    int err;
+
+    if (!_self->is_threaded) {
+        lfatal("event loop thread isn't running");
+    }
+
+    ck_pr_store_int(&_self->is_closing, 1);
+    uv_async_send(&_self->async);
+
+    if ((err = pthread_join(_self->thread, NULL))) {
+        lcritical("pthread_join() error: %s", core_log_errstr(err));
+        return -1;
+    }
+
+    _self->is_threaded = false;
+    pthread_mutex_destroy(&_self->stats_lock);
+    pthread_cond_destroy(&_self->stats_cond);
+    free(_self->ring_buf);
+    _self->ring_buf = NULL;
+
+    lnotice("stopped event loop thread");
+    return 0;
+}
+
+int output_dnssim_stats_snapshot(output_dnssim_t* self, output_dnssim_stats_t* dst)
+{
+    mlassert_self();
+    lassert(dst, "dst is nil");
+
+    if (!_self->is_threaded) {
+        _copy_stats(self, dst);
+        return 0;
+    }
+
+    /* Stats are only modified from the event loop thread, copy them there. */
+    pthread_mutex_lock(&_self->stats_lock);
+    if (_self->is_stats_closed) {
+        pthread_mutex_unlock(&_self->stats_lock);
+        lwarning("stats snapshot refused, event loop thread is finishing");
+        return -1;
+    }
+    _self->stats_dst = dst;
+    uv_async_send(&_self->stats_async);
+    while (_self->stats_dst != NULL)
+        pthread_cond_wait(&_self->stats_cond, &_self->stats_lock);
+    pthread_mutex_unlock(&_self->stats_lock);
+    return 0;
+}
+
+int output_dnssim_preconnect(output_dnssim_t* self, size_t clients, size_t conns)
+{
+    mlassert_self();
+    int ret;
+    _check_config(self);
+
+    if (_self->transport != OUTPUT_DNSSIM_TRANSPORT_TCP && _self->transport != OUTPUT_DNSSIM_TRANSPORT_UDP) {
+        lcritical("preconnect requires connection-oriented transport");
+        return -1;
+    }
+    if (self->max_client_conns > 0 && conns > self->max_client_conns) {
+        lwarning("preconnect: limiting number of connections to max_client_conns (%lu)",
+            self->max_client_conns);
+        conns = self->max_client_conns;
+    }
+
+    if (_self->n_targets == 0) {
+        lcritical("preconnect requires target to be set");
+        return -1;
+    }
+
+    if (self->share_conns) {
+        _self->targets_in_use = true;
+        for (size_t t = 0; t < _self->n_targets; ++t) {
+            for (size_t j = 0; j < conns; ++j) {
+                ret = _open_connection(&_self->targets[t]->shared_client);
+                if (ret < 0)
+                    return ret;
+            }
+        }
+    } else {
+        if (_self->client_table == NULL && clients > self->max_clients)
+            clients = self->max_clients;
+        if (_self->client_table != NULL && _self->client_table->key != OUTPUT_DNSSIM_CLIENT_KEY_ID) {
+            lcritical("preconnect requires clients identified by ID");
+            return -1;
+        }
+        for (size_t i = 0; i < clients; ++i) {
+            _output_dnssim_client_t* client = _client_by_id(self, i);
+            _output_dnssim_client_t* mirror = NULL;
+            _client_target(self, client);
+            if (self->mirror && _self->n_targets > 1)
+                mirror = _mirror_clients(self, client);
+
+            for (size_t j = 0; j < conns; ++j) {
+                ret = _open_connection(client);
+                if (ret < 0)
+                    return ret;
+                for (size_t t = 0; mirror != NULL && t < _self->n_targets - 1; ++t) {
+                    ret = _open_connection(&mirror[t]);
+                    if (ret < 0)
+                        return ret;
+                }
+            }
+        }
+    }
+
+    lnotice("preconnect: opening %lu connection(s) for %lu client(s)", conns,
+        self->share_conns ? 1 : clients);
+    return 0;
+}
+
+int output_dnssim_trace(output_dnssim_t* self, const char* file, double time_mul)
+{
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (_self->trace != NULL) {
+        lfatal("trace already enabled");
+    }
+    if (_self->is_threaded) {
+        lfatal("trace must be enabled before the event loop thread");
+    }
+
+    if (_trace_open(self, file) != 0)
+        return -1;
+    _self->trace->time_mul = time_mul;
+
+    lnotice("writing request trace to %s", file);
+    return 0;
+}
+
+void output_dnssim_trace_close(output_dnssim_t* self)
+{
+    mlassert_self();
+    lassert(!_self->is_threaded, "trace can't be closed while event loop thread runs");
+
+    _trace_close(self);
+}
+
 void output_dnssim_timeout_ms(output_dnssim_t* self, uint64_t timeout_ms)
 {
     mlassert_self();
     lassert(timeout_ms > 0, "timeout must be greater than 0");
+    _check_config(self);
 
     if (self->stats_sum != NULL)
-        free(self->stats_sum);
+        _free_stats(self->stats_sum);
     if (self->stats_current != NULL)
-        free(self->stats_current);
+        _free_stats(self->stats_current);
 
     self->timeout_ms = timeout_ms;
 
-    lfatal_oom(self->stats_sum = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(self->stats_sum->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
-
-    lfatal_oom(self->stats_current = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(self->stats_current->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
-
+    self->stats_sum = _new_stats(self);
+    self->stats_current = _new_stats(self);
     self->stats_first = self->stats_current;
+
+    /* Histograms are sized according to timeout. */
+    for (size_t i = 0; i < _self->n_targets; ++i) {
+        _free_stats(_self->targets[i]->stats);
+        _self->targets[i]->stats = _new_stats(self);
+    }
 }
 
 static void _on_stats_timer_tick(uv_timer_t* handle)
@@ -284,9 +786,7 @@ static void _on_stats_timer_tick(uv_timer_t* handle)
         self->processed, self->stats_sum->answers, self->discarded,
         self->ongoing);
 
-    output_dnssim_stats_t* stats_next;
-    lfatal_oom(stats_next = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(stats_next->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    output_dnssim_stats_t* stats_next = _new_stats(self);
 
     self->stats_current->until_ms = now_ms;
     stats_next->since_ms = now_ms;
@@ -306,6 +806,9 @@ void output_dnssim_stats_collect(output_dnssim_t* self, uint64_t interval_ms)
     if (self->stats_interval_ms != 0) {
         lfatal("statistics collection has already started!");
     }
+    if (_self->is_threaded) {
+        lfatal("statistics collection must start before the event loop thread");
+    }
     self->stats_interval_ms = interval_ms;
 
     self->stats_sum->since_ms = now_ms;
@@ -318,12 +821,8 @@ void output_dnssim_stats_collect(output_dnssim_t* self, uint64_t interval_ms)
 
 void output_dnssim_stats_finish(output_dnssim_t* self)
 {
-    uint64_t now_ms = _now_ms();
     mlassert_self();
+    lassert(!_self->is_threaded, "stats are finished by stopping the event loop thread");
 
-    self->stats_sum->until_ms = now_ms;
-    self->stats_current->until_ms = now_ms;
-
-    uv_timer_stop(&_self->stats_timer);
-    uv_close((uv_handle_t*)&_self->stats_timer, NULL);
+    _finish_stats(self);
 }
@@ -25,6 +25,7 @@
 #include "core/object/ip.h"
 #include "core/object/ip6.h"
 #include "core/object/payload.h"
+#include "core/object/pcap.h"
 #include "core/producer.h"
 #include "core/receiver.h"
 
@@ -36,6 +37,26 @@
 #include <stdint.h>
 #include <uv.h>
 #include <ck_ring.h>
+#include <ck_pr.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+#if HAVE_NGTCP2
+#include <inttypes.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <ngtcp2/ngtcp2.h>
+#include <ngtcp2/ngtcp2_crypto.h>
+#include <ngtcp2/ngtcp2_crypto_gnutls.h>
+#endif
 
 #include "output/dnssim.hh"
 #include "output/dnssim/internal.h"
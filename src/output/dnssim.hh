@@ -25,9 +25,56 @@ typedef enum output_dnssim_transport {
     OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY,
     OUTPUT_DNSSIM_TRANSPORT_UDP,
     OUTPUT_DNSSIM_TRANSPORT_TCP,
-    OUTPUT_DNSSIM_TRANSPORT_TLS
+    OUTPUT_DNSSIM_TRANSPORT_TLS,
+    OUTPUT_DNSSIM_TRANSPORT_QUIC
 } output_dnssim_transport_t;
 
+/* How clients are identified in the input packets: by 32bit ID written to
+ * the first 4 bytes of destination IP (see dnsjit.filter.ipsplit) or by the
+ * full source IPv4/IPv6 address. */
+typedef enum output_dnssim_client_key {
+    OUTPUT_DNSSIM_CLIENT_KEY_ID,
+    OUTPUT_DNSSIM_CLIENT_KEY_SRC
+} output_dnssim_client_key_t;
+
+/* Binary trace of individual requests: a header followed by fixed-size records. */
+typedef struct output_dnssim_trace_header {
+    char magic[8]; /* "DNSSIMTR" */
+    uint32_t version;
+    uint32_t record_size;
+} output_dnssim_trace_header_t;
+
+enum {
+    OUTPUT_DNSSIM_TRACE_VERSION = 2,
+
+    /* Record flags. */
+    OUTPUT_DNSSIM_TRACE_ANSWERED = 1,
+    OUTPUT_DNSSIM_TRACE_FALLBACK = 2
+};
+
+typedef struct output_dnssim_trace_record {
+    /* Monotonic time (ns) when the request should have been sent, when its
+     * first query was written to the socket (0 if never) and when it was
+     * answered or timed out. */
+    uint64_t intended_ns;
+    uint64_t sent_ns;
+    uint64_t completed_ns;
+
+    /* Time (ns) the request waited before it was written, e.g. for a TCP
+     * connection to be established or to get below max_conn_inflight. */
+    uint64_t queue_wait_ns;
+
+    uint32_t client;
+    uint8_t rcode;
+    uint8_t transport;
+    uint16_t flags;
+} output_dnssim_trace_record_t;
+
+/* Number of log2 buckets of the sampled TCP_INFO histograms. */
+enum {
+    OUTPUT_DNSSIM_TCPI_BUCKETS = 33
+};
+
 typedef struct output_dnssim_stats output_dnssim_stats_t;
 struct output_dnssim_stats {
     output_dnssim_stats_t* prev;
@@ -35,6 +82,17 @@ struct output_dnssim_stats {
 
     uint64_t* latency;
 
+    /* Histogram of time (in ms) queries spent waiting for a TCP connection. */
+    uint64_t* conn_queue_wait;
+
+    /* Histogram of time (in ms) requests spent in client queue (closed-loop). */
+    uint64_t* client_queue_wait;
+
+    /* Latency components (in ms) of requests that fell back from UDP to TCP:
+     * time until the truncated UDP answer and time spent over TCP. */
+    uint64_t* fallback_latency_udp;
+    uint64_t* fallback_latency_tcp;
+
     uint64_t since_ms;
     uint64_t until_ms;
 
@@ -42,6 +100,13 @@ struct output_dnssim_stats {
     uint64_t ongoing;
     uint64_t answers;
 
+    /* Number of truncated UDP answers that were retried over TCP. */
+    uint64_t fallback_tcp;
+
+    /* Number of requests queued or dropped due to client's outstanding limit. */
+    uint64_t client_queued;
+    uint64_t client_dropped;
+
     /* Number of connections that are open at the end of the stats interval. */
     uint64_t conn_active;
 
@@ -51,6 +116,32 @@ struct output_dnssim_stats {
     /* Number of timed out connection handshakes during the stats interval. */
     uint64_t conn_handshakes_failed;
 
+    /* Number of queries that had to wait for a connection to be sent over. */
+    uint64_t conn_queued;
+
+    /* Number of connections that resumed TLS session and that had their
+     * early data (0-RTT) accepted. */
+    uint64_t conn_resumed;
+    uint64_t conn_0rtt;
+
+    /* Number of sockets that couldn't be bound or connected because
+     * the source ports or 4-tuples ran out. */
+    uint64_t port_exhausted;
+
+    /* Samples of TCP_INFO taken from active TCP connections and the number
+     * of segments they retransmitted since the previous sample. */
+    uint64_t tcpi_samples;
+    uint64_t tcpi_retrans;
+
+    /* Histograms of the samples in log2 buckets, bucket i counts values
+     * in [2^(i-1), 2^i) and bucket 0 counts zeros: smoothed RTT in us,
+     * congestion window in segments, bytes in the kernel send queue and
+     * bytes of queries waiting in the write queue of dnssim. */
+    uint64_t tcpi_rtt_us[OUTPUT_DNSSIM_TCPI_BUCKETS];
+    uint64_t tcpi_cwnd[OUTPUT_DNSSIM_TCPI_BUCKETS];
+    uint64_t tcpi_sndq[OUTPUT_DNSSIM_TCPI_BUCKETS];
+    uint64_t tcpi_writeq[OUTPUT_DNSSIM_TCPI_BUCKETS];
+
     uint64_t rcode_noerror;
     uint64_t rcode_formerr;
     uint64_t rcode_servfail;
@@ -84,13 +175,53 @@ typedef struct output_dnssim {
     output_dnssim_stats_t* stats_current;
     output_dnssim_stats_t* stats_first;
 
+    /* Size of the client array indexed by client ID, 0 uses a sparse table
+     * of clients created on first use and evicted after they've been idle
+     * for client_idle_timeout_ms. */
     size_t max_clients;
     bool free_after_use;
+    uint64_t client_idle_timeout_ms;
+
+    /* Number of clients in the sparse table and number of evicted clients. */
+    uint64_t clients;
+    uint64_t clients_evicted;
 
     uint64_t timeout_ms;
     uint64_t idle_timeout_ms;
     uint64_t handshake_timeout_ms;
     uint64_t stats_interval_ms;
+
+    /* Minimum time between TCP_INFO samples of a connection (0 disables). */
+    uint64_t tcp_info_interval_ms;
+
+    /* Maximum number of queries in flight over a single connection (0 is unlimited). */
+    size_t max_conn_inflight;
+
+    /* Maximum number of connections a client may have open at the same time. */
+    size_t max_client_conns;
+
+    /* Share connections among all clients instead of per-client connections. */
+    bool share_conns;
+
+    /* Closed-loop client model: maximum number of outstanding requests per
+     * client (0 is open-loop), time a client waits after receiving an answer
+     * and whether to drop requests over the limit instead of queueing them. */
+    size_t max_client_outstanding;
+    uint64_t think_time_ms;
+    bool drop_over_limit;
+
+    /* Send every query to all targets instead of a single one. */
+    bool mirror;
+
+    /* Send queries in early data (0-RTT) of resumed QUIC connections. */
+    bool zero_rtt;
+
+    /* Options of outgoing sockets: SO_REUSEADDR, SO_LINGER timeout in seconds
+     * (negative keeps the system default) and IP_TRANSPARENT instead of
+     * IP_FREEBIND when binding to addresses of a source prefix. */
+    bool reuseaddr;
+    int linger_s;
+    bool transparent;
 } output_dnssim_t;
 
 core_log_t* output_dnssim_log();
@@ -100,8 +231,18 @@ void output_dnssim_free(output_dnssim_t* self);
 
 void output_dnssim_set_transport(output_dnssim_t* self, output_dnssim_transport_t tr);
 int output_dnssim_target(output_dnssim_t* self, const char* ip, uint16_t port);
+int output_dnssim_add_target(output_dnssim_t* self, const char* ip, uint16_t port, uint32_t weight);
+output_dnssim_stats_t* output_dnssim_target_stats(output_dnssim_t* self, size_t idx);
+int output_dnssim_client_key(output_dnssim_t* self, output_dnssim_client_key_t key);
 int output_dnssim_bind(output_dnssim_t* self, const char* ip);
+int output_dnssim_source_ports(output_dnssim_t* self, uint16_t port_min, uint16_t port_max);
 int output_dnssim_run_nowait(output_dnssim_t* self);
+int output_dnssim_thread_start(output_dnssim_t* self, size_t capacity);
+int output_dnssim_thread_stop(output_dnssim_t* self);
+int output_dnssim_stats_snapshot(output_dnssim_t* self, output_dnssim_stats_t* dst);
+int output_dnssim_trace(output_dnssim_t* self, const char* file, double time_mul);
+void output_dnssim_trace_close(output_dnssim_t* self);
+int output_dnssim_preconnect(output_dnssim_t* self, size_t clients, size_t conns);
 void output_dnssim_timeout_ms(output_dnssim_t* self, uint64_t timeout_ms);
 void output_dnssim_stats_collect(output_dnssim_t* self, uint64_t interval_ms);
 void output_dnssim_stats_finish(output_dnssim_t* self);
@@ -21,6 +21,7 @@
 --   output = require("dnsjit.output.dnssim").new()
 --   output:udp_only()
 --   output:target("::1", 53)
+--   -- or output:add_target("192.0.2.1", 53, 2) for several targets
 --   recv, rctx = output:receive()
 --   -- pass in objects using recv(rctx, obj)
 --   -- repeatedly call output:run_nowait() until it returns 0
@@ -46,13 +47,73 @@ local C = ffi.C
 
 local DnsSim = {}
 
-local _DNSSIM_JSON_VERSION = 20200406
+local _DNSSIM_JSON_VERSION = 20261018
 
--- Create a new DnsSim output for up to max_clients.
+-- Version of the exported JSON format.
+DnsSim.JSON_VERSION = _DNSSIM_JSON_VERSION
+
+-- Counters, latency histograms (timeout_ms + 1 entries) and TCP_INFO buckets
+-- of the statistics, in the order they are exported.
+DnsSim.STATS_COUNTERS = {
+    "since_ms", "until_ms", "requests", "ongoing", "answers", "fallback_tcp",
+    "client_queued", "client_dropped", "conn_active", "conn_handshakes",
+    "conn_handshakes_failed", "conn_queued", "conn_resumed", "conn_0rtt",
+    "port_exhausted", "tcpi_samples", "tcpi_retrans", "rcode_noerror",
+    "rcode_formerr", "rcode_servfail", "rcode_nxdomain", "rcode_notimp",
+    "rcode_refused", "rcode_yxdomain", "rcode_yxrrset", "rcode_nxrrset",
+    "rcode_notauth", "rcode_notzone", "rcode_badvers", "rcode_badkey",
+    "rcode_badtime", "rcode_badmode", "rcode_badname", "rcode_badalg",
+    "rcode_badtrunc", "rcode_badcookie", "rcode_other",
+}
+DnsSim.STATS_HISTOGRAMS = {
+    "latency", "conn_queue_wait", "client_queue_wait", "fallback_latency_udp",
+    "fallback_latency_tcp",
+}
+DnsSim.STATS_BUCKETS = { "tcpi_rtt_us", "tcpi_cwnd", "tcpi_sndq", "tcpi_writeq" }
+
+local function _write_array(file, array, n)
+    file:write(tonumber(array[0]))
+    for i=1,n-1 do
+        file:write(',', tonumber(array[i]))
+    end
+end
+
+-- Write the statistics as a JSON object to
+-- .IR file ,
+-- the histograms hold
+-- .I timeout_ms
+-- + 1 entries.
+-- Besides output_dnssim_stats_t, the statistics can be a table with the same
+-- fields and histograms indexed from 0 (e.g. merged by dnsjit.lib.coord).
+function DnsSim.write_stats(file, stats, timeout_ms)
+    file:write("{ ")
+    for _, name in ipairs(DnsSim.STATS_COUNTERS) do
+        file:write('"', name, '":', tonumber(stats[name]), ',')
+    end
+    for i, name in ipairs(DnsSim.STATS_HISTOGRAMS) do
+        file:write(i > 1 and '],"' or '"', name, '":[')
+        _write_array(file, stats[name], timeout_ms + 1)
+    end
+    for _, name in ipairs(DnsSim.STATS_BUCKETS) do
+        file:write('],"', name, '":[')
+        _write_array(file, stats[name], C.OUTPUT_DNSSIM_TCPI_BUCKETS)
+    end
+    file:write("]}")
+end
+
+-- Create a new DnsSim output for up to max_clients, which are kept in an
+-- array indexed by client ID.
+-- If
+-- .I max_clients
+-- is 0 or not given, clients are kept in a sparse table instead, created on
+-- first use and evicted when they're idle, so the client population doesn't
+-- have to be known up front.
 function DnsSim.new(max_clients)
+    max_clients = max_clients or 0
     local self = {
         obj = C.output_dnssim_new(max_clients),
         max_clients = max_clients,
+        targets = {},
     }
     ffi.gc(self.obj, C.output_dnssim_free)
     return setmetatable(self, { __index = DnsSim })
@@ -66,34 +127,188 @@ function DnsSim:log()
     return self.obj._log
 end
 
--- Set the target server where queries will be sent to. Returns 0 on success.
---
--- Only IPv6 target are supported for now.
-function DnsSim:target(ip, port)
+local function _check_port(self, port)
     local nport = tonumber(port)
     if nport == nil then
         self.obj._log:critical("invalid port: "..port)
-        return -1
+        return nil
     end
     if nport <= 0 or nport > 65535 then
         self.obj._log:critical("invalid port number: "..nport)
+        return nil
+    end
+    return nport
+end
+
+-- Configuration is read by the event loop thread without locking.
+local function _check_config(self)
+    if self._threaded then
+        self.obj._log:fatal("configuration can't be changed while the event loop thread is running")
+    end
+end
+
+-- Set the target server where queries will be sent to, replacing any
+-- previously set targets. Both IPv4 and IPv6 addresses are accepted.
+-- Can't be used once queries were sent or connections preconnected.
+-- Returns 0 on success.
+function DnsSim:target(ip, port)
+    local nport = _check_port(self, port)
+    if nport == nil then
         return -1
     end
-    return C.output_dnssim_target(self.obj, ip, nport)
+    local ret = C.output_dnssim_target(self.obj, ip, nport)
+    if ret == 0 then
+        self.targets = { { ip = ip, port = nport, weight = 1 } }
+    end
+    return ret
+end
+
+-- Add a target server to the set of targets with given
+-- .I weight
+-- (1 to 1000, default 1).
+-- Clients are assigned to targets using consistent hashing of the client ID,
+-- proportionally to the weights, so all queries and TCP connections of a
+-- client go to the same target and the assignment of most clients is
+-- preserved when a target is added or removed between runs.
+-- Targets must be set before any queries are sent or connections
+-- preconnected, they can't be changed once clients use them.
+-- Statistics of individual targets are included in the export.
+-- Returns 0 on success.
+function DnsSim:add_target(ip, port, weight)
+    local nport = _check_port(self, port)
+    if nport == nil then
+        return -1
+    end
+    if weight == nil then
+        weight = 1
+    end
+    local ret = C.output_dnssim_add_target(self.obj, ip, nport, weight)
+    if ret == 0 then
+        table.insert(self.targets, { ip = ip, port = nport, weight = weight })
+    end
+    return ret
+end
+
+-- Set this to true to send every query to all targets instead of a single
+-- one, e.g. to compare two servers under identical load.
+-- Each copy is a separate request in the statistics.
+-- When the closed-loop model is used, it's driven by the answers from the
+-- first target.
+-- Must be set before any queries are sent.
+function DnsSim:mirror(mirror)
+    _check_config(self)
+    self.obj.mirror = mirror
+end
+
+-- Return the summary statistics of target with given index (starting at 1,
+-- in the order targets were added).
+function DnsSim:target_stats(idx)
+    return C.output_dnssim_target_stats(self.obj, idx - 1)
 end
 
--- Specify source address for sending queries. Can be set multiple times. Adresses
--- are selected round-robin when sending.
+-- Set how clients are identified when using the sparse client table:
+-- .I id
+-- (default) uses the 32bit ID in the first 4 bytes of destination IP
+-- (see dnsjit.filter.ipsplit),
+-- .I src
+-- uses the full source IPv4/IPv6 address of the packet, so no ipsplit is
+-- needed.
+-- Must be set before any queries are sent.
+-- Returns 0 on success.
+function DnsSim:client_key(key)
+    if key == "id" then
+        return C.output_dnssim_client_key(self.obj, C.OUTPUT_DNSSIM_CLIENT_KEY_ID)
+    elseif key == "src" then
+        return C.output_dnssim_client_key(self.obj, C.OUTPUT_DNSSIM_CLIENT_KEY_SRC)
+    end
+    self.obj._log:critical("invalid client key: "..tostring(key))
+    return -1
+end
+
+-- Set the time in seconds after which idle clients are evicted from the
+-- sparse client table (default 60s), 0 disables eviction.
+-- A client is idle when it has no requests in progress and no open
+-- connections.
+function DnsSim:client_idle_timeout(seconds)
+    _check_config(self)
+    self.obj.client_idle_timeout_ms = math.floor(seconds * 1000)
+end
+
+-- Return the number of clients in the sparse client table and the number
+-- of clients evicted so far.
+function DnsSim:clients()
+    return tonumber(self.obj.clients), tonumber(self.obj.clients_evicted)
+end
+
+-- Specify source address for sending queries, either a single IPv4 or IPv6
+-- address or a whole prefix, e.g.
+-- .IR 2001:db8::/64 .
+-- Can be set multiple times, all sources of the address family of the target
+-- form a pool of source addresses.
+-- Each client is mapped to a single address of the pool by its ID, so
+-- distinct clients use distinct addresses as long as the pool is large
+-- enough, while connections shared among clients are spread round-robin.
+-- Addresses of a prefix don't have to be configured locally, IP_FREEBIND
+-- (or IP_TRANSPARENT, see
+-- .IR transparent() )
+-- is used to bind to them, however the replies must be routed back to the
+-- host.
+-- Returns 0 on success.
 function DnsSim:bind(ip)
     return C.output_dnssim_bind(self.obj, ip)
 end
+
+-- Allocate source ports from the range
+-- .I port_min
+-- to
+-- .I port_max
+-- instead of letting the system choose them, ports are assigned in sequence
+-- and busy ports are skipped.
+-- Call without arguments to let the system choose, in which case TCP sockets
+-- use IP_BIND_ADDRESS_NO_PORT so a source port can be reused for different
+-- targets.
+-- Sockets that couldn't be bound or connected due to lack of free ports are
+-- counted in the
+-- .I port_exhausted
+-- statistics.
+-- Returns 0 on success.
+function DnsSim:source_ports(port_min, port_max)
+    return C.output_dnssim_source_ports(self.obj, port_min or 0, port_max or 0)
+end
+
+-- Set this to true to set SO_REUSEADDR on the outgoing sockets, this allows
+-- explicitly bound source ports to be reused while in TIME_WAIT.
+-- Note that libuv always sets it on TCP sockets.
+function DnsSim:reuseaddr(reuseaddr)
+    _check_config(self)
+    self.obj.reuseaddr = reuseaddr
+end
+
+-- Set SO_LINGER timeout in seconds for TCP connections, negative value
+-- (default) keeps the system default behaviour.
+-- Timeout of 0 resets connections when they're closed, so they don't linger
+-- in TIME_WAIT and the source ports can be reused immediately.
+function DnsSim:linger(seconds)
+    _check_config(self)
+    self.obj.linger_s = seconds
+end
+
+-- Set this to true to use IP_TRANSPARENT instead of IP_FREEBIND when binding
+-- to addresses of source prefixes, this requires CAP_NET_ADMIN.
+function DnsSim:transparent(transparent)
+    _check_config(self)
+    self.obj.transparent = transparent
+end
 -- Set the transport to UDP (without any TCP fallback).
 function DnsSim:udp_only()
     C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY)
 end
 
 -- Set the preferred transport to UDP. This transport falls back to TCP
--- for individual queries if TC bit is set in received answer.
+-- for individual queries if TC bit is set in received answer. The TCP
+-- retry uses the same connection handling as the TCP transport and the
+-- latency of such requests is additionally split into the UDP and TCP
+-- components in the exported statistics.
 function DnsSim:udp()
     C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_UDP)
 end
@@ -108,6 +323,25 @@ function DnsSim:tls()
     C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_TLS)
 end
 
+-- Set the transport to DNS-over-QUIC (RFC 9250), requires dnsjit to be
+-- built with ngtcp2.
+-- Each query is sent over its own stream and clients reuse their
+-- connection, new connections are opened only when the stream limit or
+-- .I max_conn_inflight
+-- of the existing ones is reached.
+-- TLS sessions are resumed with the ticket of the client's previous
+-- connection.
+-- If
+-- .I zero_rtt
+-- is true, queries of a resumed connection are sent in early data, they're
+-- re-sent after the handshake if the server rejects it.
+-- Server certificates aren't verified; for testing, any DoQ server with
+-- ALPN "doq" (e.g. dnsdist or the ngtcp2 example server) can be used.
+function DnsSim:doq(zero_rtt)
+    C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_QUIC)
+    self.obj.zero_rtt = zero_rtt == true
+end
+
 -- Set timeout for the individual requests in seconds (default 2s). Beware:
 -- increasing this value while the target resolver isn't very responsive (cold
 -- cache, heavy load) may degrade shotgun's performance and skew the results.
@@ -123,21 +357,125 @@ end
 -- Section 6.2.3. When set to zero, connections are closed immediately after
 -- there are no more pending queries. Defaults to 10s.
 function DnsSim:idle_timeout(seconds)
+    _check_config(self)
     if seconds == nil then
         seconds = 10
     end
     self.obj.idle_timeout_ms = math.floor(seconds * 1000)
 end
 
+-- Sample TCP_INFO of active TCP connections every
+-- .I seconds
+-- (0 disables sampling, which is the default).
+-- Each connection is sampled by its own timer while it's open, the
+-- samples are aggregated to per-interval statistics: retransmitted segments
+-- and log2 histograms of RTT, congestion window, kernel send queue and
+-- dnssim's own write queue.
+-- These help to tell apart backpressure in the generator (growing write
+-- queue), network loss (retransmits) and a slow server (high RTT with
+-- empty queues).
+function DnsSim:tcp_info(seconds)
+    _check_config(self)
+    self.obj.tcp_info_interval_ms = math.floor((seconds or 0) * 1000)
+end
+
 -- Set TCP connection handshake timeout. During heavy load, the server may no
 -- longer accept new connections. This parameter ensures such connection
 -- attempts are aborted after the timeout expires. Defaults to 5s.
 function DnsSim:handshake_timeout(seconds)
+    _check_config(self)
     if seconds == nil then
         seconds = 5
     end
     self.obj.handshake_timeout_ms = math.floor(seconds * 1000)
 end
+
+-- Set the maximum number of queries in flight over a single TCP connection.
+-- Queries exceeding this limit wait until an answer is received or another
+-- connection becomes available. Zero means unlimited (default).
+function DnsSim:max_conn_inflight(max)
+    _check_config(self)
+    if max == nil then
+        max = 0
+    end
+    self.obj.max_conn_inflight = max
+end
+
+-- Set the maximum number of TCP connections a client may have open at the
+-- same time. New connections are only opened when existing ones are at their
+-- in-flight limit. Zero means unlimited. Defaults to 1.
+function DnsSim:max_client_conns(max)
+    _check_config(self)
+    if max == nil then
+        max = 1
+    end
+    self.obj.max_client_conns = max
+end
+
+-- Set this to true to share TCP connections among all clients instead of
+-- having separate connections for each client. This emulates a forwarder
+-- which multiplexes queries from many clients over a few connections;
+-- .I max_client_conns
+-- then limits the size of the shared pool.
+function DnsSim:share_conns(share)
+    _check_config(self)
+    self.obj.share_conns = share
+end
+
+-- Open
+-- .I conns
+-- TCP connections for each of the first
+-- .I clients
+-- clients (or for the shared pool of each target) before sending any queries, so that
+-- benchmarks aren't skewed by the initial connection storm. The transport
+-- and target must be set beforehand and
+-- .I idle_timeout
+-- must be long enough to keep the connections open until they're used,
+-- targets can't be changed afterwards.
+-- Returns 0 on success.
+function DnsSim:preconnect(clients, conns)
+    if conns == nil then
+        conns = 1
+    end
+    return C.output_dnssim_preconnect(self.obj, clients, conns)
+end
+-- Use the open-loop client model (default): every received object is sent
+-- as a request right away, regardless of client's outstanding requests.
+function DnsSim:open_loop()
+    _check_config(self)
+    self.obj.max_client_outstanding = 0
+end
+
+-- Use the closed-loop client model: each client may have at most
+-- .I max_outstanding
+-- requests awaiting an answer (default 1).
+-- After a request ends, the client waits for
+-- .I think_time
+-- seconds (default 0) before its slot may be used again.
+-- Requests over the limit are queued per client, or dropped if
+-- .I drop
+-- is true.
+-- Queueing requires the payload to outlive the receive call, so it's copied
+-- unless
+-- .I free_after_use
+-- is set.
+function DnsSim:closed_loop(max_outstanding, think_time, drop)
+    _check_config(self)
+    if max_outstanding == nil then
+        max_outstanding = 1
+    end
+    if max_outstanding <= 0 then
+        self.obj._log:critical("max_outstanding must be positive for closed-loop model")
+        return
+    end
+    if think_time == nil then
+        think_time = 0
+    end
+    self.obj.max_client_outstanding = max_outstanding
+    self.obj.think_time_ms = math.floor(think_time * 1000)
+    self.obj.drop_over_limit = drop == true
+end
+
 -- Run the libuv loop once without blocking when there is no I/O. This
 -- should be called repeatedly until 0 is returned and no more data
 -- is expected to be received by DnsSim.
@@ -145,9 +483,93 @@ function DnsSim:run_nowait()
     return C.output_dnssim_run_nowait(self.obj)
 end
 
+-- Run the libuv loop in a dedicated thread instead of calling
+-- .I run_nowait()
+-- repeatedly. Received objects are then passed to the loop thread through
+-- a lock-free ring of given
+-- .I capacity
+-- (power of two, default 2048) and response processing, timeouts and
+-- statistics no longer depend on how busy the producer is.
+-- Only a single thread may pass objects to the receiver.
+-- Requires
+-- .I free_after_use
+-- (objects have to be copied, see dnsjit.filter.copy) and
+-- .I stats_collect()
+-- must be called beforehand if statistics are collected.
+-- Configuration can't be changed while the thread is running.
+-- Returns 0 on success.
+function DnsSim:thread_start(capacity)
+    if capacity == nil then
+        capacity = 2048
+    end
+    local ret = C.output_dnssim_thread_start(self.obj, capacity)
+    if ret == 0 then
+        self._threaded = true
+    end
+    return ret
+end
+
+-- Signal end of input to the event loop thread and wait until all ongoing
+-- requests are finished. Statistics collection is finished as well and
+-- idle (or preconnected) connections are closed right away, without waiting
+-- for
+-- .IR idle_timeout .
+-- Returns 0 on success.
+function DnsSim:thread_stop()
+    local ret = C.output_dnssim_thread_stop(self.obj)
+    if ret == 0 then
+        self._threaded = false
+    end
+    return ret
+end
+
+-- Return a copy of the summary statistics (without latency histograms),
+-- which is safe to use while the event loop thread is running.
+-- Returns nil once the thread is finishing after
+-- .IR thread_stop() ,
+-- the final statistics are available when it returns.
+function DnsSim:stats_snapshot()
+    local stats = ffi.new("output_dnssim_stats_t")
+    if C.output_dnssim_stats_snapshot(self.obj, stats) ~= 0 then
+        return nil
+    end
+    return stats
+end
+
+-- Write a binary trace of every finished request to
+-- .IR file .
+-- Each record holds the intended send time, the time the query was written to
+-- the socket, completion time, the time it waited for a connection before,
+-- client ID, RCODE and transport, see
+-- .I output_dnssim_trace_record_t
+-- in
+-- .IR output/dnssim.hh .
+-- Records are buffered and written by a background thread.
+-- The intended send time is derived from the PCAP timestamp of the object
+-- (if the pcap object is still part of the passed-in object chain), with the
+-- time between packets multiplied by
+-- .I time_mul
+-- (default 1.0, should match dnsjit.filter.timing); when it's 0 or no
+-- PCAP timestamp is available the time of receiving the object is used.
+-- The trace can be analyzed with the dnssim-latency.lua example, which
+-- corrects for coordinated omission.
+-- Returns 0 on success.
+function DnsSim:trace(file, time_mul)
+    if time_mul == nil then
+        time_mul = 1.0
+    end
+    return C.output_dnssim_trace(self.obj, file, time_mul)
+end
+
+-- Flush and close the request trace. Requests ending afterwards aren't traced.
+function DnsSim:trace_close()
+    C.output_dnssim_trace_close(self.obj)
+end
+
 -- Set this to true if dnssim should free the memory of passed-in objects (useful
 -- when using dnsjit.filter.copy to pass objects from different thread).
 function DnsSim:free_after_use(free_after_use)
+    _check_config(self)
     self.obj.free_after_use = free_after_use
 end
 
@@ -181,57 +603,62 @@ function DnsSim:stats_collect(seconds)
     C.output_dnssim_stats_collect(self.obj, interval_ms)
 end
 
--- Stop the collection of statistics.
+-- Stop the collection of statistics. Not needed with the event loop thread,
+-- where statistics are finished by
+-- .IR thread_stop() .
 function DnsSim:stats_finish()
     C.output_dnssim_stats_finish(self.obj)
 end
 
--- Export the results to a JSON file
+-- Export the results to a JSON file.
+-- Besides the fields of version 20200406, version 20261018 exports
+-- the settings
+-- .IR tcp_info_interval_ms ,
+-- .IR max_conn_inflight ,
+-- .IR max_client_conns ,
+-- .IR max_client_outstanding ,
+-- .IR think_time_ms ,
+-- .I clients_evicted
+-- and
+-- .IR mirror ,
+-- the
+-- .I targets
+-- with their address, port, weight and own
+-- .IR stats_sum ,
+-- and in every statistics object the counters
+-- .IR fallback_tcp ,
+-- .IR client_queued ,
+-- .IR client_dropped ,
+-- .IR conn_queued ,
+-- .IR conn_resumed ,
+-- .IR conn_0rtt ,
+-- .IR port_exhausted ,
+-- .IR tcpi_samples ,
+-- .IR tcpi_retrans ,
+-- the histograms (in ms)
+-- .IR conn_queue_wait ,
+-- .IR client_queue_wait ,
+-- .I fallback_latency_udp
+-- and
+-- .I fallback_latency_tcp
+-- and the TCP_INFO buckets
+-- .IR tcpi_rtt_us ,
+-- .IR tcpi_cwnd ,
+-- .I tcpi_sndq
+-- and
+-- .I tcpi_writeq
+-- (described at output_dnssim_stats_t in dnssim.hh).
+-- Reports merged by dnsjit.lib.coord have
+-- .I merged
+-- set to true and the number of
+-- .IR workers .
 function DnsSim:export(filename)
     local file = io.open(filename, "w")
     if file == nil then
         self.obj._log:critical("export failed: no filename")
         return
     end
-
-    local function write_stats(file, stats)
-        file:write(
-            "{ ",
-                '"since_ms":', tonumber(stats.since_ms), ',',
-                '"until_ms":', tonumber(stats.until_ms), ',',
-                '"requests":', tonumber(stats.requests), ',',
-                '"ongoing":', tonumber(stats.ongoing), ',',
-                '"answers":', tonumber(stats.answers), ',',
-                '"conn_active":', tonumber(stats.conn_active), ',',
-                '"conn_handshakes":', tonumber(stats.conn_handshakes), ',',
-                '"conn_handshakes_failed":', tonumber(stats.conn_handshakes_failed), ',',
-                '"rcode_noerror":', tonumber(stats.rcode_noerror), ',',
-                '"rcode_formerr":', tonumber(stats.rcode_formerr), ',',
-                '"rcode_servfail":', tonumber(stats.rcode_servfail), ',',
-                '"rcode_nxdomain":', tonumber(stats.rcode_nxdomain), ',',
-                '"rcode_notimp":', tonumber(stats.rcode_notimp), ',',
-                '"rcode_refused":', tonumber(stats.rcode_refused), ',',
-                '"rcode_yxdomain":', tonumber(stats.rcode_yxdomain), ',',
-                '"rcode_yxrrset":', tonumber(stats.rcode_yxrrset), ',',
-                '"rcode_nxrrset":', tonumber(stats.rcode_nxrrset), ',',
-                '"rcode_notauth":', tonumber(stats.rcode_notauth), ',',
-                '"rcode_notzone":', tonumber(stats.rcode_notzone), ',',
-                '"rcode_badvers":', tonumber(stats.rcode_badvers), ',',
-                '"rcode_badkey":', tonumber(stats.rcode_badkey), ',',
-                '"rcode_badtime":', tonumber(stats.rcode_badtime), ',',
-                '"rcode_badmode":', tonumber(stats.rcode_badmode), ',',
-                '"rcode_badname":', tonumber(stats.rcode_badname), ',',
-                '"rcode_badalg":', tonumber(stats.rcode_badalg), ',',
-                '"rcode_badtrunc":', tonumber(stats.rcode_badtrunc), ',',
-                '"rcode_badcookie":', tonumber(stats.rcode_badcookie), ',',
-                '"rcode_other":', tonumber(stats.rcode_other), ',',
-                '"latency":[')
-        file:write(tonumber(stats.latency[0]))
-        for i=1,tonumber(self.obj.timeout_ms) do
-            file:write(',', tonumber(stats.latency[i]))
-        end
-        file:write("]}")
-    end
+    local timeout_ms = tonumber(self.obj.timeout_ms)
 
     file:write(
         "{ ",
@@ -241,20 +668,41 @@ function DnsSim:export(filename)
             '"timeout_ms":', tonumber(self.obj.timeout_ms), ',',
             '"idle_timeout_ms":', tonumber(self.obj.idle_timeout_ms), ',',
             '"handshake_timeout_ms":', tonumber(self.obj.handshake_timeout_ms), ',',
+            '"tcp_info_interval_ms":', tonumber(self.obj.tcp_info_interval_ms), ',',
+            '"max_conn_inflight":', tonumber(self.obj.max_conn_inflight), ',',
+            '"max_client_conns":', tonumber(self.obj.max_client_conns), ',',
+            '"max_client_outstanding":', tonumber(self.obj.max_client_outstanding), ',',
+            '"think_time_ms":', tonumber(self.obj.think_time_ms), ',',
             '"discarded":', self:discarded(), ',',
+            '"clients_evicted":', tonumber(self.obj.clients_evicted), ',',
             '"stats_sum":')
-    write_stats(file, self.obj.stats_sum)
+    DnsSim.write_stats(file, self.obj.stats_sum, timeout_ms)
     file:write(
             ',',
             '"stats_periodic":[')
 
     local stats = self.obj.stats_first
-    write_stats(file, stats)
+    DnsSim.write_stats(file, stats, timeout_ms)
 
     while (stats.next ~= nil) do
         stats = stats.next
         file:write(',')
-        write_stats(file, stats)
+        DnsSim.write_stats(file, stats, timeout_ms)
+    end
+
+    file:write('],"mirror":', tostring(self.obj.mirror), ',"targets":[')
+    for i, target in ipairs(self.targets) do
+        if i > 1 then
+            file:write(',')
+        end
+        file:write(
+            "{ ",
+                '"address":"', target.ip, '",',
+                '"port":', target.port, ',',
+                '"weight":', target.weight, ',',
+                '"stats_sum":')
+        DnsSim.write_stats(file, self:target_stats(i), timeout_ms)
+        file:write("}")
     end
 
     file:write(']}')
@@ -262,9 +710,242 @@ function DnsSim:export(filename)
     self.obj._log:notice("results exported to "..filename)
 end
 
+-- Empty statistics of dnsjit.lib.coord reports.
+local function _coord_stats(timeout_ms)
+    local stats = {}
+    for _, name in ipairs(DnsSim.STATS_COUNTERS) do
+        stats[name] = 0
+    end
+    for _, name in ipairs(DnsSim.STATS_HISTOGRAMS) do
+        local hist = {}
+        for i = 0, timeout_ms do
+            hist[i] = 0
+        end
+        stats[name] = hist
+    end
+    for _, name in ipairs(DnsSim.STATS_BUCKETS) do
+        local buckets = {}
+        for i = 0, C.OUTPUT_DNSSIM_TCPI_BUCKETS - 1 do
+            buckets[i] = 0
+        end
+        stats[name] = buckets
+    end
+    stats.since_ms = nil
+    return stats
+end
+
+-- Add the values of a report line to the statistics, times are moved to the
+-- controller's clock.
+local function _coord_merge(stats, values, timeout_ms, offset_ms)
+    local n = 1
+    for _, name in ipairs(DnsSim.STATS_COUNTERS) do
+        local v = values[n]
+        n = n + 1
+        if name == "since_ms" then
+            v = v + offset_ms
+            if stats.since_ms == nil or v < stats.since_ms then
+                stats.since_ms = v
+            end
+        elseif name == "until_ms" then
+            v = v + offset_ms
+            if v > stats.until_ms then
+                stats.until_ms = v
+            end
+        else
+            stats[name] = stats[name] + v
+        end
+    end
+    for _, name in ipairs(DnsSim.STATS_HISTOGRAMS) do
+        local hist = stats[name]
+        for i = 0, timeout_ms do
+            hist[i] = hist[i] + values[n]
+            n = n + 1
+        end
+    end
+    for _, name in ipairs(DnsSim.STATS_BUCKETS) do
+        local buckets = stats[name]
+        for i = 0, C.OUTPUT_DNSSIM_TCPI_BUCKETS - 1 do
+            buckets[i] = buckets[i] + values[n]
+            n = n + 1
+        end
+    end
+end
+
+-- Collect the reports of the workers started by the controller
+-- .I coord
+-- (a dnsjit.lib.coord) until they all disconnect (or nothing arrived within
+-- .I timeout
+-- seconds, default 0 waits forever) and write the merged statistics to
+-- .IR filename ,
+-- merged interval by interval in the format of
+-- .I export()
+-- and marked with
+-- .IR merged .
+-- For this the statistics interval has to be the same for all workers and
+-- collection has to start right after their
+-- .IR sleep() ,
+-- reports of workers with a different statistics interval or timeout than
+-- the first worker are ignored.
+-- Returns the number of workers merged.
+function DnsSim.collect(coord, filename, timeout)
+    local workers = {}
+    local merged = 0
+    local interval_ms, timeout_ms
+    local discarded, clients_evicted = 0, 0
+    local sum
+    local periodic = {}
+
+    while true do
+        local worker, line = coord:recv(timeout)
+        if worker == nil then
+            break
+        end
+        local cmd, rest = line:match("^DNSSIM (%a+) ?(.*)$")
+        if cmd == "config" then
+            local w = {}
+            w.interval_ms, w.timeout_ms, w.discarded, w.clients_evicted, w.offset_ms = rest:match("^(%d+) (%d+) (%d+) (%d+) (%-?%d+)$")
+            for k, v in pairs(w) do
+                w[k] = tonumber(v)
+            end
+            if w.interval_ms == nil then
+                coord:log():warning("invalid report config from worker "..worker)
+            else
+                if interval_ms == nil then
+                    interval_ms, timeout_ms = w.interval_ms, w.timeout_ms
+                    sum = _coord_stats(timeout_ms)
+                end
+                if w.interval_ms ~= interval_ms or w.timeout_ms ~= timeout_ms then
+                    coord:log():critical("worker "..worker.." has different stats interval or timeout, ignored")
+                else
+                    w.intervals = 0
+                    workers[worker] = w
+                end
+            end
+        elseif cmd == "sum" or cmd == "interval" then
+            local w = workers[worker]
+            if w ~= nil then
+                local values = {}
+                for v in rest:gmatch("%d+") do
+                    table.insert(values, tonumber(v))
+                end
+                if cmd == "sum" then
+                    _coord_merge(sum, values, timeout_ms, w.offset_ms)
+                else
+                    w.intervals = w.intervals + 1
+                    if periodic[w.intervals] == nil then
+                        periodic[w.intervals] = _coord_stats(timeout_ms)
+                    end
+                    _coord_merge(periodic[w.intervals], values, timeout_ms, w.offset_ms)
+                end
+            end
+        elseif cmd == "end" then
+            local w = workers[worker]
+            if w ~= nil and not w.done then
+                w.done = true
+                merged = merged + 1
+                discarded = discarded + w.discarded
+                clients_evicted = clients_evicted + w.clients_evicted
+            end
+        else
+            coord:log():warning("unknown report from worker "..worker..": "..line:sub(1, 32))
+        end
+    end
+
+    if merged == 0 then
+        coord:log():critical("no worker reported")
+        return 0
+    end
+    for worker, w in pairs(workers) do
+        if not w.done then
+            coord:log():warning("worker "..worker.." didn't finish its report")
+        end
+    end
+
+    local file = io.open(filename, "w")
+    if file == nil then
+        coord:log():critical("unable to open "..filename)
+        return 0
+    end
+    file:write(
+        "{ ",
+            '"version":', DnsSim.JSON_VERSION, ',',
+            '"merged":true,',
+            '"workers":', merged, ',',
+            '"stats_interval_ms":', interval_ms, ',',
+            '"timeout_ms":', timeout_ms, ',',
+            '"discarded":', discarded, ',',
+            '"clients_evicted":', clients_evicted, ',',
+            '"stats_sum":')
+    DnsSim.write_stats(file, sum, timeout_ms)
+    file:write(',"stats_periodic":[')
+    for i, stats in ipairs(periodic) do
+        if i > 1 then
+            file:write(',')
+        end
+        DnsSim.write_stats(file, stats, timeout_ms)
+    end
+    file:write(']}')
+    file:close()
+    coord:log():notice("merged results of "..merged.." workers exported to "..filename)
+
+    return merged
+end
+
+-- Send the statistics to the controller of the worker
+-- .I coord
+-- (a connected dnsjit.lib.coord) and close the connection, the controller
+-- merges them with
+-- .IR collect() .
+-- Statistics must have been finished (see
+-- .IR stats_finish() ).
+-- Returns 0 on success.
+function DnsSim:report(coord)
+    local obj = self.obj
+    local timeout_ms = tonumber(obj.timeout_ms)
+    local offset_ms = math.floor(tonumber(coord.obj.offset_ns) / 1000000 + 0.5)
+
+    local function send(cmd, stats)
+        local values = {}
+        for _, name in ipairs(DnsSim.STATS_COUNTERS) do
+            table.insert(values, tostring(stats[name]):match("^%d+"))
+        end
+        for _, name in ipairs(DnsSim.STATS_HISTOGRAMS) do
+            local hist = stats[name]
+            for i = 0, timeout_ms do
+                table.insert(values, tostring(hist[i]):match("^%d+"))
+            end
+        end
+        for _, name in ipairs(DnsSim.STATS_BUCKETS) do
+            local buckets = stats[name]
+            for i = 0, C.OUTPUT_DNSSIM_TCPI_BUCKETS - 1 do
+                table.insert(values, tostring(buckets[i]):match("^%d+"))
+            end
+        end
+        return coord:send("DNSSIM "..cmd.." "..table.concat(values, " "))
+    end
+
+    local ret = coord:send(string.format("DNSSIM config %d %d %d %d %d",
+        tonumber(obj.stats_interval_ms), timeout_ms, tonumber(obj.discarded),
+        tonumber(obj.clients_evicted), offset_ms))
+    if ret == 0 then
+        ret = send("sum", obj.stats_sum)
+    end
+    local stats = obj.stats_first
+    while ret == 0 and stats ~= nil do
+        ret = send("interval", stats)
+        stats = stats.next
+    end
+    if ret == 0 then
+        ret = coord:send("DNSSIM end")
+    end
+    coord:close()
+    return ret
+end
+
 -- Return the C function and context for receiving objects. Only ip/ip6 objects
 -- are supported.  The component expects a 32bit integer (in host order)
--- ranging from 0 to max_clients written to first 4 bytes of destination IP.
+-- ranging from 0 to max_clients written to first 4 bytes of destination IP,
+-- unless the sparse client table identifies clients by source address.
 -- See dnsjit.filter.ipsplit.
 function DnsSim:receive()
     local receive = C.output_dnssim_receiver()
@@ -275,5 +956,6 @@ end
 -- dnsjit.filter.ipsplit (3),
 -- dnsjit.filter.core.object.ip (3),
 -- dnsjit.filter.core.object.ip6 (3),
+-- dnsjit.lib.coord (3),
 -- https://gitlab.labs.nic.cz/knot/shotgun
 return DnsSim
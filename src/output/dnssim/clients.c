@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2019-2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+static uint32_t _extract_client(const core_object_t* obj)
+{
+    uint32_t client;
+    uint8_t* ip;
+
+    switch (obj->obj_type) {
+    case CORE_OBJECT_IP:
+        ip = ((core_object_ip_t*)obj)->dst;
+        break;
+    case CORE_OBJECT_IP6:
+        ip = ((core_object_ip6_t*)obj)->dst;
+        break;
+    default:
+        return -1;
+    }
+
+    memcpy(&client, ip, sizeof(client));
+    return client;
+}
+
+static void _free_client(_output_dnssim_client_t* client)
+{
+#if HAVE_NGTCP2
+    _free_client_quic(client);
+#endif
+    free(client->mirror);
+    _output_dnssim_backlog_t* entry = client->backlog;
+    while (entry != NULL) {
+        _output_dnssim_backlog_t* next = entry->next;
+        core_object_payload_free(entry->payload);
+        free(entry);
+        entry = next;
+    }
+}
+
+/* Client can be evicted once nothing refers to it anymore. */
+static bool _client_is_idle(output_dnssim_t* self, _output_dnssim_client_t* client)
+{
+    mlassert_self();
+
+    if (client->outstanding > 0 || client->conn != NULL || client->pending != NULL || client->orphans != NULL
+        || client->backlog != NULL)
+        return false;
+#if HAVE_NGTCP2
+    if (client->quic != NULL)
+        return false;
+#endif
+
+    for (size_t i = 0; client->mirror != NULL && i < _self->n_targets - 1; ++i) {
+        if (!_client_is_idle(self, &client->mirror[i]))
+            return false;
+    }
+    return true;
+}
+
+static uint32_t _client_hash(const uint8_t* key, size_t len)
+{
+    return _mix32(_fnv1a(2166136261, key, len));
+}
+
+static void _lru_remove(_output_dnssim_client_table_t* table, _output_dnssim_client_entry_t* entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        table->lru_first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        table->lru_last = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void _lru_append(_output_dnssim_client_table_t* table, _output_dnssim_client_entry_t* entry)
+{
+    entry->prev = table->lru_last;
+    entry->next = NULL;
+    if (table->lru_last != NULL)
+        table->lru_last->next = entry;
+    else
+        table->lru_first = entry;
+    table->lru_last = entry;
+}
+
+static void _grow_client_table(_output_dnssim_client_table_t* table)
+{
+    _output_dnssim_client_entry_t** buckets;
+    size_t n_buckets = table->n_buckets * 2;
+
+    mlfatal_oom(buckets = calloc(n_buckets, sizeof(_output_dnssim_client_entry_t*)));
+    for (size_t i = 0; i < table->n_buckets; ++i) {
+        _output_dnssim_client_entry_t* entry = table->buckets[i];
+        while (entry != NULL) {
+            _output_dnssim_client_entry_t* next = entry->hnext;
+            size_t idx = entry->hash & (n_buckets - 1);
+            entry->hnext = buckets[idx];
+            buckets[idx] = entry;
+            entry = next;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->n_buckets = n_buckets;
+}
+
+/* Find client by its key in the sparse table, creating it on first use. */
+static _output_dnssim_client_t* _client_table_get(output_dnssim_t* self,
+    const uint8_t* key, uint8_t key_len, uint32_t hash, uint32_t id)
+{
+    mlassert_self();
+    _output_dnssim_client_table_t* table = _self->client_table;
+    _output_dnssim_client_entry_t* entry;
+    uint64_t now = uv_now(&_self->loop);
+    size_t idx = hash & (table->n_buckets - 1);
+
+    for (entry = table->buckets[idx]; entry != NULL; entry = entry->hnext) {
+        if (entry->hash == hash && entry->key_len == key_len && !memcmp(entry->key, key, key_len)) {
+            entry->last_used = now;
+            _lru_remove(table, entry);
+            _lru_append(table, entry);
+            return &entry->client;
+        }
+    }
+
+    /* New client, reuse a record of an evicted one if possible. */
+    if (table->pool != NULL) {
+        entry = table->pool;
+        table->pool = entry->hnext;
+        table->pool_size--;
+    } else {
+        lfatal_oom(entry = malloc(sizeof(_output_dnssim_client_entry_t)));
+    }
+    memset(entry, 0, sizeof(_output_dnssim_client_entry_t));
+    entry->client.dnssim = self;
+    entry->client.id = id;
+    entry->hash = hash;
+    entry->key_len = key_len;
+    memcpy(entry->key, key, key_len);
+    entry->last_used = now;
+
+    entry->hnext = table->buckets[idx];
+    table->buckets[idx] = entry;
+    _lru_append(table, entry);
+
+    self->clients++;
+    if (self->clients > table->n_buckets)
+        _grow_client_table(table);
+
+    return &entry->client;
+}
+
+static _output_dnssim_client_t* _client_by_id(output_dnssim_t* self, uint32_t id)
+{
+    mlassert_self();
+
+    if (_self->client_table == NULL)
+        return id < self->max_clients ? &_self->client_arr[id] : NULL;
+
+    return _client_table_get(self, (uint8_t*)&id, sizeof(id), _client_hash((uint8_t*)&id, sizeof(id)), id);
+}
+
+/* Find the client sending the packet, returns NULL if it exceeds max_clients. */
+static _output_dnssim_client_t* _lookup_client(output_dnssim_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+    const uint8_t* src;
+    uint8_t len;
+
+    if (_self->client_table == NULL || _self->client_table->key == OUTPUT_DNSSIM_CLIENT_KEY_ID)
+        return _client_by_id(self, _extract_client(obj));
+
+    switch (obj->obj_type) {
+    case CORE_OBJECT_IP:
+        src = ((core_object_ip_t*)obj)->src;
+        len = sizeof(((core_object_ip_t*)obj)->src);
+        break;
+    case CORE_OBJECT_IP6:
+        src = ((core_object_ip6_t*)obj)->src;
+        len = sizeof(((core_object_ip6_t*)obj)->src);
+        break;
+    default:
+        return NULL;
+    }
+
+    /* The hash of the address serves as client ID, which is used to assign
+     * target and source address. */
+    uint32_t hash = _client_hash(src, len);
+    return _client_table_get(self, src, len, hash, hash);
+}
+
+static void _evict_client(output_dnssim_t* self, _output_dnssim_client_entry_t* entry)
+{
+    mlassert_self();
+    _output_dnssim_client_table_t* table = _self->client_table;
+    _output_dnssim_client_entry_t** prev = &table->buckets[entry->hash & (table->n_buckets - 1)];
+
+    while (*prev != entry)
+        prev = &(*prev)->hnext;
+    *prev = entry->hnext;
+    _lru_remove(table, entry);
+    _free_client(&entry->client);
+
+    self->clients--;
+    self->clients_evicted++;
+
+    if (table->pool_size < _OUTPUT_DNSSIM_CLIENT_POOL_MAX) {
+        entry->hnext = table->pool;
+        table->pool = entry;
+        table->pool_size++;
+    } else {
+        free(entry);
+    }
+}
+
+/* Evict clients that haven't been used for client_idle_timeout_ms. Clients
+ * that are still busy are moved to the end of the list and checked later. */
+static void _on_client_sweep(uv_timer_t* handle)
+{
+    output_dnssim_t* self = (output_dnssim_t*)handle->data;
+    _output_dnssim_client_table_t* table = _self->client_table;
+    uint64_t now = uv_now(&_self->loop);
+    uint64_t n = self->clients;
+
+    if (self->client_idle_timeout_ms == 0)
+        return;
+
+    _output_dnssim_client_entry_t* entry = table->lru_first;
+    while (entry != NULL && n-- > 0 && entry->last_used + self->client_idle_timeout_ms <= now) {
+        _output_dnssim_client_entry_t* next = entry->next;
+        if (_client_is_idle(self, &entry->client)) {
+            _evict_client(self, entry);
+        } else {
+            entry->last_used = now;
+            _lru_remove(table, entry);
+            _lru_append(table, entry);
+        }
+        entry = next;
+    }
+}
+
+static void _init_clients(output_dnssim_t* self)
+{
+    mlassert_self();
+
+    if (self->max_clients > 0) {
+        lfatal_oom(_self->client_arr = calloc(
+            self->max_clients, sizeof(_output_dnssim_client_t)));
+        for (size_t i = 0; i < self->max_clients; ++i) {
+            _self->client_arr[i].dnssim = self;
+            _self->client_arr[i].id = i;
+        }
+        return;
+    }
+
+    _output_dnssim_client_table_t* table;
+    lfatal_oom(table = calloc(1, sizeof(_output_dnssim_client_table_t)));
+    table->key = OUTPUT_DNSSIM_CLIENT_KEY_ID;
+    table->n_buckets = _OUTPUT_DNSSIM_CLIENT_BUCKETS;
+    lfatal_oom(table->buckets = calloc(table->n_buckets, sizeof(_output_dnssim_client_entry_t*)));
+    _self->client_table = table;
+
+    /* Sweep timer mustn't keep the loop running. */
+    uv_timer_init(&_self->loop, &table->sweep_timer);
+    table->sweep_timer.data = (void*)self;
+    uv_timer_start(&table->sweep_timer, _on_client_sweep,
+        _OUTPUT_DNSSIM_CLIENT_SWEEP_MS, _OUTPUT_DNSSIM_CLIENT_SWEEP_MS);
+    uv_unref((uv_handle_t*)&table->sweep_timer);
+}
+
+/* Sweep timer must be closed and the loop run before the table is freed. */
+static void _close_clients(output_dnssim_t* self)
+{
+    mlassert_self();
+
+    if (_self->client_table != NULL)
+        uv_close((uv_handle_t*)&_self->client_table->sweep_timer, NULL);
+}
+
+static void _close_client_conns(output_dnssim_t* self, _output_dnssim_client_t* client)
+{
+    mlassert_self();
+
+    _close_idle_connections(client);
+#if HAVE_NGTCP2
+    _close_idle_quic_conns(client);
+#endif
+    for (size_t t = 0; client->mirror != NULL && t < _self->n_targets - 1; ++t)
+        _close_client_conns(self, &client->mirror[t]);
+}
+
+/* Close idle and preconnected connections of all clients (and the shared
+ * ones), so the event loop ends without waiting for their idle timeout. */
+static void _close_idle_conns(output_dnssim_t* self)
+{
+    mlassert_self();
+
+    for (size_t i = 0; i < _self->n_targets; ++i)
+        _close_client_conns(self, &_self->targets[i]->shared_client);
+
+    if (_self->client_table == NULL) {
+        for (size_t i = 0; i < self->max_clients; ++i)
+            _close_client_conns(self, &_self->client_arr[i]);
+        return;
+    }
+
+    _output_dnssim_client_entry_t* entry;
+    for (entry = _self->client_table->lru_first; entry != NULL; entry = entry->next)
+        _close_client_conns(self, &entry->client);
+}
+
+static void _free_clients(output_dnssim_t* self)
+{
+    mlassert_self();
+
+    if (_self->client_table == NULL) {
+        for (size_t i = 0; i < self->max_clients; ++i)
+            _free_client(&_self->client_arr[i]);
+        free(_self->client_arr);
+        return;
+    }
+
+    _output_dnssim_client_table_t* table = _self->client_table;
+    for (size_t i = 0; i < table->n_buckets; ++i) {
+        _output_dnssim_client_entry_t* entry = table->buckets[i];
+        while (entry != NULL) {
+            _output_dnssim_client_entry_t* next = entry->hnext;
+            _free_client(&entry->client);
+            free(entry);
+            entry = next;
+        }
+    }
+    while (table->pool != NULL) {
+        _output_dnssim_client_entry_t* next = table->pool->hnext;
+        free(table->pool);
+        table->pool = next;
+    }
+    free(table->buckets);
+    free(table);
+}
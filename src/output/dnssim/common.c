@@ -34,21 +34,39 @@ static uint64_t _now_ms()
 #endif
 }
 
-static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* client, core_object_payload_t* payload)
+static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* client,
+    core_object_payload_t* payload, bool free_payload, uint64_t intended_ns)
 {
     mlassert_self();
 
     int ret;
     _output_dnssim_request_t* req;
+    _output_dnssim_target_t* target = _client_target(self, client);
+
+    /* Copies for the other targets are created first, since the request may
+     * fail and free the payload right away. */
+    if (self->mirror && !client->is_mirror && _self->n_targets > 1) {
+        _output_dnssim_client_t* mirror = _mirror_clients(self, client);
+        for (size_t i = 0; i < _self->n_targets - 1; ++i) {
+            _create_request(self, &mirror[i], core_object_payload_copy(payload), true, intended_ns);
+        }
+    }
 
     lfatal_oom(req = malloc(sizeof(_output_dnssim_request_t)));
     memset(req, 0, sizeof(_output_dnssim_request_t));
     req->dnssim = self;
     req->client = client;
     req->payload = payload;
+    req->free_payload = free_payload;
+    if (_self->trace != NULL) {
+        req->created_ns = uv_hrtime();
+        req->intended_ns = intended_ns ? intended_ns : req->created_ns;
+    }
     req->dns_q = core_object_dns_new();
     req->dns_q->obj_prev = (core_object_t*)req->payload;
     req->dnssim->ongoing++;
+    req->client->outstanding++;
+    _self->outstanding++;
     req->state = _OUTPUT_DNSSIM_REQ_ONGOING;
     req->stats = self->stats_current;
 
@@ -60,6 +78,7 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
 
     req->dnssim->stats_sum->requests++;
     req->stats->requests++;
+    target->stats->requests++;
 
     switch(_self->transport) {
     case OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY:
@@ -69,6 +88,11 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
         ret = _create_query_tcp(self, req);
         break;
+#if HAVE_NGTCP2
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
+        ret = _create_query_quic(self, req);
+        break;
+#endif
     default:
         lfatal("unsupported dnssim transport");
         break;
@@ -91,36 +115,377 @@ failure:
     return;
 }
 
-/* Bind before connect to be able to send from different source IPs. */
-static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle)
+/* Send requests from client queue while the client is below its outstanding limit. */
+static void _dispatch_backlog(_output_dnssim_client_t* client)
 {
-    if (_self->source != NULL) {
-        struct sockaddr* addr = (struct sockaddr*)&_self->source->addr;
-        int ret;
-        switch(handle->type) {
-        case UV_UDP:
-            ret = uv_udp_bind((uv_udp_t*)handle, addr, 0);
-            break;
-        case UV_TCP:
-            ret = uv_tcp_bind((uv_tcp_t*)handle, addr, 0);
-            break;
-        default:
-            lfatal("bind before connect: unsupported handle type");
+    output_dnssim_t* self = client->dnssim;
+    _output_dnssim_backlog_t* entry;
+
+    /* Requests failing right away release the client, avoid recursion. */
+    if (client->is_dispatching)
+        return;
+    client->is_dispatching = true;
+
+    while (client->backlog != NULL && client->outstanding < self->max_client_outstanding) {
+        entry = client->backlog;
+        client->backlog = entry->next;
+        if (client->backlog == NULL)
+            client->backlog_tail = NULL;
+
+        uint64_t wait = uv_now(&_self->loop) - entry->queued_at;
+        if (wait > self->timeout_ms)
+            wait = self->timeout_ms;
+        self->stats_current->client_queue_wait[wait]++;
+        self->stats_sum->client_queue_wait[wait]++;
+
+        _create_request(self, client, entry->payload, true, entry->intended_ns);
+        free(entry);
+    }
+
+    client->is_dispatching = false;
+}
+
+/* Create request right away (open-loop), or according to client's outstanding
+ * limit (closed-loop). */
+static void _submit_request(output_dnssim_t* self, _output_dnssim_client_t* client,
+    core_object_payload_t* payload, uint64_t intended_ns)
+{
+    mlassert_self();
+    _output_dnssim_backlog_t* entry;
+
+    if (self->max_client_outstanding == 0 ||
+        (client->outstanding < self->max_client_outstanding && client->backlog == NULL)) {
+        _create_request(self, client, payload, self->free_after_use, intended_ns);
+        return;
+    }
+
+    if (self->drop_over_limit) {
+        self->stats_current->client_dropped++;
+        self->stats_sum->client_dropped++;
+        self->discarded++;
+        if (self->free_after_use)
+            core_object_payload_free(payload);
+        return;
+    }
+
+    lfatal_oom(entry = malloc(sizeof(_output_dnssim_backlog_t)));
+    entry->next = NULL;
+    entry->queued_at = uv_now(&_self->loop);
+    entry->intended_ns = intended_ns;
+
+    /* Queued payload outlives the receive call, so it has to be owned. */
+    if (self->free_after_use) {
+        entry->payload = payload;
+    } else {
+        entry->payload = core_object_payload_copy(payload);
+    }
+
+    if (client->backlog_tail == NULL)
+        client->backlog = entry;
+    else
+        client->backlog_tail->next = entry;
+    client->backlog_tail = entry;
+
+    self->stats_current->client_queued++;
+    self->stats_sum->client_queued++;
+}
+
+static void _release_client(_output_dnssim_client_t* client)
+{
+    mlassert(client->outstanding > 0, "client has no outstanding requests");
+    client->outstanding--;
+    ((_output_dnssim_t*)client->dnssim)->outstanding--;
+    if (client->backlog != NULL)
+        _dispatch_backlog(client);
+}
+
+static uint32_t _fnv1a(uint32_t hash, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/* Finalizer of MurmurHash3, spreads sequential client IDs over the ring. */
+static uint32_t _mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Ring points are derived from target address rather than its position in
+ * the set, so the mapping doesn't depend on the order of adding targets. */
+static uint32_t _ring_point_hash(const struct sockaddr_storage* addr, uint32_t replica)
+{
+    uint32_t hash = 2166136261;
+
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)addr;
+        hash = _fnv1a(hash, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+        hash = _fnv1a(hash, &sin6->sin6_port, sizeof(sin6->sin6_port));
+    } else {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)addr;
+        hash = _fnv1a(hash, &sin->sin_addr, sizeof(sin->sin_addr));
+        hash = _fnv1a(hash, &sin->sin_port, sizeof(sin->sin_port));
+    }
+    hash = _fnv1a(hash, &replica, sizeof(replica));
+
+    return _mix32(hash);
+}
+
+static int _ring_point_cmp(const void* a, const void* b)
+{
+    uint32_t ha = ((const _output_dnssim_ring_point_t*)a)->hash;
+    uint32_t hb = ((const _output_dnssim_ring_point_t*)b)->hash;
+    return ha < hb ? -1 : ha > hb;
+}
+
+static void _build_ring(output_dnssim_t* self)
+{
+    mlassert_self();
+    size_t n = 0;
+
+    for (size_t i = 0; i < _self->n_targets; ++i)
+        n += _self->targets[i]->weight * _OUTPUT_DNSSIM_RING_POINTS;
+
+    free(_self->ring_points);
+    lfatal_oom(_self->ring_points = malloc(n * sizeof(_output_dnssim_ring_point_t)));
+    _self->n_ring_points = n;
+
+    n = 0;
+    for (size_t i = 0; i < _self->n_targets; ++i) {
+        _output_dnssim_target_t* target = _self->targets[i];
+        for (uint32_t j = 0; j < target->weight * _OUTPUT_DNSSIM_RING_POINTS; ++j) {
+            _self->ring_points[n].hash = _ring_point_hash(&target->addr, j);
+            _self->ring_points[n].target = target;
+            n++;
+        }
+    }
+    qsort(_self->ring_points, n, sizeof(_output_dnssim_ring_point_t), _ring_point_cmp);
+}
+
+/* Assign target to client using consistent hashing, so that the client (and
+ * its connections) always stays with the same target. */
+static _output_dnssim_target_t* _client_target(output_dnssim_t* self, _output_dnssim_client_t* client)
+{
+    mlassert_self();
+
+    if (client->target != NULL)
+        return client->target;
+
+    if (_self->n_targets == 0) {
+        lfatal("no target set");
+    }
+    _self->targets_in_use = true;
+    if (self->mirror || _self->n_targets == 1) {
+        client->target = _self->targets[0];
+        return client->target;
+    }
+
+    if (_self->ring_points == NULL)
+        _build_ring(self);
+
+    uint32_t hash = _mix32(client->id);
+    size_t lo = 0, hi = _self->n_ring_points;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_self->ring_points[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == _self->n_ring_points)
+        lo = 0;
+
+    client->target = _self->ring_points[lo].target;
+    return client->target;
+}
+
+/* Clients sending the mirrored queries to targets other than the first one. */
+static _output_dnssim_client_t* _mirror_clients(output_dnssim_t* self, _output_dnssim_client_t* client)
+{
+    mlassert_self();
+
+    if (client->mirror == NULL) {
+        lfatal_oom(client->mirror = calloc(_self->n_targets - 1, sizeof(_output_dnssim_client_t)));
+        for (size_t i = 0; i < _self->n_targets - 1; ++i) {
+            client->mirror[i].dnssim = self;
+            client->mirror[i].id = client->id;
+            client->mirror[i].is_mirror = true;
+            client->mirror[i].target = _self->targets[i + 1];
+        }
+    }
+
+    return client->mirror;
+}
+
+/* Address of the pool at given index, spread over all sources of the pool. */
+static void _source_addr(_output_dnssim_source_pool_t* pool, uint64_t idx, struct sockaddr_storage* addr)
+{
+    _output_dnssim_source_t* source = pool->sources;
+    for (size_t i = 0; i < pool->n_sources; ++i) {
+        if (idx < pool->sources[i].n_addrs) {
+            source = &pool->sources[i];
             break;
         }
-        if (ret < 0) {
-            lwarning("failed to bind to address: %s", uv_strerror(ret));
-            return ret;
+        idx -= pool->sources[i].n_addrs;
+    }
+
+    /* Add the host part to the (cleared) host bits of the prefix. */
+    *addr = source->addr;
+    uint64_t host = idx + source->offset;
+    uint8_t* bytes;
+    int i;
+    if (addr->ss_family == AF_INET6) {
+        bytes = ((struct sockaddr_in6*)addr)->sin6_addr.s6_addr;
+        i = 15;
+    } else {
+        bytes = (uint8_t*)&((struct sockaddr_in*)addr)->sin_addr.s_addr;
+        i = 3;
+    }
+    for (; i >= 0 && host > 0; --i, host >>= 8)
+        bytes[i] |= host & 0xff;
+}
+
+static void _set_sockopt(output_dnssim_t* self, int fd, int level, int name, const void* val, socklen_t len, const char* desc)
+{
+    if (setsockopt(fd, level, name, val, len) < 0)
+        lwarning("failed to set %s: %s", desc, core_log_errstr(errno));
+}
+
+/* Set the socket options and bind before connect to be able to send from
+ * different source IPs and ports. Clients are mapped to the source addresses
+ * by their ID, so each client always uses the same source address, while
+ * connections shared among clients are spread round-robin. */
+static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle,
+    _output_dnssim_client_t* client, output_dnssim_stats_t* stats)
+{
+    mlassert_self();
+    lassert(client, "client is nil");
+    lassert(client->target, "client must have a target");
+
+    int family = client->target->addr.ss_family;
+    _output_dnssim_source_pool_t* pool = family == AF_INET6 ? &_self->sources6 : &_self->sources4;
+    bool is_tcp = handle->type == UV_TCP;
+    int ret, fd, opt;
+
+    if (handle->type != UV_UDP && !is_tcp)
+        lfatal("bind before connect: unsupported handle type");
+
+    ret = uv_fileno(handle, &fd);
+    if (ret < 0) {
+        lwarning("failed to get socket of handle: %s", uv_strerror(ret));
+        return ret;
+    }
+
+    if (self->reuseaddr) {
+        opt = 1;
+        _set_sockopt(self, fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt), "SO_REUSEADDR");
+    }
+    if (is_tcp && self->linger_s >= 0) {
+        /* Zero timeout resets the connection on close, avoiding TIME_WAIT. */
+        struct linger linger = { .l_onoff = 1, .l_linger = self->linger_s };
+        _set_sockopt(self, fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger), "SO_LINGER");
+    }
+
+    if (pool->n_sources == 0 && _self->port_min == 0)
+        return 0;
+
+    struct sockaddr_storage addr;
+    if (pool->n_sources > 0) {
+        uint64_t idx;
+        if (client == &client->target->shared_client)
+            idx = pool->rr++ % pool->n_addrs;
+        else
+            idx = client->id % pool->n_addrs;
+        _source_addr(pool, idx, &addr);
+    } else {
+        memset(&addr, 0, sizeof(addr));
+        addr.ss_family = family;
+    }
+
+    if (pool->has_prefix) {
+        opt = 1;
+        if (self->transparent) {
+#if defined(IPV6_TRANSPARENT) && defined(IP_TRANSPARENT)
+            if (family == AF_INET6)
+                _set_sockopt(self, fd, IPPROTO_IPV6, IPV6_TRANSPARENT, &opt, sizeof(opt), "IPV6_TRANSPARENT");
+            else
+                _set_sockopt(self, fd, IPPROTO_IP, IP_TRANSPARENT, &opt, sizeof(opt), "IP_TRANSPARENT");
+#else
+            lwarning("IP_TRANSPARENT is not supported");
+#endif
+        } else {
+#ifdef IP_FREEBIND
+            /* Applies to IPv6 sockets as well. */
+            _set_sockopt(self, fd, IPPROTO_IP, IP_FREEBIND, &opt, sizeof(opt), "IP_FREEBIND");
+#else
+            lwarning("IP_FREEBIND is not supported");
+#endif
+        }
+    }
+
+    int attempts = 1;
+    if (_self->port_min == 0) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+        /* Let the kernel pick the port on connect, so the same port can be
+         * reused towards different targets. */
+        if (is_tcp) {
+            opt = 1;
+            _set_sockopt(self, fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &opt, sizeof(opt), "IP_BIND_ADDRESS_NO_PORT");
         }
-        _self->source = _self->source->next;
+#endif
+    } else {
+        attempts = _OUTPUT_DNSSIM_BIND_ATTEMPTS;
+    }
+
+    for (int i = 0; i < attempts; ++i) {
+        if (_self->port_min != 0) {
+            uint16_t port = _self->port_min + _self->port_next++ % (_self->port_max - _self->port_min + 1);
+            if (family == AF_INET6)
+                ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+            else
+                ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+        }
+
+        if (is_tcp)
+            ret = uv_tcp_bind((uv_tcp_t*)handle, (struct sockaddr*)&addr, 0);
+        else
+            ret = uv_udp_bind((uv_udp_t*)handle, (struct sockaddr*)&addr, 0);
+        if (ret != UV_EADDRINUSE)
+            break;
+    }
+    if (ret == UV_EADDRINUSE || ret == UV_EADDRNOTAVAIL) {
+        stats->port_exhausted++;
+        self->stats_sum->port_exhausted++;
+    }
+    if (ret < 0) {
+        lwarning("failed to bind to address: %s", uv_strerror(ret));
+        return ret;
     }
     return 0;
 }
 
+/* Remember when the first query of the request was written to the socket,
+ * a query retried over TCP doesn't change it. */
+static void _request_sent(_output_dnssim_request_t* req)
+{
+    output_dnssim_t* self = req->dnssim;
+    if (_self->trace != NULL && req->sent_ns == 0)
+        req->sent_ns = uv_hrtime();
+}
+
 static void _maybe_free_request(_output_dnssim_request_t* req)
 {
     if (req->qry == NULL && req->timer == NULL) {
-        if (req->dnssim->free_after_use) {
+        if (req->free_payload) {
             core_object_payload_free(req->payload);
         }
         core_object_dns_free(req->dns_q);
@@ -137,6 +502,11 @@ static void _close_query(_output_dnssim_query_t* qry)
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
         _close_query_tcp((_output_dnssim_query_tcp_t*)qry);
         break;
+#if HAVE_NGTCP2
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
+        _close_query_quic((_output_dnssim_query_quic_t*)qry);
+        break;
+#endif
     default:
         mlfatal("invalid query transport");
         break;
@@ -161,10 +531,33 @@ static void _close_request(_output_dnssim_request_t* req)
     }
     req->stats->latency[latency]++;
     req->dnssim->stats_sum->latency[latency]++;
+    req->client->target->stats->latency[latency]++;
+
+    if (((_output_dnssim_t*)req->dnssim)->trace != NULL)
+        _trace_request(req);
+
+    if (req->is_fallback) {
+        uint64_t udp_latency = req->fallback_at - req->created_at;
+        if (udp_latency > latency)
+            udp_latency = latency;
+        req->stats->fallback_latency_udp[udp_latency]++;
+        req->dnssim->stats_sum->fallback_latency_udp[udp_latency]++;
+        req->stats->fallback_latency_tcp[latency - udp_latency]++;
+        req->dnssim->stats_sum->fallback_latency_tcp[latency - udp_latency]++;
+    }
 
+    /* In closed-loop model, client is occupied for think time after the
+     * request ends. The request timer is reused to track it. */
+    _output_dnssim_client_t* client = req->client;
+    bool is_thinking = false;
     if (req->timer != NULL) {
         uv_timer_stop(req->timer);
-        uv_close((uv_handle_t*)req->timer, _on_request_timer_closed);
+        if (req->dnssim->max_client_outstanding > 0 && req->dnssim->think_time_ms > 0) {
+            uv_timer_start(req->timer, _on_request_think_time_end, req->dnssim->think_time_ms, 0);
+            is_thinking = true;
+        } else {
+            uv_close((uv_handle_t*)req->timer, _on_request_timer_closed);
+        }
     }
 
     /* Finish any queries in flight. */
@@ -173,6 +566,9 @@ static void _close_request(_output_dnssim_request_t* req)
         _close_query(qry);
 
     _maybe_free_request(req);
+
+    if (!is_thinking)
+        _release_client(client);
 }
 
 static void _on_request_timer_closed(uv_handle_t* handle)
@@ -189,92 +585,93 @@ static void _on_request_timeout(uv_timer_t* handle)
     _close_request(req);
 }
 
-static void _request_answered(_output_dnssim_request_t* req, core_object_dns_t* msg)
+static void _on_request_think_time_end(uv_timer_t* handle)
 {
-    req->dnssim->stats_sum->answers++;
-    req->stats->answers++;
+    _output_dnssim_request_t* req = (_output_dnssim_request_t*)handle->data;
+    _output_dnssim_client_t* client = req->client;
+    uv_close((uv_handle_t*)handle, _on_request_timer_closed);
+    _release_client(client);
+}
 
-    switch(msg->rcode) {
+static void _count_rcode(output_dnssim_stats_t* stats, uint8_t rcode)
+{
+    switch(rcode) {
     case CORE_OBJECT_DNS_RCODE_NOERROR:
-        req->dnssim->stats_sum->rcode_noerror++;
-        req->stats->rcode_noerror++;
+        stats->rcode_noerror++;
         break;
     case CORE_OBJECT_DNS_RCODE_FORMERR:
-        req->dnssim->stats_sum->rcode_formerr++;
-        req->stats->rcode_formerr++;
+        stats->rcode_formerr++;
         break;
     case CORE_OBJECT_DNS_RCODE_SERVFAIL:
-        req->dnssim->stats_sum->rcode_servfail++;
-        req->stats->rcode_servfail++;
+        stats->rcode_servfail++;
         break;
     case CORE_OBJECT_DNS_RCODE_NXDOMAIN:
-        req->dnssim->stats_sum->rcode_nxdomain++;
-        req->stats->rcode_nxdomain++;
+        stats->rcode_nxdomain++;
         break;
     case CORE_OBJECT_DNS_RCODE_NOTIMP:
-        req->dnssim->stats_sum->rcode_notimp++;
-        req->stats->rcode_notimp++;
+        stats->rcode_notimp++;
         break;
     case CORE_OBJECT_DNS_RCODE_REFUSED:
-        req->dnssim->stats_sum->rcode_refused++;
-        req->stats->rcode_refused++;
+        stats->rcode_refused++;
         break;
     case CORE_OBJECT_DNS_RCODE_YXDOMAIN:
-        req->dnssim->stats_sum->rcode_yxdomain++;
-        req->stats->rcode_yxdomain++;
+        stats->rcode_yxdomain++;
         break;
     case CORE_OBJECT_DNS_RCODE_YXRRSET:
-        req->dnssim->stats_sum->rcode_yxrrset++;
-        req->stats->rcode_yxrrset++;
+        stats->rcode_yxrrset++;
         break;
     case CORE_OBJECT_DNS_RCODE_NXRRSET:
-        req->dnssim->stats_sum->rcode_nxrrset++;
-        req->stats->rcode_nxrrset++;
+        stats->rcode_nxrrset++;
         break;
     case CORE_OBJECT_DNS_RCODE_NOTAUTH:
-        req->dnssim->stats_sum->rcode_notauth++;
-        req->stats->rcode_notauth++;
+        stats->rcode_notauth++;
         break;
     case CORE_OBJECT_DNS_RCODE_NOTZONE:
-        req->dnssim->stats_sum->rcode_notzone++;
-        req->stats->rcode_notzone++;
+        stats->rcode_notzone++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADVERS:
-        req->dnssim->stats_sum->rcode_badvers++;
-        req->stats->rcode_badvers++;
+        stats->rcode_badvers++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADKEY:
-        req->dnssim->stats_sum->rcode_badkey++;
-        req->stats->rcode_badkey++;
+        stats->rcode_badkey++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADTIME:
-        req->dnssim->stats_sum->rcode_badtime++;
-        req->stats->rcode_badtime++;
+        stats->rcode_badtime++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADMODE:
-        req->dnssim->stats_sum->rcode_badmode++;
-        req->stats->rcode_badmode++;
+        stats->rcode_badmode++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADNAME:
-        req->dnssim->stats_sum->rcode_badname++;
-        req->stats->rcode_badname++;
+        stats->rcode_badname++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADALG:
-        req->dnssim->stats_sum->rcode_badalg++;
-        req->stats->rcode_badalg++;
+        stats->rcode_badalg++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADTRUNC:
-        req->dnssim->stats_sum->rcode_badtrunc++;
-        req->stats->rcode_badtrunc++;
+        stats->rcode_badtrunc++;
         break;
     case CORE_OBJECT_DNS_RCODE_BADCOOKIE:
-        req->dnssim->stats_sum->rcode_badcookie++;
-        req->stats->rcode_badcookie++;
+        stats->rcode_badcookie++;
         break;
     default:
-        req->dnssim->stats_sum->rcode_other++;
-        req->stats->rcode_other++;
+        stats->rcode_other++;
     }
+}
+
+static void _request_answered(_output_dnssim_request_t* req, core_object_dns_t* msg)
+{
+    output_dnssim_stats_t* target_stats = req->client->target->stats;
+
+    req->is_answered = true;
+    req->rcode = msg->rcode;
+
+    req->dnssim->stats_sum->answers++;
+    req->stats->answers++;
+    target_stats->answers++;
+
+    _count_rcode(req->dnssim->stats_sum, msg->rcode);
+    _count_rcode(req->stats, msg->rcode);
+    _count_rcode(target_stats, msg->rcode);
 
     _close_request(req);
 }
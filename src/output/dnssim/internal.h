@@ -29,6 +29,7 @@
 typedef struct _output_dnssim_request _output_dnssim_request_t;
 typedef struct _output_dnssim_connection _output_dnssim_connection_t;
 typedef struct _output_dnssim_client _output_dnssim_client_t;
+typedef struct _output_dnssim_target _output_dnssim_target_t;
 
 
 /*
@@ -80,6 +81,9 @@ struct _output_dnssim_query_tcp {
 
     /* Send buffers for libuv; 0 is for dnslen, 1 is for dnsmsg. */
     uv_buf_t bufs[2];
+
+    /* Time when the query started waiting for a connection (loop time in ms). */
+    uint64_t pending_since;
 };
 
 struct _output_dnssim_request {
@@ -97,6 +101,10 @@ struct _output_dnssim_request {
     uint64_t created_at;
     uint64_t ended_at;
 
+    /* Time when truncated UDP answer made the request fall back to TCP. */
+    bool is_fallback;
+    uint64_t fallback_at;
+
     /* Timer for tracking timeout of the request. */
     uv_timer_t* timer;
 
@@ -111,6 +119,17 @@ struct _output_dnssim_request {
 
     /* Statistics interval in which this request is tracked. */
     output_dnssim_stats_t* stats;
+
+    /* Whether the payload is owned by dnssim and must be freed. */
+    bool free_payload;
+
+    /* Trace information (only set when tracing is enabled), sent_ns stays 0
+     * until the first query of the request is written. */
+    uint64_t intended_ns;
+    uint64_t created_ns;
+    uint64_t sent_ns;
+    bool is_answered;
+    uint8_t rcode;
 };
 
 
@@ -144,6 +163,9 @@ struct _output_dnssim_connection {
     /* List of queries that have been sent over this connection. */
     _output_dnssim_query_t* sent;
 
+    /* Number of queries assigned to this connection (queued and sent). */
+    size_t inflight;
+
     /* Client this connection belongs to. */
     _output_dnssim_client_t* client;
 
@@ -171,17 +193,132 @@ struct _output_dnssim_connection {
 
     /* Statistics interval in which the handshake is tracked. */
     output_dnssim_stats_t* stats;
+
+    /* Timer sampling TCP_INFO of the active connection and retransmissions
+     * counted so far. */
+    uv_timer_t* tcpi_timer;
+    uint32_t tcpi_total_retrans;
+};
+
+#if HAVE_NGTCP2
+typedef struct _output_dnssim_quic_conn _output_dnssim_quic_conn_t;
+typedef struct _output_dnssim_quic_stream _output_dnssim_quic_stream_t;
+
+typedef struct _output_dnssim_query_quic _output_dnssim_query_quic_t;
+struct _output_dnssim_query_quic {
+    _output_dnssim_query_t qry;
+
+    /* Stream this query is sent over (NULL while waiting for a connection). */
+    _output_dnssim_quic_stream_t* stream;
+
+    /* Time when the query started waiting for a connection (loop time in ms). */
+    uint64_t pending_since;
+};
+
+/* Stream of a single query, it owns the send buffer since ngtcp2 may need it
+ * for retransmissions until the stream is closed. */
+struct _output_dnssim_quic_stream {
+    _output_dnssim_quic_stream_t* next;
+
+    int64_t id;
+    _output_dnssim_quic_conn_t* conn;
+
+    /* Query of this stream, NULL once the query is closed. */
+    _output_dnssim_query_quic_t* qry;
+
+    /* DNS message prefixed by its length, with message ID set to 0 (RFC 9250). */
+    uint8_t* send_buf;
+    size_t send_len;
+    size_t send_off;
+    bool is_blocked;
+
+    uint8_t* recv_buf;
+    size_t recv_len;
+    bool is_fin_received;
+    bool needs_reset;
+};
+
+struct _output_dnssim_quic_conn {
+    _output_dnssim_quic_conn_t* next;
+
+    uv_udp_t* handle;
+
+    /* Timer for ngtcp2 expiry (retransmissions, handshake and idle timeout). */
+    uv_timer_t* timer;
+
+    ngtcp2_conn* conn;
+    ngtcp2_crypto_conn_ref conn_ref;
+    gnutls_session_t tls;
+    ngtcp2_ccerr last_error;
+
+    /* Local and remote address of the connection path. */
+    struct sockaddr_storage local;
+    socklen_t local_len;
+
+    /* List of open streams. */
+    _output_dnssim_quic_stream_t* streams;
+    size_t inflight;
+
+    /* Client this connection belongs to. */
+    _output_dnssim_client_t* client;
+
+    enum {
+        _OUTPUT_DNSSIM_QUIC_INITIALIZED,
+        _OUTPUT_DNSSIM_QUIC_CONNECTING,
+        _OUTPUT_DNSSIM_QUIC_ACTIVE,
+        _OUTPUT_DNSSIM_QUIC_CLOSING,
+        _OUTPUT_DNSSIM_QUIC_CLOSED
+    } state;
+
+    /* Whether queries were sent in early data. */
+    bool is_0rtt;
+
+    /* Set while ngtcp2 processes received packet, when no other ngtcp2
+     * functions may be called. */
+    bool is_reading;
+
+    /* Whether queries were orphaned when the established connection closed,
+     * they're re-sent once the handle is closed. */
+    bool has_orphans;
+
+    /* Statistics interval in which the handshake is tracked. */
+    output_dnssim_stats_t* stats;
 };
 
+#define _OUTPUT_DNSSIM_QUIC_MAX_PKT 1500
+#define _OUTPUT_DNSSIM_QUIC_CIDLEN 16
+#define _OUTPUT_DNSSIM_DOQ_REQUEST_CANCELLED 0x3
+#endif
+
 
 /*
  * Client structure.
  */
 
+/* Request waiting in client queue until it may be sent (closed-loop model). */
+typedef struct _output_dnssim_backlog _output_dnssim_backlog_t;
+struct _output_dnssim_backlog {
+    _output_dnssim_backlog_t* next;
+
+    core_object_payload_t* payload;
+    uint64_t queued_at;
+    uint64_t intended_ns;
+};
+
 struct _output_dnssim_client {
     /* Dnssim component this client belongs to. */
     output_dnssim_t* dnssim;
 
+    /* Client ID, as extracted from the input. */
+    uint32_t id;
+
+    /* Target this client sends its queries to (assigned on first use). */
+    _output_dnssim_target_t* target;
+
+    /* Clients sending copies of the queries to the other targets (mirror mode). */
+    _output_dnssim_client_t* mirror;
+    bool is_mirror;
+
     /* List of connections.
      * Multiple connections may be used (e.g. some are already closed for writing).
      */
@@ -189,17 +326,152 @@ struct _output_dnssim_client {
 
     /* List of queries that are pending to be sent over any available connection. */
     _output_dnssim_query_t* pending;
+
+    /* Queue of TCP queries orphaned by closed connections, which aren't
+     * re-sent and leave it (mostly from the head) as they time out. */
+    _output_dnssim_query_t* orphans;
+    _output_dnssim_query_t* orphans_tail;
+
+    /* Number of requests that occupy the client (ongoing or in think time). */
+    size_t outstanding;
+
+    /* Queue of requests over the outstanding limit (closed-loop model). */
+    _output_dnssim_backlog_t* backlog;
+    _output_dnssim_backlog_t* backlog_tail;
+    bool is_dispatching;
+
+#if HAVE_NGTCP2
+    /* QUIC connections, TLS session ticket and transport parameters
+     * remembered for 0-RTT. */
+    _output_dnssim_quic_conn_t* quic;
+    gnutls_datum_t quic_ticket;
+    uint8_t* quic_params;
+    size_t quic_params_len;
+#endif
 };
 
+/* Record of a client in the sparse client table. */
+typedef struct _output_dnssim_client_entry _output_dnssim_client_entry_t;
+struct _output_dnssim_client_entry {
+    _output_dnssim_client_t client;
+
+    /* Next entry in the hash bucket (or in the pool of free records). */
+    _output_dnssim_client_entry_t* hnext;
+
+    /* Neighbours in the list ordered by last use, for idle eviction. */
+    _output_dnssim_client_entry_t* prev;
+    _output_dnssim_client_entry_t* next;
+    uint64_t last_used;
+
+    uint32_t hash;
+    uint8_t key_len;
+    uint8_t key[16];
+};
+
+/* Hash table of clients, grows when it gets fuller than one entry per bucket. */
+typedef struct _output_dnssim_client_table {
+    output_dnssim_client_key_t key;
+    _output_dnssim_client_entry_t** buckets;
+    size_t n_buckets;
+
+    /* Clients ordered by last use (least recent first). */
+    _output_dnssim_client_entry_t* lru_first;
+    _output_dnssim_client_entry_t* lru_last;
+
+    /* Pool of records of evicted clients ready for reuse. */
+    _output_dnssim_client_entry_t* pool;
+    size_t pool_size;
+
+    uv_timer_t sweep_timer;
+} _output_dnssim_client_table_t;
+
+#define _OUTPUT_DNSSIM_CLIENT_BUCKETS 1024
+#define _OUTPUT_DNSSIM_CLIENT_POOL_MAX 65536
+#define _OUTPUT_DNSSIM_CLIENT_SWEEP_MS 1000
+
 
 /*
  * DnsSim-related structures.
  */
 
-typedef struct _output_dnssim_source _output_dnssim_source_t;
-struct _output_dnssim_source {
-    _output_dnssim_source_t* next;
+/* Source addresses: a single address or a whole prefix. */
+typedef struct _output_dnssim_source {
     struct sockaddr_storage addr;
+    uint8_t prefix_len;
+
+    /* Number of usable addresses and offset of the first one from the prefix
+     * (network and broadcast addresses are skipped). */
+    uint64_t n_addrs;
+    uint64_t offset;
+} _output_dnssim_source_t;
+
+/* Source addresses of single address family, clients are mapped to the
+ * addresses of all sources in the pool by their ID. */
+typedef struct _output_dnssim_source_pool {
+    _output_dnssim_source_t* sources;
+    size_t n_sources;
+    uint64_t n_addrs;
+
+    /* Whether any source is a prefix which requires IP_FREEBIND. */
+    bool has_prefix;
+
+    /* Round-robin cursor for connections shared among clients. */
+    uint64_t rr;
+} _output_dnssim_source_pool_t;
+
+#define _OUTPUT_DNSSIM_MAX_SOURCE_ADDRS ((uint64_t)1 << 32)
+#define _OUTPUT_DNSSIM_BIND_ATTEMPTS 8
+
+struct _output_dnssim_target {
+    struct sockaddr_storage addr;
+    uint32_t weight;
+    size_t idx;
+
+    /* Summary statistics of requests sent to this target. */
+    output_dnssim_stats_t* stats;
+
+    /* Pseudo-client which owns the connections when they're shared among clients. */
+    _output_dnssim_client_t shared_client;
+};
+
+/* Point on the consistent hashing ring, each target has weight-proportional
+ * number of points. */
+typedef struct _output_dnssim_ring_point {
+    uint32_t hash;
+    _output_dnssim_target_t* target;
+} _output_dnssim_ring_point_t;
+
+#define _OUTPUT_DNSSIM_RING_POINTS 64
+#define _OUTPUT_DNSSIM_MAX_WEIGHT 1000
+
+#define _OUTPUT_DNSSIM_TRACE_BUFS 4
+#define _OUTPUT_DNSSIM_TRACE_BUF_LEN 65536
+
+typedef struct _output_dnssim_trace_buf _output_dnssim_trace_buf_t;
+struct _output_dnssim_trace_buf {
+    output_dnssim_trace_record_t* records;
+    size_t len;
+    bool is_full;
+};
+
+typedef struct _output_dnssim_trace _output_dnssim_trace_t;
+struct _output_dnssim_trace {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool is_closing;
+
+    /* Buffers are filled by the loop (cur) and written by writer thread (wr). */
+    _output_dnssim_trace_buf_t bufs[_OUTPUT_DNSSIM_TRACE_BUFS];
+    size_t cur;
+    size_t wr;
+
+    /* Mapping of PCAP timestamps to monotonic time for intended send time. */
+    double time_mul;
+    bool has_base;
+    uint64_t base_pcap_ns;
+    uint64_t base_mono_ns;
 };
 
 typedef struct _output_dnssim _output_dnssim_t;
@@ -209,12 +481,57 @@ struct _output_dnssim {
     uv_loop_t loop;
     uv_timer_t stats_timer;
 
-    struct sockaddr_storage target;
-    _output_dnssim_source_t* source;
+    /* Set of targets and the consistent hashing ring mapping clients to them. */
+    _output_dnssim_target_t** targets;
+    size_t n_targets;
+    _output_dnssim_ring_point_t* ring_points;
+    size_t n_ring_points;
+
+    /* Set once a client or connection refers to a target, after which
+     * the targets can't be changed. */
+    bool targets_in_use;
+
+    /* Source address pools and explicit range of source ports. */
+    _output_dnssim_source_pool_t sources4;
+    _output_dnssim_source_pool_t sources6;
+    uint16_t port_min;
+    uint16_t port_max;
+    uint32_t port_next;
+
     output_dnssim_transport_t transport;
 
-    /* Array of clients, mapped by client ID (ranges from 0 to max_clients). */
+    /* Array of clients, mapped by client ID (ranges from 0 to max_clients),
+     * or sparse table of clients if max_clients is 0. */
     _output_dnssim_client_t* client_arr;
+    _output_dnssim_client_table_t* client_table;
+
+    /* Dedicated event loop thread, fed with objects through a SPSC ring. */
+    bool is_threaded;
+    int is_closing;
+    pthread_t thread;
+    uv_async_t async;
+    ck_ring_t ring;
+    ck_ring_buffer_t* ring_buf;
+
+    /* Requests occupying clients (ongoing or in think time), once the input
+     * ended the loop thread finishes when there are none left. */
+    size_t outstanding;
+    uv_check_t drain_check;
+
+    /* Stats snapshots requested from other threads. */
+    uv_async_t stats_async;
+    pthread_mutex_t stats_lock;
+    pthread_cond_t stats_cond;
+    output_dnssim_stats_t* stats_dst;
+    bool is_stats_closed;
+    bool is_stats_finished;
+
+    /* Per-request trace output, if enabled. */
+    _output_dnssim_trace_t* trace;
+
+#if HAVE_NGTCP2
+    gnutls_certificate_credentials_t quic_creds;
+#endif
 };
 
 
@@ -222,13 +539,24 @@ struct _output_dnssim {
  * Forward function declarations.
  */
 
-static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle);
+static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle,
+    _output_dnssim_client_t* client, output_dnssim_stats_t* stats);
 static int _create_query_udp(output_dnssim_t* self, _output_dnssim_request_t* req);
 static int _create_query_tcp(output_dnssim_t* self, _output_dnssim_request_t* req);
 static void _close_query_udp(_output_dnssim_query_udp_t* qry);
 static void _close_query_tcp(_output_dnssim_query_tcp_t* qry);
 static void _on_request_timer_closed(uv_handle_t* handle);
 static void _on_request_timeout(uv_timer_t* handle);
+static void _on_request_think_time_end(uv_timer_t* handle);
+static void _release_client(_output_dnssim_client_t* client);
+static _output_dnssim_target_t* _client_target(output_dnssim_t* self, _output_dnssim_client_t* client);
+static _output_dnssim_client_t* _mirror_clients(output_dnssim_t* self, _output_dnssim_client_t* client);
+static void _trace_request(_output_dnssim_request_t* req);
+#if HAVE_NGTCP2
+static int _create_query_quic(output_dnssim_t* self, _output_dnssim_request_t* req);
+static void _close_query_quic(_output_dnssim_query_quic_t* qry);
+static void _free_client_quic(_output_dnssim_client_t* client);
+#endif
 static void _maybe_close_connection(_output_dnssim_connection_t* conn);
 static void _close_connection(_output_dnssim_connection_t* conn);
 static void _request_answered(_output_dnssim_request_t* req, core_object_dns_t* msg);
@@ -237,6 +565,7 @@ static void _maybe_free_request(_output_dnssim_request_t* req);
 static void _close_query(_output_dnssim_query_t* qry);
 static void _on_uv_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
 static int _handle_pending_queries(_output_dnssim_client_t* client);
+static int _open_connection(_output_dnssim_client_t* client);
 
 
 /*
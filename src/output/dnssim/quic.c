@@ -0,0 +1,843 @@
+/*
+ * Copyright (c) 2019-2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DNS-over-QUIC (RFC 9250) using ngtcp2 with GnuTLS.
+ *
+ * Each query is sent over its own bidirectional stream, clients reuse their
+ * connection until it's closed by idle timeout. Connections resume TLS
+ * sessions and optionally send queries in early data (0-RTT).
+ */
+
+#if HAVE_NGTCP2
+
+static void _close_quic_conn(_output_dnssim_quic_conn_t* qc, bool send_close);
+static int _write_quic(_output_dnssim_quic_conn_t* qc);
+static int _handle_pending_quic(_output_dnssim_client_t* client);
+
+static ngtcp2_tstamp _quic_ts(void)
+{
+    return uv_hrtime();
+}
+
+static ngtcp2_conn* _quic_get_conn(ngtcp2_crypto_conn_ref* ref)
+{
+    return ((_output_dnssim_quic_conn_t*)ref->user_data)->conn;
+}
+
+static void _quic_path(_output_dnssim_quic_conn_t* qc, ngtcp2_path* path)
+{
+    struct sockaddr_storage* remote = &qc->client->target->addr;
+
+    path->local.addr = (ngtcp2_sockaddr*)&qc->local;
+    path->local.addrlen = qc->local_len;
+    path->remote.addr = (ngtcp2_sockaddr*)remote;
+    path->remote.addrlen = remote->ss_family == AF_INET6 ?
+        sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    path->user_data = NULL;
+}
+
+static void _free_quic_stream(_output_dnssim_quic_stream_t* s)
+{
+    if (s->qry != NULL)
+        s->qry->stream = NULL;
+    free(s->send_buf);
+    free(s->recv_buf);
+    free(s);
+}
+
+static void _maybe_free_quic_conn(_output_dnssim_quic_conn_t* qc)
+{
+    if (qc->handle != NULL || qc->timer != NULL)
+        return;
+
+    while (qc->streams != NULL) {
+        _output_dnssim_quic_stream_t* s = qc->streams;
+        qc->streams = s->next;
+        _free_quic_stream(s);
+    }
+    if (qc->conn != NULL)
+        ngtcp2_conn_del(qc->conn);
+    if (qc->tls != NULL)
+        gnutls_deinit(qc->tls);
+
+    _ll_remove(qc->client->quic, qc);
+    free(qc);
+}
+
+static void _on_quic_handle_closed(uv_handle_t* handle)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)handle->data;
+    _output_dnssim_client_t* client = qc->client;
+    bool has_orphans = qc->has_orphans;
+
+    free(qc->handle);
+    qc->handle = NULL;
+    _maybe_free_quic_conn(qc);
+
+    /* Orphaned queries are re-sent over another connection, but not after
+     * a failed handshake, so that an unreachable server isn't retried in
+     * a tight loop. */
+    if (has_orphans && _handle_pending_quic(client) != 0)
+        mldebug("quic: orphaned queries failed to be re-sent");
+}
+
+static void _on_quic_timer_closed(uv_handle_t* handle)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)handle->data;
+    free(qc->timer);
+    qc->timer = NULL;
+    _maybe_free_quic_conn(qc);
+}
+
+/* Query goes back to the client's pending queries, e.g. when the connection
+ * closes or early data is rejected. */
+static void _orphan_quic_query(_output_dnssim_query_quic_t* qry, _output_dnssim_client_t* client)
+{
+    output_dnssim_t* self = client->dnssim;
+    qry->stream = NULL;
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_ORPHANED;
+    qry->pending_since = uv_now(&_self->loop);
+    _ll_append(client->pending, &qry->qry);
+}
+
+static void _send_quic_packet(_output_dnssim_quic_conn_t* qc, const uint8_t* data, size_t len)
+{
+    uv_buf_t buf = uv_buf_init((char*)data, len);
+    int ret = uv_udp_try_send(qc->handle, &buf, 1, NULL);
+    if (ret < 0 && ret != UV_EAGAIN)
+        mldebug("quic: failed to send packet: %s", uv_strerror(ret));
+}
+
+static void _close_quic_conn(_output_dnssim_quic_conn_t* qc, bool send_close)
+{
+    output_dnssim_t* self = qc->client->dnssim;
+    bool was_active = qc->state == _OUTPUT_DNSSIM_QUIC_ACTIVE;
+
+    switch (qc->state) {
+    case _OUTPUT_DNSSIM_QUIC_INITIALIZED:
+        break;
+    case _OUTPUT_DNSSIM_QUIC_CLOSING:
+    case _OUTPUT_DNSSIM_QUIC_CLOSED:
+        return;
+    case _OUTPUT_DNSSIM_QUIC_CONNECTING:
+        /* Handshakes cut short by stopping the loop thread didn't fail. */
+        if (_self->is_stats_finished)
+            break;
+        qc->stats->conn_handshakes_failed++;
+        self->stats_sum->conn_handshakes_failed++;
+        break;
+    case _OUTPUT_DNSSIM_QUIC_ACTIVE:
+        self->stats_current->conn_active--;
+        break;
+    }
+    qc->state = _OUTPUT_DNSSIM_QUIC_CLOSING;
+
+    if (send_close && qc->conn != NULL && qc->handle != NULL &&
+        !ngtcp2_conn_in_closing_period(qc->conn) && !ngtcp2_conn_in_draining_period(qc->conn)) {
+        uint8_t buf[_OUTPUT_DNSSIM_QUIC_MAX_PKT];
+        ngtcp2_path_storage ps;
+        ngtcp2_pkt_info pi;
+        ngtcp2_path_storage_zero(&ps);
+        ngtcp2_ssize n = ngtcp2_conn_write_connection_close(qc->conn, &ps.path, &pi,
+            buf, sizeof(buf), &qc->last_error, _quic_ts());
+        if (n > 0)
+            _send_quic_packet(qc, buf, n);
+    }
+
+    /* Unanswered queries wait for the next connection. */
+    _output_dnssim_quic_stream_t* s;
+    for (s = qc->streams; s != NULL; s = s->next) {
+        if (s->qry != NULL) {
+            _orphan_quic_query(s->qry, qc->client);
+            s->qry = NULL;
+            qc->has_orphans = was_active;
+        }
+    }
+    qc->inflight = 0;
+
+    if (qc->timer != NULL) {
+        uv_timer_stop(qc->timer);
+        uv_close((uv_handle_t*)qc->timer, _on_quic_timer_closed);
+    }
+    if (qc->handle != NULL) {
+        uv_udp_recv_stop(qc->handle);
+        uv_close((uv_handle_t*)qc->handle, _on_quic_handle_closed);
+    }
+}
+
+/* Close the connections without any queries in flight right away instead
+ * of waiting for their idle timeout. */
+static void _close_idle_quic_conns(_output_dnssim_client_t* client)
+{
+    _output_dnssim_quic_conn_t* qc = client->quic;
+    while (qc != NULL) {
+        _output_dnssim_quic_conn_t* next = qc->next;
+        if (qc->inflight == 0)
+            _close_quic_conn(qc, true);
+        qc = next;
+    }
+}
+
+static void _on_quic_timer(uv_timer_t* handle)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)handle->data;
+
+    int ret = ngtcp2_conn_handle_expiry(qc->conn, _quic_ts());
+    if (ret != 0) {
+        /* Idle and handshake timeouts close the connection silently. */
+        mldebug("quic: connection expired: %s", ngtcp2_strerror(ret));
+        _close_quic_conn(qc, false);
+        return;
+    }
+    _write_quic(qc);
+}
+
+static void _update_quic_timer(_output_dnssim_quic_conn_t* qc)
+{
+    ngtcp2_tstamp expiry = ngtcp2_conn_get_expiry(qc->conn);
+    ngtcp2_tstamp now = _quic_ts();
+    uint64_t timeout_ms = 0;
+
+    if (expiry == UINT64_MAX) {
+        uv_timer_stop(qc->timer);
+        return;
+    }
+    if (expiry > now)
+        timeout_ms = (expiry - now + NGTCP2_MILLISECONDS - 1) / NGTCP2_MILLISECONDS;
+    uv_timer_start(qc->timer, _on_quic_timer, timeout_ms, 0);
+}
+
+/* Write all stream data and control frames ngtcp2 has to send. */
+static int _write_quic(_output_dnssim_quic_conn_t* qc)
+{
+    uint8_t buf[_OUTPUT_DNSSIM_QUIC_MAX_PKT];
+    ngtcp2_path_storage ps;
+    ngtcp2_pkt_info pi;
+    ngtcp2_path_storage_zero(&ps);
+
+    if (qc->state == _OUTPUT_DNSSIM_QUIC_CLOSING || qc->state == _OUTPUT_DNSSIM_QUIC_CLOSED)
+        return 0;
+
+    for (;;) {
+        _output_dnssim_quic_stream_t* s = qc->streams;
+        while (s != NULL && (s->send_off == s->send_len || s->is_blocked))
+            s = s->next;
+
+        int64_t stream_id = -1;
+        ngtcp2_vec vec;
+        size_t vcnt = 0;
+        uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
+        if (s != NULL) {
+            stream_id = s->id;
+            vec.base = s->send_buf + s->send_off;
+            vec.len = s->send_len - s->send_off;
+            vcnt = 1;
+            flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+        }
+
+        ngtcp2_ssize ndatalen = -1;
+        ngtcp2_ssize n = ngtcp2_conn_writev_stream(qc->conn, &ps.path, &pi, buf, sizeof(buf),
+            &ndatalen, flags, stream_id, vcnt ? &vec : NULL, vcnt, _quic_ts());
+        if (n < 0) {
+            switch (n) {
+            case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+                s->is_blocked = true;
+                continue;
+            case NGTCP2_ERR_STREAM_SHUT_WR:
+            case NGTCP2_ERR_STREAM_NOT_FOUND:
+                s->send_off = s->send_len;
+                continue;
+            case NGTCP2_ERR_WRITE_MORE:
+                s->send_off += ndatalen;
+                continue;
+            default:
+                mldebug("quic: write failed: %s", ngtcp2_strerror(n));
+                ngtcp2_ccerr_set_liberr(&qc->last_error, n, NULL, 0);
+                _close_quic_conn(qc, true);
+                return -1;
+            }
+        }
+        if (s != NULL && ndatalen >= 0)
+            s->send_off += ndatalen;
+        if (n == 0)
+            break;
+        _send_quic_packet(qc, buf, n);
+    }
+
+    _update_quic_timer(qc);
+    return 0;
+}
+
+static void _process_quic_answer(_output_dnssim_quic_stream_t* s)
+{
+    _output_dnssim_request_t* req = s->qry->qry.req;
+    core_object_payload_t payload = CORE_OBJECT_PAYLOAD_INIT(NULL);
+    core_object_dns_t dns_a = CORE_OBJECT_DNS_INIT(&payload);
+
+    if (s->recv_len < 2 || ((size_t)s->recv_buf[0] << 8 | s->recv_buf[1]) + 2 > s->recv_len) {
+        mldebug("quic response truncated");
+        return;
+    }
+    payload.payload = s->recv_buf + 2;
+    payload.len = (size_t)s->recv_buf[0] << 8 | s->recv_buf[1];
+
+    dns_a.obj_prev = (core_object_t*)&payload;
+    if (core_object_dns_parse_header(&dns_a) != 0) {
+        mldebug("quic response malformed");
+        return;
+    }
+
+    /* Message ID is always 0, the stream identifies the query. */
+    _request_answered(req, &dns_a);
+}
+
+static int _on_quic_recv_stream_data(ngtcp2_conn* conn, uint32_t flags, int64_t stream_id,
+    uint64_t offset, const uint8_t* data, size_t datalen, void* user_data, void* stream_user_data)
+{
+    _output_dnssim_quic_stream_t* s = (_output_dnssim_quic_stream_t*)stream_user_data;
+
+    ngtcp2_conn_extend_max_stream_offset(conn, stream_id, datalen);
+    ngtcp2_conn_extend_max_offset(conn, datalen);
+    if (s == NULL)
+        return 0;
+
+    if (datalen > 0) {
+        mlfatal_oom(s->recv_buf = realloc(s->recv_buf, s->recv_len + datalen));
+        memcpy(s->recv_buf + s->recv_len, data, datalen);
+        s->recv_len += datalen;
+    }
+    if (flags & NGTCP2_STREAM_DATA_FLAG_FIN) {
+        s->is_fin_received = true;
+        if (s->qry != NULL)
+            _process_quic_answer(s);
+    }
+
+    return 0;
+}
+
+static int _on_quic_stream_close(ngtcp2_conn* conn, uint32_t flags, int64_t stream_id,
+    uint64_t app_error_code, void* user_data, void* stream_user_data)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)user_data;
+    _output_dnssim_quic_stream_t* s = (_output_dnssim_quic_stream_t*)stream_user_data;
+
+    if (s == NULL)
+        return 0;
+
+    /* Query of a stream reset by the server is left to time out. */
+    if (s->qry != NULL) {
+        mldebug("quic: stream %" PRId64 " closed without answer", stream_id);
+        qc->inflight--;
+    }
+    _ll_remove(qc->streams, s);
+    _free_quic_stream(s);
+    return 0;
+}
+
+static int _on_quic_extend_max_stream_data(ngtcp2_conn* conn, int64_t stream_id,
+    uint64_t max_data, void* user_data, void* stream_user_data)
+{
+    _output_dnssim_quic_stream_t* s = (_output_dnssim_quic_stream_t*)stream_user_data;
+    if (s != NULL)
+        s->is_blocked = false;
+    return 0;
+}
+
+static int _on_quic_handshake_completed(ngtcp2_conn* conn, void* user_data)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)user_data;
+    output_dnssim_t* self = qc->client->dnssim;
+
+    qc->state = _OUTPUT_DNSSIM_QUIC_ACTIVE;
+    self->stats_current->conn_active++;
+    if (gnutls_session_is_resumed(qc->tls)) {
+        qc->stats->conn_resumed++;
+        self->stats_sum->conn_resumed++;
+    }
+    if (qc->is_0rtt && (gnutls_session_get_flags(qc->tls) & GNUTLS_SFLAGS_EARLY_DATA)) {
+        qc->stats->conn_0rtt++;
+        self->stats_sum->conn_0rtt++;
+    }
+    return 0;
+}
+
+static void _on_quic_rand(uint8_t* dest, size_t destlen, const ngtcp2_rand_ctx* rand_ctx)
+{
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, dest, destlen) != 0)
+        mlfatal("quic: gnutls_rnd() failed");
+}
+
+static int _on_quic_new_connection_id(ngtcp2_conn* conn, ngtcp2_cid* cid, uint8_t* token,
+    size_t cidlen, void* user_data)
+{
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, cid->data, cidlen) != 0)
+        return NGTCP2_ERR_CALLBACK_FAILURE;
+    cid->datalen = cidlen;
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, token, NGTCP2_STATELESS_RESET_TOKENLEN) != 0)
+        return NGTCP2_ERR_CALLBACK_FAILURE;
+    return 0;
+}
+
+/* Remember the session ticket and transport parameters for resumption. */
+static int _on_quic_session_ticket(gnutls_session_t session, unsigned int htype, unsigned when,
+    unsigned int incoming, const gnutls_datum_t* msg)
+{
+    ngtcp2_crypto_conn_ref* ref = (ngtcp2_crypto_conn_ref*)gnutls_session_get_ptr(session);
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)ref->user_data;
+    _output_dnssim_client_t* client = qc->client;
+    uint8_t params[256];
+
+    if (client->quic_ticket.data != NULL) {
+        gnutls_free(client->quic_ticket.data);
+        client->quic_ticket.data = NULL;
+        client->quic_ticket.size = 0;
+    }
+    if (gnutls_session_get_data2(session, &client->quic_ticket) != GNUTLS_E_SUCCESS)
+        return 0;
+
+    ngtcp2_ssize len = ngtcp2_conn_encode_0rtt_transport_params(qc->conn, params, sizeof(params));
+    if (len > 0) {
+        mlfatal_oom(client->quic_params = realloc(client->quic_params, len));
+        memcpy(client->quic_params, params, len);
+        client->quic_params_len = len;
+    }
+    return 0;
+}
+
+static int _init_quic_tls(output_dnssim_t* self, _output_dnssim_quic_conn_t* qc)
+{
+    mlassert_self();
+    static const gnutls_datum_t alpn = { (unsigned char*)"doq", 3 };
+    int ret;
+
+    ret = gnutls_init(&qc->tls, GNUTLS_CLIENT | GNUTLS_ENABLE_EARLY_DATA | GNUTLS_NO_END_OF_EARLY_DATA);
+    if (ret != GNUTLS_E_SUCCESS) {
+        lwarning("quic: gnutls_init() failed: %s", gnutls_strerror(ret));
+        qc->tls = NULL;
+        return -1;
+    }
+    if (ngtcp2_crypto_gnutls_configure_client_session(qc->tls) != 0) {
+        lwarning("quic: failed to configure TLS session");
+        return -1;
+    }
+    ret = gnutls_priority_set_direct(qc->tls,
+        "NORMAL:-VERS-ALL:+VERS-TLS1.3:%DISABLE_TLS13_COMPAT_MODE", NULL);
+    if (ret != GNUTLS_E_SUCCESS) {
+        lwarning("quic: failed to set TLS priority: %s", gnutls_strerror(ret));
+        return -1;
+    }
+    gnutls_credentials_set(qc->tls, GNUTLS_CRD_CERTIFICATE, _self->quic_creds);
+    gnutls_alpn_set_protocols(qc->tls, &alpn, 1, GNUTLS_ALPN_MANDATORY);
+    gnutls_handshake_set_hook_function(qc->tls, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
+        GNUTLS_HOOK_POST, _on_quic_session_ticket);
+
+    qc->conn_ref.get_conn = _quic_get_conn;
+    qc->conn_ref.user_data = qc;
+    gnutls_session_set_ptr(qc->tls, &qc->conn_ref);
+
+    if (qc->client->quic_ticket.data != NULL) {
+        ret = gnutls_session_set_data(qc->tls, qc->client->quic_ticket.data, qc->client->quic_ticket.size);
+        if (ret != GNUTLS_E_SUCCESS)
+            ldebug("quic: failed to set session ticket: %s", gnutls_strerror(ret));
+    }
+
+    return 0;
+}
+
+static int _init_quic_conn(output_dnssim_t* self, _output_dnssim_quic_conn_t* qc)
+{
+    mlassert_self();
+    ngtcp2_callbacks callbacks = {
+        .client_initial = ngtcp2_crypto_client_initial_cb,
+        .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
+        .encrypt = ngtcp2_crypto_encrypt_cb,
+        .decrypt = ngtcp2_crypto_decrypt_cb,
+        .hp_mask = ngtcp2_crypto_hp_mask_cb,
+        .recv_retry = ngtcp2_crypto_recv_retry_cb,
+        .update_key = ngtcp2_crypto_update_key_cb,
+        .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
+        .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
+        .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
+        .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
+        .handshake_completed = _on_quic_handshake_completed,
+        .recv_stream_data = _on_quic_recv_stream_data,
+        .stream_close = _on_quic_stream_close,
+        .extend_max_stream_data = _on_quic_extend_max_stream_data,
+        .rand = _on_quic_rand,
+        .get_new_connection_id = _on_quic_new_connection_id,
+    };
+    ngtcp2_settings settings;
+    ngtcp2_transport_params params;
+    ngtcp2_cid dcid, scid;
+    ngtcp2_path path;
+    int ret;
+
+    ngtcp2_settings_default(&settings);
+    settings.initial_ts = _quic_ts();
+    settings.handshake_timeout = self->handshake_timeout_ms * NGTCP2_MILLISECONDS;
+
+    ngtcp2_transport_params_default(&params);
+    params.initial_max_streams_uni = 0;
+    params.initial_max_stream_data_bidi_local = 65537;
+    params.initial_max_data = 1024 * 1024;
+    params.max_idle_timeout = self->idle_timeout_ms * NGTCP2_MILLISECONDS;
+
+    dcid.datalen = _OUTPUT_DNSSIM_QUIC_CIDLEN;
+    scid.datalen = _OUTPUT_DNSSIM_QUIC_CIDLEN;
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, dcid.data, dcid.datalen) != 0
+        || gnutls_rnd(GNUTLS_RND_RANDOM, scid.data, scid.datalen) != 0) {
+        lwarning("quic: failed to generate connection ID");
+        return -1;
+    }
+
+    _quic_path(qc, &path);
+    ret = ngtcp2_conn_client_new(&qc->conn, &dcid, &scid, &path, NGTCP2_PROTO_VER_V1,
+        &callbacks, &settings, &params, NULL, qc);
+    if (ret != 0) {
+        lwarning("quic: ngtcp2_conn_client_new() failed: %s", ngtcp2_strerror(ret));
+        qc->conn = NULL;
+        return -1;
+    }
+
+    if (_init_quic_tls(self, qc) != 0)
+        return -1;
+    ngtcp2_conn_set_tls_native_handle(qc->conn, qc->tls);
+
+    /* Queries may be sent right away in early data of a resumed session. */
+    if (self->zero_rtt && qc->client->quic_params != NULL && qc->client->quic_ticket.data != NULL) {
+        ret = ngtcp2_conn_decode_and_set_0rtt_transport_params(qc->conn,
+            qc->client->quic_params, qc->client->quic_params_len);
+        if (ret == 0)
+            qc->is_0rtt = true;
+        else
+            ldebug("quic: failed to set 0-RTT transport params: %s", ngtcp2_strerror(ret));
+    }
+
+    return 0;
+}
+
+static void _send_pending_quic(_output_dnssim_quic_conn_t* qc);
+
+/* Move queries back to pending, if the server rejected the early data. */
+static void _check_quic_early_data(_output_dnssim_quic_conn_t* qc)
+{
+    if (!qc->is_0rtt || qc->state != _OUTPUT_DNSSIM_QUIC_ACTIVE)
+        return;
+    qc->is_0rtt = false;
+    if (gnutls_session_get_flags(qc->tls) & GNUTLS_SFLAGS_EARLY_DATA)
+        return;
+
+    mldebug("quic: early data rejected");
+    while (qc->streams != NULL) {
+        _output_dnssim_quic_stream_t* s = qc->streams;
+        qc->streams = s->next;
+        ngtcp2_conn_set_stream_user_data(qc->conn, s->id, NULL);
+        if (s->qry != NULL) {
+            _orphan_quic_query(s->qry, qc->client);
+            s->qry = NULL;
+        }
+        _free_quic_stream(s);
+    }
+    qc->inflight = 0;
+    ngtcp2_conn_tls_early_data_rejected(qc->conn);
+}
+
+static void _on_quic_recv(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf,
+    const struct sockaddr* addr, unsigned flags)
+{
+    _output_dnssim_quic_conn_t* qc = (_output_dnssim_quic_conn_t*)handle->data;
+
+    if (nread > 0 && qc->state != _OUTPUT_DNSSIM_QUIC_CLOSING) {
+        ngtcp2_path path;
+        ngtcp2_pkt_info pi = { 0 };
+        _quic_path(qc, &path);
+
+        qc->is_reading = true;
+        int ret = ngtcp2_conn_read_pkt(qc->conn, &path, &pi, (uint8_t*)buf->base, nread, _quic_ts());
+        qc->is_reading = false;
+
+        if (ret != 0) {
+            mldebug("quic: failed to read packet: %s", ngtcp2_strerror(ret));
+            if (ret == NGTCP2_ERR_DRAINING || ret == NGTCP2_ERR_CLOSING) {
+                _close_quic_conn(qc, false);
+            } else {
+                if (ret == NGTCP2_ERR_CRYPTO)
+                    ngtcp2_ccerr_set_tls_alert(&qc->last_error,
+                        ngtcp2_conn_get_tls_alert(qc->conn), NULL, 0);
+                else
+                    ngtcp2_ccerr_set_liberr(&qc->last_error, ret, NULL, 0);
+                _close_quic_conn(qc, true);
+            }
+        } else {
+            _check_quic_early_data(qc);
+
+            /* Reset streams of queries closed while reading. */
+            _output_dnssim_quic_stream_t* s;
+            for (s = qc->streams; s != NULL; s = s->next) {
+                if (s->needs_reset) {
+                    s->needs_reset = false;
+                    ngtcp2_conn_shutdown_stream(qc->conn, 0, s->id, _OUTPUT_DNSSIM_DOQ_REQUEST_CANCELLED);
+                }
+            }
+
+            /* Queries created by the callbacks while reading are sent now. */
+            if (_handle_pending_quic(qc->client) != 0)
+                mldebug("quic: pending queries failed to be sent");
+            _write_quic(qc);
+        }
+    }
+
+    if (buf->base != NULL)
+        free(buf->base);
+}
+
+static bool _quic_conn_has_capacity(_output_dnssim_quic_conn_t* qc)
+{
+    size_t max = qc->client->dnssim->max_conn_inflight;
+    if (max > 0 && qc->inflight >= max)
+        return false;
+    return ngtcp2_conn_get_streams_bidi_left(qc->conn) > 0;
+}
+
+static void _write_quic_query(_output_dnssim_quic_conn_t* qc, _output_dnssim_query_quic_t* qry)
+{
+    output_dnssim_t* self = qc->client->dnssim;
+    _output_dnssim_quic_stream_t* s;
+    int64_t stream_id;
+
+    lfatal_oom(s = calloc(1, sizeof(_output_dnssim_quic_stream_t)));
+    int ret = ngtcp2_conn_open_bidi_stream(qc->conn, &stream_id, s);
+    if (ret != 0) {
+        ldebug("quic: failed to open stream: %s", ngtcp2_strerror(ret));
+        free(s);
+        return;
+    }
+
+    /* Track the time the query spent waiting for a connection. */
+    uint64_t wait = uv_now(&_self->loop) - qry->pending_since;
+    if (wait > self->timeout_ms)
+        wait = self->timeout_ms;
+    qry->qry.req->stats->conn_queue_wait[wait]++;
+    self->stats_sum->conn_queue_wait[wait]++;
+
+    core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
+    s->id = stream_id;
+    s->conn = qc;
+    s->qry = qry;
+    s->send_len = payload->len + 2;
+    lfatal_oom(s->send_buf = malloc(s->send_len));
+    s->send_buf[0] = payload->len >> 8;
+    s->send_buf[1] = payload->len & 0xff;
+    memcpy(s->send_buf + 2, payload->payload, payload->len);
+    if (payload->len >= 2) {
+        s->send_buf[2] = 0;
+        s->send_buf[3] = 0;
+    }
+    _ll_append(qc->streams, s);
+
+    _ll_remove(qc->client->pending, &qry->qry);
+    qry->stream = s;
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_SENT;
+    qc->inflight++;
+    _request_sent(qry->qry.req);
+}
+
+static void _send_pending_quic(_output_dnssim_quic_conn_t* qc)
+{
+    if (qc->state != _OUTPUT_DNSSIM_QUIC_ACTIVE && !(qc->is_0rtt && qc->state == _OUTPUT_DNSSIM_QUIC_CONNECTING))
+        return;
+
+    _output_dnssim_query_quic_t* qry = (_output_dnssim_query_quic_t*)qc->client->pending;
+    while (qry != NULL && _quic_conn_has_capacity(qc)) {
+        _output_dnssim_query_quic_t* next = (_output_dnssim_query_quic_t*)qry->qry.next;
+        _write_quic_query(qc, qry);
+        qry = next;
+    }
+}
+
+static int _open_quic_conn(output_dnssim_t* self, _output_dnssim_client_t* client)
+{
+    mlassert_self();
+    _output_dnssim_quic_conn_t* qc;
+    int ret;
+
+    lfatal_oom(qc = calloc(1, sizeof(_output_dnssim_quic_conn_t)));
+    qc->client = client;
+    qc->state = _OUTPUT_DNSSIM_QUIC_INITIALIZED;
+    qc->stats = self->stats_current;
+    ngtcp2_ccerr_default(&qc->last_error);
+    _ll_append(client->quic, qc);
+
+    lfatal_oom(qc->timer = malloc(sizeof(uv_timer_t)));
+    uv_timer_init(&_self->loop, qc->timer);
+    qc->timer->data = (void*)qc;
+
+    lfatal_oom(qc->handle = malloc(sizeof(uv_udp_t)));
+    qc->handle->data = (void*)qc;
+    ret = uv_udp_init_ex(&_self->loop, qc->handle, client->target->addr.ss_family);
+    if (ret < 0) {
+        lwarning("quic: failed to init uv_udp_t: %s", uv_strerror(ret));
+        free(qc->handle);
+        qc->handle = NULL;
+        goto failure;
+    }
+
+    ret = _bind_before_connect(self, (uv_handle_t*)qc->handle, client, qc->stats);
+    if (ret < 0)
+        goto failure;
+    ret = uv_udp_connect(qc->handle, (struct sockaddr*)&client->target->addr);
+    if (ret < 0) {
+        lwarning("quic: failed to connect udp socket: %s", uv_strerror(ret));
+        goto failure;
+    }
+    int len = sizeof(qc->local);
+    uv_udp_getsockname(qc->handle, (struct sockaddr*)&qc->local, &len);
+    qc->local_len = len;
+
+    if (_init_quic_conn(self, qc) != 0)
+        goto failure;
+
+    ret = uv_udp_recv_start(qc->handle, _on_uv_alloc, _on_quic_recv);
+    if (ret < 0) {
+        lwarning("quic: failed uv_udp_recv_start(): %s", uv_strerror(ret));
+        goto failure;
+    }
+
+    /* Only a started handshake may fail, like for TCP. */
+    qc->state = _OUTPUT_DNSSIM_QUIC_CONNECTING;
+    qc->stats->conn_handshakes++;
+    self->stats_sum->conn_handshakes++;
+
+    _send_pending_quic(qc);
+    return _write_quic(qc);
+failure:
+    _close_quic_conn(qc, false);
+    return -1;
+}
+
+static int _handle_pending_quic(_output_dnssim_client_t* client)
+{
+    output_dnssim_t* self = client->dnssim;
+    mlassert_self();
+    size_t n_open = 0;
+    bool is_connecting = false;
+
+    if (client->pending == NULL)
+        return 0;
+
+    /* ngtcp2 can't be called while it's processing a packet, e.g. when an
+     * answer releases the next query of a closed-loop client. Queries stay
+     * pending until the packet is processed. */
+    _output_dnssim_quic_conn_t* qc;
+    for (qc = client->quic; qc != NULL; qc = qc->next) {
+        if (qc->is_reading)
+            return 0;
+    }
+
+    qc = client->quic;
+    while (qc != NULL) {
+        _output_dnssim_quic_conn_t* next = qc->next;
+        if (qc->state == _OUTPUT_DNSSIM_QUIC_ACTIVE || qc->state == _OUTPUT_DNSSIM_QUIC_CONNECTING) {
+            n_open++;
+            if (qc->state == _OUTPUT_DNSSIM_QUIC_CONNECTING && !qc->is_0rtt)
+                is_connecting = true;
+            if (client->pending != NULL && _quic_conn_has_capacity(qc)) {
+                _send_pending_quic(qc);
+                _write_quic(qc);
+            }
+        }
+        qc = next;
+    }
+
+    /* Queries are multiplexed, a new connection is opened only when the
+     * existing ones are out of capacity. */
+    if (client->pending == NULL || is_connecting)
+        return 0;
+    if (self->max_client_conns > 0 && n_open >= self->max_client_conns)
+        return 0;
+
+    return _open_quic_conn(self, client);
+}
+
+static int _create_query_quic(output_dnssim_t* self, _output_dnssim_request_t* req)
+{
+    mlassert_self();
+    lassert(req->client, "request must have a client associated with it");
+
+    _output_dnssim_query_quic_t* qry;
+    _output_dnssim_client_t* client = _conn_client(req);
+
+    lfatal_oom(qry = calloc(1, sizeof(_output_dnssim_query_quic_t)));
+
+    qry->qry.transport = OUTPUT_DNSSIM_TRANSPORT_QUIC;
+    qry->qry.req = req;
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE;
+    qry->pending_since = uv_now(&_self->loop);
+    req->qry = &qry->qry;
+    _ll_append(client->pending, &qry->qry);
+
+    int ret = _handle_pending_quic(client);
+    if (qry->stream == NULL) {
+        req->stats->conn_queued++;
+        self->stats_sum->conn_queued++;
+    }
+    return ret;
+}
+
+static void _close_query_quic(_output_dnssim_query_quic_t* qry)
+{
+    _output_dnssim_request_t* req = qry->qry.req;
+    mlassert(req, "query must be part of a request");
+
+    _ll_try_remove(_conn_client(req)->pending, &qry->qry);
+
+    _output_dnssim_quic_stream_t* s = qry->stream;
+    if (s != NULL) {
+        _output_dnssim_quic_conn_t* qc = s->conn;
+        s->qry = NULL;
+        qry->stream = NULL;
+        qc->inflight--;
+
+        /* ngtcp2 can't be called while it's processing a packet. */
+        if (!s->is_fin_received && qc->state == _OUTPUT_DNSSIM_QUIC_ACTIVE) {
+            if (qc->is_reading) {
+                s->needs_reset = true;
+            } else {
+                ngtcp2_conn_shutdown_stream(qc->conn, 0, s->id, _OUTPUT_DNSSIM_DOQ_REQUEST_CANCELLED);
+                _send_pending_quic(qc);
+                _write_quic(qc);
+            }
+        }
+    }
+
+    _ll_remove(req->qry, &qry->qry);
+    free(qry);
+}
+
+static void _free_client_quic(_output_dnssim_client_t* client)
+{
+    gnutls_free(client->quic_ticket.data);
+    client->quic_ticket.data = NULL;
+    free(client->quic_params);
+    client->quic_params = NULL;
+}
+
+#endif
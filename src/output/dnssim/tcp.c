@@ -18,52 +18,91 @@
  * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Client whose connections are used to send the request's TCP queries. */
+static _output_dnssim_client_t* _conn_client(_output_dnssim_request_t* req)
+{
+    if (req->dnssim->share_conns)
+        return &req->client->target->shared_client;
+    return req->client;
+}
+
+static bool _conn_has_capacity(_output_dnssim_connection_t* conn)
+{
+    size_t max = conn->client->dnssim->max_conn_inflight;
+    return max == 0 || conn->inflight < max;
+}
+
 static void _maybe_free_connection(_output_dnssim_connection_t* conn)
 {
     mlassert(conn, "conn can't be nil");
     mlassert(conn->client, "conn must belong to a client");
-    if (conn->handle == NULL && conn->handshake_timer == NULL && conn->idle_timer == NULL) {
+    if (conn->handle == NULL && conn->handshake_timer == NULL && conn->idle_timer == NULL &&
+        conn->tcpi_timer == NULL) {
         _ll_remove(conn->client->conn, conn);
         free(conn);
     }
 }
 
-static void _move_queries_to_pending(_output_dnssim_query_tcp_t* qry)
+static void _move_queries_to_orphans(_output_dnssim_query_tcp_t* qry)
 {
     _output_dnssim_query_tcp_t* qry_tmp;
     while (qry != NULL) {
         mlassert(qry->conn, "query must be associated with conn");
         mlassert(qry->conn->state == _OUTPUT_DNSSIM_CONN_CLOSED, "conn must be closed");
         mlassert(qry->conn->client, "conn must be associated with client");
+        _output_dnssim_client_t* client = qry->conn->client;
         qry_tmp = (_output_dnssim_query_tcp_t*)qry->qry.next;
         qry->qry.next = NULL;
-        _ll_append(qry->conn->client->pending, &qry->qry);
+        if (client->orphans_tail == NULL)
+            client->orphans = &qry->qry;
+        else
+            client->orphans_tail->next = &qry->qry;
+        client->orphans_tail = &qry->qry;
+        qry->pending_since = uv_now(&((_output_dnssim_t*)client->dnssim)->loop);
         qry->conn = NULL;
         qry->qry.state = _OUTPUT_DNSSIM_QUERY_ORPHANED;
         qry = qry_tmp;
     }
 }
 
+/* Orphans time out in the order they were queued, so the query is usually
+ * found at the head. */
+static void _remove_orphan(_output_dnssim_client_t* client, _output_dnssim_query_t* qry)
+{
+    _output_dnssim_query_t* prev = NULL;
+    _output_dnssim_query_t* current = client->orphans;
+
+    while (current != NULL && current != qry) {
+        prev = current;
+        current = current->next;
+    }
+    if (current == NULL)
+        return;
+
+    if (prev == NULL)
+        client->orphans = qry->next;
+    else
+        prev->next = qry->next;
+    if (client->orphans_tail == qry)
+        client->orphans_tail = prev;
+    qry->next = NULL;
+}
+
 static void _on_tcp_handle_closed(uv_handle_t* handle)
 {
     _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
     conn->state = _OUTPUT_DNSSIM_CONN_CLOSED;
 
     /* Orphan any queries that are still unresolved. */
-    _move_queries_to_pending((_output_dnssim_query_tcp_t*)conn->queued);
+    _move_queries_to_orphans((_output_dnssim_query_tcp_t*)conn->queued);
     conn->queued = NULL;
-    _move_queries_to_pending((_output_dnssim_query_tcp_t*)conn->sent);
+    _move_queries_to_orphans((_output_dnssim_query_tcp_t*)conn->sent);
     conn->sent = NULL;
+    conn->inflight = 0;
 
-    /* TODO Improve client re-connect behavior in case the connection fails to
-     * establish. Currently, queries are orphaned and attempted to be re-sent
-     * along with the next query that triggers a new connection.
-     *
-     * Attempting to establish new connection immediately leads to performance
-     * issues if the number of these attempts doesn't have upper limit. */
-    ///* Ensure orhpaned queries are re-sent over a different connection. */
-    //if (_handle_pending_queries(conn->client) != 0)
-    //    mlinfo("tcp: orphaned queries failed to be re-sent");
+    /* Orphaned queries aren't re-sent over a different connection, they
+     * wait in the client's orphans until they time out. Re-sending them
+     * right away would retry a failing server without any upper limit. */
 
     mlassert(conn->handle, "conn must have tcp handle when closing it");
     free(conn->handle);
@@ -90,6 +129,15 @@ static void _on_idle_timer_closed(uv_handle_t* handle)
     _maybe_free_connection(conn);
 }
 
+static void _on_tcpi_timer_closed(uv_handle_t* handle)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+    mlassert(conn->tcpi_timer, "conn must have tcpi timer when closing it");
+    free(conn->tcpi_timer);
+    conn->tcpi_timer = NULL;
+    _maybe_free_connection(conn);
+}
+
 static void _on_tcp_query_written(uv_write_t* wr_req, int status)
 {
     _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)wr_req->data;
@@ -128,6 +176,62 @@ static void _on_tcp_query_written(uv_write_t* wr_req, int status)
     }
 }
 
+static size_t _tcpi_bucket(uint64_t value)
+{
+    size_t i = 0;
+    while (value > 0 && i < OUTPUT_DNSSIM_TCPI_BUCKETS - 1) {
+        value >>= 1;
+        i++;
+    }
+    return i;
+}
+
+static void _record_tcp_info(output_dnssim_stats_t* stats, uint32_t retrans, uint32_t rtt_us,
+    uint32_t cwnd, uint64_t sndq, uint64_t writeq)
+{
+    stats->tcpi_samples++;
+    stats->tcpi_retrans += retrans;
+    stats->tcpi_rtt_us[_tcpi_bucket(rtt_us)]++;
+    stats->tcpi_cwnd[_tcpi_bucket(cwnd)]++;
+    stats->tcpi_sndq[_tcpi_bucket(sndq)]++;
+    stats->tcpi_writeq[_tcpi_bucket(writeq)]++;
+}
+
+/* Sample the connection's TCP_INFO, every tcp_info_interval_ms while it's
+ * active. Growing write queue points to backpressure in dnssim itself,
+ * growing send queue with retransmits to the network and high RTT with an
+ * empty send queue to the server. */
+static void _on_tcpi_timer(uv_timer_t* handle)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+    output_dnssim_t* self = conn->client->dnssim;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    uv_os_fd_t fd;
+    int sndq = 0;
+
+    if (conn->state != _OUTPUT_DNSSIM_CONN_ACTIVE)
+        return;
+
+    if (uv_fileno((uv_handle_t*)conn->handle, &fd) != 0)
+        return;
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        mldebug("tcp getsockopt(TCP_INFO) failed: %s", core_log_errstr(errno));
+        return;
+    }
+    if (ioctl(fd, SIOCOUTQ, &sndq) != 0)
+        sndq = 0;
+
+    uint32_t retrans = info.tcpi_total_retrans - conn->tcpi_total_retrans;
+    conn->tcpi_total_retrans = info.tcpi_total_retrans;
+    uint64_t writeq = uv_stream_get_write_queue_size((uv_stream_t*)conn->handle);
+
+    _record_tcp_info(self->stats_current, retrans, info.tcpi_rtt, info.tcpi_snd_cwnd, sndq, writeq);
+    _record_tcp_info(self->stats_sum, retrans, info.tcpi_rtt, info.tcpi_snd_cwnd, sndq, writeq);
+#endif
+}
+
 static void _write_tcp_query(_output_dnssim_query_tcp_t* qry, _output_dnssim_connection_t* conn)
 {
     mlassert(qry, "qry can't be null");
@@ -142,6 +246,14 @@ static void _write_tcp_query(_output_dnssim_query_tcp_t* qry, _output_dnssim_con
 
     mldebug("tcp write dnsmsg id: %04x", qry->qry.req->dns_q->id);
 
+    /* Track the time the query spent waiting for a connection. */
+    output_dnssim_t* self = conn->client->dnssim;
+    uint64_t wait = uv_now(&_self->loop) - qry->pending_since;
+    if (wait > self->timeout_ms)
+        wait = self->timeout_ms;
+    qry->qry.req->stats->conn_queue_wait[wait]++;
+    self->stats_sum->conn_queue_wait[wait]++;
+
     core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
     uint16_t* len;
     mlfatal_oom(len = malloc(sizeof(uint16_t)));
@@ -150,6 +262,7 @@ static void _write_tcp_query(_output_dnssim_query_tcp_t* qry, _output_dnssim_con
     qry->bufs[1] = uv_buf_init((char*)payload->payload, payload->len);
 
     qry->conn = conn;
+    conn->inflight++;
     _ll_remove(conn->client->pending, &qry->qry);
     _ll_append(conn->queued, &qry->qry);
 
@@ -162,18 +275,16 @@ static void _write_tcp_query(_output_dnssim_query_tcp_t* qry, _output_dnssim_con
     qry->write_req.data = (void*)qry;
     uv_write(&qry->write_req, (uv_stream_t*)conn->handle, qry->bufs, 2, _on_tcp_query_written);
     qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE_CB;
+    _request_sent(qry->qry.req);
 }
 
+/* Pending queries are sent in order, taken from the head of the list. */
 static void _send_pending_queries(_output_dnssim_connection_t* conn)
 {
-    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)conn->client->pending;
+    _output_dnssim_query_tcp_t* qry;
 
-    while (qry != NULL) {
-        _output_dnssim_query_tcp_t* next = (_output_dnssim_query_tcp_t*)qry->qry.next;
-        if (qry->qry.state == _OUTPUT_DNSSIM_QUERY_PENDING_WRITE)
-            _write_tcp_query(qry, conn);
-        qry = next;
-    }
+    while ((qry = (_output_dnssim_query_tcp_t*)conn->client->pending) != NULL && _conn_has_capacity(conn))
+        _write_tcp_query(qry, conn);
 }
 
 int _process_tcp_dnsmsg(_output_dnssim_connection_t* conn)
@@ -349,7 +460,18 @@ static void _on_tcp_handle_connected(uv_connect_t* conn_req, int status)
     conn->recv_pos = 0;
     conn->recv_free_after_use = false;
 
-    _send_pending_queries(conn);
+    /* Sampling doesn't keep the loop running, the connection does. */
+    output_dnssim_t* self = conn->client->dnssim;
+    if (self->tcp_info_interval_ms > 0) {
+        lfatal_oom(conn->tcpi_timer = malloc(sizeof(uv_timer_t)));
+        uv_timer_init(&_self->loop, conn->tcpi_timer);
+        conn->tcpi_timer->data = (void*)conn;
+        uv_timer_start(conn->tcpi_timer, _on_tcpi_timer, self->tcp_info_interval_ms, self->tcp_info_interval_ms);
+        uv_unref((uv_handle_t*)conn->tcpi_timer);
+    }
+
+    if (_handle_pending_queries(conn->client) != 0)
+        mlinfo("tcp: pending queries failed to be sent");
     _maybe_close_connection(conn);
 }
 
@@ -372,14 +494,18 @@ static void _close_connection(_output_dnssim_connection_t* conn)
 {
     mlassert(conn, "conn can't be nil");
     mlassert(conn->stats, "conn must have stats");
+    output_dnssim_t* self = conn->client->dnssim;
 
     switch(conn->state) {
     case _OUTPUT_DNSSIM_CONN_CLOSING:
     case _OUTPUT_DNSSIM_CONN_CLOSED:
         return;
     case _OUTPUT_DNSSIM_CONN_CONNECTING:
+        /* Handshakes cut short by stopping the loop thread didn't fail. */
+        if (_self->is_stats_finished)
+            break;
         conn->stats->conn_handshakes_failed++;
-        conn->client->dnssim->stats_sum->conn_handshakes_failed++;
+        self->stats_sum->conn_handshakes_failed++;
         break;
     case _OUTPUT_DNSSIM_CONN_ACTIVE:
         conn->client->dnssim->stats_current->conn_active--;
@@ -398,12 +524,29 @@ static void _close_connection(_output_dnssim_connection_t* conn)
         uv_timer_stop(conn->idle_timer);
         uv_close((uv_handle_t*)conn->idle_timer, _on_idle_timer_closed);
     }
+    if (conn->tcpi_timer != NULL) {
+        uv_timer_stop(conn->tcpi_timer);
+        uv_close((uv_handle_t*)conn->tcpi_timer, _on_tcpi_timer_closed);
+    }
     if (conn->handle != NULL) {
         uv_read_stop((uv_stream_t*)conn->handle);
         uv_close((uv_handle_t*)conn->handle, _on_tcp_handle_closed);
     }
 }
 
+/* Close the connections without any queries right away instead of waiting
+ * for their idle timers, e.g. when the event loop thread stops. */
+static void _close_idle_connections(_output_dnssim_client_t* client)
+{
+    _output_dnssim_connection_t* conn = client->conn;
+    while (conn != NULL) {
+        _output_dnssim_connection_t* next = conn->next;
+        if (conn->queued == NULL && conn->sent == NULL)
+            _close_connection(conn);
+        conn = next;
+    }
+}
+
 static void _on_connection_timeout(uv_timer_t* handle)
 {
     _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
@@ -421,13 +564,14 @@ static int _connect_tcp_handle(output_dnssim_t* self, _output_dnssim_connection_
 
     lfatal_oom(conn->handle = malloc(sizeof(uv_tcp_t)));
     conn->handle->data = (void*)conn;
-    int ret = uv_tcp_init(&_self->loop, conn->handle);
+    mlassert(conn->client->target, "client must have a target");
+    int ret = uv_tcp_init_ex(&_self->loop, conn->handle, conn->client->target->addr.ss_family);
     if (ret < 0) {
         lwarning("failed to init uv_tcp_t");
         goto failure;
     }
 
-    ret = _bind_before_connect(self, (uv_handle_t*)conn->handle);
+    ret = _bind_before_connect(self, (uv_handle_t*)conn->handle, conn->client, conn->stats);
     if (ret < 0)
         goto failure;
 
@@ -455,9 +599,16 @@ static int _connect_tcp_handle(output_dnssim_t* self, _output_dnssim_connection_
 
     uv_connect_t* conn_req;
     lfatal_oom(conn_req = malloc(sizeof(uv_connect_t)));
-    ret = uv_tcp_connect(conn_req, conn->handle, (struct sockaddr*)&_self->target, _on_tcp_handle_connected);
-    if (ret < 0)
+    ret = uv_tcp_connect(conn_req, conn->handle, (struct sockaddr*)&conn->client->target->addr, _on_tcp_handle_connected);
+    if (ret < 0) {
+        free(conn_req);
+        if (ret == UV_EADDRNOTAVAIL) {
+            conn->stats->port_exhausted++;
+            self->stats_sum->port_exhausted++;
+        }
+        lwarning("tcp: failed to connect: %s", uv_strerror(ret));
         goto failure;
+    }
 
     conn->stats->conn_handshakes++;
     conn->client->dnssim->stats_sum->conn_handshakes++;
@@ -468,6 +619,23 @@ failure:
     return ret;
 }
 
+static int _open_connection(_output_dnssim_client_t* client)
+{
+    mlassert(client, "client can't be nil");
+    mlassert(client->dnssim, "client must belong to dnssim");
+    output_dnssim_t* self = client->dnssim;
+
+    _output_dnssim_connection_t* conn;
+
+    lfatal_oom(conn = calloc(1, sizeof(_output_dnssim_connection_t)));
+    conn->state = _OUTPUT_DNSSIM_CONN_INITIALIZED;
+    conn->client = client;
+    conn->stats = self->stats_current;
+    _ll_append(client->conn, conn);
+
+    return _connect_tcp_handle(self, conn);
+}
+
 static int _handle_pending_queries(_output_dnssim_client_t* client)
 {
     int ret = 0;
@@ -479,31 +647,43 @@ static int _handle_pending_queries(_output_dnssim_client_t* client)
     output_dnssim_t* self = client->dnssim;
     mlassert_self();
 
-    /* Get active TCP connection or find out whether new connection has to be opened. */
-    bool is_connecting = false;
-    _output_dnssim_connection_t *conn = client->conn;
+    /* Send data right away over active connections with free capacity and
+     * find out whether new connection has to be opened. */
+    size_t n_open = 0;
+    size_t n_connecting = 0;
+    _output_dnssim_connection_t* conn = client->conn;
     while (conn != NULL) {
-        if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE)
-            break;
-        else if (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING)
-            is_connecting = true;
-        conn = conn->next;
-    }
-
-    if (conn != NULL) {  /* Send data right away over active connection. */
-        _send_pending_queries(conn);
-    } else if (!is_connecting) {  /* No active or connecting connection -> open a new one. */
-        lfatal_oom(conn = calloc(1, sizeof(_output_dnssim_connection_t)));
-        conn->state = _OUTPUT_DNSSIM_CONN_INITIALIZED;
-        conn->client = client;
-        conn->stats = self->stats_current;
-        ret = _connect_tcp_handle(self, conn);
-        if (ret < 0)
-            return ret;
-        _ll_append(client->conn, conn);
-    } /* Otherwise, pending queries wil be sent after connected callback. */
+        _output_dnssim_connection_t* next = conn->next;
+        if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE) {
+            n_open++;
+            if (client->pending != NULL && _conn_has_capacity(conn))
+                _send_pending_queries(conn);
+        } else if (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING) {
+            n_open++;
+            n_connecting++;
+        }
+        conn = next;
+    }
+    if (client->pending == NULL)
+        return ret;
 
-    return ret;
+    /* Open a new connection unless the connections being established can
+     * take all the pending queries, or the limit of connections is reached.
+     * Otherwise, pending queries wil be sent after connected callback or
+     * once there is free capacity on one of the connections. Orphaned
+     * queries are kept apart and not re-sent, so they don't call for new
+     * connections. Pending queries are only counted up to the capacity. */
+    size_t n_pending = 0;
+    size_t n_capacity = n_connecting * self->max_conn_inflight;
+    _output_dnssim_query_t* qry;
+    for (qry = client->pending; qry != NULL && n_pending <= n_capacity; qry = qry->next)
+        n_pending++;
+    if (n_connecting > 0 && (self->max_conn_inflight == 0 || n_pending <= n_capacity))
+        return ret;
+    if (self->max_client_conns > 0 && n_open >= self->max_client_conns)
+        return ret;
+
+    return _open_connection(client);
 }
 
 static int _create_query_tcp(output_dnssim_t* self, _output_dnssim_request_t* req)
@@ -511,20 +691,24 @@ static int _create_query_tcp(output_dnssim_t* self, _output_dnssim_request_t* re
     mlassert_self();
     lassert(req->client, "request must have a client associated with it");
 
-    int ret;
     _output_dnssim_query_tcp_t* qry;
-    _output_dnssim_connection_t* conn;
-    core_object_payload_t* payload = (core_object_payload_t*)req->dns_q->obj_prev;
+    _output_dnssim_client_t* client = _conn_client(req);
 
     lfatal_oom(qry = calloc(1, sizeof(_output_dnssim_query_tcp_t)));
 
     qry->qry.transport = OUTPUT_DNSSIM_TRANSPORT_TCP;
     qry->qry.req = req;
     qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE;
+    qry->pending_since = uv_now(&_self->loop);
     req->qry = &qry->qry;  // TODO change when adding support for multiple Qs for req
-    _ll_append(req->client->pending, &qry->qry);
+    _ll_append(client->pending, &qry->qry);
 
-    return _handle_pending_queries(req->client);
+    int ret = _handle_pending_queries(client);
+    if (qry->conn == NULL) {
+        req->stats->conn_queued++;
+        self->stats_sum->conn_queued++;
+    }
+    return ret;
 }
 
 static void _close_query_tcp(_output_dnssim_query_tcp_t* qry)
@@ -541,12 +725,22 @@ static void _close_query_tcp(_output_dnssim_query_tcp_t* qry)
         return;
     }
 
-    _ll_try_remove(req->client->pending, &qry->qry);
+    if (qry->qry.state == _OUTPUT_DNSSIM_QUERY_ORPHANED)
+        _remove_orphan(_conn_client(req), &qry->qry);
+    else
+        _ll_try_remove(_conn_client(req)->pending, &qry->qry);
     if (qry->conn) {
         _output_dnssim_connection_t* conn = qry->conn;
         _ll_try_remove(conn->queued, &qry->qry);  /* edge-case of cancelled queries */
         _ll_try_remove(conn->sent, &qry->qry);
         qry->conn = NULL;
+        conn->inflight--;
+
+        /* Freed capacity may be used by queries waiting for a connection. */
+        if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE && conn->client->pending != NULL) {
+            if (_handle_pending_queries(conn->client) != 0)
+                mlinfo("tcp: pending queries failed to be sent");
+        }
         _maybe_close_connection(conn);
     }
 
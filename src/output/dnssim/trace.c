@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Per-request trace records are collected into fixed-size buffers, which are
+ * written to file by a background thread so the event loop never blocks on
+ * disk I/O (unless all buffers are full). */
+
+static void* _trace_writer(void* arg)
+{
+    _output_dnssim_trace_t* trace = (_output_dnssim_trace_t*)arg;
+    _output_dnssim_trace_buf_t* buf;
+
+    pthread_mutex_lock(&trace->lock);
+    for (;;) {
+        buf = &trace->bufs[trace->wr];
+        while (!buf->is_full && !trace->is_closing)
+            pthread_cond_wait(&trace->cond, &trace->lock);
+        if (!buf->is_full)
+            break; /* Closing and no more data. */
+        pthread_mutex_unlock(&trace->lock);
+
+        size_t len = buf->len * sizeof(output_dnssim_trace_record_t);
+        const char* data = (const char*)buf->records;
+        while (len > 0) {
+            ssize_t ret = write(trace->fd, data, len);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                mlcritical("trace: write() error %s", core_log_errstr(errno));
+                break;
+            }
+            data += ret;
+            len -= ret;
+        }
+
+        pthread_mutex_lock(&trace->lock);
+        buf->len = 0;
+        buf->is_full = false;
+        trace->wr = (trace->wr + 1) % _OUTPUT_DNSSIM_TRACE_BUFS;
+        pthread_cond_broadcast(&trace->cond);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    return NULL;
+}
+
+/* Hand the current buffer over to the writer and move on to the next one. */
+static void _trace_flush(_output_dnssim_trace_t* trace)
+{
+    pthread_mutex_lock(&trace->lock);
+    trace->bufs[trace->cur].is_full = true;
+    trace->cur = (trace->cur + 1) % _OUTPUT_DNSSIM_TRACE_BUFS;
+    pthread_cond_broadcast(&trace->cond);
+    while (trace->bufs[trace->cur].is_full)
+        pthread_cond_wait(&trace->cond, &trace->lock);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+static void _trace_request(_output_dnssim_request_t* req)
+{
+    _output_dnssim_t* dnssim = (_output_dnssim_t*)req->dnssim;
+    _output_dnssim_trace_t* trace = dnssim->trace;
+    _output_dnssim_trace_buf_t* buf = &trace->bufs[trace->cur];
+    output_dnssim_trace_record_t* rec = &buf->records[buf->len];
+
+    rec->intended_ns = req->intended_ns;
+    rec->sent_ns = req->sent_ns;
+    rec->queue_wait_ns = req->sent_ns != 0 ? req->sent_ns - req->created_ns : 0;
+    rec->completed_ns = uv_hrtime();
+    rec->client = req->client->id;
+    rec->rcode = req->rcode;
+    rec->transport = req->qry != NULL ? req->qry->transport : dnssim->transport;
+    rec->flags = 0;
+    if (req->is_answered)
+        rec->flags |= OUTPUT_DNSSIM_TRACE_ANSWERED;
+    if (req->is_fallback)
+        rec->flags |= OUTPUT_DNSSIM_TRACE_FALLBACK;
+
+    if (++buf->len == _OUTPUT_DNSSIM_TRACE_BUF_LEN)
+        _trace_flush(trace);
+}
+
+/* Time when the packet should have been sent according to its PCAP timestamp. */
+static uint64_t _trace_intended_ns(_output_dnssim_trace_t* trace, const core_object_t* obj)
+{
+    const core_object_pcap_t* pcap;
+    uint64_t pcap_ns, now_ns = uv_hrtime();
+
+    if (trace->time_mul <= 0)
+        return now_ns;
+
+    while (obj != NULL && obj->obj_type != CORE_OBJECT_PCAP)
+        obj = obj->obj_prev;
+    if (obj == NULL)
+        return now_ns;
+    pcap = (const core_object_pcap_t*)obj;
+    pcap_ns = (uint64_t)pcap->ts.sec * 1000000000 + pcap->ts.nsec;
+
+    if (!trace->has_base) {
+        trace->has_base = true;
+        trace->base_pcap_ns = pcap_ns;
+        trace->base_mono_ns = now_ns;
+    }
+    if (pcap_ns < trace->base_pcap_ns)
+        return trace->base_mono_ns;
+
+    return trace->base_mono_ns + (uint64_t)((double)(pcap_ns - trace->base_pcap_ns) * trace->time_mul);
+}
+
+static int _trace_open(output_dnssim_t* self, const char* file)
+{
+    mlassert_self();
+    _output_dnssim_trace_t* trace;
+    output_dnssim_trace_header_t hdr = {
+        { 'D', 'N', 'S', 'S', 'I', 'M', 'T', 'R' },
+        OUTPUT_DNSSIM_TRACE_VERSION,
+        sizeof(output_dnssim_trace_record_t)
+    };
+    int err;
+
+    lfatal_oom(trace = calloc(1, sizeof(_output_dnssim_trace_t)));
+    if ((trace->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        lcritical("trace: open(%s) error %s", file, core_log_errstr(errno));
+        free(trace);
+        return -1;
+    }
+    if (write(trace->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        lcritical("trace: failed to write header to %s", file);
+        close(trace->fd);
+        free(trace);
+        return -1;
+    }
+
+    for (int i = 0; i < _OUTPUT_DNSSIM_TRACE_BUFS; ++i) {
+        lfatal_oom(trace->bufs[i].records = malloc(
+            _OUTPUT_DNSSIM_TRACE_BUF_LEN * sizeof(output_dnssim_trace_record_t)));
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->cond, NULL);
+
+    if ((err = pthread_create(&trace->thread, NULL, _trace_writer, (void*)trace))) {
+        lcritical("trace: pthread_create() error: %s", core_log_errstr(err));
+        close(trace->fd);
+        for (int i = 0; i < _OUTPUT_DNSSIM_TRACE_BUFS; ++i)
+            free(trace->bufs[i].records);
+        free(trace);
+        return -1;
+    }
+
+    _self->trace = trace;
+    return 0;
+}
+
+static void _trace_close(output_dnssim_t* self)
+{
+    mlassert_self();
+    _output_dnssim_trace_t* trace = _self->trace;
+    if (trace == NULL)
+        return;
+
+    if (trace->bufs[trace->cur].len > 0)
+        _trace_flush(trace);
+
+    pthread_mutex_lock(&trace->lock);
+    trace->is_closing = true;
+    pthread_cond_broadcast(&trace->cond);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->thread, NULL);
+
+    close(trace->fd);
+    pthread_mutex_destroy(&trace->lock);
+    pthread_cond_destroy(&trace->cond);
+    for (int i = 0; i < _OUTPUT_DNSSIM_TRACE_BUFS; ++i)
+        free(trace->bufs[i].records);
+    free(trace);
+    _self->trace = NULL;
+}
@@ -22,6 +22,9 @@ static int _process_udp_response(uv_udp_t* handle, ssize_t nread, const uv_buf_t
 {
     _output_dnssim_query_udp_t* qry = (_output_dnssim_query_udp_t*)handle->data;
     _output_dnssim_request_t* req = qry->qry.req;
+    if (req == NULL)
+        return 0;
+
     core_object_payload_t payload = CORE_OBJECT_PAYLOAD_INIT(NULL);
     core_object_dns_t dns_a = CORE_OBJECT_DNS_INIT(&payload);
 
@@ -47,14 +50,45 @@ static int _process_udp_response(uv_udp_t* handle, ssize_t nread, const uv_buf_t
     return 0;
 }
 
+/* Retry the request over TCP, like a real client would after getting TC=1. */
+static void _fallback_to_tcp(_output_dnssim_query_udp_t* qry)
+{
+    _output_dnssim_request_t* req = qry->qry.req;
+    output_dnssim_t* self = req->dnssim;
+    mlassert_self();
+
+    /* Detach the UDP query from request, since request can only have
+     * a single query at a time. */
+    _ll_remove(req->qry, &qry->qry);
+    qry->qry.req = NULL;
+    _close_query_udp(qry);
+
+    req->is_fallback = true;
+    req->fallback_at = uv_now(&_self->loop);
+    req->stats->fallback_tcp++;
+    self->stats_sum->fallback_tcp++;
+
+    int ret = _create_query_tcp(self, req);
+    if (ret < 0) {
+        ldebug("udp: failed to fall back to tcp: %s", uv_strerror(ret));
+        _close_request(req);
+    }
+}
+
 static void _on_udp_query_recv(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf,
     const struct sockaddr* addr, unsigned flags)
 {
+    _output_dnssim_query_udp_t* qry = (_output_dnssim_query_udp_t*)handle->data;
+
     if (nread > 0) {
         mldebug("udp recv: %d", nread);
 
-        // TODO handle TC=1
-        _process_udp_response(handle, nread, buf);
+        int ret = _process_udp_response(handle, nread, buf);
+        if (ret == _ERR_TC && qry->qry.req != NULL) {
+            _output_dnssim_t* dnssim = (_output_dnssim_t*)qry->qry.req->dnssim;
+            if (dnssim->transport == OUTPUT_DNSSIM_TRANSPORT_UDP)
+                _fallback_to_tcp(qry);
+        }
     }
 
     if (buf->base != NULL) {
@@ -69,6 +103,12 @@ static void _on_query_udp_closed(uv_handle_t* handle)
 
     free(qry->handle);
 
+    /* Query may have been detached from request (TCP fallback). */
+    if (req == NULL) {
+        free(qry);
+        return;
+    }
+
     _ll_remove(req->qry, &qry->qry);
     free(qry);
 
@@ -103,28 +143,29 @@ static int _create_query_udp(output_dnssim_t* self, _output_dnssim_request_t* re
     qry->qry.req = req;
     qry->buf = uv_buf_init((char*)payload->payload, payload->len);
     qry->handle->data = (void*)qry;
-    ret = uv_udp_init(&_self->loop, qry->handle);
+    ret = uv_udp_init_ex(&_self->loop, qry->handle, req->client->target->addr.ss_family);
     if (ret < 0) {
         lwarning("failed to init uv_udp_t");
         goto failure;
     }
     _ll_append(req->qry, &qry->qry);
 
-    ret = _bind_before_connect(self, (uv_handle_t*)qry->handle);
+    ret = _bind_before_connect(self, (uv_handle_t*)qry->handle, req->client, req->stats);
     if (ret < 0)
         return ret;
 
-    ret = uv_udp_try_send(qry->handle, &qry->buf, 1, (struct sockaddr*)&_self->target);
+    ret = uv_udp_try_send(qry->handle, &qry->buf, 1, (struct sockaddr*)&req->client->target->addr);
     if (ret < 0) {
         lwarning("failed to send udp packet: %s", uv_strerror(ret));
         return ret;
     }
+    _request_sent(req);
 
-    // TODO IPv4
-    struct sockaddr_in6 src;
+    struct sockaddr_storage src;
     int addr_len = sizeof(src);
     uv_udp_getsockname(qry->handle, (struct sockaddr*)&src, &addr_len);
-    ldebug("sent udp from port: %d", ntohs(src.sin6_port));
+    ldebug("sent udp from port: %d", ntohs(src.ss_family == AF_INET6 ?
+        ((struct sockaddr_in6*)&src)->sin6_port : ((struct sockaddr_in*)&src)->sin_port));
 
     // listen for reply
     ret = uv_udp_recv_start(qry->handle, _on_uv_alloc, _on_udp_query_recv);
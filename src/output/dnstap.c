@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/dnstap.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define FSTRM_CONTROL_ACCEPT 0x01
+#define FSTRM_CONTROL_START 0x02
+#define FSTRM_CONTROL_STOP 0x03
+#define FSTRM_CONTROL_READY 0x04
+#define FSTRM_CONTROL_FINISH 0x05
+#define FSTRM_FIELD_CONTENT_TYPE 0x01
+#define FSTRM_MAX_CONTROL 512
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+#define DNSTAP_TYPE_MESSAGE 1
+
+/* Room for two DNS messages and everything else of a Message. */
+#define SCRATCH_SIZE (2 * 65536 + 256)
+#define MIN_BUF_SIZE (SCRATCH_SIZE + 1024)
+
+static core_log_t      _log      = LOG_T_INIT("output.dnstap");
+static output_dnstap_t _defaults = {
+    LOG_T_INIT_OBJ("output.dnstap"),
+    5, 0, 0, 0,
+    0, 0, 0, 0,
+    0, -1, 0, 0, 0, 0, 0,
+    1024 * 1024, 4, 0,
+    0,
+    0, 0, 0,
+    0, 1000, 0,
+    0,
+    0,
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    0, 0,
+    0, 0,
+    0, 0, 0, 0
+};
+
+core_log_t* output_dnstap_log()
+{
+    return &_log;
+}
+
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void output_dnstap_init(output_dnstap_t* self)
+{
+    mlassert_self();
+
+    *self = _defaults;
+
+    lfatal_oom(self->scratch = malloc(SCRATCH_SIZE));
+}
+
+static void _free_pending(output_dnstap_t* self)
+{
+    size_t i;
+
+    for (i = 0; i < self->n_pending; i++) {
+        free(self->pending[i].msg);
+    }
+    free(self->pending);
+    self->pending   = 0;
+    self->n_pending = 0;
+}
+
+static void _free_bufs(output_dnstap_buf_t* buf)
+{
+    output_dnstap_buf_t* next;
+
+    while (buf) {
+        next = buf->next;
+        free(buf->data);
+        free(buf);
+        buf = next;
+    }
+}
+
+void output_dnstap_destroy(output_dnstap_t* self)
+{
+    mlassert_self();
+
+    output_dnstap_close(self);
+
+    _free_pending(self);
+    _free_bufs(self->cur);
+    _free_bufs(self->free_bufs);
+    free(self->scratch);
+    free(self->identity);
+    free(self->version);
+    free(self->path);
+}
+
+void output_dnstap_identity(output_dnstap_t* self, const char* identity, const char* version)
+{
+    mlassert_self();
+
+    free(self->identity);
+    free(self->version);
+    self->identity     = 0;
+    self->version      = 0;
+    self->identity_len = 0;
+    self->version_len  = 0;
+
+    if (identity) {
+        lfatal_oom(self->identity = strdup(identity));
+        self->identity_len = strlen(identity);
+    }
+    if (version) {
+        lfatal_oom(self->version = strdup(version));
+        self->version_len = strlen(version);
+    }
+}
+
+void output_dnstap_pairs(output_dnstap_t* self, size_t slots)
+{
+    mlassert_self();
+
+    if (self->is_running) {
+        lfatal("pairing must be set before opening output");
+    }
+
+    _free_pending(self);
+    if (slots) {
+        lfatal_oom(self->pending = calloc(slots, sizeof(output_dnstap_query_t)));
+        self->n_pending = slots;
+    }
+    self->pairs = slots ? 1 : 0;
+}
+
+/*
+ * Frame Streams
+ */
+
+static int _write_all(output_dnstap_t* self, const uint8_t* data, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if (self->is_socket) {
+            n = send(self->fd, data, len, MSG_NOSIGNAL);
+        } else {
+            n = write(self->fd, data, len);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int _write_control(output_dnstap_t* self, uint32_t type)
+{
+    uint8_t  frame[12 + 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1];
+    uint32_t v[5] = { 0, htonl(4), htonl(type), htonl(FSTRM_FIELD_CONTENT_TYPE), htonl(sizeof(DNSTAP_CONTENT_TYPE) - 1) };
+
+    if (type == FSTRM_CONTROL_READY || type == FSTRM_CONTROL_START) {
+        v[1] = htonl(4 + 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        memcpy(frame, v, 20);
+        memcpy(frame + 20, DNSTAP_CONTENT_TYPE, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        return _write_all(self, frame, sizeof(frame));
+    }
+
+    memcpy(frame, v, 12);
+    return _write_all(self, frame, 12);
+}
+
+/* Read a control frame of the expected type from the socket. */
+static int _read_control(output_dnstap_t* self, uint32_t type)
+{
+    uint8_t  frame[8 + FSTRM_MAX_CONTROL];
+    uint32_t clen;
+    size_t   at = 0, need = 8;
+    ssize_t  n;
+
+    while (at < need) {
+        n = read(self->fd, frame + at, need - at);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        at += n;
+        if (at == 8 && need == 8) {
+            memcpy(&clen, frame + 4, 4);
+            clen = ntohl(clen);
+            if (frame[0] || frame[1] || frame[2] || frame[3] || clen < 4 || clen > FSTRM_MAX_CONTROL) {
+                return -1;
+            }
+            need += clen;
+        }
+    }
+
+    memcpy(&clen, frame + 8, 4);
+    return ntohl(clen) == type ? 0 : -1;
+}
+
+static int _open_file(output_dnstap_t* self)
+{
+    char      name[4096];
+    time_t    now = time(0);
+    struct tm tm;
+    size_t    len;
+
+    if (strchr(self->path, '%')) {
+        localtime_r(&now, &tm);
+        if (!(len = strftime(name, sizeof(name), self->path, &tm))) {
+            lcritical("invalid file name format %s", self->path);
+            return -1;
+        }
+    } else {
+        len = snprintf(name, sizeof(name), "%s", self->path);
+    }
+    if (self->file_seq && len < sizeof(name)) {
+        snprintf(name + len, sizeof(name) - len, ".%zu", self->file_seq);
+    }
+    self->file_seq++;
+
+    if ((self->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        lcritical("open(%s) error %s", name, core_log_errstr(errno));
+        return -1;
+    }
+    if (_write_control(self, FSTRM_CONTROL_START)) {
+        lcritical("write(%s) error %s", name, core_log_errstr(errno));
+        close(self->fd);
+        self->fd = -1;
+        return -1;
+    }
+
+    self->file_bytes  = 0;
+    self->file_opened = now;
+    ldebug("writing to %s", name);
+    return 0;
+}
+
+static void _close_file(output_dnstap_t* self)
+{
+    if (_write_control(self, FSTRM_CONTROL_STOP)) {
+        lwarning("write() error %s", core_log_errstr(errno));
+    }
+    close(self->fd);
+    self->fd = -1;
+}
+
+/*
+ * Writer thread
+ */
+
+static void _write_buf(output_dnstap_t* self, output_dnstap_buf_t* buf)
+{
+    if (self->is_failed) {
+        __sync_fetch_and_add(&self->dropped, 1);
+        return;
+    }
+
+    if (!self->is_socket
+        && ((self->rotate_bytes && self->file_bytes >= self->rotate_bytes)
+               || (self->rotate_secs && (uint64_t)(time(0) - self->file_opened) >= self->rotate_secs))) {
+        _close_file(self);
+        if (_open_file(self)) {
+            self->is_failed = 1;
+            __sync_fetch_and_add(&self->dropped, 1);
+            return;
+        }
+    }
+
+    if (_write_all(self, buf->data, buf->len)) {
+        lcritical("write error %s, dropping further output", core_log_errstr(errno));
+        self->is_failed = 1;
+        __sync_fetch_and_add(&self->dropped, 1);
+        return;
+    }
+    self->file_bytes += buf->len;
+}
+
+static void* _writer(void* arg)
+{
+    output_dnstap_t*     self = (output_dnstap_t*)arg;
+    output_dnstap_buf_t* buf;
+
+    pthread_mutex_lock(&self->lock);
+    for (;;) {
+        while (!self->queue && !self->stop) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        if (!self->queue) {
+            break;
+        }
+
+        buf         = self->queue;
+        self->queue = buf->next;
+        if (!self->queue) {
+            self->queue_last = 0;
+        }
+        self->queued--;
+        pthread_mutex_unlock(&self->lock);
+
+        _write_buf(self, buf);
+
+        pthread_mutex_lock(&self->lock);
+        buf->len        = 0;
+        buf->next       = self->free_bufs;
+        self->free_bufs = buf;
+        pthread_cond_signal(&self->space);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return 0;
+}
+
+static output_dnstap_buf_t* _new_buf(output_dnstap_t* self)
+{
+    output_dnstap_buf_t* buf;
+
+    lfatal_oom(buf = calloc(1, sizeof(output_dnstap_buf_t)));
+    lfatal_oom(buf->data = malloc(self->buf_size));
+    self->bufs++;
+    return buf;
+}
+
+static int _start(output_dnstap_t* self)
+{
+    int err;
+
+    if (self->buf_size < MIN_BUF_SIZE) {
+        self->buf_size = MIN_BUF_SIZE;
+    }
+    if (!self->max_bufs) {
+        self->max_bufs = 1;
+    }
+    if (!self->cur) {
+        self->cur = _new_buf(self);
+    }
+    self->stop      = 0;
+    self->is_failed = 0;
+
+    if ((err = pthread_create(&self->thr_id, 0, _writer, (void*)self))) {
+        lcritical("pthread_create() error %s", core_log_errstr(err));
+        return -1;
+    }
+    self->is_running = 1;
+    return 0;
+}
+
+int output_dnstap_open(output_dnstap_t* self, const char* file)
+{
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (self->is_running) {
+        lfatal("already opened");
+    }
+
+    free(self->path);
+    lfatal_oom(self->path = strdup(file));
+    self->is_socket = 0;
+    self->file_seq  = 0;
+
+    if (_open_file(self)) {
+        return -1;
+    }
+    if (_start(self)) {
+        _close_file(self);
+        return -1;
+    }
+    return 0;
+}
+
+int output_dnstap_connect(output_dnstap_t* self, const char* path)
+{
+    struct sockaddr_un addr;
+    mlassert_self();
+    lassert(path, "path is nil");
+
+    if (self->is_running) {
+        lfatal("already opened");
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        lcritical("socket path too long");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((self->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    self->is_socket = 1;
+    if (connect(self->fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        lcritical("connect(%s) error %s", path, core_log_errstr(errno));
+        goto failure;
+    }
+
+    if (_write_control(self, FSTRM_CONTROL_READY) || _read_control(self, FSTRM_CONTROL_ACCEPT)) {
+        lcritical("Frame Streams handshake with %s failed", path);
+        goto failure;
+    }
+    if (_write_control(self, FSTRM_CONTROL_START)) {
+        lcritical("write(%s) error %s", path, core_log_errstr(errno));
+        goto failure;
+    }
+
+    if (_start(self)) {
+        goto failure;
+    }
+    return 0;
+
+failure:
+    close(self->fd);
+    self->fd = -1;
+    return -1;
+}
+
+/* Hand the current buffer over to the writer thread. */
+static void _flush(output_dnstap_t* self)
+{
+    output_dnstap_buf_t* buf;
+
+    if (!self->cur->len) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (self->queued >= self->max_bufs) {
+        pthread_cond_wait(&self->space, &self->lock);
+    }
+    if (self->queue_last) {
+        self->queue_last->next = self->cur;
+    } else {
+        self->queue = self->cur;
+    }
+    self->queue_last = self->cur;
+    self->cur->next  = 0;
+    self->queued++;
+    pthread_cond_signal(&self->cond);
+
+    if ((buf = self->free_bufs)) {
+        self->free_bufs = buf->next;
+        buf->next       = 0;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    self->cur = buf ? buf : _new_buf(self);
+}
+
+static void _flush_pending(output_dnstap_t* self);
+
+void output_dnstap_flush(output_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (self->is_running) {
+        _flush(self);
+    }
+}
+
+void output_dnstap_close(output_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (!self->is_running) {
+        return;
+    }
+
+    _flush_pending(self);
+    _flush(self);
+
+    pthread_mutex_lock(&self->lock);
+    self->stop = 1;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->thr_id, 0);
+    self->is_running = 0;
+
+    if (self->is_socket) {
+        if (_write_control(self, FSTRM_CONTROL_STOP) || _read_control(self, FSTRM_CONTROL_FINISH)) {
+            lwarning("Frame Streams shutdown failed");
+        }
+        close(self->fd);
+        self->fd = -1;
+    } else {
+        _close_file(self);
+    }
+}
+
+/*
+ * Protocol Buffers
+ */
+
+static inline uint8_t* _pb_varint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline size_t _pb_varint_len(uint64_t v)
+{
+    size_t len = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static inline uint8_t* _pb_uint(uint8_t* p, uint32_t field, uint64_t v)
+{
+    return _pb_varint(_pb_varint(p, field << 3), v);
+}
+
+static inline uint8_t* _pb_fixed32(uint8_t* p, uint32_t field, uint32_t v)
+{
+    p    = _pb_varint(p, field << 3 | 5);
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static inline uint8_t* _pb_bytes(uint8_t* p, uint32_t field, const void* data, size_t len)
+{
+    p = _pb_varint(_pb_varint(p, field << 3 | 2), len);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+typedef struct _message {
+    uint32_t       type;
+    uint8_t        family, protocol;
+    const uint8_t *query_address, *response_address;
+    uint16_t       query_port, response_port;
+    int64_t        query_sec, response_sec;
+    uint32_t       query_nsec, response_nsec;
+    const uint8_t *query, *response;
+    size_t         query_len, response_len;
+} _message_t;
+
+/* Encode the message into a data frame at the end of the current buffer. */
+static void _write_message(output_dnstap_t* self, const _message_t* m)
+{
+    uint8_t *p = self->scratch, *frame;
+    size_t   addr_len = m->family == 2 ? 16 : 4;
+    size_t   msg_len, len;
+
+    p = _pb_uint(p, 1, m->type);
+    p = _pb_uint(p, 2, m->family);
+    p = _pb_uint(p, 3, m->protocol);
+    p = _pb_bytes(p, 4, m->query_address, addr_len);
+    p = _pb_bytes(p, 5, m->response_address, addr_len);
+    p = _pb_uint(p, 6, m->query_port);
+    p = _pb_uint(p, 7, m->response_port);
+    if (m->query) {
+        p = _pb_uint(p, 8, m->query_sec);
+        p = _pb_fixed32(p, 9, m->query_nsec);
+        p = _pb_bytes(p, 10, m->query, m->query_len);
+    }
+    if (m->response) {
+        p = _pb_uint(p, 12, m->response_sec);
+        p = _pb_fixed32(p, 13, m->response_nsec);
+        p = _pb_bytes(p, 14, m->response, m->response_len);
+    }
+    msg_len = p - self->scratch;
+
+    len = 1 + _pb_varint_len(msg_len) + msg_len + 2;
+    if (self->identity) {
+        len += 1 + _pb_varint_len(self->identity_len) + self->identity_len;
+    }
+    if (self->version) {
+        len += 1 + _pb_varint_len(self->version_len) + self->version_len;
+    }
+
+    if (self->buf_size - self->cur->len < 4 + len) {
+        _flush(self);
+        if (self->buf_size < 4 + len) {
+            self->skipped++;
+            return;
+        }
+    }
+    if (!self->cur->len) {
+        self->cur_since_ms = _now_ms();
+    }
+
+    frame    = self->cur->data + self->cur->len;
+    frame[0] = len >> 24;
+    frame[1] = len >> 16;
+    frame[2] = len >> 8;
+    frame[3] = len;
+    p        = frame + 4;
+    if (self->identity) {
+        p = _pb_bytes(p, 1, self->identity, self->identity_len);
+    }
+    if (self->version) {
+        p = _pb_bytes(p, 2, self->version, self->version_len);
+    }
+    p = _pb_bytes(p, 14, self->scratch, msg_len);
+    p = _pb_uint(p, 15, DNSTAP_TYPE_MESSAGE);
+    self->cur->len += p - frame;
+
+    self->messages++;
+
+    if (self->flush_ms && _now_ms() - self->cur_since_ms >= self->flush_ms) {
+        _flush(self);
+    }
+}
+
+/*
+ * Pairing of queries and responses
+ */
+
+static size_t _slot(output_dnstap_t* self, const output_dnstap_query_t* q)
+{
+    uint32_t h = 2166136261;
+    size_t   i;
+
+#define _mix(b) h = (h ^ (b)) * 16777619
+    for (i = 0; i < 16; i++) {
+        _mix(q->src[i]);
+        _mix(q->dst[i]);
+    }
+    _mix(q->sport);
+    _mix(q->sport >> 8);
+    _mix(q->dport);
+    _mix(q->dport >> 8);
+    _mix(q->id);
+    _mix(q->id >> 8);
+#undef _mix
+
+    return h % self->n_pending;
+}
+
+static void _write_query(output_dnstap_t* self, const output_dnstap_query_t* q)
+{
+    _message_t m;
+
+    memset(&m, 0, sizeof(m));
+    m.type             = self->query_type;
+    m.family           = q->family;
+    m.protocol         = q->protocol;
+    m.query_address    = q->src;
+    m.response_address = q->dst;
+    m.query_port       = q->sport;
+    m.response_port    = q->dport;
+    m.query_sec        = q->sec;
+    m.query_nsec       = q->nsec;
+    m.query            = q->msg;
+    m.query_len        = q->len;
+    _write_message(self, &m);
+}
+
+static void _flush_pending(output_dnstap_t* self)
+{
+    size_t i;
+
+    for (i = 0; i < self->n_pending; i++) {
+        if (self->pending[i].msg) {
+            _write_query(self, &self->pending[i]);
+            free(self->pending[i].msg);
+            self->pending[i].msg = 0;
+        }
+    }
+}
+
+/*
+ * Receiver
+ */
+
+static void _receive(output_dnstap_t* self, const core_object_t* obj)
+{
+    const core_object_payload_t* pl   = 0;
+    const core_object_pcap_t*    pcap = 0;
+    output_dnstap_query_t        q;
+    _message_t                   m;
+    int                          have_ip = 0;
+    mlassert_self();
+
+    memset(&q, 0, sizeof(q));
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_PAYLOAD:
+            if (!pl) {
+                pl = (const core_object_payload_t*)obj;
+            }
+            break;
+        case CORE_OBJECT_UDP:
+            if (!q.protocol) {
+                q.protocol = 1;
+                q.sport    = ((const core_object_udp_t*)obj)->sport;
+                q.dport    = ((const core_object_udp_t*)obj)->dport;
+            }
+            break;
+        case CORE_OBJECT_TCP:
+            if (!q.protocol) {
+                q.protocol = 2;
+                q.sport    = ((const core_object_tcp_t*)obj)->sport;
+                q.dport    = ((const core_object_tcp_t*)obj)->dport;
+            }
+            break;
+        case CORE_OBJECT_IP:
+            if (!have_ip) {
+                have_ip  = 1;
+                q.family = 1;
+                memcpy(q.src, ((const core_object_ip_t*)obj)->src, 4);
+                memcpy(q.dst, ((const core_object_ip_t*)obj)->dst, 4);
+            }
+            break;
+        case CORE_OBJECT_IP6:
+            if (!have_ip) {
+                have_ip  = 1;
+                q.family = 2;
+                memcpy(q.src, ((const core_object_ip6_t*)obj)->src, 16);
+                memcpy(q.dst, ((const core_object_ip6_t*)obj)->dst, 16);
+            }
+            break;
+        case CORE_OBJECT_PCAP:
+            pcap = (const core_object_pcap_t*)obj;
+            break;
+        }
+    }
+
+    if (!pl || !have_ip || !q.protocol || pl->len < 12 || pl->len > 65535) {
+        self->skipped++;
+        return;
+    }
+
+    if (pcap) {
+        q.sec  = pcap->ts.sec;
+        q.nsec = pcap->ts.nsec;
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        q.sec  = ts.tv_sec;
+        q.nsec = ts.tv_nsec;
+    }
+    q.id  = (uint16_t)pl->payload[0] << 8 | pl->payload[1];
+    q.msg = (uint8_t*)pl->payload;
+    q.len = pl->len;
+
+    /* Query */
+    if (!(pl->payload[2] & 0x80)) {
+        if (self->pairs) {
+            output_dnstap_query_t* slot = &self->pending[_slot(self, &q)];
+            if (slot->msg) {
+                _write_query(self, slot);
+                free(slot->msg);
+            }
+            *slot = q;
+            lfatal_oom(slot->msg = malloc(q.len));
+            memcpy(slot->msg, pl->payload, q.len);
+            return;
+        }
+        _write_query(self, &q);
+        return;
+    }
+
+    /* Response, addresses and ports are swapped compared to the query. */
+    memset(&m, 0, sizeof(m));
+    m.type             = self->query_type + 1;
+    m.family           = q.family;
+    m.protocol         = q.protocol;
+    m.query_address    = q.dst;
+    m.response_address = q.src;
+    m.query_port       = q.dport;
+    m.response_port    = q.sport;
+    m.response_sec     = q.sec;
+    m.response_nsec    = q.nsec;
+    m.response         = q.msg;
+    m.response_len     = q.len;
+
+    if (self->pairs) {
+        output_dnstap_query_t key = q, *slot;
+        memcpy(key.src, q.dst, 16);
+        memcpy(key.dst, q.src, 16);
+        key.sport = q.dport;
+        key.dport = q.sport;
+        slot      = &self->pending[_slot(self, &key)];
+
+        if (slot->msg && slot->id == key.id && slot->sport == key.sport && slot->dport == key.dport
+            && !memcmp(slot->src, key.src, 16) && !memcmp(slot->dst, key.dst, 16)) {
+            m.query      = slot->msg;
+            m.query_len  = slot->len;
+            m.query_sec  = slot->sec;
+            m.query_nsec = slot->nsec;
+            _write_message(self, &m);
+            free(slot->msg);
+            slot->msg = 0;
+            self->paired++;
+            return;
+        }
+    }
+
+    _write_message(self, &m);
+}
+
+core_receiver_t output_dnstap_receiver(output_dnstap_t* self)
+{
+    mlassert_self();
+
+    if (!self->is_running) {
+        lfatal("not opened");
+    }
+
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.compat_h")
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef struct output_dnstap_buf output_dnstap_buf_t;
+struct output_dnstap_buf {
+    output_dnstap_buf_t* next;
+    uint8_t*             data;
+    size_t               len;
+};
+
+/* Query waiting for its response when pairing messages. */
+typedef struct output_dnstap_query {
+    uint8_t  family, protocol;
+    uint8_t  src[16], dst[16];
+    uint16_t sport, dport, id;
+    int64_t  sec;
+    uint32_t nsec;
+    uint8_t* msg;
+    size_t   len;
+} output_dnstap_query_t;
+
+typedef struct output_dnstap {
+    core_log_t _log;
+
+    /* dnstap message type used for queries, responses use the next type. */
+    int32_t query_type;
+    uint8_t pairs;
+    uint8_t is_socket;
+    uint8_t is_failed;
+
+    char * identity, *version;
+    size_t identity_len, version_len;
+
+    /* File (strftime() format) or Unix socket written to. */
+    char*    path;
+    int      fd;
+    uint64_t rotate_bytes, rotate_secs;
+    uint64_t file_bytes;
+    int64_t  file_opened;
+    size_t   file_seq;
+
+    /* Buffers filled by the receiver and written by the writer thread. */
+    size_t               buf_size, max_bufs, bufs;
+    output_dnstap_buf_t* cur;
+    output_dnstap_buf_t *queue, *queue_last, *free_bufs;
+    size_t               queued;
+    uint64_t             flush_ms, cur_since_ms;
+    uint8_t*             scratch;
+
+    pthread_t       thr_id;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond, space;
+    uint8_t         is_running, stop;
+
+    output_dnstap_query_t* pending;
+    size_t                 n_pending;
+
+    size_t messages, paired, skipped, dropped;
+} output_dnstap_t;
+
+core_log_t* output_dnstap_log();
+void output_dnstap_init(output_dnstap_t* self);
+void output_dnstap_destroy(output_dnstap_t* self);
+void output_dnstap_identity(output_dnstap_t* self, const char* identity, const char* version);
+void output_dnstap_pairs(output_dnstap_t* self, size_t slots);
+int output_dnstap_open(output_dnstap_t* self, const char* file);
+int output_dnstap_connect(output_dnstap_t* self, const char* path);
+void output_dnstap_flush(output_dnstap_t* self);
+void output_dnstap_close(output_dnstap_t* self);
+
+core_receiver_t output_dnstap_receiver(output_dnstap_t* self);
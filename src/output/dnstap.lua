@@ -0,0 +1,196 @@
+-- Copyright (c) 2018-2020, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.dnstap
+-- Output DNS messages as dnstap to Frame Streams files or a Unix socket
+--   local output = require("dnsjit.output.dnstap").new()
+--   output:message_type("client")
+--   output:pairs()
+--   output:rotate(1024 * 1024 * 1024, 3600)
+--   output:open("traffic-%Y%m%d-%H%M%S.dnstap")
+--   ...
+--   output:close()
+--
+-- Output module serializing DNS messages into dnstap protobuf messages in
+-- a Frame Streams container, written either to files or to a Unix socket
+-- (e.g. of a dnstap collector, using the bidirectional handshake).
+-- .P
+-- The received objects must be layered (e.g. by
+-- .IR dnsjit.filter.layer ),
+-- the DNS message is taken from the payload and addresses and ports from
+-- the IP/IPv6 and UDP/TCP objects in the chain.
+-- The timestamp is taken from the PCAP object, or the current time if
+-- there's none.
+-- Queries and responses are told apart by the QR bit.
+-- .P
+-- Messages are encoded into buffers which are written by a separate writer
+-- thread, the receiver blocks only when all buffers are waiting to be
+-- written.
+-- A buffer is handed over when it's full, or with the next message after
+-- it was filled for
+-- .I flush_ms
+-- (default 1000) milliseconds.
+-- .P
+-- When pairing is enabled, queries are held until their response arrives
+-- (matched by addresses, ports and message ID) and a single response
+-- message containing both the query and the response is written, like
+-- resolvers log them.
+-- Queries without a response are written on their own when their slot is
+-- needed by another query or when the output is closed.
+-- .SS Attributes
+-- .TP
+-- buf_size
+-- Size of the buffers in bytes (default 1MiB, minimum is about 129KiB).
+-- .TP
+-- max_bufs
+-- Number of buffers that may wait for the writer thread (default 4).
+-- .TP
+-- flush_ms
+-- Maximum time a message waits in a buffer, 0 to only write full buffers.
+module(...,package.seeall)
+
+require("dnsjit.output.dnstap_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "output_dnstap_t"
+local output_dnstap_t = ffi.typeof(t_name)
+local Dnstap = {}
+
+local _types = {
+    auth = 1,
+    resolver = 3,
+    client = 5,
+    forwarder = 7,
+    stub = 9,
+    tool = 11,
+    update = 13,
+}
+
+-- Create a new Dnstap output.
+function Dnstap.new()
+    local self = {
+        obj = output_dnstap_t(),
+    }
+    C.output_dnstap_init(self.obj)
+    ffi.gc(self.obj, C.output_dnstap_destroy)
+    return setmetatable(self, { __index = Dnstap })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Dnstap:log()
+    if self == nil then
+        return C.output_dnstap_log()
+    end
+    return self.obj._log
+end
+
+-- Set the dnstap message type family, one of
+-- .IR auth ,
+-- .IR resolver ,
+-- .I client
+-- (default),
+-- .IR forwarder ,
+-- .IR stub ,
+-- .I tool
+-- or
+-- .IR update .
+-- Queries are written as the
+-- .I *_QUERY
+-- type and responses as the
+-- .I *_RESPONSE
+-- type.
+function Dnstap:message_type(name)
+    local t = _types[name]
+    if t == nil then
+        error("unknown dnstap message type: " .. tostring(name))
+    end
+    self.obj.query_type = t
+end
+
+-- Set the identity and version strings of the dnstap messages, either may
+-- be nil to leave it out.
+function Dnstap:identity(identity, version)
+    C.output_dnstap_identity(self.obj, identity, version)
+end
+
+-- Pair queries with their responses using a table of
+-- .I slots
+-- (default 65536) pending queries, must be set before opening.
+-- Use 0 to disable pairing.
+function Dnstap:pairs(slots)
+    C.output_dnstap_pairs(self.obj, slots or 65536)
+end
+
+-- Rotate output files after
+-- .I bytes
+-- were written or
+-- .I seconds
+-- passed, 0 or nil disables either condition.
+-- If the file name contains
+-- .BR strftime (3)
+-- conversions it's formatted with the time the file is opened, the
+-- rotated files additionally get a sequence number suffix.
+function Dnstap:rotate(bytes, seconds)
+    self.obj.rotate_bytes = bytes or 0
+    self.obj.rotate_secs = seconds or 0
+end
+
+-- Open the
+-- .I file
+-- to write to and start the writer thread.
+-- Returns 0 on success.
+function Dnstap:open(file)
+    return C.output_dnstap_open(self.obj, file)
+end
+
+-- Connect to a Frame Streams reader on the Unix socket
+-- .I path
+-- and start the writer thread.
+-- Returns 0 on success.
+function Dnstap:connect(path)
+    return C.output_dnstap_connect(self.obj, path)
+end
+
+-- Hand the current buffer over to the writer thread.
+function Dnstap:flush()
+    C.output_dnstap_flush(self.obj)
+end
+
+-- Write pending queries and buffers, stop the writer thread and close the
+-- file or the socket.
+function Dnstap:close()
+    C.output_dnstap_close(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function Dnstap:receive()
+    return C.output_dnstap_receiver(self.obj), self.obj
+end
+
+-- Return the number of dnstap messages written, the number of queries
+-- paired with a response, the number of skipped objects (not a DNS message
+-- or missing layers) and the number of buffers dropped due to write errors.
+function Dnstap:stats()
+    return tonumber(self.obj.messages), tonumber(self.obj.paired),
+        tonumber(self.obj.skipped), tonumber(self.obj.dropped)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.input.dnstap (3)
+return Dnstap
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/ktls.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+#endif
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#define RECORD_ALERT 21
+#define RECORD_HANDSHAKE 22
+#define RECORD_APPLICATION_DATA 23
+
+#define HANDSHAKE_NEW_SESSION_TICKET 4
+
+#ifdef HAVE_LINUX_TLS_H
+typedef union _crypto_info {
+    struct tls_crypto_info                      info;
+    struct tls12_crypto_info_aes_gcm_128        aes128;
+    struct tls12_crypto_info_aes_gcm_256        aes256;
+    struct tls12_crypto_info_chacha20_poly1305 chacha;
+} _crypto_info_t;
+
+/*
+ * Fill in the crypto info of a direction from the record state of the
+ * session, the layout of the nonce follows the kernel's TLS_TX/TLS_RX.
+ */
+static int _crypto_info(gnutls_session_t session, int read, _crypto_info_t* ci, socklen_t* len)
+{
+    gnutls_datum_t mac, iv, key;
+    unsigned char  seq[8];
+    int            tls13;
+
+    switch (gnutls_protocol_get_version(session)) {
+    case GNUTLS_TLS1_2:
+        tls13 = 0;
+        break;
+    case GNUTLS_TLS1_3:
+        tls13 = 1;
+        break;
+    default:
+        return -1;
+    }
+    if (gnutls_record_get_state(session, read, &mac, &iv, &key, seq) < 0) {
+        return -1;
+    }
+
+    memset(ci, 0, sizeof(*ci));
+    ci->info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+
+    switch (gnutls_cipher_get(session)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        if (key.size != TLS_CIPHER_AES_GCM_128_KEY_SIZE || iv.size < (tls13 ? 12 : 4)) {
+            return -1;
+        }
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(ci->aes128.salt, iv.data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        memcpy(ci->aes128.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_128_SALT_SIZE : seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        memcpy(ci->aes128.key, key.data, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        memcpy(ci->aes128.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+        *len = sizeof(ci->aes128);
+        return 0;
+    case GNUTLS_CIPHER_AES_256_GCM:
+        if (key.size != TLS_CIPHER_AES_GCM_256_KEY_SIZE || iv.size < (tls13 ? 12 : 4)) {
+            return -1;
+        }
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(ci->aes256.salt, iv.data, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        memcpy(ci->aes256.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_256_SALT_SIZE : seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        memcpy(ci->aes256.key, key.data, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+        memcpy(ci->aes256.rec_seq, seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+        *len = sizeof(ci->aes256);
+        return 0;
+    case GNUTLS_CIPHER_CHACHA20_POLY1305:
+        if (key.size != TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE || iv.size != TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE) {
+            return -1;
+        }
+        ci->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(ci->chacha.iv, iv.data, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+        memcpy(ci->chacha.key, key.data, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE);
+        memcpy(ci->chacha.rec_seq, seq, TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE);
+        *len = sizeof(ci->chacha);
+        return 0;
+    default:
+        break;
+    }
+
+    return -1;
+}
+#endif
+
+int output_ktls_enable(gnutls_session_t session, int fd, int rx)
+{
+#ifdef HAVE_LINUX_TLS_H
+    _crypto_info_t ci;
+    socklen_t      len;
+    int            ret = 0, err = 0;
+
+    if (_crypto_info(session, 0, &ci, &len)) {
+        errno = ENOTSUP;
+        return 0;
+    }
+    /* Without the ULP nothing changed, with it but without keys the
+     * socket passes data through unchanged. */
+    if (!setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"))
+        && !setsockopt(fd, SOL_TLS, TLS_TX, &ci, len)) {
+        ret = OUTPUT_KTLS_TX;
+
+        /* Records GnuTLS already read ahead would be lost. */
+        if (rx && !gnutls_record_check_pending(session)
+            && !_crypto_info(session, 1, &ci, &len)
+            && !setsockopt(fd, SOL_TLS, TLS_RX, &ci, len)) {
+            ret |= OUTPUT_KTLS_RX;
+        }
+    }
+    err = errno;
+    memset(&ci, 0, sizeof(ci));
+    errno = err;
+
+    return ret;
+#else
+    (void)session;
+    (void)fd;
+    (void)rx;
+    errno = ENOTSUP;
+    return 0;
+#endif
+}
+
+ssize_t output_ktls_recv(int fd, void* buf, size_t len)
+{
+#ifdef HAVE_LINUX_TLS_H
+    char            cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec    iov = { buf, len };
+    struct msghdr   msg;
+    struct cmsghdr* cmsg;
+    unsigned char   hdr[4];
+    size_t          have = 0, skip = 0, i;
+    ssize_t         n;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        if ((n = recvmsg(fd, &msg, 0)) < 1) {
+            return n;
+        }
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_TLS || cmsg->cmsg_type != TLS_GET_RECORD_TYPE
+            || *(unsigned char*)CMSG_DATA(cmsg) == RECORD_APPLICATION_DATA) {
+            return n;
+        }
+        if (*(unsigned char*)CMSG_DATA(cmsg) == RECORD_ALERT) {
+            return 0;
+        }
+        if (*(unsigned char*)CMSG_DATA(cmsg) != RECORD_HANDSHAKE) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        /*
+         * Session tickets aren't used and can be skipped, other
+         * post-handshake messages (e.g. a TLS 1.3 KeyUpdate) change the
+         * session and can't be handled by the kernel.
+         */
+        for (i = 0; i < (size_t)n;) {
+            if (skip) {
+                if (skip > (size_t)n - i) {
+                    skip -= (size_t)n - i;
+                    break;
+                }
+                i += skip;
+                skip = 0;
+                continue;
+            }
+            hdr[have++] = ((unsigned char*)buf)[i++];
+            if (hdr[0] != HANDSHAKE_NEW_SESSION_TICKET) {
+                errno = EPROTO;
+                return -1;
+            }
+            if (have == sizeof(hdr)) {
+                skip = ((size_t)hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+                have = 0;
+            }
+        }
+    }
+#else
+    return recv(fd, buf, len, 0);
+#endif
+}
+
+void output_ktls_bye(int fd)
+{
+#ifdef HAVE_LINUX_TLS_H
+    char            cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    unsigned char   alert[2] = { 1, 0 }; /* warning, close_notify */
+    struct iovec    iov      = { alert, sizeof(alert) };
+    struct msghdr   msg;
+    struct cmsghdr* cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_TLS;
+    cmsg->cmsg_type    = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg)   = RECORD_ALERT;
+
+    sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    (void)fd;
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2018-2020, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __dnsjit_output_ktls_h
+#define __dnsjit_output_ktls_h
+
+#include <sys/types.h>
+#include <gnutls/gnutls.h>
+
+/*
+ * Kernel TLS (kTLS) shared by the TLS outputs: after the handshake the
+ * record protection of the session is handed to the kernel, which then
+ * encrypts what's written to and decrypts what's read from the socket.
+ */
+
+#define OUTPUT_KTLS_TX 1
+#define OUTPUT_KTLS_RX 2
+
+/*
+ * Move the write and, if rx is set, the read direction of the established
+ * session to the kernel. Returns the directions moved; nothing is moved if
+ * the kernel, the protocol version or the cipher doesn't support it, errno
+ * tells why and the session stays usable with GnuTLS.
+ */
+int output_ktls_enable(gnutls_session_t session, int fd, int rx);
+
+/*
+ * Receive application data from a socket with the read direction in the
+ * kernel. Session tickets are skipped and alerts end the connection
+ * (returns 0), other records fail with EPROTO.
+ */
+ssize_t output_ktls_recv(int fd, void* buf, size_t len);
+
+/*
+ * Send a close_notify alert over a socket with the write direction in the
+ * kernel, the session itself can't do it anymore.
+ */
+void output_ktls_bye(int fd);
+
+#endif
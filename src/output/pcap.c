@@ -23,11 +23,22 @@
 #include "output/pcap.h"
 #include "core/assert.h"
 #include "core/object/pcap.h"
+#include "core/inet.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/payload.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 static core_log_t    _log      = LOG_T_INIT("output.pcap");
 static output_pcap_t _defaults = {
     LOG_T_INIT_OBJ("output.pcap"),
-    0, 0
+    0, 0,
+    0, 0, 0,
+    0, 0, 0
 };
 
 core_log_t* output_pcap_log()
@@ -45,6 +56,8 @@ void output_pcap_init(output_pcap_t* self)
 void output_pcap_destroy(output_pcap_t* self)
 {
     mlassert_self();
+
+    free(self->buf);
 }
 
 int output_pcap_open(output_pcap_t* self, const char* file, int linktype, int snaplen)
@@ -101,11 +114,319 @@ static void _receive(output_pcap_t* self, const core_object_t* obj)
     }
 }
 
+/*
+ * Rewrite mode, the layer objects are written back into the frame they
+ * were parsed from and checksums are fixed. Unchanged frames, and the
+ * unchanged payload and trailer of changed frames, are written directly
+ * from the original buffers.
+ */
+
+typedef struct _frame {
+    size_t  l3, l4, pl, end;
+    uint8_t v, proto, has_l4;
+} _frame_t;
+
+static int _locate(const core_object_pcap_t* pkt, _frame_t* f)
+{
+    const uint8_t* b   = pkt->bytes;
+    size_t         len = pkt->caplen, off, hl;
+    uint16_t       type;
+    uint8_t        nxt;
+
+    switch (pkt->linktype) {
+    case DLT_EN10MB:
+        if (len < 14) {
+            return -1;
+        }
+        off  = 12;
+        type = (b[off] << 8) | b[off + 1];
+        while ((type == 0x8100 || type == 0x88a8 || type == 0x9100) && off + 6 <= len) {
+            off += 4;
+            type = (b[off] << 8) | b[off + 1];
+        }
+        off += 2;
+        break;
+    case DLT_NULL:
+    case DLT_LOOP:
+        off = 4;
+        break;
+    case DLT_RAW:
+    case 101: /* LINKTYPE_RAW */
+        off = 0;
+        break;
+    case DLT_LINUX_SLL:
+        off = 16;
+        break;
+    default:
+        return -1;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->l3 = off;
+    if (off + 20 > len) {
+        return -1;
+    }
+    f->v = b[off] >> 4;
+    if (f->v == 4) {
+        hl = (b[off] & 0xf) * 4;
+        if (hl < 20 || off + hl > len) {
+            return -1;
+        }
+        f->end   = off + ((b[off + 2] << 8) | b[off + 3]);
+        f->l4    = off + hl;
+        f->pl    = f->l4;
+        f->proto = b[off + 9];
+        /* Only the first fragment carries the transport header. */
+        if (((b[off + 6] << 8) | b[off + 7]) & 0x1fff) {
+            return 0;
+        }
+    } else if (f->v == 6) {
+        if (off + 40 > len) {
+            return -1;
+        }
+        f->end = off + 40 + ((b[off + 4] << 8) | b[off + 5]);
+        f->pl = off + 40;
+        if (!(hl = core_inet_ip6_l4(b + off, len - off, &nxt))) {
+            return 0;
+        }
+        f->l4    = off + hl;
+        f->proto = nxt;
+    } else {
+        return -1;
+    }
+
+    switch (f->proto) {
+    case 17:
+        f->pl = f->l4 + 8;
+        break;
+    case 6:
+        if (f->l4 + 20 <= len) {
+            f->pl = f->l4 + (b[f->l4 + 12] >> 4) * 4;
+        } else {
+            f->pl = len + 1;
+        }
+        break;
+    case 58:
+        f->pl = f->l4 + 4;
+        break;
+    default:
+        return 0;
+    }
+    if (f->pl <= len && f->pl <= f->end && (f->v == 6 || f->proto != 58)) {
+        f->has_l4 = 1;
+    } else {
+        f->pl = f->v == 4 ? f->l4 : f->l3 + 40;
+    }
+
+    return 0;
+}
+
+static inline void _put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static inline void _put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static void _write(output_pcap_t* self, const struct pcap_pkthdr* hdr,
+    const uint8_t* a, size_t alen, const uint8_t* b, size_t blen, const uint8_t* c, size_t clen)
+{
+    FILE*    fp = pcap_dump_file(self->dumper);
+    uint32_t rec[4];
+
+    /* Same record header as written by pcap_dump(). */
+    rec[0] = hdr->ts.tv_sec;
+    rec[1] = hdr->ts.tv_usec;
+    rec[2] = hdr->caplen;
+    rec[3] = hdr->len;
+    fwrite(rec, sizeof(rec), 1, fp);
+    if (alen) {
+        fwrite(a, alen, 1, fp);
+    }
+    if (blen) {
+        fwrite(b, blen, 1, fp);
+    }
+    if (clen) {
+        fwrite(c, clen, 1, fp);
+    }
+}
+
+static void _receive_rewrite(output_pcap_t* self, const core_object_t* obj)
+{
+    const core_object_pcap_t*    pkt     = 0;
+    const core_object_ip_t*      ip      = 0;
+    const core_object_ip6_t*     ip6     = 0;
+    const core_object_udp_t*     udp     = 0;
+    const core_object_tcp_t*     tcp     = 0;
+    const core_object_payload_t* payload = 0;
+    const uint8_t *              bytes, *pl;
+    struct pcap_pkthdr           hdr;
+    _frame_t                     f;
+    size_t                       captured, old_len, pl_len, trailer, seg, alen, addr;
+    ssize_t                      delta = 0;
+    int                          ips = 0, pl_changed = 0, is_udp = 0;
+    uint8_t*                     h;
+    uint8_t*                     csum = 0;
+    uint32_t                     sum;
+    mlassert_self();
+
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_PCAP:
+            pkt = (const core_object_pcap_t*)obj;
+            break;
+        case CORE_OBJECT_IP:
+            if (!ips++)
+                ip = (const core_object_ip_t*)obj;
+            break;
+        case CORE_OBJECT_IP6:
+            if (!ips++)
+                ip6 = (const core_object_ip6_t*)obj;
+            break;
+        case CORE_OBJECT_UDP:
+            if (!ips)
+                udp = (const core_object_udp_t*)obj;
+            break;
+        case CORE_OBJECT_TCP:
+            if (!ips)
+                tcp = (const core_object_tcp_t*)obj;
+            break;
+        case CORE_OBJECT_PAYLOAD:
+            if (!ips && !payload)
+                payload = (const core_object_payload_t*)obj;
+            break;
+        }
+    }
+    if (!pkt) {
+        return;
+    }
+
+    hdr.ts.tv_sec  = pkt->ts.sec;
+    hdr.ts.tv_usec = pkt->ts.nsec / 1000;
+    hdr.caplen     = pkt->caplen;
+    hdr.len        = pkt->len;
+    bytes          = pkt->bytes;
+
+    /* Tunneled packets and objects not matching the frame are written as is. */
+    if (!ips) {
+        _write(self, &hdr, bytes, pkt->caplen, 0, 0, 0, 0);
+        return;
+    }
+    if (ips > 1 || _locate(pkt, &f)
+        || (ip && f.v != 4) || (ip6 && f.v != 6)
+        || (udp && (!f.has_l4 || f.proto != 17)) || (tcp && (!f.has_l4 || f.proto != 6))) {
+        self->skipped++;
+        _write(self, &hdr, bytes, pkt->caplen, 0, 0, 0, 0);
+        return;
+    }
+
+    if (self->buf_size < f.pl) {
+        free(self->buf);
+        lfatal_oom(self->buf = malloc(f.pl));
+        self->buf_size = f.pl;
+    }
+    h = self->buf;
+    memcpy(h, bytes, f.pl);
+
+    captured = f.end < pkt->caplen ? f.end : pkt->caplen;
+    old_len  = captured > f.pl ? captured - f.pl : 0;
+    pl       = bytes + f.pl;
+    pl_len   = old_len;
+    trailer  = pkt->caplen > captured ? pkt->caplen - captured : 0;
+    if ((udp || tcp) && payload && (payload->payload != pl || payload->len != old_len)) {
+        pl         = payload->payload;
+        pl_len     = payload->len;
+        delta      = (ssize_t)pl_len - (ssize_t)old_len;
+        pl_changed = 1;
+    }
+
+    if (ip) {
+        h[f.l3 + 1] = ip->tos;
+        _put16(h + f.l3 + 4, ip->id);
+        h[f.l3 + 8] = ip->ttl;
+        memcpy(h + f.l3 + 12, ip->src, 4);
+        memcpy(h + f.l3 + 16, ip->dst, 4);
+        _put16(h + f.l3 + 2, ((h[f.l3 + 2] << 8) | h[f.l3 + 3]) + delta);
+        alen = 4;
+    } else {
+        _put32(h + f.l3, ip6->flow);
+        h[f.l3 + 7] = ip6->hlim;
+        memcpy(h + f.l3 + 8, ip6->src, 16);
+        memcpy(h + f.l3 + 24, ip6->dst, 16);
+        _put16(h + f.l3 + 4, ((h[f.l3 + 4] << 8) | h[f.l3 + 5]) + delta);
+        alen = 16;
+    }
+    if (udp) {
+        _put16(h + f.l4, udp->sport);
+        _put16(h + f.l4 + 2, udp->dport);
+        _put16(h + f.l4 + 4, ((h[f.l4 + 4] << 8) | h[f.l4 + 5]) + delta);
+    } else if (tcp) {
+        _put16(h + f.l4, tcp->sport);
+        _put16(h + f.l4 + 2, tcp->dport);
+        _put32(h + f.l4 + 4, tcp->seq);
+        _put32(h + f.l4 + 8, tcp->ack);
+        h[f.l4 + 13] = tcp->flags;
+        _put16(h + f.l4 + 14, tcp->win);
+        _put16(h + f.l4 + 18, tcp->urp);
+    }
+
+    if (!pl_changed && !memcmp(h, bytes, f.pl)) {
+        _write(self, &hdr, bytes, pkt->caplen, 0, 0, 0, 0);
+        return;
+    }
+    self->rewritten++;
+
+    if (ip) {
+        core_inet_ip4_csum(h + f.l3);
+    }
+
+    if (f.has_l4) {
+        csum = core_inet_l4_csum(h + f.l4, f.pl - f.l4, f.proto, ip != 0, &is_udp);
+    }
+    if (csum) {
+        seg  = f.end - f.l4 + delta;
+        addr = f.l3 + (ip ? 12 : 8);
+        if (f.end <= pkt->caplen) {
+            /* Whole segment is captured, compute the checksum. */
+            csum[0] = 0;
+            csum[1] = 0;
+            sum     = core_inet_csum_add(0, h + addr, alen * 2, 0);
+            sum += f.proto + seg;
+            sum = core_inet_csum_add(sum, h + f.l4, f.pl - f.l4, 0);
+            sum = core_inet_csum_add(sum, pl, pl_len, 0);
+            sum = ~core_inet_csum_fold(sum) & 0xffff;
+            _put16(csum, sum || !is_udp ? sum : 0xffff);
+        } else if (!pl_changed) {
+            /* Truncated, update the checksum incrementally. The transport
+             * header goes first, it contains the checksum itself. */
+            core_inet_csum_replace(csum, is_udp, bytes + f.l4, h + f.l4, f.pl - f.l4, 0);
+            core_inet_csum_replace(csum, is_udp, bytes + addr, h + addr, alen * 2, 0);
+        } else {
+            self->unfixed++;
+            ldebug("checksum not updated, payload changed in truncated packet");
+        }
+    }
+
+    hdr.caplen = f.pl + pl_len + trailer;
+    hdr.len    = pkt->len + delta;
+    _write(self, &hdr, h, f.pl, pl, pl_len, bytes + captured, trailer);
+}
+
 core_receiver_t output_pcap_receiver(output_pcap_t* self)
 {
     if (!self->dumper) {
         lfatal("PCAP not opened");
     }
 
+    if (self->rewrite) {
+        return (core_receiver_t)_receive_rewrite;
+    }
     return (core_receiver_t)_receive;
 }
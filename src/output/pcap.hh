@@ -30,6 +30,12 @@ typedef struct output_pcap {
     core_log_t     _log;
     pcap_t*        pcap;
     pcap_dumper_t* dumper;
+
+    /* Write modified layer objects back into the frame, see rewrite(). */
+    uint8_t  rewrite;
+    uint8_t* buf;
+    size_t   buf_size;
+    uint64_t rewritten, unfixed, skipped;
 } output_pcap_t;
 
 core_log_t* output_pcap_log();
@@ -26,6 +26,22 @@
 -- Output module for writing
 -- .I dnsjit.core.object.pcap
 -- objects to a PCAP,
+-- .P
+-- By default the captured bytes are written as they are, so changes done
+-- to the layer objects (e.g. by dnsjit.filter.ipsplit) are lost.
+-- In rewrite mode, see
+-- .IR rewrite() ,
+-- the layer objects of the received chain are written back into the
+-- frame: IPv4 TOS, ID, TTL and addresses, IPv6 flow, hop limit and
+-- addresses, UDP ports, TCP ports, sequence numbers, flags, window and
+-- urgent pointer, and the payload (which can be replaced, grown or
+-- truncated).
+-- Lengths are updated and the IPv4 header and UDP/TCP/ICMPv6 checksums are
+-- recomputed, or updated incrementally when the packet was truncated by
+-- the capture.
+-- Unchanged frames, and the unchanged payload and trailer of changed
+-- frames, are written directly from the original buffers.
+-- Tunneled packets (more than one IP layer) are written unchanged.
 module(...,package.seeall)
 
 require("dnsjit.output.pcap_h")
@@ -70,6 +86,23 @@ function Pcap:close()
     C.output_pcap_close(self.obj)
 end
 
+-- Enable or disable rewrite mode (default disabled), must be set before
+-- getting the receiver.
+function Pcap:rewrite(bool)
+    if bool == nil or bool == true then
+        self.obj.rewrite = 1
+    else
+        self.obj.rewrite = 0
+    end
+end
+
+-- Return the number of frames rewritten, frames with a checksum that could
+-- not be updated (payload changed in a truncated packet) and frames
+-- written unchanged because they could not be matched with the objects.
+function Pcap:rewrite_stats()
+    return tonumber(self.obj.rewritten), tonumber(self.obj.unfixed), tonumber(self.obj.skipped)
+end
+
 -- Return the C functions and context for receiving objects.
 function Pcap:receive()
     return C.output_pcap_receiver(self.obj), self.obj
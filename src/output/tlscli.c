@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include "output/tlscli.h"
+#include "output/ktls.h"
 #include "core/assert.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
@@ -41,7 +42,8 @@ static output_tlscli_t _defaults = {
     { 0 }, CORE_OBJECT_PAYLOAD_INIT(0),
     0, 0, 0, 0,
     { 5, 0 },
-    0, 0
+    0, 0,
+    0, 0, 0
 };
 
 core_log_t* output_tlscli_log()
@@ -77,7 +79,11 @@ void output_tlscli_destroy(output_tlscli_t* self)
 
     if (self->fd > -1) {
         if (self->session) {
-            gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
+            if (self->ktls_tx) {
+                output_ktls_bye(self->fd);
+            } else {
+                gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
+            }
             gnutls_deinit(self->session);
         }
         shutdown(self->fd, SHUT_RDWR);
@@ -147,9 +153,90 @@ int output_tlscli_connect(output_tlscli_t* self, const char* host, const char* p
     }
 
     self->tls_ok = 1;
+
+    if (self->ktls) {
+        int dirs = output_ktls_enable(self->session, self->fd, 1);
+
+        self->ktls_tx = (dirs & OUTPUT_KTLS_TX) ? 1 : 0;
+        self->ktls_rx = (dirs & OUTPUT_KTLS_RX) ? 1 : 0;
+        if (dirs) {
+            linfo("kernel TLS enabled for%s%s", self->ktls_tx ? " tx" : "", self->ktls_rx ? " rx" : "");
+        } else {
+            linfo("kernel TLS not available (%s), using GnuTLS", core_log_errstr(errno));
+        }
+    }
+
     return 0;
 }
 
+/*
+ * Send the length and the payload as one record through kernel TLS.
+ */
+static int _send_ktls(output_tlscli_t* self, const uint8_t* payload, size_t len)
+{
+    uint16_t      dnslen = htons(len);
+    struct iovec  iov[2] = { { &dnslen, sizeof(dnslen) }, { (void*)payload, len } };
+    struct msghdr msg    = { 0 };
+    ssize_t       n;
+
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    while (msg.msg_iovlen) {
+        if ((n = sendmsg(self->fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        while (n && msg.msg_iovlen) {
+            if ((size_t)n >= msg.msg_iov->iov_len) {
+                n -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            } else {
+                msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + n;
+                msg.msg_iov->iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Receive with GnuTLS or, when the kernel took over, directly from the
+ * socket with the same return values.
+ */
+static ssize_t _recv(output_tlscli_t* self, void* buf, size_t len)
+{
+    struct pollfd pfd = { self->fd, POLLIN, 0 };
+    ssize_t       n;
+    int           ms;
+
+    if (!self->ktls_rx) {
+        return gnutls_record_recv(self->session, buf, len);
+    }
+
+    if (self->timeout.sec || self->timeout.nsec) {
+        ms = (self->timeout.sec * 1000) + (self->timeout.nsec / 1000000);
+        if (!ms) {
+            ms = 1;
+        }
+        if (!(n = poll(&pfd, 1, ms))) {
+            return GNUTLS_E_TIMEDOUT;
+        }
+        if (n < 0) {
+            return errno == EINTR ? GNUTLS_E_AGAIN : GNUTLS_E_PULL_ERROR;
+        }
+    }
+    if ((n = output_ktls_recv(self->fd, buf, len)) < 0) {
+        return errno == EINTR || errno == EAGAIN ? GNUTLS_E_AGAIN : GNUTLS_E_PULL_ERROR;
+    }
+    return n;
+}
+
 static void _receive(output_tlscli_t* self, const core_object_t* obj)
 {
     const uint8_t* payload;
@@ -171,6 +258,15 @@ static void _receive(output_tlscli_t* self, const core_object_t* obj)
             return;
         }
 
+        if (self->ktls_tx) {
+            if (_send_ktls(self, payload, len)) {
+                self->errs++;
+                return;
+            }
+            self->pkts++;
+            return;
+        }
+
         sent   = 0;
         dnslen = htons(len);
 
@@ -266,7 +362,7 @@ static const core_object_t* _produce(output_tlscli_t* self)
 
     if (!self->have_dnslen) {
         for (;;) {
-            n = gnutls_record_recv(self->session, ((uint8_t*)&dnslen) + recv, sizeof(dnslen) - recv);
+            n = _recv(self, ((uint8_t*)&dnslen) + recv, sizeof(dnslen) - recv);
             if (n > 0) {
                 recv += n;
                 if (recv < sizeof(dnslen))
@@ -298,7 +394,7 @@ static const core_object_t* _produce(output_tlscli_t* self)
     }
 
     for (;;) {
-        n = gnutls_record_recv(self->session, self->recvbuf + self->recv, sizeof(self->recvbuf) - self->recv);
+        n = _recv(self, self->recvbuf + self->recv, sizeof(self->recvbuf) - self->recv);
         if (n > 0) {
             self->recv += n;
             if (self->recv < self->dnslen)
@@ -40,6 +40,11 @@ typedef struct output_tlscli {
 
     gnutls_session_t                 session;
     gnutls_certificate_credentials_t cred;
+
+    /* Hand the records to kernel TLS after the handshake, if possible,
+     * and the directions the kernel took over. */
+    uint8_t ktls;
+    uint8_t ktls_tx, ktls_rx;
 } output_tlscli_t;
 
 core_log_t* output_tlscli_log();
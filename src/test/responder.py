@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Stand-in DNS responder for the tests: answers every query with an empty
+# NOERROR answer over UDP and TCP on the same port of 127.0.0.1, which is
+# printed on stdout once it's ready. Runs until killed.
+# With --doq it answers over DNS-over-QUIC instead (needs aioquic), and
+# --close-after N closes each connection on the query after the N-th.
+# --truncate sets TC in the UDP answers, so they're retried over TCP.
+# --delay SECONDS holds each answer back, so that queries pile up, and
+# --log FILE writes a line for each query with the transport, source address
+# and port and the number of queries in flight from that address.
+
+import argparse
+import asyncio
+import datetime
+import socket
+import struct
+import sys
+import threading
+import time
+
+
+def answer(msg, truncated=False):
+    if len(msg) < 12:
+        return None
+    # QR and RA set, opcode and RD kept, RCODE NOERROR.
+    flags = struct.unpack("!H", msg[2:4])[0]
+    flags = (flags & 0x7900) | 0x8080
+    if truncated:
+        flags |= 0x0200
+    return msg[:2] + struct.pack("!H", flags) + msg[4:]
+
+
+class QueryLog:
+    def __init__(self, path):
+        self._file = open(path, "w") if path else None
+        self._lock = threading.Lock()
+        self._inflight = {}
+
+    def begin(self, transport, addr):
+        with self._lock:
+            n = self._inflight.get(addr[0], 0) + 1
+            self._inflight[addr[0]] = n
+            if self._file:
+                print(transport, addr[0], addr[1], n, file=self._file, flush=True)
+
+    def end(self, addr):
+        with self._lock:
+            self._inflight[addr[0]] -= 1
+
+
+log = QueryLog(None)
+
+
+def reply_udp(sock, ans, addr):
+    # Done before sending, the client may send its next query right away.
+    log.end(addr)
+    sock.sendto(ans, addr)
+
+
+def serve_udp(sock, delay, truncate):
+    while True:
+        msg, addr = sock.recvfrom(65535)
+        ans = answer(msg, truncate)
+        if ans is None:
+            continue
+        log.begin("udp", addr)
+        if delay > 0:
+            threading.Timer(delay, reply_udp, args=(sock, ans, addr)).start()
+        else:
+            reply_udp(sock, ans, addr)
+
+
+def recv_exact(conn, n):
+    buf = b""
+    while len(buf) < n:
+        data = conn.recv(n - len(buf))
+        if not data:
+            return None
+        buf += data
+    return buf
+
+
+def serve_tcp_conn(conn, addr, delay):
+    with conn:
+        while True:
+            hdr = recv_exact(conn, 2)
+            if hdr is None:
+                return
+            msg = recv_exact(conn, struct.unpack("!H", hdr)[0])
+            if msg is None:
+                return
+            ans = answer(msg)
+            if ans is not None:
+                log.begin("tcp", addr)
+                if delay > 0:
+                    time.sleep(delay)
+                log.end(addr)
+                conn.sendall(struct.pack("!H", len(ans)) + ans)
+
+
+def serve_tcp(sock, delay):
+    while True:
+        conn, addr = sock.accept()
+        threading.Thread(target=serve_tcp_conn, args=(conn, addr, delay), daemon=True).start()
+
+
+def bind():
+    # Find a port that is free for both UDP and TCP.
+    for _ in range(100):
+        udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        udp.bind(("127.0.0.1", 0))
+        port = udp.getsockname()[1]
+        tcp = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        try:
+            tcp.bind(("127.0.0.1", port))
+        except OSError:
+            udp.close()
+            tcp.close()
+            continue
+        tcp.listen(128)
+        return udp, tcp, port
+    sys.exit("no free port")
+
+
+def self_signed():
+    from cryptography import x509
+    from cryptography.hazmat.primitives import hashes
+    from cryptography.hazmat.primitives.asymmetric import ec
+    from cryptography.x509.oid import NameOID
+
+    key = ec.generate_private_key(ec.SECP256R1())
+    name = x509.Name([x509.NameAttribute(NameOID.COMMON_NAME, "localhost")])
+    now = datetime.datetime.now(datetime.timezone.utc)
+    cert = (
+        x509.CertificateBuilder()
+        .subject_name(name)
+        .issuer_name(name)
+        .public_key(key.public_key())
+        .serial_number(x509.random_serial_number())
+        .not_valid_before(now - datetime.timedelta(days=1))
+        .not_valid_after(now + datetime.timedelta(days=1))
+        .sign(key, hashes.SHA256())
+    )
+    return cert, key
+
+
+async def serve_doq(close_after):
+    from aioquic.asyncio import serve
+    from aioquic.asyncio.protocol import QuicConnectionProtocol
+    from aioquic.quic.configuration import QuicConfiguration
+    from aioquic.quic.events import StreamDataReceived
+
+    class DoqProtocol(QuicConnectionProtocol):
+        def __init__(self, *args, **kwargs):
+            super().__init__(*args, **kwargs)
+            self._streams = {}
+            self._answered = 0
+
+        def quic_event_received(self, event):
+            if not isinstance(event, StreamDataReceived):
+                return
+            msg = self._streams.pop(event.stream_id, b"") + event.data
+            if not event.end_stream:
+                self._streams[event.stream_id] = msg
+                return
+            if close_after > 0 and self._answered >= close_after:
+                # DOQ_NO_ERROR, the query is left unanswered.
+                self._quic.close(error_code=0)
+                self.transmit()
+                return
+            ans = answer(msg[2:])
+            if ans is None:
+                return
+            self._quic.send_stream_data(event.stream_id,
+                struct.pack("!H", len(ans)) + ans, end_stream=True)
+            self._answered += 1
+            self.transmit()
+
+    # Port is picked by binding a socket and closing it right away.
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", 0))
+    port = sock.getsockname()[1]
+    sock.close()
+
+    config = QuicConfiguration(is_client=False, alpn_protocols=["doq"])
+    config.certificate, config.private_key = self_signed()
+    await serve("127.0.0.1", port, configuration=config, create_protocol=DoqProtocol)
+    print(port, flush=True)
+    await asyncio.Event().wait()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--doq", action="store_true")
+    parser.add_argument("--close-after", type=int, default=0)
+    parser.add_argument("--delay", type=float, default=0)
+    parser.add_argument("--log")
+    parser.add_argument("--truncate", action="store_true")
+    args = parser.parse_args()
+
+    global log
+    log = QueryLog(args.log)
+
+    if args.doq:
+        asyncio.run(serve_doq(args.close_after))
+        return
+
+    udp, tcp, port = bind()
+    threading.Thread(target=serve_udp, args=(udp, args.delay, args.truncate), daemon=True).start()
+    threading.Thread(target=serve_tcp, args=(tcp, args.delay), daemon=True).start()
+    print(port, flush=True)
+    threading.Event().wait()
+
+
+if __name__ == "__main__":
+    main()
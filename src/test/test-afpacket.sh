@@ -0,0 +1,36 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs root and veth support, skipped otherwise.
+tx="djtx$$"
+rx="djrx$$"
+ip link add "$tx" type veth peer name "$rx" 2>/dev/null || exit 77
+trap 'ip link del "$tx"' EXIT
+for i in "$tx" "$rx"; do
+    sysctl -qw "net.ipv6.conf.$i.disable_ipv6=1" || true
+    ip link set "$i" up
+done
+
+before=`cat "/sys/class/net/$rx/statistics/rx_packets"`
+../dnsjit "$srcdir/test_afpacket.lua" dns.pcap-dist "$tx" >test-afpacket.out
+after=`cat "/sys/class/net/$rx/statistics/rx_packets"`
+
+sent=`cat test-afpacket.out`
+test "$sent" -gt 0
+test `expr "$after" - "$before"` -eq "$sent"
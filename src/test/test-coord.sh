@@ -0,0 +1,48 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 for the stand-in responder, skipped otherwise.
+command -v python3 >/dev/null 2>&1 || exit 77
+
+python3 "$srcdir/responder.py" >test-coord.port &
+pid=$!
+trap 'kill $pid' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    test -s test-coord.port && break
+    sleep 1
+done
+port=`cat test-coord.port`
+cport=`python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])'`
+
+rm -f test-coord.worker0 test-coord.worker1
+../dnsjit "$srcdir/test_coord.lua" controller "$cport" "$port" test-coord.json test-coord.worker >test-coord.out &
+ctl=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    grep -q listening test-coord.out && break
+    sleep 1
+done
+
+../dnsjit "$srcdir/test_coord.lua" worker "$cport" pellets.pcap-dist test-coord.worker &
+w1=$!
+../dnsjit "$srcdir/test_coord.lua" worker "$cport" pellets.pcap-dist test-coord.worker &
+w2=$!
+wait $w1
+wait $w2
+wait $ctl
+test `tail -n 1 test-coord.out` -eq 91
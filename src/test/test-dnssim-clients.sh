@@ -0,0 +1,32 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 for the stand-in responder, skipped otherwise.
+command -v python3 >/dev/null 2>&1 || exit 77
+
+python3 "$srcdir/responder.py" >test-dnssim-clients.port &
+pid=$!
+trap 'kill $pid' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    test -s test-dnssim-clients.port && break
+    sleep 1
+done
+
+../dnsjit "$srcdir/test_dnssim_clients.lua" pellets.pcap-dist `cat test-dnssim-clients.port` >test-dnssim-clients.out
+test `cat test-dnssim-clients.out` -gt 1
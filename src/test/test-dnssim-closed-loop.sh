@@ -0,0 +1,41 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 for the stand-in responder, skipped otherwise.
+command -v python3 >/dev/null 2>&1 || exit 77
+
+for mode in queue drop; do
+    rm -f test-dnssim-closed-loop.port test-dnssim-closed-loop.queries
+    python3 "$srcdir/responder.py" --delay 0.05 --log test-dnssim-closed-loop.queries >test-dnssim-closed-loop.port &
+    pid=$!
+    trap 'kill $pid' EXIT
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        test -s test-dnssim-closed-loop.port && break
+        sleep 1
+    done
+
+    ../dnsjit "$srcdir/test_dnssim_closed_loop.lua" dns.pcap-dist `cat test-dnssim-closed-loop.port` "$mode" >test-dnssim-closed-loop.out
+    kill $pid
+    trap - EXIT
+
+    # The responder saw all the sent queries and never more than two of
+    # them in flight.
+    test `wc -l <test-dnssim-closed-loop.queries` -eq `cat test-dnssim-closed-loop.out`
+    test `awk '$4 > max { max = $4 } END { print max }' test-dnssim-closed-loop.queries` -eq 2
+done
@@ -0,0 +1,48 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 with aioquic for the stand-in DoQ responder and dnsjit built
+# with ngtcp2, skipped otherwise.
+python3 -c "import aioquic" >/dev/null 2>&1 || exit 77
+
+pid=
+trap 'test -z "$pid" || kill $pid' EXIT
+for close_after in 0 3; do
+    python3 "$srcdir/responder.py" --doq --close-after "$close_after" >test-dnssim-doq.port &
+    pid=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        test -s test-dnssim-doq.port && break
+        sleep 1
+    done
+    port=`cat test-dnssim-doq.port`
+
+    if ! ../dnsjit "$srcdir/test_dnssim_doq.lua" dns.pcap-dist "$port" "$close_after" >test-dnssim-doq.out; then
+        if grep -q "DNS-over-QUIC support not compiled in" test-dnssim-doq.out; then
+            exit 77
+        fi
+        cat test-dnssim-doq.out
+        exit 1
+    fi
+    test `cat test-dnssim-doq.out` -gt 0
+
+    kill $pid
+    wait $pid || true
+    pid=
+    rm -f test-dnssim-doq.port
+done
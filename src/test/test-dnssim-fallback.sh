@@ -0,0 +1,42 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 for the stand-in responder, skipped otherwise.
+command -v python3 >/dev/null 2>&1 || exit 77
+
+python3 "$srcdir/responder.py" --truncate --log test-dnssim-fallback.queries >test-dnssim-fallback.port &
+pid=$!
+trap 'kill $pid' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    test -s test-dnssim-fallback.port && break
+    sleep 1
+done
+port=`cat test-dnssim-fallback.port`
+
+# Each query is sent over UDP and retried over TCP.
+../dnsjit "$srcdir/test_dnssim_fallback.lua" dns.pcap-dist "$port" udp >test-dnssim-fallback.out
+queries=`cat test-dnssim-fallback.out`
+test "$queries" -gt 0
+test `grep -c '^udp ' test-dnssim-fallback.queries` -eq "$queries"
+test `grep -c '^tcp ' test-dnssim-fallback.queries` -eq "$queries"
+
+# Without fallback, the queries aren't retried.
+../dnsjit "$srcdir/test_dnssim_fallback.lua" dns.pcap-dist "$port" udp_only >test-dnssim-fallback.out
+test `grep -c '^udp ' test-dnssim-fallback.queries` -eq `expr 2 \* "$queries"`
+test `grep -c '^tcp ' test-dnssim-fallback.queries` -eq "$queries"
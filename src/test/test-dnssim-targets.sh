@@ -0,0 +1,44 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs python3 for the stand-in responders, skipped otherwise.
+command -v python3 >/dev/null 2>&1 || exit 77
+
+python3 "$srcdir/responder.py" >test-dnssim-targets.port1 &
+pid1=$!
+python3 "$srcdir/responder.py" >test-dnssim-targets.port2 &
+pid2=$!
+trap 'kill $pid1 $pid2' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    test -s test-dnssim-targets.port1 && test -s test-dnssim-targets.port2 && break
+    sleep 1
+done
+port1=`cat test-dnssim-targets.port1`
+port2=`cat test-dnssim-targets.port2`
+
+for transport in udp tcp; do
+    ../dnsjit "$srcdir/test_dnssim_targets.lua" dns.pcap-dist "$port1" "$port2" "$transport" >test-dnssim-targets.out
+    test `cat test-dnssim-targets.out` -gt 0
+done
+
+# Changing targets used by preconnected clients must fail.
+if ../dnsjit "$srcdir/test_dnssim_targets.lua" dns.pcap-dist "$port1" "$port2" tcp change >test-dnssim-targets.out; then
+    exit 1
+fi
+grep -q "targets can't be changed" test-dnssim-targets.out
@@ -0,0 +1,52 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+# Needs the GnuTLS utilities for an echoing server and python3 to find a
+# free port, the offload needs the tls kernel module, skipped otherwise.
+command -v gnutls-serv >/dev/null 2>&1 || exit 77
+command -v certtool >/dev/null 2>&1 || exit 77
+command -v python3 >/dev/null 2>&1 || exit 77
+test -d /sys/module/tls || exit 77
+
+certtool --generate-privkey --key-type ecdsa --outfile test-ktls.key >/dev/null 2>&1
+printf 'cn = localhost\nexpiration_days = 1\n' >test-ktls.tmpl
+certtool --generate-self-signed --load-privkey test-ktls.key --template test-ktls.tmpl \
+    --outfile test-ktls.crt >/dev/null 2>&1
+
+pid=
+trap 'test -z "$pid" || kill $pid' EXIT
+
+# Start an echoing server with the given priority string and run the test.
+run() {
+    port=`python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])'`
+    gnutls-serv --echo --port "$port" --priority "$2" \
+        --x509keyfile test-ktls.key --x509certfile test-ktls.crt >/dev/null 2>&1 &
+    pid=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        python3 -c "import socket; socket.create_connection(('127.0.0.1', $port)).close()" 2>/dev/null && break
+        sleep 1
+    done
+    ../dnsjit "$srcdir/test_ktls.lua" "$port" "$1" >test-ktls.out
+    kill $pid
+    pid=
+    test `cat test-ktls.out` -gt 0
+}
+
+run offload "NORMAL:-VERS-ALL:+VERS-TLS1.3"
+run fallback "NORMAL:-VERS-ALL:+VERS-TLS1.3:-CIPHER-ALL:+AES-128-CCM"
@@ -0,0 +1,19 @@
+-- Test case for dnsjit.output.afpacket, sends a PCAP to one end of a veth
+-- pair and prints the number of packets sent, the caller checks that the
+-- other end received them all.
+local pcap, ifname = arg[2], arg[3]
+
+local input = require("dnsjit.input.pcap").new()
+local output = require("dnsjit.output.afpacket").new()
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+assert(output:open(ifname) == 0, "unable to open "..ifname)
+input:receiver(output)
+input:loop()
+output:close()
+
+local packets, bytes, kicks, ring_full, dropped, errors = output:stats()
+assert(packets == input:packets(), "not all packets sent")
+assert(dropped == 0 and errors == 0, "packets dropped or send errors")
+assert(kicks > 0, "kernel never kicked")
+print(packets)
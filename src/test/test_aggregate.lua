@@ -0,0 +1,59 @@
+-- Test case for dnsjit.output.aggregate, counts in two shards where one
+-- goes idle after its first packet and checks that the other's seconds are
+-- finished once the idle shard is behind by more than the lateness, and
+-- that nothing is finished before the end without a lateness.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+
+local pkt = ffi.new("core_object_pcap_t")
+pkt.obj_type = object.PCAP
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+pl.obj_prev = ffi.cast("core_object_t*", pkt)
+-- DNS header of a query with one question.
+local msg = ffi.new("uint8_t[12]", { 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0 })
+pl.payload = msg
+pl.len = 12
+
+local function send(shard, sec)
+    local recv, rctx = shard:receive()
+    pkt.ts.sec = sec
+    recv(rctx, pl:uncast())
+end
+
+local function run(lateness)
+    local agg = require("dnsjit.output.aggregate").new()
+    local last, finished = nil, 0
+    agg:resolutions(1)
+    agg:window(2)
+    agg:lateness(lateness)
+    agg:callback(function(_, sec, _)
+        last = sec
+        finished = finished + 1
+    end)
+
+    local idle, busy = agg:shard(), agg:shard()
+    send(idle, 0)
+    for sec = 0, 30 do
+        send(busy, sec)
+    end
+    local before = last
+
+    agg:finish()
+    local packets, late = agg:stats()
+    assert(packets == 32, "lateness "..lateness..": wrong number of packets")
+    return before, late, finished
+end
+
+-- Idle shard counts at 20 (30 less the lateness), seconds before 18 (20
+-- less the window) are finished and its packet of second 0 is then late.
+local before, late, finished = run(10)
+assert(before == 17, "busy shard held back by the idle one")
+assert(late == 1, "packet of the idle shard not late")
+assert(finished == 31, "wrong number of buckets")
+
+before, late, finished = run(0)
+assert(before == nil, "finished without waiting for the idle shard")
+assert(late == 0, "late packets without lateness")
+assert(finished == 31, "wrong number of buckets")
+print(finished)
@@ -0,0 +1,99 @@
+-- Test case for dnsjit.filter.amplify, multiplies a PCAP with jitter and
+-- writes it in the rewrite mode of dnsjit.output.pcap, then checks the
+-- number of packets, that the timestamps are in order and the synthetic
+-- clients of the written PCAP.
+-- The capture itself may have a few packets out of order, the written PCAP
+-- must not have more.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, file = arg[2], arg[3]
+local copies = 4
+
+-- Return the PCAP and IP objects of a layered object.
+local function layers(obj)
+    local pkt, ip
+    obj = ffi.cast("core_object_t*", obj)
+    while obj ~= nil do
+        if obj.obj_type == object.PCAP then
+            pkt = obj:cast()
+        elseif obj.obj_type == object.IP then
+            ip = obj:cast()
+        end
+        obj = obj.obj_prev
+    end
+    return pkt, ip
+end
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local amplify = require("dnsjit.filter.amplify").new()
+local output = require("dnsjit.output.pcap").new()
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+output:rewrite()
+amplify:copies(copies)
+amplify:jitter(5000000, 1)
+amplify:receiver(output)
+
+-- Return the timestamp in microseconds as written to a PCAP.
+local function usec(pkt)
+    return tonumber(pkt.ts.sec) * 1000000 + math.floor(tonumber(pkt.ts.nsec) / 1000)
+end
+
+local prod, pctx = layer:produce()
+local recv, rctx = amplify:receive()
+
+local unordered, last = 0, 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local ts = usec(layers(obj))
+    if ts < last then
+        unordered = unordered + 1
+    end
+    last = ts
+    recv(rctx, obj)
+end
+amplify:flush()
+output:close()
+
+local packets, clients, passed, queued, queued_max = amplify:stats()
+assert(packets > passed, "no IP packets in "..pcap)
+assert(queued == 0, "objects still queued after flush")
+assert(queued_max > 0, "nothing was held back")
+
+input = require("dnsjit.input.pcap").new()
+layer = require("dnsjit.filter.layer").new()
+assert(input:open_offline(file) == 0, "unable to open "..file)
+layer:producer(input)
+prod, pctx = layer:produce()
+
+local n, synthetic, seen = 0, 0, {}
+last = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pkt, ip = layers(obj)
+    local ts = usec(pkt)
+    n = n + 1
+    if ts < last then
+        unordered = unordered - 1
+        assert(unordered >= 0, "packet "..n..": timestamp out of order")
+    end
+    last = ts
+    if ip ~= nil and ip.src[0] >= 240 then
+        synthetic = synthetic + 1
+        seen[ip:source()] = true
+    end
+end
+
+assert(n == packets + (copies - 1) * (packets - passed), "wrong number of packets: "..n)
+assert(synthetic == (copies - 1) * (packets - passed), "wrong number of copies: "..synthetic)
+local distinct = 0
+for _ in pairs(seen) do
+    distinct = distinct + 1
+end
+assert(distinct == clients, "wrong number of synthetic clients: "..distinct)
+print(n)
@@ -0,0 +1,246 @@
+-- Test cases for dnsjit.filter.anonymize: Crypto-PAn sample addresses of
+-- the original implementation, the addresses and checksums of an
+-- anonymized PCAP and the EDNS Client Subnet option of a query.
+local ffi = require("ffi")
+local bit = require("bit")
+local object = require("dnsjit.core.objects")
+local pcap, file = arg[2], arg[3]
+
+-- Key and sample addresses of the original Crypto-PAn distribution.
+local key = string.char(21, 34, 23, 141, 51, 164, 207, 128, 19, 10, 91, 22, 73, 144, 125, 16,
+    216, 152, 143, 131, 121, 121, 101, 39, 98, 87, 76, 45, 42, 132, 34, 2)
+local samples = {
+    { "128.11.68.132", "135.242.180.132" }, { "129.118.74.4", "134.136.186.123" },
+    { "130.132.252.244", "133.68.164.234" }, { "141.223.7.43", "141.167.8.160" },
+    { "141.233.145.108", "141.129.237.235" }, { "152.163.225.39", "151.140.114.167" },
+    { "156.29.3.236", "147.225.12.42" }, { "165.247.96.84", "162.9.99.234" },
+    { "166.107.77.190", "160.132.178.185" }, { "192.102.249.13", "252.138.62.131" },
+    { "192.215.32.125", "252.43.47.189" }, { "192.233.80.103", "252.25.108.8" },
+    { "192.41.57.43", "252.222.221.184" }, { "193.150.244.223", "253.169.52.216" },
+    { "195.205.63.100", "255.186.223.5" }, { "198.200.171.101", "249.199.68.213" },
+    { "198.26.132.101", "249.36.123.202" }, { "198.36.213.5", "249.7.21.132" },
+    { "198.51.77.238", "249.18.186.254" }, { "199.217.79.101", "248.38.184.213" },
+    { "202.49.198.20", "245.206.7.234" }, { "203.12.160.252", "244.248.163.4" },
+    { "204.184.162.189", "243.192.77.90" }, { "204.202.136.230", "243.178.4.198" },
+    { "204.29.20.4", "243.33.20.123" }, { "205.178.38.67", "242.108.198.51" },
+    { "205.188.147.153", "242.96.16.101" }, { "205.188.248.25", "242.96.88.27" },
+    { "207.105.49.5", "241.118.205.138" }, { "207.135.65.238", "241.202.129.222" },
+    { "207.155.9.214", "241.220.250.22" }, { "207.188.7.45", "241.255.249.220" },
+    { "207.25.71.27", "241.33.119.156" }, { "207.33.151.131", "241.1.233.131" },
+    { "208.147.89.59", "227.237.98.191" }, { "208.234.120.210", "227.154.67.17" },
+    { "208.28.185.184", "227.39.94.90" }, { "208.52.56.122", "227.8.63.165" },
+    { "209.12.231.7", "226.243.167.8" }, { "209.238.72.3", "226.6.119.243" },
+    { "209.246.74.109", "226.22.124.76" }, { "209.68.60.238", "226.184.220.233" },
+}
+
+local function raw(addr)
+    local a, b, c, d = addr:match("^(%d+)%.(%d+)%.(%d+)%.(%d+)$")
+    return string.char(tonumber(a), tonumber(b), tonumber(c), tonumber(d))
+end
+
+local function str(addr)
+    return table.concat({ addr:byte(1, 4) }, ".")
+end
+
+local function sum(b, from, to, s)
+    for i = from, to - 1, 2 do
+        s = s + b[i] * 256 + (i + 1 < to and b[i + 1] or 0)
+    end
+    return s
+end
+
+local function fold(s)
+    while s > 0xffff do
+        s = bit.band(s, 0xffff) + bit.rshift(s, 16)
+    end
+    return s
+end
+
+-- Return if the IPv4 and UDP checksums of an Ethernet frame are valid.
+local function csums_ok(b, caplen)
+    local l4 = 14 + bit.band(b[14], 0xf) * 4
+    local ulen = b[l4 + 4] * 256 + b[l4 + 5]
+    if l4 + ulen > caplen or fold(sum(b, 14, l4, 0)) ~= 0xffff then
+        return false
+    end
+    return (b[l4 + 6] == 0 and b[l4 + 7] == 0)
+        or fold(sum(b, l4, l4 + ulen, sum(b, 26, 34, 17 + ulen))) == 0xffff
+end
+
+local function new_anon()
+    local anon = require("dnsjit.filter.anonymize").new()
+    assert(anon:key(key) == 0, "unable to set key")
+    return anon
+end
+
+-----------------------------------------------------
+--   Crypto-PAn sample addresses
+--
+-- With AES-NI (if supported), GnuTLS and without
+-- the prefix cache, each twice to use the cache.
+-----------------------------------------------------
+local anons = { new_anon(), require("dnsjit.filter.anonymize").new(), require("dnsjit.filter.anonymize").new() }
+anons[2].obj.has_aesni = 0
+assert(anons[2]:key(key) == 0, "unable to set key")
+anons[3]:cache_size(0)
+assert(anons[3]:key(key) == 0, "unable to set key")
+for i, anon in ipairs(anons) do
+    for _ = 1, 2 do
+        for _, s in ipairs(samples) do
+            local out = str(anon:address(raw(s[1])))
+            assert(out == s[2], "anon "..i..": "..s[1].." -> "..out..", expected "..s[2])
+        end
+    end
+end
+
+-----------------------------------------------------
+--   dns.pcap: addresses and checksums
+--
+-- The queries were captured with invalid UDP
+-- checksums (offloaded), only valid checksums must
+-- stay valid.
+-----------------------------------------------------
+local anon = new_anon()
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.pcap").new()
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+anon:receiver(output)
+
+local prod, pctx = layer:produce()
+local recv, rctx = anon:receive()
+local expected = {}
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    obj = ffi.cast("core_object_t*", obj)
+    local o, ip, pkt = obj, nil, nil
+    while o ~= nil do
+        if o.obj_type == object.IP then
+            ip = o:cast()
+        elseif o.obj_type == object.PCAP then
+            pkt = o:cast()
+        end
+        o = o.obj_prev
+    end
+    if ip ~= nil then
+        table.insert(expected, {
+            str(anon:address(ffi.string(ip.src, 4))),
+            str(anon:address(ffi.string(ip.dst, 4))),
+            ip.p == 17 and csums_ok(ffi.cast("const uint8_t*", pkt.bytes), pkt.caplen),
+        })
+    end
+    recv(rctx, obj)
+end
+output:close()
+assert(#expected > 0, "no IP packets in "..pcap)
+
+input = require("dnsjit.input.pcap").new()
+layer = require("dnsjit.filter.layer").new()
+assert(input:open_offline(file) == 0, "unable to open "..file)
+layer:producer(input)
+prod, pctx = layer:produce()
+local n, valid = 0, 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local o, ip, pkt = ffi.cast("core_object_t*", obj), nil, nil
+    while o ~= nil do
+        if o.obj_type == object.IP then
+            ip = o:cast()
+        elseif o.obj_type == object.PCAP then
+            pkt = o:cast()
+        end
+        o = o.obj_prev
+    end
+    if ip ~= nil then
+        n = n + 1
+        assert(ip:source() == expected[n][1] and ip:destination() == expected[n][2],
+            "packet "..n..": addresses not anonymized")
+        if expected[n][3] then
+            assert(csums_ok(ffi.cast("const uint8_t*", pkt.bytes), pkt.caplen),
+                "packet "..n..": checksums not updated")
+            valid = valid + 1
+        end
+    end
+end
+assert(n == #expected, "read "..n.." of "..#expected.." IP packets")
+assert(valid > 0, "no packets with valid checksums in "..pcap)
+
+-----------------------------------------------------
+--   EDNS Client Subnet
+--
+-- A query with ECS 192.0.16.0/20, the address is
+-- anonymized and truncated to the source prefix or
+-- zeroed.
+-----------------------------------------------------
+local query = {
+    -- Ethernet
+    0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 2, 0x08, 0x00,
+    -- IPv4, total length 79, UDP, 10.1.2.3 -> 10.9.8.7
+    0x45, 0, 0, 79, 0, 1, 0, 0, 64, 17, 0, 0, 10, 1, 2, 3, 10, 9, 8, 7,
+    -- UDP 12345 -> 53, length 59
+    0x30, 0x39, 0, 53, 0, 59, 0, 0,
+    -- DNS header, RD, 1 question and 1 additional
+    0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 1,
+    7, 101, 120, 97, 109, 112, 108, 101, 3, 99, 111, 109, 0, 0, 1, 0, 1,
+    -- OPT with ECS family 1, source prefix 20, scope 0
+    0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 11,
+    0, 8, 0, 7, 0, 1, 20, 0, 192, 0, 16,
+}
+local ecs_at = #query - 3
+
+for _, mode in ipairs({ "anonymize", "zero" }) do
+    local buf = ffi.new("uint8_t[?]", #query, query)
+    buf[24], buf[25] = 0, 0
+    local s = bit.bnot(fold(sum(buf, 14, 34, 0)))
+    buf[24], buf[25] = bit.band(bit.rshift(s, 8), 0xff), bit.band(s, 0xff)
+    s = bit.bnot(fold(sum(buf, 34, #query, sum(buf, 26, 34, 17 + 59))))
+    buf[40], buf[41] = bit.band(bit.rshift(s, 8), 0xff), bit.band(s, 0xff)
+    assert(csums_ok(buf, #query), "wrong checksums in query")
+
+    local pkt = ffi.new("core_object_pcap_t")
+    pkt.obj_type = object.PCAP
+    pkt.linktype = 1
+    pkt.snaplen = 65535
+    pkt.bytes = buf
+    pkt.caplen = #query
+    pkt.len = #query
+
+    anon = new_anon()
+    anon:ecs(mode)
+    layer = require("dnsjit.filter.layer").new()
+    output = require("dnsjit.output.pcap").new()
+    assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+    anon:receiver(output)
+    layer:receiver(anon)
+    recv, rctx = layer:receive()
+    recv(rctx, pkt:uncast())
+    output:close()
+    local _, _, _, ecs_rewritten = anon:stats()
+    assert(ecs_rewritten == 1, mode..": ECS not rewritten")
+
+    local want = { 0, 0, 0 }
+    if mode == "anonymize" then
+        local out = anon:address(raw("192.0.16.0"))
+        want = { out:byte(1), out:byte(2), bit.band(out:byte(3), 0xf0) }
+    end
+
+    input = require("dnsjit.input.pcap").new()
+    assert(input:open_offline(file) == 0, "unable to open "..file)
+    prod, pctx = input:produce()
+    local obj = prod(pctx)
+    assert(obj ~= nil, mode..": no packet written")
+    pkt = ffi.cast("core_object_t*", obj):cast()
+    local b = ffi.cast("const uint8_t*", pkt.bytes)
+    assert(pkt.caplen == #query, mode..": wrong length")
+    for i = 1, 3 do
+        assert(b[ecs_at + i - 1] == want[i], mode..": wrong ECS address")
+    end
+    assert(b[ecs_at - 2] == 20, mode..": ECS prefix changed")
+    assert(csums_ok(b, pkt.caplen), mode..": checksums not updated")
+end
+print(n)
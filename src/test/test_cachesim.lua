@@ -0,0 +1,83 @@
+-- Test case for dnsjit.output.cachesim, feeds a small trace of queries and
+-- a negative response with known stack distances and checks the hit ratio
+-- curve and the statistics.
+local ffi = require("ffi")
+local bit = require("bit")
+local object = require("dnsjit.core.objects")
+
+local function u16(v)
+    return string.char(bit.rshift(v, 8), bit.band(v, 0xff))
+end
+
+local function u32(v)
+    return u16(bit.rshift(v, 16)) .. u16(bit.band(v, 0xffff))
+end
+
+local function name(n)
+    local wire = ""
+    for label in n:gmatch("[^.]+") do
+        wire = wire .. string.char(#label) .. label
+    end
+    return wire .. "\0"
+end
+
+local function query(qname)
+    return u16(1) .. u16(0x0100) .. u16(1) .. u16(0) .. u16(0) .. u16(0) .. name(qname) .. u16(1) .. u16(1)
+end
+
+-- NXDOMAIN with the SOA in the authority section, empty MNAME and RNAME.
+local function nxdomain(qname, ttl, minimum)
+    return u16(1) .. u16(0x8183) .. u16(1) .. u16(0) .. u16(1) .. u16(0) .. name(qname) .. u16(1) .. u16(1)
+        .. u16(0xc00c) .. u16(6) .. u16(1) .. u32(ttl) .. u16(22) .. "\0\0"
+        .. u32(1) .. u32(3600) .. u32(600) .. u32(86400) .. u32(minimum)
+end
+
+-- Time in seconds and message, the comments are the stack distance of
+-- each query (the number of other keys queried since its last query).
+local trace = {
+    { 0, query("a.example") }, -- cold
+    { 1, query("b.example") }, -- cold
+    { 2, query("A.EXAMPLE") }, -- 1
+    { 3, query("c.example") }, -- cold
+    { 4, query("b.example") }, -- 2
+    { 5, query("a.example") }, -- 2
+    { 6, query("d.example") }, -- cold
+    -- Expires after MINIMUM (60s), not the TTL of the SOA (300s).
+    { 6, nxdomain("d.example", 300, 60) },
+    { 30, query("d.example") }, -- 0
+    { 100, query("d.example") }, -- expired, cold
+}
+
+local cachesim = require("dnsjit.output.cachesim").new()
+local recv, rctx = cachesim:receive()
+
+local pkt = ffi.new("core_object_pcap_t")
+pkt.obj_type = object.PCAP
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+pl.obj_prev = ffi.cast("core_object_t*", pkt)
+
+for _, e in ipairs(trace) do
+    local buf = ffi.new("uint8_t[?]", #e[2])
+    ffi.copy(buf, e[2], #e[2])
+    pkt.ts.sec = e[1]
+    pl.payload = buf
+    pl.len = #e[2]
+    recv(rctx, pl:uncast())
+end
+
+local queries, responses, sampled, expired, discarded, keys, cold = cachesim:stats()
+assert(queries == 9 and responses == 1 and sampled == 9, "wrong number of queries or responses")
+assert(expired == 1, "negative answer not expired by the SOA MINIMUM")
+assert(discarded == 0 and keys == 4, "wrong number of discarded objects or keys")
+assert(cold == 5, "wrong number of cold misses")
+
+-- Hits at distance 0, 1 and 2 (twice) of 9 queries.
+local want = { { 1, 1 / 9 }, { 2, 2 / 9 }, { 3, 4 / 9 } }
+local curve = cachesim:curve()
+assert(#curve == #want, "wrong number of curve points")
+for i, w in ipairs(want) do
+    assert(curve[i].size == w[1], "point "..i..": wrong size")
+    assert(math.abs(curve[i].hit_ratio - w[2]) < 1e-9, "point "..i..": wrong hit ratio")
+end
+print(queries)
@@ -0,0 +1,131 @@
+-- Test case for dnsjit.lib.coord, a controller and two workers replaying a
+-- PCAP with dnssim on localhost.
+-- The workers also write their own statistics and clock offset to a Lua
+-- file, which the controller uses to check the merged statistics.
+--   test_coord.lua controller <port> <target port> <merged file> <worker prefix>
+--   test_coord.lua worker <port> <pcap> <worker prefix>
+local role, port = arg[2], arg[3]
+
+local coord = require("dnsjit.lib.coord").new()
+
+local function counters(json)
+    local stats = {}
+    for _, name in ipairs({ "requests", "answers", "since_ms", "until_ms" }) do
+        stats[name] = tonumber(json:match('[{, ]"'..name..'":(%d+)'))
+    end
+    return stats
+end
+
+if role == "controller" then
+    local target_port, merged, prefix = arg[4], arg[5], arg[6]
+    assert(coord:listen("127.0.0.1", port) == 0, "unable to listen")
+    print("listening")
+    io.stdout:flush()
+    assert(coord:accept(2, 30) == 0, "workers didn't connect")
+    assert(coord:start(1, target_port) == 0, "unable to start workers")
+    assert(require("dnsjit.output.dnssim").collect(coord, merged, 30) == 2, "not all workers merged")
+
+    local file = io.open(merged)
+    local json = file:read("*a")
+    file:close()
+    assert(json:match('"merged":true,"workers":2,'), "not merged from 2 workers")
+    local sum = counters(json:match('"stats_sum":(%b{})'))
+    local periodic = {}
+    for stats in json:match('"stats_periodic":(%b[])'):gmatch("%b{}") do
+        table.insert(periodic, counters(stats))
+    end
+
+    -- Expected values from the workers' own statistics, moved to the
+    -- controller's clock.
+    local function expect(expected, stats, offset_ms)
+        expected.requests = (expected.requests or 0) + stats.requests
+        expected.answers = (expected.answers or 0) + stats.answers
+        local since, ended = stats.since_ms + offset_ms, stats.until_ms + offset_ms
+        if expected.since_ms == nil or since < expected.since_ms then
+            expected.since_ms = since
+        end
+        if expected.until_ms == nil or ended > expected.until_ms then
+            expected.until_ms = ended
+        end
+    end
+    local function check(what, stats, expected)
+        for name, value in pairs(expected) do
+            assert(stats[name] == value, what.." "..name.." is "..tostring(stats[name])..", expected "..value)
+        end
+    end
+
+    local expected_sum, expected_periodic = {}, {}
+    for index = 0, 1 do
+        local w = dofile(prefix..index)
+        assert(w.sum.requests > 0, "worker "..index.." sent no queries")
+        assert(w.sum.answers == w.sum.requests, "worker "..index.." didn't get all answers")
+        expect(expected_sum, w.sum, w.offset_ms)
+        for i, stats in ipairs(w.periodic) do
+            expected_periodic[i] = expected_periodic[i] or {}
+            expect(expected_periodic[i], stats, w.offset_ms)
+        end
+    end
+
+    check("stats_sum", sum, expected_sum)
+    assert(#periodic == #expected_periodic, "merged "..#periodic.." intervals, expected "..#expected_periodic)
+    assert(#periodic > 1, "replay didn't span multiple intervals")
+    for i, expected in ipairs(expected_periodic) do
+        check("stats_periodic["..i.."]", periodic[i], expected)
+    end
+    print(sum.requests)
+    return
+end
+
+local pcap, prefix = arg[4], arg[5]
+assert(coord:connect("127.0.0.1", port) == 0, "unable to connect to the controller")
+local target_port = coord:wait(30)
+assert(target_port, "controller didn't start the worker")
+
+local input = require("dnsjit.input.pcap").new()
+local timing = require("dnsjit.filter.timing").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.dnssim").new()
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+assert(output:target("127.0.0.1", tonumber(target_port)) == 0, "unable to set target")
+output:udp_only()
+output:client_key("src")
+
+timing:keep()
+timing:receiver(layer)
+layer:receiver(coord)
+coord:receiver(output)
+
+local prod, pctx = input:produce()
+local trecv, tctx = timing:receive()
+coord:sleep()
+output:stats_collect(1)
+while true do
+    local obj = prod(pctx)
+    if obj == nil then
+        break
+    end
+    trecv(tctx, obj)
+    output:run_nowait()
+end
+output:stats_finish()
+while output:run_nowait() ~= 0 do end
+
+-- Offset is rounded the same way as in the report.
+local file = io.open(prefix..coord:index(), "w")
+local function write(stats)
+    file:write(string.format("{ requests = %d, answers = %d, since_ms = %d, until_ms = %d },\n",
+        tonumber(stats.requests), tonumber(stats.answers), tonumber(stats.since_ms), tonumber(stats.until_ms)))
+end
+file:write(string.format("return { offset_ms = %d,\nsum = ",
+    math.floor(tonumber(coord.obj.offset_ns) / 1000000 + 0.5)))
+write(output.obj.stats_sum)
+file:write("periodic = {\n")
+local stats = output.obj.stats_first
+while stats ~= nil do
+    write(stats)
+    stats = stats.next
+end
+file:write("} }\n")
+file:close()
+
+assert(output:report(coord) == 0, "unable to report to the controller")
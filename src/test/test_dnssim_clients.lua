@@ -0,0 +1,71 @@
+-- Test case for the sparse client table of dnsjit.output.dnssim, sends the
+-- DNS queries of a PCAP with clients identified by their source address,
+-- and again once the clients are idle, so they're evicted and created again.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port = arg[2], tonumber(arg[3])
+
+local output = require("dnsjit.output.dnssim").new()
+output:udp_only()
+output:target("127.0.0.1", port)
+output:timeout(2)
+assert(output:client_key("src") == 0, "unable to set client key")
+output:client_idle_timeout(0.1)
+output:free_after_use(true)
+
+-- Send the queries, sent to port 53 over UDP, and count them and their
+-- source addresses.
+local function replay()
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    local copy = require("dnsjit.filter.copy").new()
+
+    assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+    layer:producer(input)
+    copy:obj_type(object.IP)
+    copy:obj_type(object.IP6)
+    copy:obj_type(object.PAYLOAD)
+    copy:receiver(output)
+
+    local prod, pctx = layer:produce()
+    local recv, rctx = copy:receive()
+    local queries, sources, n_sources = 0, {}, 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pl = ffi.cast("core_object_t*", obj)
+        local udp = pl.obj_prev
+        if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+            and udp:cast().dport == 53 then
+            local ip = udp.obj_prev
+            local src = ffi.string(ip:cast().src, ip.obj_type == object.IP6 and 16 or 4)
+            if sources[src] == nil then
+                sources[src] = true
+                n_sources = n_sources + 1
+            end
+            queries = queries + 1
+            recv(rctx, obj)
+        end
+        output:run_nowait()
+    end
+    while output:run_nowait() ~= 0 do end
+    return queries, n_sources
+end
+
+local queries, n_sources = replay()
+assert(n_sources > 1, "too few clients in "..pcap)
+assert(output:answers() == queries, "not all queries answered")
+local clients, evicted = output:clients()
+assert(clients == n_sources, "unexpected number of clients")
+
+-- The table is swept every second while the loop runs, so the idle clients
+-- are evicted as soon as the next queries arrive, except for the client of
+-- the first one, which is busy then. Evicted clients are created again on
+-- their next query.
+os.execute("sleep 1.5")
+replay()
+assert(output:answers() == 2 * queries, "not all queries answered after eviction")
+clients, evicted = output:clients()
+assert(evicted >= n_sources - 1, "idle clients weren't evicted")
+assert(clients == n_sources, "clients not created again")
+print(n_sources)
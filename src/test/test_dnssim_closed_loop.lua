@@ -0,0 +1,73 @@
+-- Test case for the closed-loop client model of dnsjit.output.dnssim, sends
+-- the DNS queries of a PCAP (all from one client) to a responder which holds
+-- each answer back, allowing two of them in flight at a time.
+-- With "queue" as last argument the other queries wait in the client queue,
+-- with "drop" they're dropped.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port, mode = arg[2], tonumber(arg[3]), arg[4]
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(1)
+
+output:udp_only()
+output:target("127.0.0.1", port)
+output:timeout(5)
+output:closed_loop(2, 0, mode == "drop")
+output:free_after_use(true)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+end
+while output:run_nowait() ~= 0 do end
+
+local stats = output.obj.stats_sum
+assert(queries > 2, "too few queries in "..pcap)
+if mode == "drop" then
+    assert(tonumber(stats.client_dropped) == queries - 2, "queries over the limit weren't dropped")
+    assert(tonumber(stats.client_queued) == 0, "queries were queued")
+    assert(output:answers() == 2, "unexpected number of answers")
+    print(2)
+    return
+end
+
+assert(tonumber(stats.client_queued) == queries - 2, "queries over the limit weren't queued")
+assert(tonumber(stats.client_dropped) == 0, "queries were dropped")
+assert(output:answers() == queries, "not all queries answered")
+local waited, longest = 0, 0
+for i = 0, output.obj.timeout_ms do
+    local n = tonumber(stats.client_queue_wait[i])
+    waited = waited + n
+    if n > 0 then
+        longest = i
+    end
+end
+assert(waited == queries - 2, "queue wait not recorded for all queued queries")
+-- The last ones waited for about half of the held back answers.
+assert(longest >= 50 * (queries / 2 - 2), "queue wait too short: "..longest.."ms")
+print(queries)
@@ -0,0 +1,61 @@
+-- Test case for DNS-over-QUIC of dnsjit.output.dnssim, sends the DNS queries
+-- of a PCAP to a stand-in DoQ responder from a closed-loop client, so every
+-- answer releases the next query while the packet is being processed.
+-- If the responder closes connections with queries in flight, these have to
+-- be re-sent over a new connection.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port, close_after = arg[2], tonumber(arg[3]), tonumber(arg[4])
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(8)
+
+output:doq()
+assert(output:target("127.0.0.1", port) == 0, "unable to set target")
+output:timeout(2)
+output:idle_timeout(1)
+output:closed_loop(1, 0)
+output:free_after_use(true)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+    output:run_nowait()
+end
+while output:run_nowait() ~= 0 do end
+
+local handshakes = tonumber(output.obj.stats_sum.conn_handshakes)
+assert(queries > 0, "no queries in "..pcap)
+assert(output:requests() == queries, "not all queries sent")
+assert(output:answers() == queries, "not all queries answered")
+assert(output:noerror() == queries, "unexpected rcode")
+if close_after > 0 then
+    assert(handshakes > queries / (close_after + 1), "connections weren't closed by responder")
+else
+    assert(handshakes == 1, "queries not multiplexed over a single connection")
+end
+print(queries)
@@ -0,0 +1,73 @@
+-- Test case for the TCP fallback of dnsjit.output.dnssim, sends the DNS
+-- queries of a PCAP to a responder which truncates all its UDP answers.
+-- With "udp" as last argument the queries have to be retried over TCP,
+-- with "udp_only" the truncated answers are ignored and the queries time
+-- out.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port, transport = arg[2], tonumber(arg[3]), arg[4]
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(1)
+
+if transport == "udp_only" then
+    output:udp_only()
+else
+    output:udp()
+end
+output:target("127.0.0.1", port)
+output:timeout(1)
+output:idle_timeout(1)
+output:free_after_use(true)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+    output:run_nowait()
+end
+while output:run_nowait() ~= 0 do end
+
+local stats = output.obj.stats_sum
+assert(queries > 0, "no queries in "..pcap)
+if transport == "udp_only" then
+    assert(output:answers() == 0, "truncated answers accepted")
+    assert(tonumber(stats.fallback_tcp) == 0, "queries retried over TCP")
+    print(queries)
+    return
+end
+
+assert(output:answers() == queries, "not all queries answered")
+assert(output:noerror() == queries, "unexpected rcode")
+
+assert(tonumber(stats.fallback_tcp) == queries, "queries not retried over TCP")
+local udp_part, tcp_part = 0, 0
+for i = 0, output.obj.timeout_ms do
+    udp_part = udp_part + tonumber(stats.fallback_latency_udp[i])
+    tcp_part = tcp_part + tonumber(stats.fallback_latency_tcp[i])
+end
+assert(udp_part == queries and tcp_part == queries, "fallback latency not recorded")
+print(queries)
@@ -0,0 +1,95 @@
+-- Test case for the source address and port pools of dnsjit.output.dnssim,
+-- sends the DNS queries of a PCAP from a /27 of loopback addresses and
+-- a range of ports and checks in the query log of the responder that each
+-- client of the PCAP used a single address of the pool and only the ports
+-- of the range were used.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port, transport, log = arg[2], tonumber(arg[3]), arg[4], arg[5]
+local port_min, port_max = 30000, 30999
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(32)
+
+if transport == "tcp" then
+    output:tcp()
+else
+    output:udp_only()
+end
+output:target("127.0.0.1", port)
+output:timeout(5)
+output:idle_timeout(5)
+assert(output:bind("127.0.1.0/27") == 0, "unable to bind to prefix")
+assert(output:source_ports(port_min, port_max) == 0, "unable to set source ports")
+output:free_after_use(true)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP, and count them for
+-- each source address.
+local queries, clients = 0, {}
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        local ip = udp.obj_prev
+        local src
+        if ip.obj_type == object.IP6 then
+            src = ffi.string(ip:cast().src, 16)
+        else
+            src = ffi.string(ip:cast().src, 4)
+        end
+        clients[src] = (clients[src] or 0) + 1
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+    output:run_nowait()
+end
+while output:run_nowait() ~= 0 do end
+
+assert(queries > 0, "no queries in "..pcap)
+assert(output:answers() == queries, "not all queries answered")
+assert(tonumber(output.obj.stats_sum.port_exhausted) == 0, "source ports exhausted")
+
+-- Each query is logged by the responder as "transport address port inflight".
+local sources, logged = {}, 0
+for line in io.lines(log) do
+    local t, addr, sport = line:match("^(%a+) (%S+) (%d+)")
+    assert(t == transport:sub(1, 3), "unexpected transport: "..line)
+    local host = tonumber(addr:match("^127%.0%.1%.(%d+)$"))
+    assert(host and host >= 1 and host <= 30, "source address not from the pool: "..line)
+    sport = tonumber(sport)
+    assert(sport >= port_min and sport <= port_max, "source port not from the range: "..line)
+    sources[addr] = (sources[addr] or 0) + 1
+    logged = logged + 1
+end
+assert(logged == queries, "not all queries logged")
+
+-- Clients and addresses have to match one to one, so compare their sorted
+-- query counts.
+local function counts(t)
+    local c = {}
+    for _, n in pairs(t) do
+        table.insert(c, n)
+    end
+    table.sort(c)
+    return table.concat(c, " ")
+end
+assert(counts(clients) == counts(sources), "clients not mapped to distinct addresses")
+print(queries)
@@ -0,0 +1,76 @@
+-- Test case for targets of dnsjit.output.dnssim, mirrors the DNS queries of
+-- a PCAP to two responders over preconnected clients and checks the
+-- statistics of both targets.
+-- The transport is "udp" (with TCP fallback, the preconnected connections
+-- stay unused) or "tcp", the queries are then sent over the preconnected
+-- connections.
+-- With "change" as last argument it tries to replace the targets after
+-- preconnecting instead, which has to fail.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port1, port2, transport, mode = arg[2], tonumber(arg[3]), tonumber(arg[4]), arg[5], arg[6]
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(8)
+
+if transport == "tcp" then
+    output:tcp()
+else
+    output:udp()
+end
+assert(output:add_target("127.0.0.1", port1) == 0, "unable to add target 1")
+assert(output:add_target("127.0.0.1", port2) == 0, "unable to add target 2")
+output:mirror(true)
+output:timeout(2)
+output:idle_timeout(1)
+output:free_after_use(true)
+assert(output:preconnect(8, 1) == 0, "unable to preconnect")
+
+if mode == "change" then
+    -- Preconnected clients refer to the targets, this is fatal.
+    output:target("127.0.0.1", port1)
+    return
+end
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+    output:run_nowait()
+end
+while output:run_nowait() ~= 0 do end
+
+assert(queries > 0, "no queries in "..pcap)
+assert(tonumber(output.obj.processed) == queries, "not all queries processed")
+for i = 1, 2 do
+    local stats = output:target_stats(i)
+    assert(tonumber(stats.requests) == queries, "target "..i..": not all queries sent")
+    assert(tonumber(stats.answers) == queries, "target "..i..": not all queries answered")
+    assert(tonumber(stats.rcode_noerror) == queries, "target "..i..": unexpected rcode")
+end
+assert(output:requests() == 2 * queries, "mirrored requests missing")
+assert(tonumber(output.obj.stats_sum.conn_handshakes) == 16, "connections weren't reused")
+print(queries)
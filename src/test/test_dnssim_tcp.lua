@@ -0,0 +1,75 @@
+-- Test case for the TCP connection pool of dnsjit.output.dnssim, sends the
+-- DNS queries of a PCAP (all from one client) to a responder which holds
+-- each answer back, over two preconnected connections with one query in
+-- flight each, and checks that the connections were reused and the other
+-- queries waited for them.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, port = arg[2], tonumber(arg[3])
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(1)
+
+output:tcp()
+output:target("127.0.0.1", port)
+output:timeout(5)
+output:idle_timeout(5)
+output:max_client_conns(2)
+output:max_conn_inflight(1)
+output:free_after_use(true)
+assert(output:preconnect(1, 2) == 0, "unable to preconnect")
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+end
+while output:run_nowait() ~= 0 do end
+
+local stats = output.obj.stats_sum
+assert(queries > 4, "too few queries in "..pcap)
+assert(tonumber(output.obj.processed) == queries, "not all queries processed")
+assert(output:answers() == queries, "not all queries answered")
+assert(output:noerror() == queries, "unexpected rcode")
+
+-- Only the preconnected connections were used.
+assert(tonumber(stats.conn_handshakes) == 2, "connections weren't reused")
+
+-- At least all but the first query on each connection had to wait for it
+-- (all of them when the connections weren't up yet).
+assert(tonumber(stats.conn_queued) >= queries - 2, "queries weren't queued")
+local waited, longest = 0, 0
+for i = 0, output.obj.timeout_ms do
+    local n = tonumber(stats.conn_queue_wait[i])
+    waited = waited + n
+    if n > 0 then
+        longest = i
+    end
+end
+assert(waited == queries, "queue wait not recorded for all queries")
+-- The last ones waited for about half of the held back answers.
+assert(longest >= 20 * (queries / 2 - 2), "queue wait too short: "..longest.."ms")
+print(queries)
@@ -0,0 +1,74 @@
+-- Test case for the TCP_INFO sampling of dnsjit.output.dnssim, sends the DNS
+-- queries of a PCAP (all from one client) one by one over a single connection
+-- to a responder which holds each answer back, and checks that the
+-- connection was sampled periodically while it was open.
+local ffi = require("ffi")
+local clock = require("dnsjit.lib.clock")
+local object = require("dnsjit.core.objects")
+local pcap, port = arg[2], tonumber(arg[3])
+local period = 0.05
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(1)
+
+output:tcp()
+output:target("127.0.0.1", port)
+output:timeout(5)
+output:idle_timeout(0.1)
+output:max_conn_inflight(1)
+output:tcp_info(period)
+output:free_after_use(true)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+local sec, nsec = clock.monotonic()
+local started = sec + nsec / 1e9
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+end
+while output:run_nowait() ~= 0 do end
+sec, nsec = clock.monotonic()
+local elapsed = sec + nsec / 1e9 - started
+
+local stats = output.obj.stats_sum
+assert(queries > 4, "too few queries in "..pcap)
+assert(output:answers() == queries, "not all queries answered")
+assert(tonumber(stats.conn_handshakes) == 1, "more than one connection")
+
+-- The connection is open for about the whole run, sampling mustn't depend
+-- on the queries written or answers read.
+local samples = tonumber(stats.tcpi_samples)
+local expected = elapsed / period
+assert(samples >= expected / 2 and samples <= expected + 1,
+    "unexpected number of samples "..samples.." in "..elapsed.."s")
+for _, name in ipairs(require("dnsjit.output.dnssim").STATS_BUCKETS) do
+    local n = 0
+    for i = 0, ffi.C.OUTPUT_DNSSIM_TCPI_BUCKETS - 1 do
+        n = n + tonumber(stats[name][i])
+    end
+    assert(n == samples, name.." doesn't hold all samples")
+end
+print(samples)
@@ -0,0 +1,66 @@
+-- Test case for the event loop thread of dnsjit.output.dnssim, sends the DNS
+-- queries of a PCAP from the producer thread over preconnected clients,
+-- with a long idle timeout which stopping the thread mustn't wait for.
+local ffi = require("ffi")
+local clock = require("dnsjit.lib.clock")
+local object = require("dnsjit.core.objects")
+local pcap, port, transport = arg[2], tonumber(arg[3]), arg[4]
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(8)
+
+if transport == "tcp" then
+    output:tcp()
+else
+    output:udp()
+end
+output:target("127.0.0.1", port)
+output:timeout(2)
+output:idle_timeout(30)
+output:free_after_use(true)
+assert(output:preconnect(8) == 0, "unable to preconnect")
+output:stats_collect(1)
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+assert(output:thread_start(64) == 0, "unable to start event loop thread")
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+end
+assert(output:stats_snapshot() ~= nil, "snapshot refused while running")
+
+local started = clock.monotonic()
+assert(output:thread_stop() == 0, "unable to stop event loop thread")
+assert(clock.monotonic() - started < 10, "stopping waited for idle connections")
+
+local stats = output.obj.stats_sum
+assert(queries > 0, "no queries in "..pcap)
+assert(tonumber(output.obj.processed) == queries, "not all queries processed")
+assert(output:answers() == queries, "not all queries answered")
+assert(tonumber(stats.conn_handshakes) == 8, "unexpected number of handshakes")
+assert(tonumber(stats.conn_handshakes_failed) == 0, "handshakes failed")
+print(queries)
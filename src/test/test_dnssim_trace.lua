@@ -0,0 +1,96 @@
+-- Test case for the request trace of dnsjit.output.dnssim, sends the DNS
+-- queries of a PCAP (all from one client) to a responder which holds each
+-- answer back and checks the times in the trace.
+-- With "tcp" as last argument the queries go over a single connection with
+-- one query in flight, so they have to wait before they're written, with
+-- "udp" they're written right away.
+local ffi = require("ffi")
+local bit = require("bit")
+local object = require("dnsjit.core.objects")
+local pcap, port, transport, file = arg[2], tonumber(arg[3]), arg[4], arg[5]
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local output = require("dnsjit.output.dnssim").new(1)
+
+if transport == "tcp" then
+    output:tcp()
+    output:max_conn_inflight(1)
+else
+    output:udp_only()
+end
+output:target("127.0.0.1", port)
+output:timeout(5)
+output:idle_timeout(1)
+output:free_after_use(true)
+assert(output:trace(file, 0) == 0, "unable to open trace")
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+ipsplit:receiver(output)
+ipsplit:overwrite_dst()
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+
+local prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+
+-- Pass on only the queries, sent to port 53 over UDP.
+local queries = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pl = ffi.cast("core_object_t*", obj)
+    local udp = pl.obj_prev
+    if pl.obj_type == object.PAYLOAD and udp ~= nil and udp.obj_type == object.UDP
+        and udp:cast().dport == 53 then
+        queries = queries + 1
+        recv(rctx, obj)
+    end
+end
+while output:run_nowait() ~= 0 do end
+output:trace_close()
+assert(queries > 4, "too few queries in "..pcap)
+assert(output:answers() == queries, "not all queries answered")
+
+local f = assert(io.open(file, "rb"))
+local hdr = ffi.new("output_dnssim_trace_header_t")
+local data = f:read(ffi.sizeof(hdr))
+ffi.copy(hdr, data, ffi.sizeof(hdr))
+assert(ffi.string(hdr.magic, 8) == "DNSSIMTR", "bad trace magic")
+assert(hdr.version == ffi.C.OUTPUT_DNSSIM_TRACE_VERSION, "bad trace version")
+assert(hdr.record_size == ffi.sizeof("output_dnssim_trace_record_t"), "bad record size")
+
+local rec = ffi.new("output_dnssim_trace_record_t")
+local records, longest = 0, 0
+while true do
+    data = f:read(hdr.record_size)
+    if data == nil then break end
+    ffi.copy(rec, data, hdr.record_size)
+    records = records + 1
+
+    assert(bit.band(rec.flags, ffi.C.OUTPUT_DNSSIM_TRACE_ANSWERED) ~= 0, "request not answered")
+    assert(rec.sent_ns ~= 0, "send time not recorded")
+    assert(rec.sent_ns - rec.queue_wait_ns >= rec.intended_ns, "sent before created")
+    assert(rec.completed_ns > rec.sent_ns, "completed before sent")
+    -- Answers are held back by 20ms.
+    assert(tonumber(rec.completed_ns - rec.sent_ns) >= 15e6, "latency includes the wait: "..records)
+    local wait = tonumber(rec.queue_wait_ns) / 1e6
+    if wait > longest then
+        longest = wait
+    end
+end
+f:close()
+assert(records == queries, "not all requests traced")
+
+if transport == "tcp" then
+    -- The last ones waited for most of the other answers.
+    assert(longest >= 10 * (queries - 2), "queue wait too short: "..longest.."ms")
+else
+    assert(longest < 20, "queue wait too long: "..longest.."ms")
+end
+print(queries)
@@ -0,0 +1,76 @@
+-- Test case for dnsjit.output.dnstap and dnsjit.input.dnstap, writes the
+-- DNS messages of a PCAP to a dnstap file, reads it back and checks that
+-- the messages, addresses, ports and timestamps match.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, file = arg[2], arg[3]
+
+-- Return the message, addresses, ports and timestamp of a layered object
+-- as a string, or nil if it's missing any layer.
+local function describe(obj)
+    local pl, ip, l4, ts
+    obj = ffi.cast("core_object_t*", obj)
+    while obj ~= nil do
+        if obj.obj_type == object.PAYLOAD and pl == nil then
+            pl = obj:cast()
+        elseif (obj.obj_type == object.UDP or obj.obj_type == object.TCP) and l4 == nil then
+            l4 = obj:cast()
+        elseif (obj.obj_type == object.IP or obj.obj_type == object.IP6) and ip == nil then
+            ip = obj:cast()
+        elseif obj.obj_type == object.PCAP then
+            ts = obj:cast().ts
+        end
+        obj = obj.obj_prev
+    end
+    if pl == nil or ip == nil or l4 == nil or ts == nil or pl.len < 12 then
+        return nil
+    end
+    return table.concat({
+        ip:source(), l4.sport, ip:destination(), l4.dport,
+        tonumber(ts.sec), tonumber(ts.nsec),
+        ffi.string(pl.payload, pl.len),
+    }, " ")
+end
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.dnstap").new()
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+assert(output:open(file) == 0, "unable to open "..file)
+
+local prod, pctx = layer:produce()
+local recv, rctx = output:receive()
+
+local written = {}
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local msg = describe(obj)
+    if msg ~= nil then
+        table.insert(written, msg)
+    end
+    recv(rctx, obj)
+end
+output:close()
+
+local messages, paired, skipped, dropped = output:stats()
+assert(#written > 0, "no DNS messages in "..pcap)
+assert(messages == #written, "not all messages written")
+assert(paired == 0 and dropped == 0, "unexpected pairing or drops")
+
+local dnstap = require("dnsjit.input.dnstap").new()
+assert(dnstap:open(file) == 0, "unable to read "..file)
+prod, pctx = dnstap:produce()
+
+local n = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    n = n + 1
+    assert(describe(obj) == written[n], "message "..n.." differs")
+end
+assert(n == #written, "read "..n.." of "..#written.." messages")
+assert(dnstap:skipped() == 0, "messages skipped")
+print(n)
@@ -0,0 +1,47 @@
+-- Test case for kernel TLS in dnsjit.output.tlscli, sends DNS messages to
+-- an echoing TLS server and checks that they come back unchanged.
+-- With "offload" the server negotiates TLS 1.3 with AES-GCM and the kernel
+-- has to take over both directions (also skipping the session tickets the
+-- server sends after the handshake), with "fallback" it negotiates AES-CCM,
+-- which isn't supported, and GnuTLS has to be used.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local port, mode = arg[2], arg[3]
+
+local output = require("dnsjit.output.tlscli").new()
+output:timeout(5, 0)
+output:ktls(true)
+assert(output:connect("127.0.0.1", port) == 0, "unable to connect")
+
+local tx, rx = output:ktls_active()
+if mode == "offload" then
+    assert(tx and rx, "kernel TLS not enabled")
+else
+    assert(not tx and not rx, "kernel TLS enabled for an unsupported cipher")
+end
+
+local recv, rctx = output:receive()
+local prod, pctx = output:produce()
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+
+local n = 0
+for _, len in ipairs({ 12, 33, 512, 1400, 4000, 12 }) do
+    local buf = ffi.new("uint8_t[?]", len)
+    for i = 0, len - 1 do
+        buf[i] = (i * 7 + len) % 256
+    end
+    pl.payload = buf
+    pl.len = len
+    recv(rctx, pl:uncast())
+
+    local obj = prod(pctx)
+    assert(obj ~= nil, "nothing received")
+    local echo = ffi.cast("core_object_t*", obj):cast()
+    assert(echo.len == len, "message "..(n + 1)..": wrong length "..tonumber(echo.len))
+    assert(ffi.string(echo.payload, len) == ffi.string(buf, len), "message "..(n + 1)..": wrong data")
+    n = n + 1
+end
+assert(output:packets() == n and output:received() == n, "wrong number of messages")
+assert(output:errors() == 0, "errors")
+print(n)
@@ -0,0 +1,118 @@
+-- Test case for the rewrite mode of dnsjit.output.pcap, changes the
+-- addresses and ports of the UDP packets of a PCAP (and shortens some
+-- payloads), writes it in rewrite mode and checks the changes and the
+-- checksums of the written PCAP.
+local ffi = require("ffi")
+local bit = require("bit")
+local object = require("dnsjit.core.objects")
+local pcap, file = arg[2], arg[3]
+
+-- Return the PCAP, IP, UDP and payload objects of a layered object.
+local function layers(obj)
+    local pkt, ip, udp, pl
+    obj = ffi.cast("core_object_t*", obj)
+    while obj ~= nil do
+        if obj.obj_type == object.PCAP then
+            pkt = obj:cast()
+        elseif obj.obj_type == object.IP then
+            ip = obj:cast()
+        elseif obj.obj_type == object.UDP then
+            udp = obj:cast()
+        elseif obj.obj_type == object.PAYLOAD then
+            pl = obj:cast()
+        end
+        obj = obj.obj_prev
+    end
+    return pkt, ip, udp, pl
+end
+
+local function sum(b, from, to, s)
+    for i = from, to - 1, 2 do
+        s = s + b[i] * 256 + (i + 1 < to and b[i + 1] or 0)
+    end
+    return s
+end
+
+local function fold(s)
+    while s > 0xffff do
+        s = bit.band(s, 0xffff) + bit.rshift(s, 16)
+    end
+    return s
+end
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.pcap").new()
+
+assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+layer:producer(input)
+assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+output:rewrite()
+
+local prod, pctx = layer:produce()
+local recv, rctx = output:receive()
+
+local expected, n = {}, 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local _, ip, udp, pl = layers(obj)
+    if ip ~= nil and udp ~= nil then
+        n = n + 1
+        ip.src[0] = 10
+        ip.dst[0] = 192
+        ip.dst[1] = 0
+        ip.dst[2] = 2
+        if udp.dport == 53 then
+            udp.sport = 10000 + n
+        else
+            udp.dport = 10000 + n
+        end
+        if n % 3 == 0 and pl ~= nil and pl.len > 12 then
+            pl.len = pl.len - 1
+        end
+        table.insert(expected, { ip:source(), ip:destination(), udp.sport, udp.dport,
+            pl ~= nil and tonumber(pl.len) or 0 })
+    end
+    recv(rctx, obj)
+end
+output:close()
+
+local rewritten, unfixed, skipped = output:rewrite_stats()
+assert(n > 0, "no UDP packets in "..pcap)
+assert(rewritten == n, "not all packets rewritten")
+assert(unfixed == 0 and skipped == 0, "checksums not fixed or packets skipped")
+
+input = require("dnsjit.input.pcap").new()
+layer = require("dnsjit.filter.layer").new()
+assert(input:open_offline(file) == 0, "unable to open "..file)
+layer:producer(input)
+prod, pctx = layer:produce()
+
+local i = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pkt, ip, udp, pl = layers(obj)
+    if ip ~= nil and udp ~= nil then
+        i = i + 1
+        local e = expected[i]
+        assert(ip:source() == e[1] and ip:destination() == e[2], "packet "..i..": wrong addresses")
+        assert(udp.sport == e[3] and udp.dport == e[4], "packet "..i..": wrong ports")
+        assert(pl ~= nil and pl.len == e[5], "packet "..i..": wrong payload length")
+
+        local b = ffi.cast("const uint8_t*", pkt.bytes)
+        local l3 = 14
+        local l4 = l3 + ip.hl * 4
+        local ulen = b[l4 + 4] * 256 + b[l4 + 5]
+        assert(pkt.caplen == pkt.len and l4 + ulen == pkt.caplen, "packet "..i..": wrong lengths")
+        assert(ip.len == ulen + ip.hl * 4, "packet "..i..": wrong IP length")
+        assert(fold(sum(b, l3, l4, 0)) == 0xffff, "packet "..i..": wrong IP checksum")
+        if b[l4 + 6] ~= 0 or b[l4 + 7] ~= 0 then
+            local s = sum(b, l3 + 12, l3 + 20, 17 + ulen)
+            assert(fold(sum(b, l4, l4 + ulen, s)) == 0xffff, "packet "..i..": wrong UDP checksum")
+        end
+    end
+end
+assert(i == n, "read "..i.." of "..n.." UDP packets")
+print(n)
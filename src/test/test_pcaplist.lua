@@ -0,0 +1,72 @@
+-- Test case for dnsjit.input.pcaplist, reads a PCAP twice as a list of two
+-- files, added with add() and glob(), once by run() writing them with
+-- dnsjit.output.pcap and once as producer, and checks that all packets of
+-- both files are read in order.
+local ffi = require("ffi")
+local pcap, file = arg[2], arg[3]
+
+-- Return the timestamp in microseconds and the length of a PCAP object.
+local function packet(obj)
+    local pkt = ffi.cast("core_object_t*", obj):cast()
+    return tonumber(pkt.ts.sec) * 1000000 + math.floor(tonumber(pkt.ts.nsec) / 1000), tonumber(pkt.len)
+end
+
+-- Return the packets of a PCAP read by dnsjit.input.pcap.
+local function read(name)
+    local input = require("dnsjit.input.pcap").new()
+    assert(input:open_offline(name) == 0, "unable to open "..name)
+    local prod, pctx = input:produce()
+    local packets = {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local ts, len = packet(obj)
+        table.insert(packets, { ts = ts, len = len })
+    end
+    return packets
+end
+
+local function list()
+    local input = require("dnsjit.input.pcaplist").new()
+    assert(input:add(pcap) == 0, "unable to add "..pcap)
+    assert(input:glob(pcap) == 0, "unable to glob "..pcap)
+    assert(input:files() == 2, "wrong number of files")
+    assert(input:name(1) == pcap and input:name(2) == pcap, "wrong file names")
+    return input
+end
+
+local function check(mode, packets, expected)
+    assert(#packets == 2 * #expected, mode..": wrong number of packets: "..#packets)
+    for i, pkt in ipairs(packets) do
+        local want = expected[(i - 1) % #expected + 1]
+        assert(pkt.ts == want.ts and pkt.len == want.len, mode..", packet "..i..": out of order")
+    end
+end
+
+local expected = read(pcap)
+assert(#expected > 0, "no packets in "..pcap)
+
+local input = list()
+local output = require("dnsjit.output.pcap").new()
+assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+input:receiver(output)
+assert(input:run() == 0, "run failed")
+output:close()
+assert(input:packets() == 2 * #expected, "run: wrong number of packets seen")
+assert(input:stats() == 0, "run: files skipped")
+check("run", read(file), expected)
+
+input = list()
+local prod, pctx = input:produce()
+local packets = {}
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local ts, len = packet(obj)
+    table.insert(packets, { ts = ts, len = len })
+end
+assert(input:packets() == 2 * #expected, "producer: wrong number of packets seen")
+assert(input:stats() == 0, "producer: files skipped")
+check("producer", packets, expected)
+
+print(#packets)
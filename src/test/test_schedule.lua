@@ -0,0 +1,87 @@
+-- Test case for dnsjit.filter.schedule, schedules a PCAP with per-client
+-- time factors, writes it with dnsjit.output.pcap and checks that all
+-- packets are written in the order of their timestamps, once without and
+-- once with a queue limit that makes it drop packets.
+-- The capture itself may have a few packets out of order, the written PCAP
+-- must not have more.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local pcap, file = arg[2], arg[3]
+
+-- Return the timestamp in microseconds as written to a PCAP.
+local function usec(obj)
+    obj = ffi.cast("core_object_t*", obj)
+    while obj.obj_type ~= object.PCAP do
+        obj = obj.obj_prev
+    end
+    local pkt = obj:cast()
+    return tonumber(pkt.ts.sec) * 1000000 + math.floor(tonumber(pkt.ts.nsec) / 1000)
+end
+
+local function run(limit)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    local schedule = require("dnsjit.filter.schedule").new()
+    local output = require("dnsjit.output.pcap").new()
+
+    assert(input:open_offline(pcap) == 0, "unable to open "..pcap)
+    layer:producer(input)
+    assert(output:open(file, 1, 65535) == 0, "unable to open "..file)
+    schedule:multiply(0.5)
+    schedule:stretch(0.5, 2, 1)
+    schedule:limit(limit)
+    schedule:receiver(output)
+
+    local prod, pctx = layer:produce()
+    local recv, rctx = schedule:receive()
+
+    local unordered, last = 0, 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local ts = usec(obj)
+        if ts < last then
+            unordered = unordered + 1
+        end
+        last = ts
+        recv(rctx, obj)
+    end
+    schedule:flush()
+    output:close()
+
+    local packets, _, _, queued, queued_max, dropped = schedule:stats()
+    assert(packets > 0, "no packets in "..pcap)
+    assert(queued == 0, "objects still queued after flush")
+    if limit > 0 then
+        assert(queued_max <= limit, "queue limit exceeded")
+        assert(dropped > 0, "nothing dropped with a limit of "..limit)
+    else
+        assert(dropped == 0, "dropped without a limit")
+    end
+
+    input = require("dnsjit.input.pcap").new()
+    layer = require("dnsjit.filter.layer").new()
+    assert(input:open_offline(file) == 0, "unable to open "..file)
+    layer:producer(input)
+    prod, pctx = layer:produce()
+
+    local n = 0
+    last = 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local ts = usec(obj)
+        n = n + 1
+        if ts < last then
+            unordered = unordered - 1
+            assert(unordered >= 0, "limit "..limit..", packet "..n..": timestamp out of order")
+        end
+        last = ts
+    end
+    assert(n == packets - dropped, "limit "..limit..": wrong number of packets: "..n)
+    return n
+end
+
+local n = run(0)
+run(4)
+print(n)
@@ -0,0 +1,69 @@
+-- Test case for dnsjit.core.shmchannel, forks a producer which connects to
+-- the consumer and puts packets into a small channel until it is killed,
+-- then checks that the consumer gets the packets put before and sees the
+-- producer went away instead of waiting for it forever.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local path = arg[2]
+
+ffi.cdef[[
+int fork(void);
+int kill(int pid, int sig);
+int waitpid(int pid, int* status, int options);
+int usleep(unsigned int usec);
+void _exit(int status);
+]]
+
+local pid = ffi.C.fork()
+assert(pid >= 0, "fork failed")
+
+if pid == 0 then
+    local chan = require("dnsjit.core.shmchannel").new()
+    local connected = false
+    for _ = 1, 500 do
+        if chan:connect(path) == 0 then
+            connected = true
+            break
+        end
+        ffi.C.usleep(10000)
+    end
+    if not connected then
+        ffi.C._exit(1)
+    end
+
+    local bytes = ffi.new("uint8_t[64]")
+    local pkt = ffi.new("core_object_pcap_t")
+    pkt.obj_type = object.PCAP
+    pkt.bytes = bytes
+    pkt.caplen = 64
+    pkt.len = 64
+    local n = 0
+    while true do
+        n = n + 1
+        pkt.ts.sec = n
+        chan:put(pkt:uncast())
+    end
+end
+
+local chan = require("dnsjit.core.shmchannel").new()
+assert(chan:create(16, 128) == 0, "unable to create channel")
+assert(chan:serve(path) == 0, "unable to serve channel on "..path)
+
+-- Packets arrive in order, the producer is killed after the first 100.
+local got = 0
+while true do
+    local obj = chan:get()
+    if obj == nil then break end
+    local pkt = obj:cast()
+    got = got + 1
+    assert(pkt.ts.sec == got and pkt.caplen == 64, "packet "..got..": wrong packet")
+    if got == 100 then
+        assert(ffi.C.kill(pid, 9) == 0, "unable to kill producer")
+        ffi.C.waitpid(pid, nil, 0)
+    end
+end
+
+assert(got >= 100, "channel ended before the producer was killed")
+assert(chan.lost == 1, "producer going away not noticed")
+assert(chan:closed(), "channel not closed")
+print(got)
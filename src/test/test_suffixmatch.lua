@@ -0,0 +1,103 @@
+-- Test case for dnsjit.filter.suffixmatch, loads a list from a file in hosts
+-- format and one from a table and checks the matches by name and of DNS
+-- queries passed through the receiver: names are case-insensitive, the
+-- longest listed suffix wins and "." matches all names. Then the lists are
+-- reloaded and the receiver has to switch to them with the next query.
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local file = arg[2]
+
+local fp = io.open(file, "w")
+fp:write("# blocked\n")
+fp:write("0.0.0.0 ads.example.com\n")
+fp:write("*.tracker.net\n")
+fp:write("bad.Example.ORG # comment\n")
+fp:write("\n")
+fp:close()
+
+local suffixmatch = require("dnsjit.filter.suffixmatch").new()
+
+local function check(name, tag, labels)
+    local t, l = suffixmatch:match(name)
+    assert(t == tag, name..": tag "..tostring(t)..", expected "..tostring(tag))
+    assert(l == labels, name..": "..tostring(l).." labels, expected "..tostring(labels))
+end
+
+assert(suffixmatch:load({ file, { "example.com", "Customer.Example.com" } }) == 5, "wrong number of names")
+check("ads.example.com", 1, 3)
+check("x.ADS.Example.Com.", 1, 3)
+check("www.example.com", 2, 2)
+check("EXAMPLE.COM", 2, 2)
+check("a.customer.example.com", 2, 3)
+check("tracker.net", 1, 2)
+check("foo.tracker.net", 1, 2)
+check("bad.example.org", 1, 3)
+check("example.org", nil, nil)
+check("example.net", nil, nil)
+
+assert(suffixmatch:load({ file, { "example.com", "customer.example.com" }, { "." } }) == 6, "wrong number of names")
+check("example.net", 3, 0)
+check("example.org", 3, 0)
+check("www.example.com", 2, 2)
+check("ads.example.com", 1, 3)
+assert(suffixmatch:reloads() == 2, "wrong number of reloads")
+
+-- Route DNS queries to a receiver for each tag.
+local outputs = {}
+for tag = 0, 3 do
+    outputs[tag] = require("dnsjit.output.null").new()
+    suffixmatch:receiver(outputs[tag], tag)
+end
+local recv, rctx = suffixmatch:receive()
+
+local pkt = ffi.new("core_object_pcap_t")
+pkt.obj_type = object.PCAP
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+pl.obj_prev = ffi.cast("core_object_t*", pkt)
+
+local function query(name)
+    local wire = "\0\1\1\0\0\1\0\0\0\0\0\0"
+    for label in name:gmatch("[^.]+") do
+        wire = wire..string.char(#label)..label
+    end
+    wire = wire.."\0\0\1\0\1"
+    local buf = ffi.new("uint8_t[?]", #wire)
+    ffi.copy(buf, wire, #wire)
+    pl.payload = buf
+    pl.len = #wire
+    recv(rctx, pl:uncast())
+    return suffixmatch:last()
+end
+
+local function packets()
+    local n = {}
+    for tag = 0, 3 do
+        n[tag] = outputs[tag]:packets()
+    end
+    return n
+end
+
+assert(query("Www.ADS.example.COM") == 1, "query not matched by the file")
+assert(query("www.example.com") == 2, "query not matched by the table")
+assert(query("example.net") == 3, "query not matched by the root")
+local n = packets()
+assert(n[0] == 0 and n[1] == 1 and n[2] == 1 and n[3] == 1, "queries passed to the wrong receivers")
+
+-- The receiver takes the new lists with the next query.
+assert(suffixmatch:load({ { "www.example.com" } }) == 1, "reload failed")
+assert(suffixmatch:reloads() == 3, "wrong number of reloads")
+assert(query("www.example.com") == 1, "reloaded lists not used")
+assert(query("ads.example.com") == 0, "old lists still used")
+assert(query("example.net") == 0, "old root still used")
+n = packets()
+assert(n[0] == 2 and n[1] == 2 and n[2] == 1 and n[3] == 1, "queries passed to the wrong receivers after reload")
+
+-- A file that can't be read keeps the lists in use.
+local names, failed = suffixmatch:load({ file..".missing" })
+assert(names == nil and failed == file..".missing", "missing file loaded")
+assert(query("www.example.com") == 1, "lists replaced by a failed load")
+
+local matched, unmatched, invalid, dropped = suffixmatch:stats()
+assert(matched == 5 and unmatched == 2 and invalid == 0 and dropped == 0, "wrong stats")
+print(matched + unmatched)